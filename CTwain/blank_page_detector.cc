@@ -0,0 +1,194 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "blank_page_detector.h"
+#include "dib_view.h"
+#include "twain_session.h"
+
+namespace ctwain{
+
+	namespace{
+		unsigned Luma(const TW_UINT8* bgr){
+			return (bgr[0] * 29u + bgr[1] * 150u + bgr[2] * 77u) >> 8;
+		}
+	}
+
+	bool BlankPageDetector::Begin(const TW_IMAGEINFO& info){
+		analyzing_ = false;
+		if (info.Compression != TWCP_NONE || info.ImageWidth <= 0){
+			return false;
+		}
+		switch (info.PixelType){
+		case TWPT_BW:
+			return info.BitsPerPixel == 1 && Start(info.ImageWidth, info.ImageLength, true, 1, true);
+		case TWPT_GRAY:
+			return info.BitsPerPixel == 8 && Start(info.ImageWidth, info.ImageLength, false, 1, true);
+		case TWPT_RGB:
+			// order doesn't matter per sample but planes would have to be read apart
+			return info.BitsPerPixel == 24 && !info.Planar && Start(info.ImageWidth, info.ImageLength, false, 3, true);
+		default:
+			return false;
+		}
+	}
+
+	bool BlankPageDetector::Start(TW_UINT32 width, TW_INT32 height, bool bitonal, TW_UINT32 samples, bool inkIsZero){
+		auto margin = std::min<TW_UINT32>(options_.MarginPercent, 49);
+		auto marginX = static_cast<TW_UINT32>(static_cast<unsigned long long>(width) * margin / 100);
+		if (bitonal){
+			// whole bytes only, partial ones at the margins are left out
+			first_byte_ = (marginX + 7) / 8;
+			last_byte_ = (width - marginX) / 8;
+		}
+		else{
+			first_byte_ = static_cast<size_t>(marginX) * samples;
+			last_byte_ = static_cast<size_t>(width - marginX) * samples;
+		}
+		if (first_byte_ >= last_byte_){
+			return false;
+		}
+		max_dark_ = std::numeric_limits<unsigned long long>::max();
+		if (height > 0){
+			top_ = static_cast<TW_UINT32>(static_cast<unsigned long long>(height) * margin / 100);
+			bottom_ = static_cast<TW_UINT32>(height) - top_;
+			// past this much ink the page can't be blank anymore
+			double samples = static_cast<double>(last_byte_ - first_byte_) * (bitonal ? 8 : 1) * (bottom_ - top_);
+			max_dark_ = static_cast<unsigned long long>(samples * options_.MaxInkPercent / 100);
+		}
+		else{
+			top_ = marginX;
+			bottom_ = std::numeric_limits<TW_UINT32>::max();
+		}
+		width_ = width;
+		bitonal_ = bitonal;
+		ink_is_zero_ = inkIsZero;
+		stats_ = SampleStats();
+		analyzing_ = true;
+		return true;
+	}
+
+	void BlankPageDetector::AddRows(const TW_UINT8* data, size_t stride, TW_UINT32 first_row, TW_UINT32 rows){
+		if (!analyzing_){
+			return;
+		}
+		auto begin = std::max(first_row, top_);
+		auto end = std::min(first_row + rows, bottom_);
+		auto bytes = last_byte_ - first_byte_;
+		for (auto row = begin; row < end && stats_.Dark <= max_dark_; row++){
+			auto samples = data + static_cast<size_t>(row - first_row) * stride + first_byte_;
+			if (bitonal_){
+				size_t set = PixelKernels::CountBits(samples, bytes);
+				stats_.Count += bytes * 8;
+				stats_.Dark += ink_is_zero_ ? bytes * 8 - set : set;
+			}
+			else{
+				PixelKernels::AccumulateSamples(samples, bytes, options_.InkThreshold, stats_);
+			}
+		}
+	}
+
+	void BlankPageDetector::AddStrip(const TransferredStripEventArgs& strip){
+		if (!analyzing_){
+			return;
+		}
+		if (strip.Compression != TWCP_NONE || strip.XOffset != 0 || strip.Columns < width_ ||
+			strip.BytesPerRow == TWON_DONTCARE32 || strip.Rows == TWON_DONTCARE32 ||
+			static_cast<unsigned long long>(strip.BytesPerRow) * strip.Rows > strip.BytesWritten){
+			Cancel();
+			return;
+		}
+		AddRows(strip.Data, strip.BytesPerRow, strip.YOffset, strip.Rows);
+	}
+
+	BlankPageResult BlankPageDetector::Finish(){
+		BlankPageResult result;
+		if (!analyzing_ || stats_.Count == 0){
+			analyzing_ = false;
+			return result;
+		}
+		analyzing_ = false;
+
+		double count = static_cast<double>(stats_.Count);
+		result.Analyzed = true;
+		result.InkPercent = stats_.Dark * 100.0 / count;
+		if (!bitonal_){
+			double mean = stats_.Sum / count;
+			double variance = stats_.SumOfSquares / count - mean * mean;
+			result.Deviation = variance > 0 ? std::sqrt(variance) : 0;
+		}
+		result.Blank = result.InkPercent <= options_.MaxInkPercent &&
+			(bitonal_ || result.Deviation <= options_.MaxDeviation);
+		return result;
+	}
+
+	BlankPageResult BlankPageDetector::Analyze(const TW_IMAGEINFO& info, const TW_UINT8* data, size_t stride){
+		if (!data || info.ImageLength <= 0 || !Begin(info)){
+			return BlankPageResult();
+		}
+		AddRows(data, stride, 0, static_cast<TW_UINT32>(info.ImageLength));
+		return Finish();
+	}
+
+	BlankPageResult BlankPageDetector::Analyze(const DibView& dib){
+		analyzing_ = false;
+		if (!dib.valid() || dib.compression() != 0 || dib.width() == 0){
+			return BlankPageResult();
+		}
+
+		auto palette = dib.palette();
+		bool started = false;
+		switch (dib.bit_depth()){
+		case 1:
+			// whichever palette entry is darker is the ink
+			started = Start(dib.width(), dib.height(), true, 1,
+				!palette || dib.palette_size() < 2 || Luma(palette) <= Luma(palette + 4));
+			break;
+		case 8:
+			// indexes are only sample values with the identity gray palette
+			if (palette){
+				for (TW_UINT32 i = 0; i < dib.palette_size(); i++){
+					auto entry = palette + i * 4;
+					if (entry[0] != i || entry[1] != i || entry[2] != i){
+						return BlankPageResult();
+					}
+				}
+			}
+			started = Start(dib.width(), dib.height(), false, 1, true);
+			break;
+		case 24:
+			started = Start(dib.width(), dib.height(), false, 3, true);
+			break;
+		default:
+			break;
+		}
+		if (!started){
+			return BlankPageResult();
+		}
+		// the margins are the same top and bottom so bottom-up rows need no flipping
+		AddRows(dib.bits(), dib.stride(), 0, dib.height());
+		return Finish();
+	}
+}
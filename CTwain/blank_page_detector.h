@@ -0,0 +1,181 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef BLANK_PAGE_DETECTOR_H_
+#define BLANK_PAGE_DETECTOR_H_
+
+#include "pixel_kernels.h"
+
+namespace ctwain{
+
+	class DibView;
+	struct TransferredStripEventArgs;
+
+	/// <summary>
+	/// Settings for <see cref="BlankPageDetector"/>. The defaults suit white paper.
+	/// </summary>
+	struct BlankPageOptions{
+		/// <summary>
+		/// How much of every edge is left out, in percent of the page size. Scanners leave
+		/// shadows, punch holes and the paper edges there.
+		/// </summary>
+		TW_UINT32 MarginPercent = 5;
+
+		/// <summary>
+		/// Samples darker than this count as ink, 0 to 255.
+		/// </summary>
+		TW_UINT8 InkThreshold = 160;
+
+		/// <summary>
+		/// The most ink a blank page can have, in percent of the samples looked at.
+		/// </summary>
+		double MaxInkPercent = 0.2;
+
+		/// <summary>
+		/// The highest standard deviation of the samples a blank page can have, which catches
+		/// faint content lighter than <see cref="InkThreshold"/>. Not used for bitonal pages.
+		/// </summary>
+		double MaxDeviation = 16;
+
+		/// <summary>
+		/// Whether blank pages are dropped right after their transfer, so neither
+		/// <see cref="TwainSession::OnTransferredData"/> nor the page pipeline gets them.
+		/// </summary>
+		bool DropBlankPages = false;
+	};
+
+	/// <summary>
+	/// What <see cref="BlankPageDetector"/> found on a page.
+	/// </summary>
+	struct BlankPageResult{
+		/// <summary>
+		/// Gets a value indicating whether the page was looked at. Compressed, planar, palette,
+		/// 16-bit and file transfer pages are not.
+		/// </summary>
+		bool Analyzed = false;
+
+		/// <summary>
+		/// Gets a value indicating whether the page is blank.
+		/// </summary>
+		bool Blank = false;
+
+		/// <summary>
+		/// Gets the ink coverage in percent of the samples looked at, the lower the blanker.
+		/// Pages of known size stop being looked at once they have too much ink to be blank.
+		/// </summary>
+		double InkPercent = 0;
+
+		/// <summary>
+		/// Gets the standard deviation of the samples looked at, 0 for bitonal pages.
+		/// </summary>
+		double Deviation = 0;
+	};
+
+	/// <summary>
+	/// Tells blank pages, such as the backs of duplex scans, from ones with content by their
+	/// ink coverage and sample deviation inside the margins, using <see cref="PixelKernels"/>.
+	/// Pages can be analyzed whole or one strip at a time while they transfer.
+	/// Bitonal pages are taken as TWPF_CHOCOLATE (0 is black) unless a DIB palette says otherwise,
+	/// and color pages are measured per sample. This class is not thread-safe.
+	/// </summary>
+	class BlankPageDetector
+	{
+	public:
+		/// <summary>
+		/// Initializes a new instance of the <see cref="BlankPageDetector"/> class.
+		/// </summary>
+		/// <param name="options">The settings.</param>
+		explicit BlankPageDetector(const BlankPageOptions& options) : options_(options){}
+
+		/// <summary>
+		/// Gets the settings.
+		/// </summary>
+		const BlankPageOptions& options() const{ return options_; }
+
+		/// <summary>
+		/// Starts a page that comes in strips. When the page length isn't known yet only the
+		/// top margin is left out, as wide as the side margins.
+		/// </summary>
+		/// <param name="info">The image information from the source.</param>
+		/// <returns>false if the page can't be analyzed.</returns>
+		bool Begin(const TW_IMAGEINFO& info);
+
+		/// <summary>
+		/// Adds rows of the page started with <see cref="Begin"/>.
+		/// </summary>
+		/// <param name="data">The first row.</param>
+		/// <param name="stride">The bytes from one row to the next.</param>
+		/// <param name="first_row">The page row <paramref name="data"/> starts at.</param>
+		/// <param name="rows">The number of rows.</param>
+		void AddRows(const TW_UINT8* data, size_t stride, TW_UINT32 first_row, TW_UINT32 rows);
+
+		/// <summary>
+		/// Adds a memory transfer strip of the page started with <see cref="Begin"/>.
+		/// Compressed strips and tiles narrower than the page cancel the page.
+		/// </summary>
+		/// <param name="strip">The strip.</param>
+		void AddStrip(const TransferredStripEventArgs& strip);
+
+		/// <summary>
+		/// Drops the page started with <see cref="Begin"/>.
+		/// </summary>
+		void Cancel(){ analyzing_ = false; }
+
+		/// <summary>
+		/// Gets the result for the page started with <see cref="Begin"/> and ends it.
+		/// </summary>
+		BlankPageResult Finish();
+
+		/// <summary>
+		/// Analyzes a whole page.
+		/// </summary>
+		/// <param name="info">The image information from the source.</param>
+		/// <param name="data">The first row.</param>
+		/// <param name="stride">The bytes from one row to the next.</param>
+		BlankPageResult Analyze(const TW_IMAGEINFO& info, const TW_UINT8* data, size_t stride);
+
+		/// <summary>
+		/// Analyzes a 1, 8 or 24-bit uncompressed DIB such as from a native transfer.
+		/// 8-bit DIBs need the usual gray palette.
+		/// </summary>
+		/// <param name="dib">The DIB.</param>
+		BlankPageResult Analyze(const DibView& dib);
+
+	private:
+		BlankPageOptions options_;
+		bool analyzing_ = false;
+		bool bitonal_ = false;
+		bool ink_is_zero_ = true;
+		TW_UINT32 top_ = 0;
+		TW_UINT32 bottom_ = 0;
+		size_t first_byte_ = 0;
+		size_t last_byte_ = 0;
+		TW_UINT32 width_ = 0;
+		SampleStats stats_;
+		unsigned long long max_dark_ = 0;
+
+		bool Start(TW_UINT32 width, TW_INT32 height, bool bitonal, TW_UINT32 samples, bool inkIsZero);
+	};
+}
+
+#endif //BLANK_PAGE_DETECTOR_H_
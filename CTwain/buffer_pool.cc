@@ -0,0 +1,214 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <cstdlib>
+#include <malloc.h>
+#include "build_macros.h"
+#include "buffer_pool.h"
+
+using namespace std;
+
+namespace ctwain{
+
+	namespace{
+		// every buffer is preceded by one alignment unit holding its bucket size
+		const size_t kMinBucket = 4096;
+		const size_t kMagic = 0x54574250; // TWBP
+
+		struct BufferHeader{
+			size_t Magic;
+			size_t Size;
+		};
+
+		void* SystemAlloc(size_t size){
+#ifdef TWH_CMP_MSC
+			return _aligned_malloc(size, BufferPool::kAlignment);
+#else
+			void* mem = nullptr;
+			return posix_memalign(&mem, BufferPool::kAlignment, size) == 0 ? mem : nullptr;
+#endif
+		}
+
+		void SystemFree(void* mem){
+#ifdef TWH_CMP_MSC
+			_aligned_free(mem);
+#else
+			free(mem);
+#endif
+		}
+
+		BufferHeader* HeaderOf(const void* buffer){
+			return reinterpret_cast<BufferHeader*>(
+				const_cast<char*>(static_cast<const char*>(buffer)) - BufferPool::kAlignment);
+		}
+	}
+
+	BufferPool::BufferPool(size_t max_cached_bytes) : max_cached_bytes_{ max_cached_bytes }, stats_{ 0 }
+	{
+	}
+
+	BufferPool::~BufferPool()
+	{
+		Trim();
+	}
+
+	size_t BufferPool::BucketSize(size_t size){
+		if (size <= kMinBucket){
+			return kMinBucket;
+		}
+		// eighth steps between powers of two keep the waste under 12.5%
+		size_t top = kMinBucket;
+		while (top < size){
+			top <<= 1;
+		}
+		size_t step = top >> 4;
+		return (size + step - 1) / step * step;
+	}
+
+	size_t BufferPool::BufferSize(const void* buffer){
+		return buffer ? HeaderOf(buffer)->Size : 0;
+	}
+
+	void* BufferPool::Acquire(size_t size){
+		size_t bucket = BucketSize(size);
+		{
+			lock_guard<mutex> lk(mutex_);
+			auto hit = buckets_.find(bucket);
+			if (hit != buckets_.end() && !hit->second.Free.empty()){
+				void* buffer = hit->second.Free.back();
+				hit->second.Free.pop_back();
+				stats_.Hits++;
+				stats_.BytesCached -= bucket;
+				stats_.BytesInUse += bucket;
+				if (stats_.BytesInUse > stats_.HighWaterBytes){
+					stats_.HighWaterBytes = stats_.BytesInUse;
+				}
+				return buffer;
+			}
+		}
+
+		auto mem = static_cast<char*>(SystemAlloc(bucket + kAlignment));
+		if (!mem){
+			return nullptr;
+		}
+		auto header = reinterpret_cast<BufferHeader*>(mem);
+		header->Magic = kMagic;
+		header->Size = bucket;
+
+		lock_guard<mutex> lk(mutex_);
+		// grow the cache now rather than when the buffer comes back
+		auto& created = buckets_[bucket];
+		created.Count++;
+		created.Free.reserve(created.Count);
+		stats_.Misses++;
+		stats_.BytesInUse += bucket;
+		if (stats_.BytesInUse > stats_.HighWaterBytes){
+			stats_.HighWaterBytes = stats_.BytesInUse;
+		}
+		return mem + kAlignment;
+	}
+
+	void BufferPool::Release(void* buffer){
+		if (!buffer){
+			return;
+		}
+		auto header = HeaderOf(buffer);
+		if (header->Magic != kMagic){
+			return;
+		}
+		size_t bucket = header->Size;
+		{
+			lock_guard<mutex> lk(mutex_);
+			stats_.BytesInUse -= bucket;
+			auto& released = buckets_[bucket];
+			if (stats_.BytesCached + bucket <= max_cached_bytes_){
+				released.Free.push_back(buffer);
+				stats_.BytesCached += bucket;
+				return;
+			}
+			if (released.Count > 0){
+				released.Count--;
+			}
+		}
+		SystemFree(header);
+	}
+
+	void BufferPool::Keep(size_t size, size_t count){
+		size_t bucket = BucketSize(size);
+		lock_guard<mutex> lk(mutex_);
+		auto& kept = buckets_[bucket];
+		kept.Free.reserve(count);
+		while (kept.Count < count && stats_.BytesCached + bucket <= max_cached_bytes_){
+			auto mem = static_cast<char*>(SystemAlloc(bucket + kAlignment));
+			if (!mem){
+				return;
+			}
+			auto header = reinterpret_cast<BufferHeader*>(mem);
+			header->Magic = kMagic;
+			header->Size = bucket;
+			kept.Free.push_back(mem + kAlignment);
+			kept.Count++;
+			stats_.BytesCached += bucket;
+		}
+	}
+
+	void BufferPool::Trim(){
+		vector<void*> release;
+		{
+			lock_guard<mutex> lk(mutex_);
+			for (auto& bucket : buckets_){
+				release.insert(release.end(), bucket.second.Free.begin(), bucket.second.Free.end());
+				bucket.second.Count -= bucket.second.Free.size();
+				bucket.second.Free.clear();
+			}
+			stats_.BytesCached = 0;
+		}
+		for (auto buffer : release){
+			SystemFree(HeaderOf(buffer));
+		}
+	}
+
+	void BufferPool::set_max_cached_bytes(size_t bytes){
+		{
+			lock_guard<mutex> lk(mutex_);
+			max_cached_bytes_ = bytes;
+			if (stats_.BytesCached <= bytes){
+				return;
+			}
+		}
+		Trim();
+	}
+
+	BufferPoolStats BufferPool::stats() const{
+		lock_guard<mutex> lk(mutex_);
+		return stats_;
+	}
+
+	void BufferPool::ResetStats(){
+		lock_guard<mutex> lk(mutex_);
+		stats_.Hits = 0;
+		stats_.Misses = 0;
+		stats_.HighWaterBytes = stats_.BytesInUse;
+	}
+}
@@ -0,0 +1,156 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef BUFFER_POOL_H_
+#define BUFFER_POOL_H_
+
+#include <cstddef>
+#include <map>
+#include <vector>
+#include <mutex>
+
+namespace ctwain{
+
+	/// <summary>
+	/// Counters reported by a <see cref="BufferPool"/>.
+	/// </summary>
+	struct BufferPoolStats{
+		/// <summary>
+		/// Gets the number of requests served from a cached buffer.
+		/// </summary>
+		unsigned long long Hits;
+
+		/// <summary>
+		/// Gets the number of requests that had to allocate from the system.
+		/// </summary>
+		unsigned long long Misses;
+
+		/// <summary>
+		/// Gets the bytes currently handed out by the pool.
+		/// </summary>
+		size_t BytesInUse;
+
+		/// <summary>
+		/// Gets the highest value <see cref="BytesInUse"/> has reached.
+		/// </summary>
+		size_t HighWaterBytes;
+
+		/// <summary>
+		/// Gets the bytes held in the pool waiting to be reused.
+		/// </summary>
+		size_t BytesCached;
+	};
+
+	/// <summary>
+	/// A thread-safe pool of aligned buffers bucketed by size. Released buffers are kept
+	/// and handed out again for requests that round up to the same bucket.
+	/// This class should not be used by typical consumers.
+	/// </summary>
+	class BufferPool
+	{
+	public:
+		/// <summary>
+		/// The alignment of every buffer from the pool.
+		/// </summary>
+		static const size_t kAlignment = 64;
+
+		/// <summary>
+		/// Initializes a new instance of the <see cref="BufferPool"/> class.
+		/// </summary>
+		/// <param name="max_cached_bytes">The most bytes to keep around for reuse.</param>
+		explicit BufferPool(size_t max_cached_bytes = 256 * 1024 * 1024);
+		~BufferPool();
+
+		BufferPool(const BufferPool&) = delete;
+		BufferPool& operator=(const BufferPool&) = delete;
+
+		/// <summary>
+		/// Gets a buffer of at least <paramref name="size"/> bytes. Calls to this must be coupled with 
+		/// <see cref="Release"/> later.
+		/// </summary>
+		/// <param name="size">The size in bytes.</param>
+		/// <returns>The buffer or nullptr if out of memory.</returns>
+		void* Acquire(size_t size);
+
+		/// <summary>
+		/// Returns a buffer to the pool. Doesn't allocate, the pool makes room for every buffer when it's created.
+		/// </summary>
+		/// <param name="buffer">The buffer from <see cref="Acquire"/>.</param>
+		void Release(void* buffer);
+
+		/// <summary>
+		/// Gets the usable size of a buffer from <see cref="Acquire"/>.
+		/// </summary>
+		/// <param name="buffer">The buffer.</param>
+		static size_t BufferSize(const void* buffer);
+
+		/// <summary>
+		/// Makes sure at least <paramref name="count"/> buffers of a size exist, in use or cached,
+		/// so that many can be acquired at once without going to the system.
+		/// </summary>
+		/// <param name="size">The size in bytes.</param>
+		/// <param name="count">The number of buffers.</param>
+		void Keep(size_t size, size_t count);
+
+		/// <summary>
+		/// Frees every cached buffer back to the system.
+		/// </summary>
+		void Trim();
+
+		/// <summary>
+		/// Sets the most bytes to keep around for reuse. Buffers released beyond that are freed.
+		/// </summary>
+		void set_max_cached_bytes(size_t bytes);
+
+		/// <summary>
+		/// Gets a snapshot of the pool counters.
+		/// </summary>
+		BufferPoolStats stats() const;
+
+		/// <summary>
+		/// Resets the hit/miss and high-water counters.
+		/// </summary>
+		void ResetStats();
+
+		/// <summary>
+		/// Gets the bucket size a request would be rounded up to.
+		/// </summary>
+		/// <param name="size">The requested size in bytes.</param>
+		static size_t BucketSize(size_t size);
+
+	private:
+		struct Bucket{
+			// the cached buffers of this size
+			std::vector<void*> Free;
+			// the buffers of this size that exist, which Free always has room for
+			size_t Count;
+		};
+
+		mutable std::mutex mutex_;
+		std::map<size_t, Bucket> buckets_;
+		size_t max_cached_bytes_;
+		BufferPoolStats stats_;
+	};
+}
+
+#endif //BUFFER_POOL_H_
@@ -31,12 +31,23 @@
 #define LOADLIBRARY(lib) LoadLibrary(lib) 
 #define LOADFUNCTION(lib, func) GetProcAddress(lib, func)
 #define UNLOADLIBRARY(lib) FreeLibrary(lib)
+// only for plain data, VS2013 has no thread_local
+#define CTWAIN_THREAD_LOCAL __declspec(thread)
+// copies a string into a fixed size buffer, cutting it to fit
+#define CTWAIN_COPY_TEXT(target, size, text) strncpy_s(target, size, text, _TRUNCATE)
 
-#elif  TWH_CMP_GNU
+#elif defined(TWH_CMP_GNU)
+#include <cstdio>
+#include <dlfcn.h>
 #define LOADLIBRARY(lib) dlopen(lib, RTLD_NOW)
 #define LOADFUNCTION(lib, func) dlsym(lib, func)
 #define UNLOADLIBRARY(lib) dlclose(lib)
+#define CTWAIN_THREAD_LOCAL __thread
+#define CTWAIN_COPY_TEXT(target, size, text) snprintf(target, size, "%s", text)
 typedef void * HMODULE;
+// there are no windows, DAT_PARENT takes a null handle
+typedef void * HWND;
+#define UNREFERENCED_PARAMETER(P) (void)(P)
 
 #if !defined(TRUE)
 #define FALSE		0
@@ -44,7 +55,7 @@ typedef void * HMODULE;
 #endif
 
 #else
-#error Sorry, we don't recognize this system...
+#error "Sorry, we don't recognize this system..."
 #endif
 
 
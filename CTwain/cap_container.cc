@@ -0,0 +1,164 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <cstring>
+#include "cap_container.h"
+#include "capability_cache.h"
+#include "entry_points.h"
+
+namespace ctwain{
+
+	bool ItemReader<std::string>::Read(TW_UINT16 itemType, const void* item, std::string& value){
+		switch (itemType){
+		case TWTY_STR32:
+		case TWTY_STR64:
+		case TWTY_STR128:
+		case TWTY_STR255:
+		case TWTY_STR1024:
+		{
+			// sources don't always terminate a full string
+			auto text = static_cast<const char*>(item);
+			auto size = CapabilityCache::ItemSize(itemType);
+			size_t length = 0;
+			while (length < size && text[length]){
+				length++;
+			}
+			value.assign(text, length);
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+
+	TW_UINT16 CapView::item_type() const{
+		// every container starts with its item type
+		return container_ ? *reinterpret_cast<const TW_UINT16*>(container_) : TWTY_UINT16;
+	}
+
+	TW_UINT32 CapView::count() const{
+		if (!container_){
+			return 0;
+		}
+		switch (con_type_){
+		case TWON_ONEVALUE:
+			return 1;
+		case TWON_ARRAY:
+			return reinterpret_cast<const TW_ARRAY*>(container_)->NumItems;
+		case TWON_ENUMERATION:
+			return reinterpret_cast<const TW_ENUMERATION*>(container_)->NumItems;
+		default:
+			return 0;
+		}
+	}
+
+	TW_UINT32 CapView::current_index() const{
+		if (container_ && con_type_ == TWON_ENUMERATION){
+			return reinterpret_cast<const TW_ENUMERATION*>(container_)->CurrentIndex;
+		}
+		return 0;
+	}
+
+	TW_UINT32 CapView::default_index() const{
+		if (container_ && con_type_ == TWON_ENUMERATION){
+			return reinterpret_cast<const TW_ENUMERATION*>(container_)->DefaultIndex;
+		}
+		return 0;
+	}
+
+	const void* CapView::item(TW_UINT32 index) const{
+		if (index >= count()){
+			return nullptr;
+		}
+		const TW_UINT8* items = nullptr;
+		switch (con_type_){
+		case TWON_ONEVALUE:
+			return &reinterpret_cast<const TW_ONEVALUE*>(container_)->Item;
+		case TWON_ARRAY:
+			items = reinterpret_cast<const TW_ARRAY*>(container_)->ItemList;
+			break;
+		case TWON_ENUMERATION:
+			items = reinterpret_cast<const TW_ENUMERATION*>(container_)->ItemList;
+			break;
+		}
+		auto size = CapabilityCache::ItemSize(item_type());
+		return size ? items + index * size : nullptr;
+	}
+
+	CapContainer::CapContainer(CapContainer&& other) : handle_(other.handle_), copy_(std::move(other.copy_)), view_(other.view_){
+		other.handle_ = nullptr;
+		other.view_ = CapView();
+	}
+
+	CapContainer& CapContainer::operator=(CapContainer&& other){
+		if (this != &other){
+			Reset();
+			handle_ = other.handle_;
+			// the moved vector keeps its buffer so the view stays on it
+			copy_ = std::move(other.copy_);
+			view_ = other.view_;
+			other.handle_ = nullptr;
+			other.view_ = CapView();
+		}
+		return *this;
+	}
+
+	void CapContainer::Adopt(TW_CAPABILITY& cap){
+		Reset();
+		if (cap.hContainer){
+			handle_ = cap.hContainer;
+			cap.hContainer = nullptr;
+			view_ = CapView(cap.ConType, EntryPoints::Lock(handle_));
+		}
+	}
+
+	void CapContainer::Reference(TW_UINT16 conType, const void* container){
+		Reset();
+		view_ = CapView(conType, container);
+	}
+
+	void CapContainer::Own(){
+		if (handle_ || !copy_.empty() || !view_.valid()){
+			return;
+		}
+		copy_.resize(CapabilityCache::ContainerSize(view_.con_type(), view_.data()));
+		if (copy_.empty()){
+			return;
+		}
+		memcpy(copy_.data(), view_.data(), copy_.size());
+		view_ = CapView(view_.con_type(), copy_.data());
+	}
+
+	void CapContainer::Reset(){
+		if (handle_){
+			if (view_.valid()){
+				EntryPoints::Unlock(handle_);
+			}
+			EntryPoints::Free(handle_);
+			handle_ = nullptr;
+		}
+		copy_.clear();
+		view_ = CapView();
+	}
+}
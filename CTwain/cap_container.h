@@ -0,0 +1,309 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef CAP_CONTAINER_H_
+#define CAP_CONTAINER_H_
+
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "twain2.3.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// Maps a C++ item type to its TWTY_* value at compile time.
+	/// TW_BOOL shares its type with TW_UINT16 and maps to TWTY_UINT16.
+	/// </summary>
+	template<typename T> struct TwainItemType;
+	template<> struct TwainItemType<TW_INT8>{ static const TW_UINT16 value = TWTY_INT8; };
+	template<> struct TwainItemType<TW_INT16>{ static const TW_UINT16 value = TWTY_INT16; };
+	template<> struct TwainItemType<TW_INT32>{ static const TW_UINT16 value = TWTY_INT32; };
+	template<> struct TwainItemType<TW_UINT8>{ static const TW_UINT16 value = TWTY_UINT8; };
+	template<> struct TwainItemType<TW_UINT16>{ static const TW_UINT16 value = TWTY_UINT16; };
+	template<> struct TwainItemType<TW_UINT32>{ static const TW_UINT16 value = TWTY_UINT32; };
+	template<> struct TwainItemType<TW_FIX32>{ static const TW_UINT16 value = TWTY_FIX32; };
+	template<> struct TwainItemType<TW_FRAME>{ static const TW_UINT16 value = TWTY_FRAME; };
+	template<> struct TwainItemType<TW_STR32>{ static const TW_UINT16 value = TWTY_STR32; };
+	template<> struct TwainItemType<TW_STR64>{ static const TW_UINT16 value = TWTY_STR64; };
+	template<> struct TwainItemType<TW_STR128>{ static const TW_UINT16 value = TWTY_STR128; };
+	template<> struct TwainItemType<TW_STR255>{ static const TW_UINT16 value = TWTY_STR255; };
+
+	/// <summary>
+	/// Maps a TWTY_* value to its C++ item type at compile time.
+	/// </summary>
+	template<TW_UINT16 Type> struct TwainItem;
+	template<> struct TwainItem<TWTY_INT8>{ typedef TW_INT8 type; };
+	template<> struct TwainItem<TWTY_INT16>{ typedef TW_INT16 type; };
+	template<> struct TwainItem<TWTY_INT32>{ typedef TW_INT32 type; };
+	template<> struct TwainItem<TWTY_UINT8>{ typedef TW_UINT8 type; };
+	template<> struct TwainItem<TWTY_UINT16>{ typedef TW_UINT16 type; };
+	template<> struct TwainItem<TWTY_UINT32>{ typedef TW_UINT32 type; };
+	template<> struct TwainItem<TWTY_BOOL>{ typedef TW_BOOL type; };
+	template<> struct TwainItem<TWTY_FIX32>{ typedef TW_FIX32 type; };
+	template<> struct TwainItem<TWTY_FRAME>{ typedef TW_FRAME type; };
+	template<> struct TwainItem<TWTY_STR32>{ typedef TW_STR32 type; };
+	template<> struct TwainItem<TWTY_STR64>{ typedef TW_STR64 type; };
+	template<> struct TwainItem<TWTY_STR128>{ typedef TW_STR128 type; };
+	template<> struct TwainItem<TWTY_STR255>{ typedef TW_STR255 type; };
+
+	/// <summary>
+	/// Reads one item of a runtime TWTY_* type into the C++ type T. The conversion
+	/// is picked by T at compile time: integers widen or narrow from any integer type,
+	/// TW_FIX32 also reads integers, strings read any TWTY_STR* type, and TW_FRAME
+	/// only reads frames. Returns false if the item can't be represented as T.
+	/// </summary>
+	template<typename T, typename Enable = void>
+	struct ItemReader;
+
+	template<typename T>
+	struct ItemReader<T, typename std::enable_if<std::is_integral<T>::value>::type>{
+		static bool Read(TW_UINT16 itemType, const void* item, T& value){
+			switch (itemType){
+			case TWTY_INT8:
+				value = static_cast<T>(*static_cast<const TwainItem<TWTY_INT8>::type*>(item));
+				return true;
+			case TWTY_INT16:
+				value = static_cast<T>(*static_cast<const TwainItem<TWTY_INT16>::type*>(item));
+				return true;
+			case TWTY_INT32:
+				value = static_cast<T>(*static_cast<const TwainItem<TWTY_INT32>::type*>(item));
+				return true;
+			case TWTY_UINT8:
+				value = static_cast<T>(*static_cast<const TwainItem<TWTY_UINT8>::type*>(item));
+				return true;
+			case TWTY_UINT16:
+			case TWTY_BOOL:
+				value = static_cast<T>(*static_cast<const TwainItem<TWTY_UINT16>::type*>(item));
+				return true;
+			case TWTY_UINT32:
+				value = static_cast<T>(*static_cast<const TwainItem<TWTY_UINT32>::type*>(item));
+				return true;
+			default:
+				return false;
+			}
+		}
+	};
+
+	template<>
+	struct ItemReader<TW_FIX32>{
+		static bool Read(TW_UINT16 itemType, const void* item, TW_FIX32& value){
+			if (itemType == TWTY_FIX32){
+				value = *static_cast<const TW_FIX32*>(item);
+				return true;
+			}
+			TW_INT32 whole;
+			if (ItemReader<TW_INT32>::Read(itemType, item, whole)){
+				value.Whole = static_cast<TW_INT16>(whole);
+				value.Frac = 0;
+				return true;
+			}
+			return false;
+		}
+	};
+
+	template<>
+	struct ItemReader<TW_FRAME>{
+		static bool Read(TW_UINT16 itemType, const void* item, TW_FRAME& value){
+			if (itemType == TWTY_FRAME){
+				value = *static_cast<const TW_FRAME*>(item);
+				return true;
+			}
+			return false;
+		}
+	};
+
+	template<>
+	struct ItemReader<std::string>{
+		static bool Read(TW_UINT16 itemType, const void* item, std::string& value);
+	};
+
+	/// <summary>
+	/// A read-only typed span over the items of a container.
+	/// </summary>
+	template<typename T>
+	class ItemSpan
+	{
+	public:
+		ItemSpan() : data_(nullptr), size_(0){}
+		ItemSpan(const T* data, size_t size) : data_(data), size_(size){}
+
+		const T* begin() const{ return data_; }
+		const T* end() const{ return data_ + size_; }
+		size_t size() const{ return size_; }
+		bool empty() const{ return size_ == 0; }
+		const T& operator[](size_t index) const{ return data_[index]; }
+
+	private:
+		const T* data_;
+		size_t size_;
+	};
+
+	/// <summary>
+	/// A non-owning view over a locked capability container (TW_ONEVALUE, TW_ARRAY,
+	/// TW_ENUMERATION or TW_RANGE). Items are read in place without copying.
+	/// </summary>
+	class CapView
+	{
+	public:
+		CapView() : con_type_(TWON_DONTCARE16), container_(nullptr){}
+		CapView(TW_UINT16 conType, const void* container)
+			: con_type_(conType), container_(static_cast<const TW_UINT8*>(container)){}
+
+		/// <summary>
+		/// Gets a value indicating whether there's a container to read.
+		/// </summary>
+		bool valid() const{ return container_ != nullptr; }
+
+		/// <summary>
+		/// Gets the container memory.
+		/// </summary>
+		const void* data() const{ return container_; }
+
+		/// <summary>
+		/// Gets the TWON_* container type.
+		/// </summary>
+		TW_UINT16 con_type() const{ return con_type_; }
+
+		/// <summary>
+		/// Gets the TWTY_* item type.
+		/// </summary>
+		TW_UINT16 item_type() const;
+
+		/// <summary>
+		/// Gets the number of items in a one value, array or enumeration. Ranges have 0,
+		/// use <see cref="range"/> for those.
+		/// </summary>
+		TW_UINT32 count() const;
+
+		/// <summary>
+		/// Gets the current item index, 0 if not an enumeration.
+		/// </summary>
+		TW_UINT32 current_index() const;
+
+		/// <summary>
+		/// Gets the default item index, 0 if not an enumeration.
+		/// </summary>
+		TW_UINT32 default_index() const;
+
+		/// <summary>
+		/// Gets the range or nullptr if not a range.
+		/// </summary>
+		const TW_RANGE* range() const{ return con_type_ == TWON_RANGE ? reinterpret_cast<const TW_RANGE*>(container_) : nullptr; }
+
+		/// <summary>
+		/// Gets a pointer to an item or nullptr if out of range.
+		/// </summary>
+		const void* item(TW_UINT32 index) const;
+
+		/// <summary>
+		/// Gets the items as a typed span. The span is empty if the item type
+		/// is not exactly the one for T, use <see cref="Read"/> to convert instead.
+		/// </summary>
+		template<typename T>
+		ItemSpan<T> Items() const{
+			auto type = item_type();
+			if (type == TWTY_BOOL && TwainItemType<T>::value == TWTY_UINT16){
+				type = TWTY_UINT16;
+			}
+			auto first = item(0);
+			if (!first || type != TwainItemType<T>::value){
+				return ItemSpan<T>();
+			}
+			return ItemSpan<T>(static_cast<const T*>(first), count());
+		}
+
+		/// <summary>
+		/// Reads and converts an item.
+		/// </summary>
+		/// <returns>false if out of range or the item can't convert to T.</returns>
+		template<typename T>
+		bool Read(TW_UINT32 index, T& value) const{
+			auto pointer = item(index);
+			return pointer && ItemReader<T>::Read(item_type(), pointer, value);
+		}
+
+		/// <summary>
+		/// Reads and converts one of the TW_RANGE values (e.g. CurrentValue).
+		/// </summary>
+		template<typename T>
+		static bool ReadRange(const TW_RANGE& range, const TW_UINT32& rangeValue, T& value){
+			return ItemReader<T>::Read(range.ItemType == TWTY_FIX32 ? TWTY_FIX32 : TWTY_UINT32, &rangeValue, value);
+		}
+
+	private:
+		TW_UINT16 con_type_;
+		const TW_UINT8* container_;
+	};
+
+	/// <summary>
+	/// Holds a capability container for reading, either by owning the source's
+	/// handle (kept locked and freed on destruction), by owning a copy of it,
+	/// or by referencing memory owned by someone else such as the capability cache.
+	/// </summary>
+	class CapContainer
+	{
+	public:
+		CapContainer() : handle_(nullptr){}
+		~CapContainer(){ Reset(); }
+
+		CapContainer(const CapContainer&) = delete;
+		CapContainer& operator=(const CapContainer&) = delete;
+		CapContainer(CapContainer&& other);
+		CapContainer& operator=(CapContainer&& other);
+
+		/// <summary>
+		/// Takes ownership of the container handle in a capability and locks it.
+		/// The handle in the capability is cleared.
+		/// </summary>
+		void Adopt(TW_CAPABILITY& cap);
+
+		/// <summary>
+		/// References a container owned by someone else.
+		/// </summary>
+		void Reference(TW_UINT16 conType, const void* container);
+
+		/// <summary>
+		/// Copies a referenced container so it no longer depends on its owner.
+		/// Does nothing if the container is owned already.
+		/// </summary>
+		void Own();
+
+		/// <summary>
+		/// Unlocks and frees any owned handle or copy.
+		/// </summary>
+		void Reset();
+
+		/// <summary>
+		/// Gets the view over the container.
+		/// </summary>
+		const CapView& view() const{ return view_; }
+
+	private:
+		TW_HANDLE handle_;
+		std::vector<TW_UINT8> copy_;
+		CapView view_;
+	};
+}
+
+#endif //CAP_CONTAINER_H_
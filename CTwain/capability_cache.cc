@@ -0,0 +1,270 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <cstddef>
+#include <cstring>
+#include "capability_cache.h"
+
+using namespace std;
+
+namespace ctwain{
+
+	namespace{
+		// capabilities that sources commonly change when the key one is set.
+		// this can never be complete since drivers are free to tie anything together
+		// but covers the relationships the spec calls out.
+		struct CapDependency{
+			TW_UINT16 Cap;
+			TW_UINT16 Dependents[12];
+		};
+
+		const CapDependency kDependencies[] = {
+			{ ICAP_PIXELTYPE, { ICAP_BITDEPTH, ICAP_PIXELFLAVOR, ICAP_BITDEPTHREDUCTION, ICAP_THRESHOLD,
+			ICAP_HALFTONES, ICAP_COMPRESSION, ICAP_JPEGPIXELTYPE, ICAP_IMAGEFILEFORMAT } },
+			{ ICAP_BITDEPTH, { ICAP_PIXELTYPE, ICAP_BITDEPTHREDUCTION, ICAP_THRESHOLD, ICAP_HALFTONES, ICAP_COMPRESSION } },
+			{ ICAP_BITDEPTHREDUCTION, { ICAP_THRESHOLD, ICAP_HALFTONES } },
+			{ ICAP_UNITS, { ICAP_XRESOLUTION, ICAP_YRESOLUTION, ICAP_FRAMES, ICAP_PHYSICALWIDTH, ICAP_PHYSICALHEIGHT,
+			ICAP_MINIMUMWIDTH, ICAP_MINIMUMHEIGHT, ICAP_XNATIVERESOLUTION, ICAP_YNATIVERESOLUTION } },
+			{ ICAP_XRESOLUTION, { ICAP_YRESOLUTION } },
+			{ ICAP_YRESOLUTION, { ICAP_XRESOLUTION } },
+			{ ICAP_SUPPORTEDSIZES, { ICAP_FRAMES } },
+			{ ICAP_FRAMES, { ICAP_SUPPORTEDSIZES } },
+			{ ICAP_XFERMECH, { ICAP_IMAGEFILEFORMAT, ICAP_COMPRESSION } },
+			{ ICAP_COMPRESSION, { ICAP_IMAGEFILEFORMAT, ICAP_PIXELTYPE, ICAP_BITDEPTH } },
+			{ ICAP_IMAGEFILEFORMAT, { ICAP_COMPRESSION } },
+			{ ICAP_UNDEFINEDIMAGESIZE, { ICAP_FRAMES, ICAP_SUPPORTEDSIZES } },
+			{ ICAP_AUTOMATICBORDERDETECTION, { ICAP_UNDEFINEDIMAGESIZE, ICAP_FRAMES, ICAP_SUPPORTEDSIZES } },
+			{ ICAP_LIGHTPATH, { ICAP_PIXELTYPE, ICAP_BITDEPTH, ICAP_XRESOLUTION, ICAP_YRESOLUTION,
+			ICAP_PHYSICALWIDTH, ICAP_PHYSICALHEIGHT } },
+			{ CAP_FEEDERENABLED, { CAP_FEEDERLOADED, CAP_AUTOFEED, CAP_DUPLEXENABLED, ICAP_SUPPORTEDSIZES,
+			ICAP_FRAMES, ICAP_PHYSICALWIDTH, ICAP_PHYSICALHEIGHT, ICAP_XNATIVERESOLUTION, ICAP_YNATIVERESOLUTION } },
+			{ CAP_DUPLEXENABLED, { CAP_CAMERAENABLED } },
+		};
+
+		// setting these switches which camera later values apply to so nothing cached holds
+		bool InvalidatesAll(TW_UINT16 cap){
+			return cap == CAP_CAMERASIDE || cap == CAP_CAMERAENABLED;
+		}
+
+		string IdentityKey(const TW_IDENTITY& source){
+			string key{ source.Manufacturer };
+			key += '|';
+			key += source.ProductFamily;
+			key += '|';
+			key += source.ProductName;
+			key += '|';
+			key += source.Version.Info;
+			return key;
+		}
+	}
+
+	void CapabilityCache::Bind(const TW_IDENTITY& source){
+		values_.clear();
+		item_types_.clear();
+		current_support_ = &support_[IdentityKey(source)];
+	}
+
+	void CapabilityCache::Clear(){
+		values_.clear();
+	}
+
+	const CachedCap* CapabilityCache::Find(TW_UINT16 cap, TW_UINT16 msg) const{
+		auto hit = values_.find(Key(cap, msg));
+		return hit == values_.end() ? nullptr : &hit->second;
+	}
+
+	const CachedCap* CapabilityCache::Store(TW_UINT16 cap, TW_UINT16 msg, TW_UINT16 conType, const void* container){
+		auto& entry = values_[Key(cap, msg)];
+		entry.ConType = conType;
+		size_t size = container ? ContainerSize(conType, container) : 0;
+		entry.Container.resize(size);
+		if (size){
+			memcpy(entry.Container.data(), container, size);
+		}
+		return &entry;
+	}
+
+	void CapabilityCache::Invalidate(TW_UINT16 cap){
+		if (InvalidatesAll(cap)){
+			values_.clear();
+			return;
+		}
+		Erase(cap);
+		for (auto& dependency : kDependencies){
+			if (dependency.Cap == cap){
+				for (auto dependent : dependency.Dependents){
+					if (dependent){
+						Erase(dependent);
+					}
+				}
+				break;
+			}
+		}
+	}
+
+	void CapabilityCache::Erase(TW_UINT16 cap){
+		auto it = values_.lower_bound(Key(cap, 0));
+		auto end = values_.upper_bound(Key(cap, 0xffff));
+		values_.erase(it, end);
+	}
+
+	bool CapabilityCache::FindItemType(TW_UINT16 cap, TW_UINT16& itemType) const{
+		auto hit = item_types_.find(cap);
+		if (hit == item_types_.end()){
+			return false;
+		}
+		itemType = hit->second;
+		return true;
+	}
+
+	void CapabilityCache::StoreItemType(TW_UINT16 cap, TW_UINT16 itemType){
+		item_types_[cap] = itemType;
+	}
+
+	bool CapabilityCache::FindSupport(TW_UINT16 cap, TW_INT32& support) const{
+		if (current_support_){
+			auto hit = current_support_->find(cap);
+			if (hit != current_support_->end()){
+				support = hit->second;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void CapabilityCache::StoreSupport(TW_UINT16 cap, TW_INT32 support){
+		if (current_support_){
+			(*current_support_)[cap] = support;
+		}
+	}
+
+	bool CapabilityCache::Allows(TW_UINT16 cap, TW_UINT16 msg) const{
+		TW_INT32 support;
+		if (!FindSupport(cap, support) || support == kSupportUnknown){
+			return true;
+		}
+		switch (msg){
+		case MSG_GET:
+			return (support & TWQC_GET) != 0;
+		case MSG_GETCURRENT:
+			return (support & TWQC_GETCURRENT) != 0;
+		case MSG_GETDEFAULT:
+			return (support & TWQC_GETDEFAULT) != 0;
+		case MSG_SET:
+			return (support & TWQC_SET) != 0;
+		case MSG_SETCONSTRAINT:
+			return (support & TWQC_SETCONSTRAINT) != 0;
+		case MSG_RESET:
+			return (support & TWQC_RESET) != 0;
+		case MSG_GETHELP:
+			return (support & TWQC_GETHELP) != 0;
+		case MSG_GETLABEL:
+			return (support & TWQC_GETLABEL) != 0;
+		case MSG_GETLABELENUM:
+			return (support & TWQC_GETLABELENUM) != 0;
+		default:
+			return true;
+		}
+	}
+
+	bool CapabilityCache::IsVolatile(TW_UINT16 cap){
+		switch (cap){
+		case CAP_FEEDERLOADED:
+		case CAP_DEVICEONLINE:
+		case CAP_DEVICETIMEDATE:
+		case CAP_POWERSUPPLY:
+		case CAP_BATTERYMINUTES:
+		case CAP_BATTERYPERCENTAGE:
+		case CAP_PRINTERINDEX:
+		case CAP_CUSTOMDSDATA:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	size_t CapabilityCache::ItemSize(TW_UINT16 itemType){
+		switch (itemType){
+		case TWTY_INT8:
+		case TWTY_UINT8:
+			return 1;
+		case TWTY_INT16:
+		case TWTY_UINT16:
+		case TWTY_BOOL:
+			return 2;
+		// the 32 bit types are longs in the TWAIN header, 8 bytes on 64 bit Linux,
+		// and sources lay out their items with the same header
+		case TWTY_INT32:
+			return sizeof(TW_INT32);
+		case TWTY_UINT32:
+			return sizeof(TW_UINT32);
+		case TWTY_FIX32:
+			return sizeof(TW_FIX32);
+		case TWTY_FRAME:
+			return sizeof(TW_FRAME);
+		case TWTY_STR32:
+			return sizeof(TW_STR32);
+		case TWTY_STR64:
+			return sizeof(TW_STR64);
+		case TWTY_STR128:
+			return sizeof(TW_STR128);
+		case TWTY_STR255:
+			return sizeof(TW_STR255);
+		case TWTY_STR1024:
+			return 1026;
+		case TWTY_UNI512:
+			return 1024;
+		case TWTY_HANDLE:
+			return sizeof(TW_HANDLE);
+		default:
+			return 0;
+		}
+	}
+
+	size_t CapabilityCache::ContainerSize(TW_UINT16 conType, const void* container){
+		switch (conType){
+		case TWON_ONEVALUE:
+		{
+			// small items live in the TW_UINT32 but bigger ones run past it
+			auto one = static_cast<const TW_ONEVALUE*>(container);
+			size_t item = ItemSize(one->ItemType);
+			return offsetof(TW_ONEVALUE, Item) + (item > sizeof(TW_UINT32) ? item : sizeof(TW_UINT32));
+		}
+		case TWON_RANGE:
+			return sizeof(TW_RANGE);
+		case TWON_ENUMERATION:
+		{
+			auto enumeration = static_cast<const TW_ENUMERATION*>(container);
+			return offsetof(TW_ENUMERATION, ItemList) + ItemSize(enumeration->ItemType) * enumeration->NumItems;
+		}
+		case TWON_ARRAY:
+		{
+			auto array = static_cast<const TW_ARRAY*>(container);
+			return offsetof(TW_ARRAY, ItemList) + ItemSize(array->ItemType) * array->NumItems;
+		}
+		default:
+			return 0;
+		}
+	}
+}
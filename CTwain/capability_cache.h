@@ -0,0 +1,166 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef CAPABILITY_CACHE_H_
+#define CAPABILITY_CACHE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include "twain2.3.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// A copy of a capability container as returned by the source.
+	/// Only successful calls are cached.
+	/// </summary>
+	struct CachedCap{
+		/// <summary>
+		/// Gets the TWON_* container type.
+		/// </summary>
+		TW_UINT16 ConType;
+
+		/// <summary>
+		/// Gets the container bytes, e.g. a TW_ONEVALUE or TW_ENUMERATION.
+		/// </summary>
+		std::vector<TW_UINT8> Container;
+	};
+
+	/// <summary>
+	/// Caches capability containers and MSG_QUERYSUPPORT results for the opened source.
+	/// Values are only valid while the source stays open and untouched, the support
+	/// matrix is kept per source identity since it doesn't change between opens.
+	/// This class should not be used by typical consumers.
+	/// </summary>
+	class CapabilityCache
+	{
+	public:
+		/// <summary>
+		/// Value stored when the source could not tell what it supports.
+		/// </summary>
+		static const TW_INT32 kSupportUnknown = -1;
+
+		/// <summary>
+		/// Starts caching for a newly opened source. Cached values are dropped.
+		/// </summary>
+		/// <param name="source">The source identity.</param>
+		void Bind(const TW_IDENTITY& source);
+
+		/// <summary>
+		/// Drops every cached value but keeps the support matrices.
+		/// </summary>
+		void Clear();
+
+		/// <summary>
+		/// Finds a cached container.
+		/// </summary>
+		/// <param name="cap">The CAP_* or ICAP_* value.</param>
+		/// <param name="msg">The MSG_GET* value it was read with.</param>
+		/// <returns>The entry or nullptr if not cached.</returns>
+		const CachedCap* Find(TW_UINT16 cap, TW_UINT16 msg) const;
+
+		/// <summary>
+		/// Stores a copy of a locked container from a successful call.
+		/// </summary>
+		/// <param name="cap">The CAP_* or ICAP_* value.</param>
+		/// <param name="msg">The MSG_GET* value it was read with.</param>
+		/// <param name="conType">The TWON_* container type.</param>
+		/// <param name="container">The locked container.</param>
+		/// <returns>The new entry.</returns>
+		const CachedCap* Store(TW_UINT16 cap, TW_UINT16 msg, TW_UINT16 conType, const void* container);
+
+		/// <summary>
+		/// Drops the cached values of a capability and of every capability that
+		/// sources commonly change along with it.
+		/// </summary>
+		/// <param name="cap">The capability that was set.</param>
+		void Invalidate(TW_UINT16 cap);
+
+		/// <summary>
+		/// Gets the TWTY_* item type a capability was last read or set with. Types are kept
+		/// until the next <see cref="Bind"/> since a source doesn't change them while it is open.
+		/// </summary>
+		/// <param name="cap">The capability.</param>
+		/// <param name="itemType">The item type.</param>
+		/// <returns>false if the capability hasn't been read or set yet.</returns>
+		bool FindItemType(TW_UINT16 cap, TW_UINT16& itemType) const;
+
+		/// <summary>
+		/// Stores the item type a capability was read or set with.
+		/// </summary>
+		void StoreItemType(TW_UINT16 cap, TW_UINT16 itemType);
+
+		/// <summary>
+		/// Gets the cached MSG_QUERYSUPPORT bits (TWQC_*) of a capability.
+		/// </summary>
+		/// <param name="cap">The capability.</param>
+		/// <param name="support">The support bits or <see cref="kSupportUnknown"/>.</param>
+		/// <returns>false if the support has not been queried yet.</returns>
+		bool FindSupport(TW_UINT16 cap, TW_INT32& support) const;
+
+		/// <summary>
+		/// Stores the MSG_QUERYSUPPORT bits of a capability.
+		/// </summary>
+		void StoreSupport(TW_UINT16 cap, TW_INT32 support);
+
+		/// <summary>
+		/// Checks whether a message is allowed for a capability according to the cached support.
+		/// Capabilities with no or unknown support information are always allowed.
+		/// </summary>
+		/// <param name="cap">The capability.</param>
+		/// <param name="msg">The MSG_* value.</param>
+		bool Allows(TW_UINT16 cap, TW_UINT16 msg) const;
+
+		/// <summary>
+		/// Gets the number of bytes in a container.
+		/// </summary>
+		/// <param name="conType">The TWON_* container type.</param>
+		/// <param name="container">The locked container.</param>
+		static size_t ContainerSize(TW_UINT16 conType, const void* container);
+
+		/// <summary>
+		/// Gets the number of bytes of one item of a TWTY_* type.
+		/// </summary>
+		static size_t ItemSize(TW_UINT16 itemType);
+
+		/// <summary>
+		/// Checks whether a capability reports device status that changes by itself
+		/// (e.g. CAP_FEEDERLOADED) and so must always be read from the source.
+		/// </summary>
+		static bool IsVolatile(TW_UINT16 cap);
+
+	private:
+		typedef std::map<TW_UINT16, TW_INT32> SupportMap;
+
+		std::map<TW_UINT32, CachedCap> values_;
+		std::map<TW_UINT16, TW_UINT16> item_types_;
+		std::map<std::string, SupportMap> support_;
+		SupportMap* current_support_ = nullptr;
+
+		static TW_UINT32 Key(TW_UINT16 cap, TW_UINT16 msg){ return (static_cast<TW_UINT32>(cap) << 16) | msg; }
+		void Erase(TW_UINT16 cap);
+	};
+}
+
+#endif //CAPABILITY_CACHE_H_
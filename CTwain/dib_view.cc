@@ -0,0 +1,153 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#include "stdafx.h"
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include "dib_view.h"
+
+namespace ctwain{
+
+	namespace{
+		// BITMAPINFOHEADER field offsets, read by hand so this also builds without windows.h.
+		// Fields are read as fixed width types since TW_INT32 is a long.
+		const size_t kInfoHeaderSize = 40;
+		const size_t kWidthOffset = 4;
+		const size_t kHeightOffset = 8;
+		const size_t kPlanesOffset = 12;
+		const size_t kBitCountOffset = 14;
+		const size_t kCompressionOffset = 16;
+		const size_t kXPelsOffset = 24;
+		const size_t kYPelsOffset = 28;
+		const size_t kClrUsedOffset = 32;
+		// masks are part of the V2 and later headers, otherwise they follow the header
+		const size_t kMasksOffset = 40;
+		const size_t kMasksSize = 12;
+		const size_t kV2HeaderSize = 52;
+
+		const TW_UINT32 kRgb = 0;
+		const TW_UINT32 kBitFields = 3;
+
+		template<typename T>
+		T ReadField(const TW_UINT8* data, size_t offset){
+			T value;
+			memcpy(&value, data + offset, sizeof(value));
+			return value;
+		}
+	}
+
+	DibView::DibView(const void* dib, size_t size) : masks_{}{
+		auto data = static_cast<const TW_UINT8*>(dib);
+		if (!data || (size && size < kInfoHeaderSize)){
+			return;
+		}
+
+		auto headerSize = ReadField<uint32_t>(data, 0);
+		auto width = ReadField<int32_t>(data, kWidthOffset);
+		auto height = ReadField<int32_t>(data, kHeightOffset);
+		auto planes = ReadField<uint16_t>(data, kPlanesOffset);
+		auto bitCount = ReadField<uint16_t>(data, kBitCountOffset);
+		auto compression = ReadField<uint32_t>(data, kCompressionOffset);
+		auto colorsUsed = ReadField<uint32_t>(data, kClrUsedOffset);
+
+		// BITMAPCOREHEADER (12 bytes) and compressed DIBs aren't supported
+		if (headerSize < kInfoHeaderSize || (size && headerSize > size) || planes != 1 ||
+			width <= 0 || height == 0 || height == std::numeric_limits<int32_t>::min()){
+			return;
+		}
+		switch (bitCount){
+		case 1:
+		case 4:
+		case 8:
+		case 24:
+			if (compression != kRgb){
+				return;
+			}
+			break;
+		case 16:
+		case 32:
+			if (compression != kRgb && compression != kBitFields){
+				return;
+			}
+			break;
+		default:
+			return;
+		}
+
+		size_t offset = headerSize;
+		if (compression == kBitFields){
+			size_t masks = kMasksOffset;
+			if (headerSize < kV2HeaderSize){
+				if (size && offset + kMasksSize > size){
+					return;
+				}
+				masks = offset;
+				offset += kMasksSize;
+			}
+			for (int i = 0; i < 3; i++){
+				masks_[i] = ReadField<uint32_t>(data, masks + i * 4);
+			}
+		}
+		else if (bitCount == 16){
+			masks_[0] = 0x7C00;
+			masks_[1] = 0x03E0;
+			masks_[2] = 0x001F;
+		}
+		else if (bitCount == 32){
+			masks_[0] = 0x00FF0000;
+			masks_[1] = 0x0000FF00;
+			masks_[2] = 0x000000FF;
+		}
+
+		// an indexed DIB has a full palette unless it says otherwise,
+		// deeper ones can still carry one that has to be skipped
+		TW_UINT32 colors = colorsUsed;
+		if (bitCount <= 8 && (colors == 0 || colors > (1u << bitCount))){
+			colors = 1u << bitCount;
+		}
+		if (colors > 0x10000){
+			return;
+		}
+		auto palette = data + offset;
+		offset += static_cast<size_t>(colors) * 4;
+
+		auto rows = static_cast<TW_UINT32>(height < 0 ? -height : height);
+		auto stride = static_cast<TW_UINT32>(((static_cast<unsigned long long>(width) * bitCount + 31) / 32) * 4);
+		if (size && (offset > size || static_cast<unsigned long long>(stride) * rows > size - offset)){
+			return;
+		}
+
+		header_ = data;
+		palette_ = palette;
+		bits_ = data + offset;
+		width_ = static_cast<TW_UINT32>(width);
+		height_ = rows;
+		bit_depth_ = bitCount;
+		compression_ = compression;
+		stride_ = stride;
+		bottom_up_ = height > 0;
+		palette_size_ = colors;
+		x_pels_per_meter_ = ReadField<int32_t>(data, kXPelsOffset);
+		y_pels_per_meter_ = ReadField<int32_t>(data, kYPelsOffset);
+	}
+}
@@ -0,0 +1,195 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef DIB_VIEW_H_
+#define DIB_VIEW_H_
+
+#include <cstddef>
+#include <iterator>
+
+namespace ctwain{
+
+	/// <summary>
+	/// Reads a packed DIB (BITMAPINFOHEADER, optional masks and palette, then pixels)
+	/// in place, such as the native image data on Windows. Nothing is copied so the view
+	/// is only good while the data is. Only uncompressed (BI_RGB) and BI_BITFIELDS data is supported.
+	/// </summary>
+	class DibView
+	{
+	public:
+		/// <summary>
+		/// Walks the rows of a <see cref="DibView"/> from the top of the image down,
+		/// whichever way they are stored.
+		/// </summary>
+		class RowIterator
+		{
+		public:
+			// rows are computed on dereference so they come back by value, which only an input iterator may do
+			typedef std::input_iterator_tag iterator_category;
+			typedef const TW_UINT8* value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const value_type* pointer;
+			typedef value_type reference;
+
+			RowIterator() : view_{ nullptr }, y_{ 0 }{}
+			RowIterator(const DibView* view, TW_UINT32 y) : view_{ view }, y_{ y }{}
+
+			const TW_UINT8* operator*() const{ return view_->row(y_); }
+			RowIterator& operator++(){ y_++; return *this; }
+			RowIterator operator++(int){ auto previous = *this; y_++; return previous; }
+			bool operator==(const RowIterator& other) const{ return y_ == other.y_; }
+			bool operator!=(const RowIterator& other) const{ return y_ != other.y_; }
+
+		private:
+			const DibView* view_;
+			TW_UINT32 y_;
+		};
+
+		/// <summary>
+		/// Initializes an invalid view.
+		/// </summary>
+		DibView(){}
+
+		/// <summary>
+		/// Initializes a new instance of the <see cref="DibView"/> class.
+		/// Check <see cref="valid"/> before using it.
+		/// </summary>
+		/// <param name="dib">The locked DIB.</param>
+		/// <param name="size">The bytes available at <paramref name="dib"/> to check against, 0 if unknown.</param>
+		explicit DibView(const void* dib, size_t size = 0);
+
+		/// <summary>
+		/// Gets a value indicating whether the data is a DIB this view can read.
+		/// </summary>
+		bool valid() const{ return bits_ != nullptr; }
+
+		/// <summary>
+		/// Gets the start of the DIB, which is the BITMAPINFOHEADER.
+		/// </summary>
+		const TW_UINT8* header() const{ return header_; }
+
+		/// <summary>
+		/// Gets the width in pixels.
+		/// </summary>
+		TW_UINT32 width() const{ return width_; }
+
+		/// <summary>
+		/// Gets the height in pixels.
+		/// </summary>
+		TW_UINT32 height() const{ return height_; }
+
+		/// <summary>
+		/// Gets the bits per pixel.
+		/// </summary>
+		TW_UINT16 bit_depth() const{ return bit_depth_; }
+
+		/// <summary>
+		/// Gets the BI_* compression, BI_RGB (0) or BI_BITFIELDS (3).
+		/// </summary>
+		TW_UINT32 compression() const{ return compression_; }
+
+		/// <summary>
+		/// Gets the bytes per row including the padding to 4 bytes.
+		/// </summary>
+		TW_UINT32 stride() const{ return stride_; }
+
+		/// <summary>
+		/// Gets a value indicating whether the last row is stored first, which is the usual case.
+		/// </summary>
+		bool bottom_up() const{ return bottom_up_; }
+
+		/// <summary>
+		/// Gets the color table as blue, green, red, reserved quads, or nullptr if there is none.
+		/// </summary>
+		const TW_UINT8* palette() const{ return palette_size_ ? palette_ : nullptr; }
+
+		/// <summary>
+		/// Gets the number of entries in <see cref="palette"/>.
+		/// </summary>
+		TW_UINT32 palette_size() const{ return palette_size_; }
+
+		/// <summary>
+		/// Gets the channel masks of 16 and 32 bit data, either from BI_BITFIELDS or the defaults.
+		/// They are 0 for other bit depths.
+		/// </summary>
+		TW_UINT32 red_mask() const{ return masks_[0]; }
+		TW_UINT32 green_mask() const{ return masks_[1]; }
+		TW_UINT32 blue_mask() const{ return masks_[2]; }
+
+		/// <summary>
+		/// Gets the resolution in pixels per meter as stored, 0 if not given.
+		/// </summary>
+		TW_INT32 x_pels_per_meter() const{ return x_pels_per_meter_; }
+		TW_INT32 y_pels_per_meter() const{ return y_pels_per_meter_; }
+
+		/// <summary>
+		/// Gets the pixel data in storage order.
+		/// </summary>
+		const TW_UINT8* bits() const{ return bits_; }
+
+		/// <summary>
+		/// Gets the size of <see cref="bits"/> in bytes.
+		/// </summary>
+		size_t image_size() const{ return static_cast<size_t>(stride_) * height_; }
+
+		/// <summary>
+		/// Gets the bytes from the start of the DIB to <see cref="bits"/>.
+		/// </summary>
+		size_t bits_offset() const{ return static_cast<size_t>(bits_ - header_); }
+
+		/// <summary>
+		/// Gets a row counting from the top of the image.
+		/// </summary>
+		/// <param name="y">The row, less than <see cref="height"/>.</param>
+		const TW_UINT8* row(TW_UINT32 y) const{
+			return bits_ + static_cast<size_t>(bottom_up_ ? height_ - 1 - y : y) * stride_;
+		}
+
+		/// <summary>
+		/// Gets the top row.
+		/// </summary>
+		RowIterator begin() const{ return RowIterator{ this, 0 }; }
+
+		/// <summary>
+		/// Gets the end of the rows.
+		/// </summary>
+		RowIterator end() const{ return RowIterator{ this, height_ }; }
+
+	private:
+		const TW_UINT8* header_ = nullptr;
+		const TW_UINT8* palette_ = nullptr;
+		const TW_UINT8* bits_ = nullptr;
+		TW_UINT32 width_ = 0;
+		TW_UINT32 height_ = 0;
+		TW_UINT16 bit_depth_ = 0;
+		TW_UINT32 compression_ = 0;
+		TW_UINT32 stride_ = 0;
+		bool bottom_up_ = false;
+		TW_UINT32 palette_size_ = 0;
+		TW_UINT32 masks_[3];
+		TW_INT32 x_pels_per_meter_ = 0;
+		TW_INT32 y_pels_per_meter_ = 0;
+	};
+}
+
+#endif //DIB_VIEW_H_
@@ -0,0 +1,561 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <thread>
+#include <vector>
+#include "build_macros.h"
+#include "driver_host.h"
+#include "dib_view.h"
+#include "logger.h"
+#include "page_stream.h"
+#include "twain_session.h"
+
+#ifndef TWH_CMP_MSC
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace ctwain{
+
+	namespace{
+		const char kWorkerSwitch[] = "--ctwain-host";
+		// commands carry no data
+		const size_t kCommandBytes = PageRing::kAlignment;
+		const TW_UINT32 kCommandSlots = 8;
+		// how often waits look at the other side and the other ring
+		const unsigned kPollMilliseconds = 100;
+
+		std::atomic<unsigned> ring_count{ 0 };
+
+		long CurrentProcessId(){
+#ifdef TWH_CMP_MSC
+			return static_cast<long>(GetCurrentProcessId());
+#else
+			return static_cast<long>(getpid());
+#endif
+		}
+
+		bool ProcessRunning(long process_id){
+#ifdef TWH_CMP_MSC
+			auto process = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(process_id));
+			if (!process){
+				return false;
+			}
+			bool running = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+			CloseHandle(process);
+			return running;
+#else
+			// orphans get a new parent
+			return getppid() == static_cast<pid_t>(process_id);
+#endif
+		}
+
+		bool Post(PageRing& ring, HostMessage message, TW_UINT16 result, TW_UINT32 argument, unsigned milliseconds){
+			if (!ring.Reserve(0, milliseconds)){
+				return false;
+			}
+			PageDescriptor descriptor{};
+			descriptor.Message = message;
+			descriptor.Result = result;
+			descriptor.Argument = argument;
+			return ring.Publish(descriptor, 0);
+		}
+
+		/// <summary>
+		/// Beats the page ring's heartbeat from a thread of its own while the worker runs, so
+		/// the host doesn't take a slow driver call or a driver UI for a hung worker.
+		/// </summary>
+		class Heartbeat
+		{
+		public:
+			explicit Heartbeat(PageRing& ring) : thread_{ [this, &ring]{ Run(ring); } }{}
+
+			~Heartbeat(){
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					stop_ = true;
+				}
+				stop_changed_.notify_all();
+				thread_.join();
+			}
+
+			Heartbeat(const Heartbeat&) = delete;
+			Heartbeat& operator=(const Heartbeat&) = delete;
+
+		private:
+			std::mutex mutex_;
+			std::condition_variable stop_changed_;
+			bool stop_ = false;
+			std::thread thread_;
+
+			void Run(PageRing& ring){
+				std::unique_lock<std::mutex> lock(mutex_);
+				while (!stop_){
+					ring.Beat();
+					stop_changed_.wait_for(lock, std::chrono::milliseconds(kPollMilliseconds));
+				}
+			}
+		};
+
+		/// <summary>
+		/// The worker side, which opens the source and acquires whenever the host says.
+		/// </summary>
+		class Worker
+		{
+		public:
+			Worker(PageRing& pages, PageRing& commands, long host_process_id) :
+				pages_(pages), commands_(commands), host_process_id_{ host_process_id }{}
+
+			TW_UINT16 Open(const std::string& source_name){
+				if (!session_.Initialize() || session_.OpenDsm() != TWRC_SUCCESS){
+					return TWRC_FAILURE;
+				}
+				auto sources = session_.GetSources();
+				auto hit = std::find_if(sources.begin(), sources.end(),
+					[&source_name](const TW_IDENTITY& test){ return source_name == test.ProductName; });
+				if (hit == sources.end()){
+					CTWAIN_LOG_ERROR("The hosted source %s was not found.", source_name.c_str());
+					return TWRC_FAILURE;
+				}
+				return session_.OpenSource(*hit);
+			}
+
+			void Close(){
+				session_.CloseSource();
+				session_.CloseDsm();
+			}
+
+			bool Reply(HostMessage message, TW_UINT16 result){
+				// the host may be holding every page so wait for it as long as it's there
+				while (!Post(pages_, message, result, 0, kPollMilliseconds)){
+					if (pages_.closed() || !ProcessRunning(host_process_id_)){
+						return false;
+					}
+				}
+				return true;
+			}
+
+			void Run(){
+				while (!quit_){
+					PageDescriptor command;
+					if (!commands_.Next(command, kPollMilliseconds)){
+						if (commands_.closed() || !ProcessRunning(host_process_id_)){
+							break;
+						}
+						continue;
+					}
+					commands_.Release(command);
+					switch (command.Message){
+					case HostMessage::kAcquire:
+						Acquire(static_cast<TW_UINT16>(command.Argument));
+						break;
+					case HostMessage::kQuit:
+						quit_ = true;
+						break;
+					default:
+						// a cancel that came after the acquisition ended
+						break;
+					}
+				}
+			}
+
+		private:
+			TwainSession session_;
+			PageRing& pages_;
+			PageRing& commands_;
+			long host_process_id_;
+			bool quit_ = false;
+
+			void Acquire(TW_UINT16 transfer_mechanism){
+				TW_UINT32 value = transfer_mechanism;
+				session_.CapSet(ICAP_XFERMECH, SetType::Current, value);
+				// the ring does the queuing
+				AcquireOptions options;
+				options.MaxQueuedPages = 1;
+				auto stream = session_.AcquireAsync(options);
+				TW_UINT16 result = stream ? TWRC_SUCCESS : TWRC_FAILURE;
+				while (stream){
+					auto next = stream->Next();
+					while (next.wait_for(std::chrono::milliseconds(kPollMilliseconds)) == std::future_status::timeout){
+						Poll(*stream);
+					}
+					auto page = next.get();
+					if (!page){
+						break;
+					}
+					if (Poll(*stream) && !Send(*page, *stream)){
+						result = TWRC_FAILURE;
+						stream->Cancel();
+					}
+				}
+				Reply(HostMessage::kBatchEnded, result);
+			}
+
+			// takes the commands that matter during an acquisition
+			bool Poll(PageStream& stream){
+				PageDescriptor command;
+				while (commands_.Next(command, 0)){
+					commands_.Release(command);
+					if (command.Message == HostMessage::kQuit){
+						quit_ = true;
+					}
+					if (command.Message == HostMessage::kCancel || command.Message == HostMessage::kQuit){
+						stream.Cancel();
+					}
+				}
+				if (!quit_ && (pages_.closed() || !ProcessRunning(host_process_id_))){
+					quit_ = true;
+					stream.Cancel();
+				}
+				return !stream.canceled();
+			}
+
+			bool Send(const TransferredPage& page, PageStream& stream){
+				PageDescriptor descriptor{};
+				descriptor.Sequence = page.sequence();
+				if (page.image_info()){
+					descriptor.HasImageInfo = TRUE;
+					descriptor.ImageInfo = *page.image_info();
+				}
+				const void* data;
+				size_t size;
+				if (page.native_data()){
+					DibView dib(page.native_data());
+					if (!dib.valid()){
+						CTWAIN_LOG_ERROR("Hosted native page %lu is not a DIB.", static_cast<unsigned long>(page.sequence()));
+						return false;
+					}
+					descriptor.Message = HostMessage::kNativePage;
+					data = page.native_data();
+					size = dib.bits_offset() + dib.image_size();
+				}
+				else if (page.memory_size() > 0){
+					descriptor.Message = HostMessage::kMemoryPage;
+					descriptor.BytesPerRow = page.bytes_per_row();
+					descriptor.Compression = page.compression();
+					descriptor.ImageFileFormat = page.image_file_format();
+					data = page.memory_data();
+					size = page.memory_size();
+				}
+				else if (!page.file_path().empty()){
+					descriptor.Message = HostMessage::kFilePage;
+					descriptor.ImageFileFormat = page.image_file_format();
+					data = page.file_path().c_str();
+					size = page.file_path().size() + 1;
+				}
+				else{
+					return true;
+				}
+				if (size > pages_.arena_size()){
+					CTWAIN_LOG_ERROR("Hosted page %lu needs %llu bytes but the ring has %llu.", static_cast<unsigned long>(page.sequence()),
+						static_cast<unsigned long long>(size), static_cast<unsigned long long>(pages_.arena_size()));
+					return false;
+				}
+
+				TW_UINT8* target;
+				while ((target = pages_.Reserve(size, kPollMilliseconds)) == nullptr){
+					if (!Poll(stream)){
+						return false;
+					}
+				}
+				// the worker's one copy, from its transferred page into the ring the host reads in place
+				memcpy(target, data, size);
+				return pages_.Publish(descriptor, size);
+			}
+		};
+	}
+
+	HostedPage::HostedPage(std::shared_ptr<PageRing> ring, const PageDescriptor& descriptor) :
+		ring_(std::move(ring)), descriptor_(descriptor)
+	{
+		data_ = ring_->data(descriptor_);
+		if (descriptor_.Message == HostMessage::kFilePage && descriptor_.Size > 0){
+			file_path_.assign(reinterpret_cast<const char*>(data_), static_cast<size_t>(descriptor_.Size) - 1);
+		}
+	}
+
+	HostedPage::~HostedPage(){
+		ring_->Release(descriptor_);
+	}
+
+	TW_UINT16 DriverHost::Start(const std::string& source_name, const HostOptions& options){
+		if (started()){
+			return TWRC_FAILURE;
+		}
+		options_ = options;
+		worker_failed_ = false;
+		acquiring_ = false;
+
+		auto name = "ctwain-" + std::to_string(CurrentProcessId()) + "-" + std::to_string(ring_count++);
+		pages_ = std::make_shared<PageRing>();
+		if (!pages_->Create(name + "-pages", options_.RingBytes, options_.RingSlots) ||
+			!commands_.Create(name + "-commands", kCommandBytes, kCommandSlots) ||
+			!Launch(name, source_name)){
+			Stop();
+			return TWRC_FAILURE;
+		}
+
+		PageDescriptor reply;
+		if (!Receive(reply)){
+			Stop();
+			return TWRC_FAILURE;
+		}
+		pages_->Release(reply);
+		if (reply.Message != HostMessage::kWorkerStarted || reply.Result != TWRC_SUCCESS){
+			CTWAIN_LOG_ERROR("The driver host worker couldn't open %s.", source_name.c_str());
+			Stop();
+			return TWRC_FAILURE;
+		}
+		return TWRC_SUCCESS;
+	}
+
+	TW_UINT16 DriverHost::Acquire(TW_UINT16 transfer_mechanism){
+		if (!started() || acquiring_ || !Send(HostMessage::kAcquire, transfer_mechanism)){
+			return TWRC_FAILURE;
+		}
+		acquiring_ = true;
+		batch_result_ = TWRC_SUCCESS;
+		return TWRC_SUCCESS;
+	}
+
+	std::unique_ptr<HostedPage> DriverHost::Next(){
+		if (!acquiring_){
+			return nullptr;
+		}
+		PageDescriptor descriptor;
+		while (Receive(descriptor)){
+			switch (descriptor.Message){
+			case HostMessage::kNativePage:
+			case HostMessage::kMemoryPage:
+			case HostMessage::kFilePage:
+				return std::unique_ptr<HostedPage>(new HostedPage(pages_, descriptor));
+			case HostMessage::kBatchEnded:
+				pages_->Release(descriptor);
+				batch_result_ = descriptor.Result;
+				acquiring_ = false;
+				return nullptr;
+			default:
+				pages_->Release(descriptor);
+				break;
+			}
+		}
+		batch_result_ = TWRC_FAILURE;
+		acquiring_ = false;
+		return nullptr;
+	}
+
+	void DriverHost::Cancel(){
+		Send(HostMessage::kCancel, 0);
+	}
+
+	void DriverHost::Stop(){
+		if (!started()){
+			return;
+		}
+		if (WorkerRunning() && (!Send(HostMessage::kQuit, 0) || !WaitForWorker(options_.TimeoutMilliseconds))){
+			CTWAIN_LOG_WARNING("The driver host worker didn't exit in time.");
+		}
+		EndWorker();
+		{
+			std::lock_guard<std::mutex> lock(commands_mutex_);
+			commands_.Close();
+		}
+		// pages still out keep the ring mapped
+		pages_.reset();
+		acquiring_ = false;
+	}
+
+	bool DriverHost::Send(HostMessage message, TW_UINT32 argument){
+		std::lock_guard<std::mutex> lock(commands_mutex_);
+		return Post(commands_, message, TWRC_SUCCESS, argument, options_.TimeoutMilliseconds);
+	}
+
+	bool DriverHost::Receive(PageDescriptor& descriptor){
+		// pages may take as long as the driver needs, only a silent heartbeat means the worker hung
+		auto heartbeat = pages_->heartbeat();
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options_.TimeoutMilliseconds);
+		for (;;){
+			if (pages_->Next(descriptor, kPollMilliseconds)){
+				return true;
+			}
+			if (!WorkerRunning()){
+				CTWAIN_LOG_ERROR("The driver host worker exited.");
+				break;
+			}
+			auto now = std::chrono::steady_clock::now();
+			if (pages_->heartbeat() != heartbeat){
+				heartbeat = pages_->heartbeat();
+				deadline = now + std::chrono::milliseconds(options_.TimeoutMilliseconds);
+			}
+			else if (now >= deadline){
+				CTWAIN_LOG_ERROR("The driver host worker stopped responding.");
+				break;
+			}
+		}
+		worker_failed_ = true;
+		EndWorker();
+		return false;
+	}
+
+	bool DriverHost::Launch(const std::string& ring_name, const std::string& source_name){
+		auto path = options_.WorkerPath;
+		std::vector<std::string> arguments{ kWorkerSwitch, ring_name, std::to_string(options_.RingBytes),
+			std::to_string(options_.RingSlots), std::to_string(CurrentProcessId()), source_name };
+#ifdef TWH_CMP_MSC
+		if (path.empty()){
+			char module[MAX_PATH];
+			auto length = GetModuleFileNameA(nullptr, module, MAX_PATH);
+			if (length == 0 || length == MAX_PATH){
+				return false;
+			}
+			path.assign(module, length);
+		}
+		auto commandLine = "\"" + path + "\"";
+		for (auto& argument : arguments){
+			commandLine += " \"" + argument + "\"";
+		}
+		STARTUPINFOA startup{ 0 };
+		startup.cb = sizeof(startup);
+		PROCESS_INFORMATION info{ 0 };
+		if (!CreateProcessA(path.c_str(), &commandLine[0], nullptr, nullptr, FALSE, 0, nullptr, nullptr, &startup, &info)){
+			CTWAIN_LOG_ERROR("Failed to start the driver host worker %s (error %lu).", path.c_str(), GetLastError());
+			return false;
+		}
+		CloseHandle(info.hThread);
+		process_ = info.hProcess;
+#else
+		if (path.empty()){
+			char module[4096];
+			auto length = readlink("/proc/self/exe", module, sizeof(module));
+			if (length <= 0 || static_cast<size_t>(length) == sizeof(module)){
+				return false;
+			}
+			path.assign(module, static_cast<size_t>(length));
+		}
+		std::vector<char*> argv{ &path[0] };
+		for (auto& argument : arguments){
+			argv.push_back(&argument[0]);
+		}
+		argv.push_back(nullptr);
+		pid_t process_id;
+		auto error = posix_spawn(&process_id, path.c_str(), nullptr, nullptr, argv.data(), environ);
+		if (error != 0){
+			CTWAIN_LOG_ERROR("Failed to start the driver host worker %s (error %d).", path.c_str(), error);
+			return false;
+		}
+		process_id_ = process_id;
+#endif
+		return true;
+	}
+
+	bool DriverHost::WorkerRunning(){
+#ifdef TWH_CMP_MSC
+		return process_ && WaitForSingleObject(process_, 0) == WAIT_TIMEOUT;
+#else
+		if (process_id_ == 0){
+			return false;
+		}
+		int status;
+		if (waitpid(static_cast<pid_t>(process_id_), &status, WNOHANG) == 0){
+			return true;
+		}
+		process_id_ = 0;
+		return false;
+#endif
+	}
+
+	bool DriverHost::WaitForWorker(unsigned milliseconds){
+#ifdef TWH_CMP_MSC
+		return !process_ || WaitForSingleObject(process_, milliseconds) == WAIT_OBJECT_0;
+#else
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+		while (WorkerRunning()){
+			if (std::chrono::steady_clock::now() >= deadline){
+				return false;
+			}
+			usleep(10000);
+		}
+		return true;
+#endif
+	}
+
+	void DriverHost::EndWorker(){
+#ifdef TWH_CMP_MSC
+		if (process_){
+			if (WaitForSingleObject(process_, 0) == WAIT_TIMEOUT){
+				TerminateProcess(process_, 1);
+				WaitForSingleObject(process_, INFINITE);
+			}
+			CloseHandle(process_);
+			process_ = nullptr;
+		}
+#else
+		if (WorkerRunning()){
+			kill(static_cast<pid_t>(process_id_), SIGKILL);
+			int status;
+			waitpid(static_cast<pid_t>(process_id_), &status, 0);
+			process_id_ = 0;
+		}
+#endif
+	}
+
+	bool DriverHost::IsWorker(int argc, char* argv[]){
+		return argc == 7 && strcmp(argv[1], kWorkerSwitch) == 0;
+	}
+
+	int DriverHost::RunWorker(int argc, char* argv[]){
+		if (!IsWorker(argc, argv)){
+			return -1;
+		}
+		std::string name = argv[2];
+		auto ringBytes = static_cast<size_t>(strtoull(argv[3], nullptr, 10));
+		auto ringSlots = static_cast<TW_UINT32>(strtoul(argv[4], nullptr, 10));
+		auto hostProcessId = strtol(argv[5], nullptr, 10);
+
+		PageRing pages;
+		PageRing commands;
+		if (!pages.Open(name + "-pages", ringBytes, ringSlots) || !commands.Open(name + "-commands", kCommandBytes, kCommandSlots)){
+			return 1;
+		}
+		Heartbeat heartbeat(pages);
+		Worker worker(pages, commands, hostProcessId);
+		auto result = worker.Open(argv[6]);
+		if (worker.Reply(HostMessage::kWorkerStarted, result) && result == TWRC_SUCCESS){
+			worker.Run();
+		}
+		worker.Close();
+		return result == TWRC_SUCCESS ? 0 : 1;
+	}
+}
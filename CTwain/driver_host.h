@@ -0,0 +1,251 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef DRIVER_HOST_H_
+#define DRIVER_HOST_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include "page_ring.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// Settings for <see cref="DriverHost::Start"/>.
+	/// </summary>
+	struct HostOptions{
+		/// <summary>
+		/// The program to run as the worker, which has to hand its command line to
+		/// <see cref="DriverHost::RunWorker"/> first thing. Empty for the current program.
+		/// </summary>
+		std::string WorkerPath;
+
+		/// <summary>
+		/// The bytes of page data that can be in flight, which must fit the largest page.
+		/// </summary>
+		size_t RingBytes = 64 * 1024 * 1024;
+
+		/// <summary>
+		/// The pages that can be in flight.
+		/// </summary>
+		TW_UINT32 RingSlots = 16;
+
+		/// <summary>
+		/// How long the worker's heartbeat may stay silent before it's taken as hung and ended.
+		/// The worker beats from a thread of its own, so slow pages and driver UI don't count
+		/// against this; <see cref="DriverHost::Stop"/> also waits this long for it to exit.
+		/// </summary>
+		unsigned TimeoutMilliseconds = 60000;
+	};
+
+	/// <summary>
+	/// A page from a <see cref="DriverHost"/> worker. The data is read straight from the shared
+	/// ring and its space is given back to the worker when the page is destroyed, so keep pages
+	/// only as long as needed. The page may outlive the host and be destroyed on any thread.
+	/// </summary>
+	class HostedPage
+	{
+	public:
+		/// <summary>
+		/// Gives the page's space in the ring back.
+		/// </summary>
+		~HostedPage();
+
+		HostedPage(const HostedPage&) = delete;
+		HostedPage& operator=(const HostedPage&) = delete;
+
+		/// <summary>
+		/// Gets the page number within the worker's session, starting from 0.
+		/// </summary>
+		TW_UINT32 sequence() const{ return descriptor_.Sequence; }
+
+		/// <summary>
+		/// Gets the final image information or nullptr if not applicable.
+		/// </summary>
+		const TW_IMAGEINFO* image_info() const{ return descriptor_.HasImageInfo ? &descriptor_.ImageInfo : nullptr; }
+
+		/// <summary>
+		/// Gets the DIB if the transfer was native, see <see cref="DibView"/>.
+		/// </summary>
+		const TW_UINT8* native_data() const{ return descriptor_.Message == HostMessage::kNativePage ? data_ : nullptr; }
+
+		/// <summary>
+		/// Gets the size of <see cref="native_data"/>.
+		/// </summary>
+		size_t native_size() const{ return native_data() ? size() : 0; }
+
+		/// <summary>
+		/// Gets the assembled data if the transfer was buffered memory, as in <see cref="TransferredPage::memory_data"/>.
+		/// </summary>
+		const TW_UINT8* memory_data() const{ return descriptor_.Message == HostMessage::kMemoryPage ? data_ : nullptr; }
+
+		/// <summary>
+		/// Gets the size of <see cref="memory_data"/>.
+		/// </summary>
+		size_t memory_size() const{ return memory_data() ? size() : 0; }
+
+		/// <summary>
+		/// Gets the row stride of <see cref="memory_data"/> for uncompressed data.
+		/// </summary>
+		TW_UINT32 bytes_per_row() const{ return descriptor_.BytesPerRow; }
+
+		/// <summary>
+		/// Gets the compression of <see cref="memory_data"/> (TWCP_* value).
+		/// </summary>
+		TW_UINT16 compression() const{ return descriptor_.Compression; }
+
+		/// <summary>
+		/// Gets the file path if transfer is for file.
+		/// </summary>
+		const std::string& file_path() const{ return file_path_; }
+
+		/// <summary>
+		/// Gets the image file format if transfer is for file or memory file.
+		/// </summary>
+		TW_UINT16 image_file_format() const{ return descriptor_.ImageFileFormat; }
+
+	private:
+		friend class DriverHost;
+
+		HostedPage(std::shared_ptr<PageRing> ring, const PageDescriptor& descriptor);
+
+		size_t size() const{ return static_cast<size_t>(descriptor_.Size); }
+
+		std::shared_ptr<PageRing> ring_;
+		PageDescriptor descriptor_;
+		const TW_UINT8* data_;
+		std::string file_path_;
+	};
+
+	/// <summary>
+	/// Runs one source in a worker process so a misbehaving driver can only take the worker down.
+	/// The worker drives a <see cref="TwainSession"/> with <see cref="TwainSession::AcquireAsync"/> and copies
+	/// each page once, from the page it transferred into a <see cref="PageRing"/> shared with this process,
+	/// which reads it in place. A worker that exits or whose heartbeat stops for
+	/// <see cref="HostOptions::TimeoutMilliseconds"/> is ended and reported through <see cref="worker_failed"/>.
+	/// Use one host per source.
+	/// This class is not thread-safe, except for <see cref="Cancel"/>.
+	/// </summary>
+	class DriverHost
+	{
+	public:
+		DriverHost(){}
+
+		/// <summary>
+		/// Stops the worker if started.
+		/// </summary>
+		~DriverHost(){ Stop(); }
+
+		DriverHost(const DriverHost&) = delete;
+		DriverHost& operator=(const DriverHost&) = delete;
+
+		/// <summary>
+		/// Starts a worker process and has it open a source.
+		/// </summary>
+		/// <param name="source_name">The product name of the source.</param>
+		/// <param name="options">The settings.</param>
+		/// <returns>TWRC_SUCCESS once the source is open, TWRC_FAILURE if the worker couldn't be
+		/// started or the source opened, in which case the worker is gone again.</returns>
+		TW_UINT16 Start(const std::string& source_name, const HostOptions& options = HostOptions());
+
+		/// <summary>
+		/// Has the worker acquire with the source UI hidden. Take the pages with <see cref="Next"/>.
+		/// </summary>
+		/// <param name="transfer_mechanism">The ICAP_XFERMECH to use.</param>
+		/// <returns>TWRC_FAILURE if no worker is running or it is acquiring already.</returns>
+		TW_UINT16 Acquire(TW_UINT16 transfer_mechanism);
+
+		/// <summary>
+		/// Waits for the next page of the acquisition. Holding on to as many pages as the ring
+		/// takes stalls the worker until one is destroyed.
+		/// </summary>
+		/// <returns>The page, or nullptr once the acquisition ended, see <see cref="batch_result"/>,
+		/// or the worker failed.</returns>
+		std::unique_ptr<HostedPage> Next();
+
+		/// <summary>
+		/// Asks the worker to cancel the acquisition. <see cref="Next"/> still has to be called until
+		/// it gives nullptr. Safe to call from any thread.
+		/// </summary>
+		void Cancel();
+
+		/// <summary>
+		/// Asks the worker to close the source and exit, and ends it if it doesn't in time.
+		/// Pages still around stay valid.
+		/// </summary>
+		void Stop();
+
+		/// <summary>
+		/// Gets a value indicating whether a worker is running.
+		/// </summary>
+		bool started() const{ return pages_ != nullptr; }
+
+		/// <summary>
+		/// Gets a value indicating whether the last worker exited or hung and was ended.
+		/// </summary>
+		bool worker_failed() const{ return worker_failed_; }
+
+		/// <summary>
+		/// Gets the TWRC_* result of the last acquisition, TWRC_FAILURE if the source couldn't be
+		/// enabled, a page couldn't be passed on, or the worker failed.
+		/// </summary>
+		TW_UINT16 batch_result() const{ return batch_result_; }
+
+		/// <summary>
+		/// Gets a value indicating whether a command line is one a host started a worker with.
+		/// </summary>
+		static bool IsWorker(int argc, char* argv[]);
+
+		/// <summary>
+		/// Runs as a worker if the command line is one a host started it with, returning once the host
+		/// stops it or goes away. Call this first thing in main, before creating any session, and return
+		/// its exit code if it's not -1. Set the DSM with <see cref="EntryPoints::set_dsm_path"/> before if needed.
+		/// </summary>
+		/// <returns>The exit code, or -1 if this is not a worker.</returns>
+		static int RunWorker(int argc, char* argv[]);
+
+	private:
+		HostOptions options_;
+		std::shared_ptr<PageRing> pages_;
+		PageRing commands_;
+		std::mutex commands_mutex_;
+		bool acquiring_ = false;
+		bool worker_failed_ = false;
+		TW_UINT16 batch_result_ = TWRC_SUCCESS;
+#ifdef TWH_CMP_MSC
+		HANDLE process_ = nullptr;
+#else
+		long process_id_ = 0;
+#endif
+
+		bool Launch(const std::string& ring_name, const std::string& source_name);
+		bool WorkerRunning();
+		bool WaitForWorker(unsigned milliseconds);
+		void EndWorker();
+		bool Send(HostMessage message, TW_UINT32 argument);
+		bool Receive(PageDescriptor& descriptor);
+	};
+}
+
+#endif //DRIVER_HOST_H_
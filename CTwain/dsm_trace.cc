@@ -0,0 +1,383 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#include "stdafx.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include "build_macros.h"
+#include "dsm_trace.h"
+
+#ifndef TWH_CMP_MSC
+#include <time.h>
+#endif
+
+namespace ctwain{
+
+	namespace{
+		const unsigned long long kMaxDuration = (1ull << 48) - 1;
+
+		double ReadNsPerTick(){
+#ifdef TWH_CMP_MSC
+			LARGE_INTEGER frequency;
+			QueryPerformanceFrequency(&frequency);
+			return 1e9 / static_cast<double>(frequency.QuadPart);
+#else
+			return 1;
+#endif
+		}
+		// not a function static, those aren't thread-safe on VS2013
+		const double kNsPerTick = ReadNsPerTick();
+
+		unsigned long long ToNanoseconds(unsigned long long ticks){
+			return static_cast<unsigned long long>(ticks * kNsPerTick);
+		}
+
+		unsigned long long PackTriple(TW_UINT32 dg, TW_UINT16 dat, TW_UINT16 msg){
+			return static_cast<unsigned long long>(dg) << 32 | static_cast<unsigned long long>(dat) << 16 | msg;
+		}
+
+		// floor(log2(ns)) clamped to the histogram
+		unsigned BucketOf(unsigned long long ns){
+			unsigned bucket = 0;
+			if (ns >> 32){ ns >>= 32; bucket += 32; }
+			if (ns >> 16){ ns >>= 16; bucket += 16; }
+			if (ns >> 8){ ns >>= 8; bucket += 8; }
+			if (ns >> 4){ ns >>= 4; bucket += 4; }
+			if (ns >> 2){ ns >>= 2; bucket += 2; }
+			if (ns >> 1){ bucket += 1; }
+			return std::min(bucket, DsmCallStats::kBuckets - 1);
+		}
+
+		struct TripleSlot{
+			std::atomic<unsigned long long> Key; // packed triple + 1, 0 when unused
+			std::atomic<unsigned long long> Calls;
+			std::atomic<unsigned long long> Failures;
+			std::atomic<unsigned long long> TotalNs;
+			std::atomic<unsigned long long> MaxNs;
+			std::atomic<unsigned long long> Buckets[DsmCallStats::kBuckets];
+		};
+
+		// everything one thread has traced. Only the owner writes so updates are plain
+		// loads and stores, readers just see them a little late. The owner bumps Claim
+		// before overwriting a ring entry so readers can tell which entries changed under them.
+		// No constructor so new ThreadTrace() zeroes it all.
+		struct ThreadTrace{
+			struct Entry{
+				std::atomic<unsigned long long> Timestamp;
+				std::atomic<unsigned long long> Triple;
+				std::atomic<unsigned long long> Result; // duration << 16 | return code
+			};
+
+			Entry Entries[DsmTrace::kRingRecords];
+			std::atomic<unsigned long long> Head;
+			std::atomic<unsigned long long> Claim;
+			std::atomic<unsigned long long> Floor;
+
+			TripleSlot Triples[DsmTrace::kMaxTriples];
+			std::atomic<unsigned long long> Dropped;
+			// set by Reset, the owner zeroes its histograms on its next call
+			std::atomic<bool> ResetPending;
+			unsigned Index;
+			// under threads_mutex: the owner has ended, then Reset has cleared it for another thread
+			bool Detached;
+			bool Free;
+		};
+
+		void Bump(std::atomic<unsigned long long>& counter, unsigned long long amount){
+			counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+		}
+
+		std::mutex threads_mutex;
+		std::vector<std::unique_ptr<ThreadTrace>> threads;
+		CTWAIN_THREAD_LOCAL ThreadTrace* current_thread = nullptr;
+
+		ThreadTrace* AttachThread(){
+			{
+				std::lock_guard<std::mutex> lock(threads_mutex);
+				auto free = std::find_if(threads.begin(), threads.end(),
+					[](const std::unique_ptr<ThreadTrace>& test){ return test->Free; });
+				if (free != threads.end()){
+					(*free)->Free = false;
+					current_thread = free->get();
+					return current_thread;
+				}
+			}
+			std::unique_ptr<ThreadTrace> trace{ new ThreadTrace() };
+			std::lock_guard<std::mutex> lock(threads_mutex);
+			trace->Index = static_cast<unsigned>(threads.size());
+			threads.push_back(std::move(trace));
+			current_thread = threads.back().get();
+			return current_thread;
+		}
+
+		TripleSlot* FindSlot(ThreadTrace& trace, unsigned long long key){
+			auto index = static_cast<unsigned>((key * 0x9E3779B97F4A7C15ull) >> 32);
+			for (unsigned probe = 0; probe < DsmTrace::kMaxTriples; probe++){
+				auto& slot = trace.Triples[(index + probe) & (DsmTrace::kMaxTriples - 1)];
+				auto current = slot.Key.load(std::memory_order_relaxed);
+				if (current == key){
+					return &slot;
+				}
+				if (current == 0){
+					slot.Key.store(key, std::memory_order_release);
+					return &slot;
+				}
+			}
+			return nullptr;
+		}
+
+		void ClearHistograms(ThreadTrace& trace){
+			for (auto& slot : trace.Triples){
+				slot.Calls.store(0, std::memory_order_relaxed);
+				slot.Failures.store(0, std::memory_order_relaxed);
+				slot.TotalNs.store(0, std::memory_order_relaxed);
+				slot.MaxNs.store(0, std::memory_order_relaxed);
+				for (auto& bucket : slot.Buckets){
+					bucket.store(0, std::memory_order_relaxed);
+				}
+			}
+			trace.Dropped.store(0, std::memory_order_relaxed);
+		}
+
+		// only for traces nobody owns, so nothing writes to them meanwhile
+		void ClearTrace(ThreadTrace& trace){
+			ClearHistograms(trace);
+			for (auto& slot : trace.Triples){
+				slot.Key.store(0, std::memory_order_relaxed);
+			}
+			trace.Head.store(0, std::memory_order_relaxed);
+			trace.Claim.store(0, std::memory_order_relaxed);
+			trace.Floor.store(0, std::memory_order_relaxed);
+			trace.ResetPending.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	std::atomic<bool> DsmTrace::enabled_{ false };
+
+	void DsmTrace::set_enabled(bool enabled){
+		enabled_.store(enabled, std::memory_order_relaxed);
+	}
+
+	unsigned long long DsmTrace::dropped(){
+		unsigned long long dropped = 0;
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		for (auto& trace : threads){
+			if (!trace->ResetPending.load(std::memory_order_acquire)){
+				dropped += trace->Dropped.load(std::memory_order_relaxed);
+			}
+		}
+		return dropped;
+	}
+
+	unsigned long long DsmTrace::Now(){
+#ifdef TWH_CMP_MSC
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		return static_cast<unsigned long long>(now.QuadPart);
+#else
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return static_cast<unsigned long long>(now.tv_sec) * 1000000000ull + now.tv_nsec;
+#endif
+	}
+
+	void DsmTrace::Record(TW_UINT32 dg, TW_UINT16 dat, TW_UINT16 msg, TW_UINT16 rc, unsigned long long start){
+		auto ns = std::min(ToNanoseconds(Now() - start), kMaxDuration);
+		auto triple = PackTriple(dg, dat, msg);
+
+		auto& trace = current_thread ? *current_thread : *AttachThread();
+		if (trace.ResetPending.load(std::memory_order_relaxed)){
+			ClearHistograms(trace);
+			trace.ResetPending.store(false, std::memory_order_release);
+		}
+
+		auto slot = FindSlot(trace, triple + 1);
+		if (slot){
+			Bump(slot->Calls, 1);
+			if (rc == TWRC_FAILURE){
+				Bump(slot->Failures, 1);
+			}
+			Bump(slot->TotalNs, ns);
+			Bump(slot->Buckets[BucketOf(ns)], 1);
+			if (ns > slot->MaxNs.load(std::memory_order_relaxed)){
+				slot->MaxNs.store(ns, std::memory_order_relaxed);
+			}
+		}
+		else{
+			Bump(trace.Dropped, 1);
+		}
+
+		auto head = trace.Head.load(std::memory_order_relaxed);
+		trace.Claim.store(head + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		auto& entry = trace.Entries[head & (kRingRecords - 1)];
+		entry.Timestamp.store(ToNanoseconds(start), std::memory_order_relaxed);
+		entry.Triple.store(triple, std::memory_order_relaxed);
+		entry.Result.store(ns << 16 | rc, std::memory_order_relaxed);
+		trace.Head.store(head + 1, std::memory_order_release);
+	}
+
+	std::vector<DsmCallRecord> DsmTrace::Records(){
+		std::vector<DsmCallRecord> records;
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		for (auto& trace : threads){
+			auto head = trace->Head.load(std::memory_order_acquire);
+			auto first = std::max(trace->Floor.load(std::memory_order_relaxed), head > kRingRecords ? head - kRingRecords : 0);
+			auto copied = records.size();
+
+			for (auto i = first; i < head; i++){
+				auto& entry = trace->Entries[i & (kRingRecords - 1)];
+				auto triple = entry.Triple.load(std::memory_order_relaxed);
+				auto result = entry.Result.load(std::memory_order_relaxed);
+
+				DsmCallRecord record;
+				record.TimestampNs = entry.Timestamp.load(std::memory_order_relaxed);
+				record.DurationNs = result >> 16;
+				record.DataGroup = static_cast<TW_UINT32>(triple >> 32);
+				record.DataArgumentType = static_cast<TW_UINT16>(triple >> 16);
+				record.Message = static_cast<TW_UINT16>(triple);
+				record.ReturnCode = static_cast<TW_UINT16>(result);
+				record.ThreadIndex = trace->Index;
+				records.push_back(record);
+			}
+
+			// drop whatever the owner started overwriting while it was copied
+			std::atomic_thread_fence(std::memory_order_acquire);
+			auto claim = trace->Claim.load(std::memory_order_relaxed);
+			if (claim > kRingRecords && claim - kRingRecords > first){
+				auto stale = std::min(claim - kRingRecords - first, head - first);
+				records.erase(records.begin() + copied, records.begin() + copied + static_cast<size_t>(stale));
+			}
+		}
+
+		std::sort(records.begin(), records.end(),
+			[](const DsmCallRecord& a, const DsmCallRecord& b){ return a.TimestampNs < b.TimestampNs; });
+		return records;
+	}
+
+	std::vector<DsmCallStats> DsmTrace::Stats(){
+		std::vector<DsmCallStats> stats;
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		for (auto& trace : threads){
+			if (trace->ResetPending.load(std::memory_order_acquire)){
+				continue;
+			}
+			for (auto& slot : trace->Triples){
+				auto key = slot.Key.load(std::memory_order_acquire);
+				auto calls = slot.Calls.load(std::memory_order_relaxed);
+				if (key == 0 || calls == 0){
+					continue;
+				}
+
+				// the same triple from several threads goes in one histogram
+				auto entry = std::find_if(stats.begin(), stats.end(), [key](const DsmCallStats& test){
+					return PackTriple(test.DataGroup, test.DataArgumentType, test.Message) + 1 == key;
+				});
+				if (entry == stats.end()){
+					DsmCallStats empty{};
+					empty.DataGroup = static_cast<TW_UINT32>((key - 1) >> 32);
+					empty.DataArgumentType = static_cast<TW_UINT16>((key - 1) >> 16);
+					empty.Message = static_cast<TW_UINT16>(key - 1);
+					stats.push_back(empty);
+					entry = stats.end() - 1;
+				}
+				entry->Calls += calls;
+				entry->Failures += slot.Failures.load(std::memory_order_relaxed);
+				entry->TotalNs += slot.TotalNs.load(std::memory_order_relaxed);
+				entry->MaxNs = std::max(entry->MaxNs, slot.MaxNs.load(std::memory_order_relaxed));
+				for (unsigned i = 0; i < DsmCallStats::kBuckets; i++){
+					entry->Buckets[i] += slot.Buckets[i].load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		std::sort(stats.begin(), stats.end(), [](const DsmCallStats& a, const DsmCallStats& b){
+			return PackTriple(a.DataGroup, a.DataArgumentType, a.Message) < PackTriple(b.DataGroup, b.DataArgumentType, b.Message);
+		});
+		return stats;
+	}
+
+	void DsmTrace::DetachThread(){
+		if (!current_thread){
+			return;
+		}
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		current_thread->Detached = true;
+		current_thread = nullptr;
+	}
+
+	void DsmTrace::Reset(){
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		for (auto& trace : threads){
+			if (trace->Detached){
+				ClearTrace(*trace);
+				trace->Detached = false;
+				trace->Free = true;
+				continue;
+			}
+			trace->ResetPending.store(true, std::memory_order_relaxed);
+			trace->Floor.store(trace->Head.load(std::memory_order_acquire), std::memory_order_relaxed);
+		}
+	}
+
+	unsigned long long DsmTrace::Percentile(const DsmCallStats& stats, double percent){
+		unsigned long long total = 0;
+		for (auto count : stats.Buckets){
+			total += count;
+		}
+		if (total == 0){
+			return 0;
+		}
+
+		auto rank = static_cast<unsigned long long>(percent / 100.0 * total + 0.5);
+		rank = std::max(1ull, std::min(rank, total));
+		unsigned long long seen = 0;
+		for (unsigned i = 0; i < DsmCallStats::kBuckets; i++){
+			seen += stats.Buckets[i];
+			if (seen >= rank){
+				return std::min((1ull << (i + 1)) - 1, stats.MaxNs);
+			}
+		}
+		return stats.MaxNs;
+	}
+
+	void DsmTrace::ExportStats(std::ostream& out){
+		out << "dg,dat,msg,calls,failures,total_ns,mean_ns,p50_ns,p90_ns,p99_ns,max_ns\n";
+		for (auto& entry : Stats()){
+			out << entry.DataGroup << std::hex << ",0x" << entry.DataArgumentType << ",0x" << entry.Message << std::dec
+				<< ',' << entry.Calls << ',' << entry.Failures << ',' << entry.TotalNs << ',' << entry.TotalNs / entry.Calls
+				<< ',' << Percentile(entry, 50) << ',' << Percentile(entry, 90) << ',' << Percentile(entry, 99)
+				<< ',' << entry.MaxNs << '\n';
+		}
+	}
+
+	void DsmTrace::ExportRecords(std::ostream& out){
+		out << "timestamp_ns,thread,dg,dat,msg,rc,duration_ns\n";
+		for (auto& record : Records()){
+			out << record.TimestampNs << ',' << record.ThreadIndex << ',' << record.DataGroup
+				<< std::hex << ",0x" << record.DataArgumentType << ",0x" << record.Message << std::dec
+				<< ',' << record.ReturnCode << ',' << record.DurationNs << '\n';
+		}
+	}
+}
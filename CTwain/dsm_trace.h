@@ -0,0 +1,223 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef DSM_TRACE_H_
+#define DSM_TRACE_H_
+
+#include <atomic>
+#include <ostream>
+#include <vector>
+
+namespace ctwain{
+
+	/// <summary>
+	/// One DSM call kept in a <see cref="DsmTrace"/> ring.
+	/// </summary>
+	struct DsmCallRecord{
+		/// <summary>
+		/// Gets when the call started, in nanoseconds on the trace clock.
+		/// </summary>
+		unsigned long long TimestampNs;
+
+		/// <summary>
+		/// Gets how long the call took in nanoseconds.
+		/// </summary>
+		unsigned long long DurationNs;
+
+		/// <summary>
+		/// Gets the DG_* value.
+		/// </summary>
+		TW_UINT32 DataGroup;
+
+		/// <summary>
+		/// Gets the DAT_* value.
+		/// </summary>
+		TW_UINT16 DataArgumentType;
+
+		/// <summary>
+		/// Gets the MSG_* value.
+		/// </summary>
+		TW_UINT16 Message;
+
+		/// <summary>
+		/// Gets the TWRC_* value returned.
+		/// </summary>
+		TW_UINT16 ReturnCode;
+
+		/// <summary>
+		/// Gets the index of the thread that made the call, in the order threads were first traced.
+		/// The index of a thread that ended goes to another one after a <see cref="DsmTrace::Reset"/>.
+		/// </summary>
+		unsigned ThreadIndex;
+	};
+
+	/// <summary>
+	/// The latency histogram of one DG/DAT/MSG triple.
+	/// </summary>
+	struct DsmCallStats{
+		/// <summary>
+		/// The number of histogram buckets. Bucket i counts calls taking [2^i, 2^(i+1)) ns.
+		/// </summary>
+		static const unsigned kBuckets = 40;
+
+		/// <summary>
+		/// Gets the DG_* value.
+		/// </summary>
+		TW_UINT32 DataGroup;
+
+		/// <summary>
+		/// Gets the DAT_* value.
+		/// </summary>
+		TW_UINT16 DataArgumentType;
+
+		/// <summary>
+		/// Gets the MSG_* value.
+		/// </summary>
+		TW_UINT16 Message;
+
+		/// <summary>
+		/// Gets the number of calls.
+		/// </summary>
+		unsigned long long Calls;
+
+		/// <summary>
+		/// Gets the number of calls that returned TWRC_FAILURE.
+		/// </summary>
+		unsigned long long Failures;
+
+		/// <summary>
+		/// Gets the time spent in all calls in nanoseconds.
+		/// </summary>
+		unsigned long long TotalNs;
+
+		/// <summary>
+		/// Gets the slowest call in nanoseconds.
+		/// </summary>
+		unsigned long long MaxNs;
+
+		/// <summary>
+		/// Gets the call counts per latency bucket.
+		/// </summary>
+		unsigned long long Buckets[kBuckets];
+	};
+
+	/// <summary>
+	/// Optional timing of every call that goes through <see cref="EntryPoints::DSM_Entry"/>.
+	/// Each thread writes the latest calls to its own ring and keeps a latency histogram
+	/// per DG/DAT/MSG triple, so recording takes no locks or atomic read-modify-writes.
+	/// The histograms of all threads are merged when read. Off by default; when off a call
+	/// only pays for checking <see cref="enabled"/>.
+	/// This class should not be used by typical consumers.
+	/// </summary>
+	class DsmTrace
+	{
+	public:
+		/// <summary>
+		/// The number of latest calls kept per thread.
+		/// </summary>
+		static const unsigned kRingRecords = 4096;
+
+		/// <summary>
+		/// The most distinct triples per thread that get a histogram, a power of 2.
+		/// Calls beyond that are only counted in <see cref="dropped"/>.
+		/// </summary>
+		static const unsigned kMaxTriples = 256;
+
+		/// <summary>
+		/// Gets a value indicating whether calls are being traced.
+		/// </summary>
+		static bool enabled(){ return enabled_.load(std::memory_order_relaxed); }
+
+		/// <summary>
+		/// Turns tracing on or off. Whatever was recorded is kept.
+		/// </summary>
+		static void set_enabled(bool enabled);
+
+		/// <summary>
+		/// Gets the number of calls that had no room for a histogram.
+		/// </summary>
+		static unsigned long long dropped();
+
+		/// <summary>
+		/// Gets the current time on the trace clock in ticks.
+		/// </summary>
+		static unsigned long long Now();
+
+		/// <summary>
+		/// Records a call that started at <paramref name="start"/> and just returned.
+		/// </summary>
+		/// <param name="data_group">The DG_* value.</param>
+		/// <param name="data_argument_type">The DAT_* value.</param>
+		/// <param name="message">The MSG_* value.</param>
+		/// <param name="return_code">The TWRC_* value.</param>
+		/// <param name="start">The <see cref="Now"/> value before the call.</param>
+		static void Record(TW_UINT32 data_group, TW_UINT16 data_argument_type, TW_UINT16 message,
+			TW_UINT16 return_code, unsigned long long start);
+
+		/// <summary>
+		/// Tells the trace the calling thread is about to end. Its calls stay readable
+		/// until the next <see cref="Reset"/>, which hands its ring to the next thread
+		/// that gets traced. Threads that end without this keep their ring for good.
+		/// </summary>
+		static void DetachThread();
+
+		/// <summary>
+		/// Gets the calls still held in the rings of every thread, oldest first.
+		/// Safe to call while other threads are tracing.
+		/// </summary>
+		static std::vector<DsmCallRecord> Records();
+
+		/// <summary>
+		/// Gets the histogram of every triple seen since the last <see cref="Reset"/>.
+		/// </summary>
+		static std::vector<DsmCallStats> Stats();
+
+		/// <summary>
+		/// Clears the rings and histograms, and frees the rings of detached threads for reuse.
+		/// </summary>
+		static void Reset();
+
+		/// <summary>
+		/// Estimates a latency percentile from a histogram, as the upper bound of the bucket it falls in.
+		/// </summary>
+		/// <param name="stats">The histogram.</param>
+		/// <param name="percent">The percentile, 0 to 100.</param>
+		/// <returns>The latency in nanoseconds.</returns>
+		static unsigned long long Percentile(const DsmCallStats& stats, double percent);
+
+		/// <summary>
+		/// Writes <see cref="Stats"/> as CSV, one line per triple.
+		/// </summary>
+		static void ExportStats(std::ostream& out);
+
+		/// <summary>
+		/// Writes <see cref="Records"/> as CSV, one line per call.
+		/// </summary>
+		static void ExportRecords(std::ostream& out);
+
+	private:
+		static std::atomic<bool> enabled_;
+	};
+}
+
+#endif //DSM_TRACE_H_
@@ -22,39 +22,79 @@
 //
 
 #include "stdafx.h"
+#include <mutex>
 #include "entry_points.h"
 #include "build_macros.h"
+#include "buffer_pool.h"
+#include "dsm_trace.h"
 
 namespace ctwain{
 
+	namespace{
+		// sessions load the DSM and open it from their own loop threads
+		std::mutex dsm_mutex;
+		// only counts the apps, the functions themselves are read without it
+		std::mutex memory_mutex;
+		// made on first use and never destroyed, pages and buffers may still be freed during
+		// static destruction. Not a function local static as those aren't thread-safe on VS2013
+		std::once_flag pool_once;
+		BufferPool* pool = nullptr;
+	}
+
 	HMODULE EntryPoints::dsm_module_ = nullptr;
-	DSMENTRYPROC EntryPoints::dsm_entry_ = nullptr;
-	TW_ENTRYPOINT EntryPoints::memory_entry_{ 0 };
+	std::atomic<DSMENTRYPROC> EntryPoints::dsm_entry_{ nullptr };
+	unsigned EntryPoints::dsm_references_ = 0;
+	std::atomic<DSM_MEMALLOCATE> EntryPoints::mem_allocate_{ nullptr };
+	std::atomic<DSM_MEMFREE> EntryPoints::mem_free_{ nullptr };
+	std::atomic<DSM_MEMLOCK> EntryPoints::mem_lock_{ nullptr };
+	std::atomic<DSM_MEMUNLOCK> EntryPoints::mem_unlock_{ nullptr };
+	unsigned EntryPoints::memory_entry_references_ = 0;
+	std::basic_string<DsmPathChar> EntryPoints::dsm_path_;
+
+	void EntryPoints::set_dsm_path(const DsmPathChar* path){
+		if (path){
+			dsm_path_ = path;
+		}
+		else{
+			dsm_path_.clear();
+		}
+	}
 
 	bool EntryPoints::InitializeDSM(){
+		std::lock_guard<std::mutex> lock(dsm_mutex);
 		if (!dsm_module_){
 
+			if (!dsm_path_.empty()){
+				dsm_module_ = LOADLIBRARY(dsm_path_.c_str());
+			}
+			else{
 #ifdef TWH_CMP_MSC
-			dsm_module_ = LOADLIBRARY(L"twaindsm.dll");
-#elif
-			dsm_module_ = LOADLIBRARY("/usr/local/lib/libtwaindsm.so");
+				dsm_module_ = LOADLIBRARY(L"twaindsm.dll");
+#else
+				dsm_module_ = LOADLIBRARY("/usr/local/lib/libtwaindsm.so");
 #endif
+			}
 			if (dsm_module_){
 				dsm_entry_ = (DSMENTRYPROC) LOADFUNCTION(dsm_module_, "DSM_Entry");
-				if (dsm_entry_){
-					return true;
-				}
-				else{
+				if (!dsm_entry_){
 					UNLOADLIBRARY(dsm_module_);
 					dsm_module_ = nullptr;
 				}
 			}
 		}
-		return dsm_entry_ != nullptr;
+		if (dsm_entry_.load() != nullptr){
+			dsm_references_++;
+			return true;
+		}
+		return false;
 	}
 
 
 	void EntryPoints::UninitializeDSM() {
+		std::lock_guard<std::mutex> lock(dsm_mutex);
+		if (dsm_references_ == 0 || --dsm_references_ > 0){
+			return;
+		}
 		dsm_entry_ = nullptr;
 		if (dsm_module_) {
 			UNLOADLIBRARY(dsm_module_);
@@ -63,29 +103,81 @@ namespace ctwain{
 	}
 
 	TW_UINT16 EntryPoints::DSM_Entry(pTW_IDENTITY orig, pTW_IDENTITY dest, TW_UINT32 DG, TW_UINT16 DAT, TW_UINT16 MSG, TW_MEMREF pData) {
-		if (dsm_entry_) {
-			return dsm_entry_(orig, dest, DG, DAT, MSG, pData);
+		auto entry = dsm_entry_.load();
+		if (entry) {
+			if (!DsmTrace::enabled()){
+				return entry(orig, dest, DG, DAT, MSG, pData);
+			}
+			auto start = DsmTrace::Now();
+			auto rc = entry(orig, dest, DG, DAT, MSG, pData);
+			DsmTrace::Record(DG, DAT, MSG, rc, start);
+			return rc;
 		}
 		return TWRC_FAILURE;
 	}
 
-	void EntryPoints::UpdateMemoryEntry(pTW_IDENTITY appId){
-		if (appId){
-			if ((appId->SupportedGroups & DF_DSM2) == DF_DSM2){
-				TW_ENTRYPOINT ep{ 0 };
-				ep.Size = sizeof(TW_ENTRYPOINT);
-				auto rc = DSM_Entry(appId, nullptr, DG_CONTROL, DAT_ENTRYPOINT, MSG_GET, &ep);
-				if (rc == TWRC_SUCCESS){
-					memory_entry_ = ep;
-					return;
-				}
-			}
+	TW_ENTRYPOINT EntryPoints::AddMemoryEntry(pTW_IDENTITY appId){
+		TW_ENTRYPOINT ep{ 0 };
+		// only 2.x apps get the entry, the rest use the system functions
+		if ((appId->SupportedGroups & DF_DSM2) != DF_DSM2){
+			return ep;
+		}
+		ep.Size = sizeof(TW_ENTRYPOINT);
+		auto rc = DSM_Entry(appId, nullptr, DG_CONTROL, DAT_ENTRYPOINT, MSG_GET, &ep);
+		if (rc != TWRC_SUCCESS){
+			return TW_ENTRYPOINT{ 0 };
 		}
-		memory_entry_ = { 0 };
+		std::lock_guard<std::mutex> lock(memory_mutex);
+		mem_allocate_ = ep.DSM_MemAllocate;
+		mem_free_ = ep.DSM_MemFree;
+		mem_lock_ = ep.DSM_MemLock;
+		mem_unlock_ = ep.DSM_MemUnlock;
+		memory_entry_references_++;
+		return ep;
 	}
+
+	void EntryPoints::RemoveMemoryEntry(pTW_IDENTITY appId){
+		if ((appId->SupportedGroups & DF_DSM2) != DF_DSM2){
+			return;
+		}
+		std::lock_guard<std::mutex> lock(memory_mutex);
+		if (memory_entry_references_ > 0 && --memory_entry_references_ == 0){
+			mem_allocate_ = nullptr;
+			mem_free_ = nullptr;
+			mem_lock_ = nullptr;
+			mem_unlock_ = nullptr;
+		}
+	}
+
+	TW_ENTRYPOINT EntryPoints::memory_entry(){
+		TW_ENTRYPOINT entry{ 0 };
+		entry.Size = sizeof(TW_ENTRYPOINT);
+		entry.DSM_MemAllocate = mem_allocate_.load();
+		entry.DSM_MemFree = mem_free_.load();
+		entry.DSM_MemLock = mem_lock_.load();
+		entry.DSM_MemUnlock = mem_unlock_.load();
+		return entry;
+	}
+
 	TW_HANDLE EntryPoints::Alloc(TW_UINT32 size){
-		if (memory_entry_.DSM_MemAllocate){
-			return memory_entry_.DSM_MemAllocate(size);
+		return Alloc(memory_entry(), size);
+	}
+
+	void EntryPoints::Free(TW_HANDLE handle){
+		Free(memory_entry(), handle);
+	}
+
+	TW_MEMREF EntryPoints::Lock(TW_HANDLE handle){
+		return Lock(memory_entry(), handle);
+	}
+
+	void EntryPoints::Unlock(TW_HANDLE handle){
+		Unlock(memory_entry(), handle);
+	}
+
+	TW_HANDLE EntryPoints::Alloc(const TW_ENTRYPOINT& entry, TW_UINT32 size){
+		if (entry.DSM_MemAllocate){
+			return entry.DSM_MemAllocate(size);
 		}
 #ifdef TWH_CMP_MSC
 		return GlobalAlloc(GPTR, size);
@@ -94,9 +186,9 @@ namespace ctwain{
 #endif
 	}
 
-	void EntryPoints::Free(TW_HANDLE handle){
-		if (memory_entry_.DSM_MemFree){
-			memory_entry_.DSM_MemFree(handle);
+	void EntryPoints::Free(const TW_ENTRYPOINT& entry, TW_HANDLE handle){
+		if (entry.DSM_MemFree){
+			entry.DSM_MemFree(handle);
 			return;
 		}
 #ifdef TWH_CMP_MSC
@@ -106,9 +198,9 @@ namespace ctwain{
 #endif
 	}
 
-	TW_MEMREF EntryPoints::Lock(TW_HANDLE handle){
-		if (memory_entry_.DSM_MemLock){
-			return memory_entry_.DSM_MemLock(handle);
+	TW_MEMREF EntryPoints::Lock(const TW_ENTRYPOINT& entry, TW_HANDLE handle){
+		if (entry.DSM_MemLock){
+			return entry.DSM_MemLock(handle);
 		}
 #ifdef TWH_CMP_MSC
 		return GlobalLock(handle);
@@ -117,13 +209,26 @@ namespace ctwain{
 #endif
 	}
 
-	void EntryPoints::Unlock(TW_HANDLE handle){
-		if (memory_entry_.DSM_MemUnlock){
-			memory_entry_.DSM_MemUnlock(handle);
+	void EntryPoints::Unlock(const TW_ENTRYPOINT& entry, TW_HANDLE handle){
+		if (entry.DSM_MemUnlock){
+			entry.DSM_MemUnlock(handle);
 			return;
 		}
 #ifdef TWH_CMP_MSC
 		GlobalUnlock(handle);
 #endif
 	}
+
+	TW_MEMREF EntryPoints::AllocBuffer(TW_UINT32 size){
+		return buffer_pool().Acquire(size);
+	}
+
+	void EntryPoints::FreeBuffer(TW_MEMREF buffer){
+		buffer_pool().Release(buffer);
+	}
+
+	BufferPool& EntryPoints::buffer_pool(){
+		std::call_once(pool_once, []{ pool = new BufferPool(); });
+		return *pool;
+	}
 }
\ No newline at end of file
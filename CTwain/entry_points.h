@@ -25,8 +25,20 @@
 #define ENTRY_POINTS_H_
 
 
+#include <atomic>
+#include <string>
+#include "build_macros.h"
+
 namespace ctwain{
 
+	class BufferPool;
+
+#ifdef TWH_CMP_MSC
+	typedef wchar_t DsmPathChar;
+#else
+	typedef char DsmPathChar;
+#endif
+
 	/// <summary>
 	/// Contains all the function calls required to interop with TWAIN.
 	/// This class should not be used by typical consumers.
@@ -35,23 +47,39 @@ namespace ctwain{
 	{
 	public:
 		/// <summary>
-		/// Loads the DSM library.
+		/// Loads the DSM library, or adds a reference to it if another session has already.
 		/// </summary>
 		/// <returns></returns>
 		static bool InitializeDSM();
 		/// <summary>
-		/// Unloads the DSM library.
+		/// Drops a reference from <see cref="InitializeDSM"/> and unloads the DSM library with the last one.
 		/// </summary>
 		static void UninitializeDSM();
 
 		/// <summary>
-		/// Updates the memory management function entry with current app id.
+		/// Sets the DSM library to load instead of the installed one, e.g. a stand-in for testing.
+		/// Takes effect on the next <see cref="InitializeDSM"/> while no DSM is loaded.
+		/// </summary>
+		/// <param name="path">The library path, or nullptr for the installed DSM.</param>
+		static void set_dsm_path(const DsmPathChar* path);
+
+		/// <summary>
+		/// Gets the memory management functions from the DSM for an app that just opened it.
+		/// The DSM hands every app the same functions so they are shared by all sessions
+		/// until the last one calls <see cref="RemoveMemoryEntry"/>.
+		/// </summary>
+		/// <param name="app_id">The pointer to application id.</param>
+		/// <returns>The functions for the session to keep, empty when the system ones are used.</returns>
+		static TW_ENTRYPOINT AddMemoryEntry(pTW_IDENTITY app_id);
+
+		/// <summary>
+		/// Drops an app added with <see cref="AddMemoryEntry"/> after it closed the DSM.
 		/// </summary>
 		/// <param name="app_id">The pointer to application id.</param>
-		static void UpdateMemoryEntry(pTW_IDENTITY app_id);
+		static void RemoveMemoryEntry(pTW_IDENTITY app_id);
 
 		/// <summary>
-		/// Main DSM entry method.
+		/// Main DSM entry method. Every call is timed by <see cref="DsmTrace"/> while tracing is on.
 		/// </summary>
 		/// <param name="origin">The caller id.</param>
 		/// <param name="destination">The destination id.</param>
@@ -97,10 +125,71 @@ namespace ctwain{
 		/// <param name="handle">The handle from <see cref="Lock"/>.</param>
 		static void Unlock(TW_HANDLE handle);
 
+		/// <summary>
+		/// Allocates memory with a session's copy of the functions from <see cref="AddMemoryEntry"/>,
+		/// which doesn't touch any shared state.
+		/// </summary>
+		/// <param name="entry">The memory functions, empty for the system ones.</param>
+		/// <param name="size">The size in bytes.</param>
+		/// <returns>Handle to the allocated memory.</returns>
+		static TW_HANDLE Alloc(const TW_ENTRYPOINT& entry, TW_UINT32 size);
+
+		/// <summary>
+		/// Frees memory with a session's copy of the memory functions.
+		/// </summary>
+		/// <param name="entry">The memory functions, empty for the system ones.</param>
+		/// <param name="handle">The handle from <see cref="Allocate"/>.</param>
+		static void Free(const TW_ENTRYPOINT& entry, TW_HANDLE handle);
+
+		/// <summary>
+		/// Locks memory with a session's copy of the memory functions.
+		/// </summary>
+		/// <param name="entry">The memory functions, empty for the system ones.</param>
+		/// <param name="handle">The handle to allocated memory.</param>
+		/// <returns>Handle to the lock.</returns>
+		static TW_MEMREF Lock(const TW_ENTRYPOINT& entry, TW_HANDLE handle);
+
+		/// <summary>
+		/// Unlocks memory with a session's copy of the memory functions.
+		/// </summary>
+		/// <param name="entry">The memory functions, empty for the system ones.</param>
+		/// <param name="handle">The handle from <see cref="Lock"/>.</param>
+		static void Unlock(const TW_ENTRYPOINT& entry, TW_HANDLE handle);
+
+		/// <summary>
+		/// Function to get an app-owned transfer buffer from the shared <see cref="BufferPool"/>.
+		/// The result is a plain pointer (<c>TWMF_APPOWNS | TWMF_POINTER</c>) that needs no locking.
+		/// Calls to this must be coupled with <see cref="FreeBuffer"/> later.
+		/// </summary>
+		/// <param name="size">The size in bytes.</param>
+		/// <returns>Pointer to the buffer.</returns>
+		static TW_MEMREF AllocBuffer(TW_UINT32 size);
+
+		/// <summary>
+		/// Function to return a transfer buffer to the shared pool. 
+		/// </summary>
+		/// <param name="buffer">The buffer from <see cref="AllocBuffer"/>.</param>
+		static void FreeBuffer(TW_MEMREF buffer);
+
+		/// <summary>
+		/// Gets the pool behind <see cref="AllocBuffer"/> for tuning and its counters.
+		/// </summary>
+		static BufferPool& buffer_pool();
+
 	private:
 		static HMODULE dsm_module_;
-		static DSMENTRYPROC dsm_entry_;
-		static TW_ENTRYPOINT memory_entry_;
+		static std::basic_string<DsmPathChar> dsm_path_;
+		// read on every DSM call without the lock
+		static std::atomic<DSMENTRYPROC> dsm_entry_;
+		static unsigned dsm_references_;
+		// read without the lock by the overloads that take no entry
+		static std::atomic<DSM_MEMALLOCATE> mem_allocate_;
+		static std::atomic<DSM_MEMFREE> mem_free_;
+		static std::atomic<DSM_MEMLOCK> mem_lock_;
+		static std::atomic<DSM_MEMUNLOCK> mem_unlock_;
+		static unsigned memory_entry_references_;
+
+		static TW_ENTRYPOINT memory_entry();
 	};
 }
 
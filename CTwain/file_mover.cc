@@ -0,0 +1,249 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <cstdio>
+#include <vector>
+#include "build_macros.h"
+#include "file_mover.h"
+#include "logger.h"
+
+#ifndef TWH_CMP_MSC
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace ctwain{
+
+	namespace{
+		const char* FileExtension(TW_UINT16 format){
+			switch (format){
+			case TWFF_TIFF:
+			case TWFF_TIFFMULTI:
+				return ".tif";
+			case TWFF_PICT:
+				return ".pct";
+			case TWFF_BMP:
+				return ".bmp";
+			case TWFF_XBM:
+				return ".xbm";
+			case TWFF_JFIF:
+			case TWFF_SPIFF:
+			case TWFF_EXIF:
+				return ".jpg";
+			case TWFF_FPX:
+				return ".fpx";
+			case TWFF_PNG:
+				return ".png";
+			case TWFF_PDF:
+			case TWFF_PDFA:
+			case TWFF_PDFA2:
+				return ".pdf";
+			case TWFF_JP2:
+				return ".jp2";
+			case TWFF_JPX:
+				return ".jpx";
+			case TWFF_DEJAVU:
+				return ".djvu";
+			default:
+				return "";
+			}
+		}
+
+		// copies to a temporary name next to the target first so the target is never seen half written
+		bool CopyDurably(const string& from, const string& to){
+			auto temporary = to + ".part";
+#ifdef TWH_CMP_MSC
+			bool ok = CopyFileExA(from.c_str(), temporary.c_str(), nullptr, nullptr, nullptr, 0) != FALSE;
+			if (ok){
+				auto out = CreateFileA(temporary.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+				ok = out != INVALID_HANDLE_VALUE;
+				if (ok){
+					ok = FlushFileBuffers(out) != FALSE;
+					CloseHandle(out);
+				}
+			}
+			if (!ok || !MoveFileExA(temporary.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)){
+				DeleteFileA(temporary.c_str());
+				return false;
+			}
+			return true;
+#else
+			auto in = open(from.c_str(), O_RDONLY);
+			if (in < 0){
+				return false;
+			}
+			auto out = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (out < 0){
+				close(in);
+				return false;
+			}
+			vector<char> buffer(1 << 20);
+			bool ok = true;
+			while (ok){
+				auto count = read(in, buffer.data(), buffer.size());
+				if (count <= 0){
+					ok = count == 0;
+					break;
+				}
+				for (ssize_t written = 0; ok && written < count;){
+					auto result = write(out, buffer.data() + written, static_cast<size_t>(count - written));
+					ok = result > 0;
+					written += ok ? result : 0;
+				}
+			}
+			ok = ok && fsync(out) == 0;
+			ok = close(out) == 0 && ok;
+			close(in);
+			if (!ok || rename(temporary.c_str(), to.c_str()) != 0){
+				unlink(temporary.c_str());
+				return false;
+			}
+			return true;
+#endif
+		}
+	}
+
+	FileMover::FileMover(){
+		thread_ = thread([this](){ Run(); });
+	}
+
+	FileMover::~FileMover(){
+		Flush();
+		{
+			lock_guard<mutex> lk(mutex_);
+			stopping_ = true;
+		}
+		work_ready_.notify_all();
+		thread_.join();
+	}
+
+	void FileMover::Move(const string& from, const string& to){
+		{
+			lock_guard<mutex> lk(mutex_);
+			queue_.emplace_back(from, to);
+		}
+		work_ready_.notify_one();
+	}
+
+	void FileMover::Flush(){
+		unique_lock<mutex> lk(mutex_);
+		while (!queue_.empty() || moving_){
+			idle_.wait(lk);
+		}
+	}
+
+	unsigned long long FileMover::failed() const{
+		lock_guard<mutex> lk(mutex_);
+		return failed_;
+	}
+
+	bool FileMover::MoveNow(const string& from, const string& to){
+#ifdef TWH_CMP_MSC
+		if (MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)){
+			return true;
+		}
+		auto error = GetLastError();
+		if (error == ERROR_NOT_SAME_DEVICE && CopyDurably(from, to)){
+			DeleteFileA(from.c_str());
+			return true;
+		}
+		CTWAIN_LOG_ERROR("Failed to move %s to %s (error %lu).", from.c_str(), to.c_str(), error);
+		return false;
+#else
+		if (rename(from.c_str(), to.c_str()) == 0){
+			return true;
+		}
+		if (errno == EXDEV && CopyDurably(from, to)){
+			unlink(from.c_str());
+			return true;
+		}
+		CTWAIN_LOG_ERROR("Failed to move %s to %s (error %d).", from.c_str(), to.c_str(), errno);
+		return false;
+#endif
+	}
+
+	void FileMover::Run(){
+		unique_lock<mutex> lk(mutex_);
+		while (true){
+			while (queue_.empty() && !stopping_){
+				work_ready_.wait(lk);
+			}
+			if (queue_.empty()){
+				return;
+			}
+
+			auto move = std::move(queue_.front());
+			queue_.pop_front();
+			moving_ = true;
+			lk.unlock();
+
+			bool moved = MoveNow(move.first, move.second);
+
+			lk.lock();
+			moving_ = false;
+			if (!moved){
+				failed_++;
+			}
+			if (queue_.empty()){
+				idle_.notify_all();
+			}
+		}
+	}
+
+	string FormatFileName(const string& pattern, TW_UINT32 number, TW_UINT16 format){
+		auto digits = to_string(number);
+		auto start = pattern.find('#');
+		string name;
+		if (start == string::npos){
+			name = pattern + digits;
+		}
+		else{
+			auto end = pattern.find_first_not_of('#', start);
+			auto width = (end == string::npos ? pattern.size() : end) - start;
+			if (digits.size() < width){
+				digits.insert(0, width - digits.size(), '0');
+			}
+			name = pattern.substr(0, start) + digits + (end == string::npos ? string{} : pattern.substr(end));
+		}
+		return name + FileExtension(format);
+	}
+
+	string JoinPath(const string& directory, const string& name){
+		if (directory.empty()){
+			return name;
+		}
+		auto last = directory.back();
+		if (last == '/' || last == '\\'){
+			return directory + name;
+		}
+#ifdef TWH_CMP_MSC
+		return directory + '\\' + name;
+#else
+		return directory + '/' + name;
+#endif
+	}
+}
@@ -0,0 +1,139 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef FILE_MOVER_H_
+#define FILE_MOVER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace ctwain{
+
+	/// <summary>
+	/// Settings for per page file transfer targets, see <see cref="TwainSession::EnableFileNaming"/>.
+	/// </summary>
+	struct FileNamingOptions{
+		/// <summary>
+		/// The file name without extension. A run of '#' is replaced by the zero padded page number,
+		/// and the number is appended if there is none. The extension comes from the file format.
+		/// </summary>
+		std::string NamePattern = "page_####";
+
+		/// <summary>
+		/// The directory the files end up in. It must exist.
+		/// </summary>
+		std::string TargetDirectory;
+
+		/// <summary>
+		/// The directory the source writes to, such as a RAM disk or tmpfs mount, from where
+		/// finished files are moved to <see cref="TargetDirectory"/> in the background.
+		/// Empty to have the source write to the target directory. It must exist.
+		/// </summary>
+		std::string StagingDirectory;
+
+		/// <summary>
+		/// The number of the first page.
+		/// </summary>
+		TW_UINT32 FirstNumber = 1;
+	};
+
+	/// <summary>
+	/// Moves files one at a time in the order queued on a thread of its own, so the caller
+	/// doesn't wait for the disk. Files are renamed when they stay on the same volume and
+	/// copied and deleted otherwise. A file that can't be moved is left where it was.
+	/// </summary>
+	class FileMover
+	{
+	public:
+		/// <summary>
+		/// Initializes a new instance of the <see cref="FileMover"/> class and starts its thread.
+		/// </summary>
+		FileMover();
+
+		/// <summary>
+		/// Finishes every queued move and stops the thread.
+		/// </summary>
+		~FileMover();
+
+		FileMover(const FileMover&) = delete;
+		FileMover& operator=(const FileMover&) = delete;
+
+		/// <summary>
+		/// Queues a move, replacing any file at <paramref name="to"/>.
+		/// </summary>
+		/// <param name="from">The file to move.</param>
+		/// <param name="to">The new path.</param>
+		void Move(const std::string& from, const std::string& to);
+
+		/// <summary>
+		/// Waits until every queued move is done.
+		/// </summary>
+		void Flush();
+
+		/// <summary>
+		/// Gets the number of moves that failed so far.
+		/// </summary>
+		unsigned long long failed() const;
+
+		/// <summary>
+		/// Moves a file right away. Across volumes it is copied and flushed to a ".part" file
+		/// next to the target first, which is then renamed over the target, so the target is never half written.
+		/// </summary>
+		/// <param name="from">The file to move.</param>
+		/// <param name="to">The new path, replaced if it exists.</param>
+		/// <returns>false if the file couldn't be moved.</returns>
+		static bool MoveNow(const std::string& from, const std::string& to);
+
+	private:
+		std::thread thread_;
+		mutable std::mutex mutex_;
+		std::condition_variable work_ready_;
+		std::condition_variable idle_;
+		std::deque<std::pair<std::string, std::string>> queue_;
+		bool moving_ = false;
+		bool stopping_ = false;
+		unsigned long long failed_ = 0;
+
+		void Run();
+	};
+
+	/// <summary>
+	/// Builds the file name for a page from <see cref="FileNamingOptions::NamePattern"/>.
+	/// </summary>
+	/// <param name="pattern">The name pattern.</param>
+	/// <param name="number">The page number.</param>
+	/// <param name="format">The TWFF_ file format, which picks the extension.</param>
+	/// <returns>The file name.</returns>
+	std::string FormatFileName(const std::string& pattern, TW_UINT32 number, TW_UINT16 format);
+
+	/// <summary>
+	/// Joins a directory and a file name.
+	/// </summary>
+	std::string JoinPath(const std::string& directory, const std::string& name);
+}
+
+#endif //FILE_MOVER_H_
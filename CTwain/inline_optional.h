@@ -0,0 +1,79 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef INLINE_OPTIONAL_H_
+#define INLINE_OPTIONAL_H_
+
+#include <type_traits>
+
+namespace ctwain{
+
+	/// <summary>
+	/// An optional value stored in place, for the small plain TWAIN structs the event args carry
+	/// so that handing them out doesn't take a heap allocation per page. It reads like
+	/// the std::unique_ptr it replaces: test it as a bool and use * or -> to get at the value.
+	/// </summary>
+	template<typename T>
+	class InlineOptional
+	{
+		static_assert(std::is_pod<T>::value, "InlineOptional only holds plain structs");
+
+	public:
+		InlineOptional(){}
+
+		InlineOptional(const T& value) : value_(value), has_value_{ true }{}
+
+		InlineOptional& operator=(const T& value){
+			value_ = value;
+			has_value_ = true;
+			return *this;
+		}
+
+		/// <summary>
+		/// Gets a value indicating whether there is a value.
+		/// </summary>
+		explicit operator bool() const{ return has_value_; }
+
+		/// <summary>
+		/// Gets the value or nullptr if there is none.
+		/// </summary>
+		T* get(){ return has_value_ ? &value_ : nullptr; }
+		const T* get() const{ return has_value_ ? &value_ : nullptr; }
+
+		T& operator*(){ return value_; }
+		const T& operator*() const{ return value_; }
+		T* operator->(){ return &value_; }
+		const T* operator->() const{ return &value_; }
+
+		/// <summary>
+		/// Removes the value.
+		/// </summary>
+		void reset(){ has_value_ = false; }
+
+	private:
+		T value_;
+		bool has_value_ = false;
+	};
+}
+
+#endif //INLINE_OPTIONAL_H_
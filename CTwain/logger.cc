@@ -0,0 +1,277 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#include "stdafx.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "logger.h"
+
+namespace ctwain{
+
+	namespace{
+		const char* LevelName(LogLevel level){
+			switch (level){
+			case LogLevel::kTrace:
+				return "trace";
+			case LogLevel::kDebug:
+				return "debug";
+			case LogLevel::kInfo:
+				return "info";
+			case LogLevel::kWarning:
+				return "warning";
+			case LogLevel::kError:
+				return "error";
+			default:
+				return "";
+			}
+		}
+
+		struct LogSlot{
+			std::atomic<size_t> Sequence;
+			LogLevel Level;
+			unsigned Length;
+			char Text[Logger::kMaxMessageLength];
+		};
+
+		// bounded queue for many producers, each slot's sequence says whose turn it is.
+		// the logger thread is the only consumer
+		class LogRing{
+		public:
+			LogRing() : enqueue_{ 0 }, dequeue_{ 0 }{
+				for (size_t i = 0; i < Logger::kRingMessages; i++){
+					slots_[i].Sequence.store(i, std::memory_order_relaxed);
+				}
+			}
+
+			// claims a slot to fill, nullptr when full
+			LogSlot* BeginPush(size_t& position){
+				position = enqueue_.load(std::memory_order_relaxed);
+				for (;;){
+					auto& slot = slots_[position & (Logger::kRingMessages - 1)];
+					auto sequence = slot.Sequence.load(std::memory_order_acquire);
+					auto lag = static_cast<ptrdiff_t>(sequence - position);
+					if (lag == 0){
+						if (enqueue_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+							return &slot;
+						}
+					}
+					else if (lag < 0){
+						return nullptr;
+					}
+					else{
+						position = enqueue_.load(std::memory_order_relaxed);
+					}
+				}
+			}
+
+			void EndPush(LogSlot* slot, size_t position){
+				slot->Sequence.store(position + 1, std::memory_order_release);
+			}
+
+			// the oldest filled slot, nullptr when empty or still being filled
+			LogSlot* Front(){
+				auto& slot = slots_[dequeue_ & (Logger::kRingMessages - 1)];
+				return slot.Sequence.load(std::memory_order_acquire) == dequeue_ + 1 ? &slot : nullptr;
+			}
+
+			void PopFront(){
+				auto& slot = slots_[dequeue_ & (Logger::kRingMessages - 1)];
+				slot.Sequence.store(dequeue_ + Logger::kRingMessages, std::memory_order_release);
+				dequeue_++;
+			}
+
+		private:
+			LogSlot slots_[Logger::kRingMessages];
+			std::atomic<size_t> enqueue_;
+			size_t dequeue_;
+		};
+
+		LogRing ring;
+		std::atomic<unsigned long long> queued{ 0 };
+		std::atomic<unsigned long long> dropped_messages{ 0 };
+
+		std::mutex sink_mutex;
+		std::shared_ptr<LogSink> sink = std::make_shared<ConsoleLogSink>();
+
+		// declared last so it's destroyed first, while the ring and sink are still there
+		class LogThread{
+		public:
+			~LogThread(){
+				if (thread_.joinable()){
+					{
+						std::lock_guard<std::mutex> lock(mutex_);
+						stop_ = true;
+					}
+					wake_.notify_one();
+					thread_.join();
+				}
+			}
+
+			void Start(){
+				std::call_once(started_, [this]{ thread_ = std::thread{ [this]{ Run(); } }; });
+			}
+
+			void Wake(){
+				// pairs with the fence in Run so either the push is seen or the wake is
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (sleeping_.load(std::memory_order_relaxed)){
+					std::lock_guard<std::mutex> lock(mutex_);
+					wake_.notify_one();
+				}
+			}
+
+			void Flush(){
+				auto target = queued.load(std::memory_order_acquire);
+				std::unique_lock<std::mutex> lock(mutex_);
+				if (!thread_.joinable()){
+					return;
+				}
+				wake_.notify_one();
+				flushed_.wait(lock, [this, target]{ return written_ >= target || stop_; });
+			}
+
+		private:
+			std::once_flag started_;
+			std::thread thread_;
+			std::mutex mutex_;
+			std::condition_variable wake_;
+			std::condition_variable flushed_;
+			std::atomic<bool> sleeping_{ false };
+			bool stop_ = false;
+			unsigned long long written_ = 0;
+
+			void Run(){
+				std::unique_lock<std::mutex> lock(mutex_);
+				for (;;){
+					lock.unlock();
+					auto count = Drain();
+					lock.lock();
+
+					written_ += count;
+					if (count > 0){
+						flushed_.notify_all();
+						continue;
+					}
+					if (stop_){
+						break;
+					}
+
+					sleeping_.store(true, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (!ring.Front()){
+						// the timeout only matters for a message that was still being formatted
+						wake_.wait_for(lock, std::chrono::milliseconds(100));
+					}
+					sleeping_.store(false, std::memory_order_relaxed);
+				}
+				flushed_.notify_all();
+			}
+
+			unsigned long long Drain(){
+				unsigned long long count = 0;
+				std::lock_guard<std::mutex> lock(sink_mutex);
+				while (auto slot = ring.Front()){
+					if (sink){
+						sink->Write(slot->Level, slot->Text, slot->Length);
+					}
+					ring.PopFront();
+					count++;
+				}
+				if (count > 0 && sink){
+					sink->Flush();
+				}
+				return count;
+			}
+		};
+
+		LogThread log_thread;
+	}
+
+	std::atomic<LogLevel> Logger::level_{ static_cast<LogLevel>(CTWAIN_LOG_LEVEL) };
+
+	void Logger::Write(LogLevel level, const char* format, ...){
+		if (level < level_.load(std::memory_order_relaxed) || level >= LogLevel::kOff){
+			return;
+		}
+		log_thread.Start();
+
+		size_t position;
+		auto slot = ring.BeginPush(position);
+		if (!slot){
+			dropped_messages.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		va_list args;
+		va_start(args, format);
+#ifdef TWH_CMP_MSC
+		auto length = vsnprintf_s(slot->Text, sizeof(slot->Text), _TRUNCATE, format, args);
+#else
+		auto length = vsnprintf(slot->Text, sizeof(slot->Text), format, args);
+#endif
+		va_end(args);
+
+		// cut messages report -1 or their full length depending on the CRT
+		if (length < 0 || static_cast<size_t>(length) >= sizeof(slot->Text)){
+			length = static_cast<int>(strlen(slot->Text));
+		}
+		slot->Level = level;
+		slot->Length = static_cast<unsigned>(length);
+		ring.EndPush(slot, position);
+
+		queued.fetch_add(1, std::memory_order_release);
+		log_thread.Wake();
+	}
+
+	void Logger::set_sink(std::shared_ptr<LogSink> newSink){
+		std::lock_guard<std::mutex> lock(sink_mutex);
+		sink = std::move(newSink);
+	}
+
+	void Logger::Flush(){
+		log_thread.Flush();
+	}
+
+	unsigned long long Logger::dropped(){
+		return dropped_messages.load(std::memory_order_relaxed);
+	}
+
+	void ConsoleLogSink::Write(LogLevel level, const char* message, size_t length){
+		buffer_.append("[ctwain ");
+		buffer_.append(LevelName(level));
+		buffer_.append("] ");
+		buffer_.append(message, length);
+		buffer_.push_back('\n');
+	}
+
+	void ConsoleLogSink::Flush(){
+		fwrite(buffer_.data(), 1, buffer_.size(), stderr);
+		fflush(stderr);
+		buffer_.clear();
+	}
+}
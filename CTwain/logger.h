@@ -0,0 +1,184 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef LOGGER_H_
+#define LOGGER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Numeric levels for CTWAIN_LOG_LEVEL, the preprocessor can't compare LogLevel.
+#define CTWAIN_LOG_LEVEL_TRACE 0
+#define CTWAIN_LOG_LEVEL_DEBUG 1
+#define CTWAIN_LOG_LEVEL_INFO 2
+#define CTWAIN_LOG_LEVEL_WARNING 3
+#define CTWAIN_LOG_LEVEL_ERROR 4
+#define CTWAIN_LOG_LEVEL_OFF 5
+
+// The lowest level compiled in. Calls below it compile to nothing, arguments included.
+#ifndef CTWAIN_LOG_LEVEL
+#ifdef _DEBUG
+#define CTWAIN_LOG_LEVEL CTWAIN_LOG_LEVEL_DEBUG
+#else
+#define CTWAIN_LOG_LEVEL CTWAIN_LOG_LEVEL_INFO
+#endif
+#endif
+
+#if CTWAIN_LOG_LEVEL <= CTWAIN_LOG_LEVEL_TRACE
+#define CTWAIN_LOG_TRACE(...) ::ctwain::Logger::Write(::ctwain::LogLevel::kTrace, __VA_ARGS__)
+#else
+#define CTWAIN_LOG_TRACE(...) ((void)0)
+#endif
+
+#if CTWAIN_LOG_LEVEL <= CTWAIN_LOG_LEVEL_DEBUG
+#define CTWAIN_LOG_DEBUG(...) ::ctwain::Logger::Write(::ctwain::LogLevel::kDebug, __VA_ARGS__)
+#else
+#define CTWAIN_LOG_DEBUG(...) ((void)0)
+#endif
+
+#if CTWAIN_LOG_LEVEL <= CTWAIN_LOG_LEVEL_INFO
+#define CTWAIN_LOG_INFO(...) ::ctwain::Logger::Write(::ctwain::LogLevel::kInfo, __VA_ARGS__)
+#else
+#define CTWAIN_LOG_INFO(...) ((void)0)
+#endif
+
+#if CTWAIN_LOG_LEVEL <= CTWAIN_LOG_LEVEL_WARNING
+#define CTWAIN_LOG_WARNING(...) ::ctwain::Logger::Write(::ctwain::LogLevel::kWarning, __VA_ARGS__)
+#else
+#define CTWAIN_LOG_WARNING(...) ((void)0)
+#endif
+
+#if CTWAIN_LOG_LEVEL <= CTWAIN_LOG_LEVEL_ERROR
+#define CTWAIN_LOG_ERROR(...) ::ctwain::Logger::Write(::ctwain::LogLevel::kError, __VA_ARGS__)
+#else
+#define CTWAIN_LOG_ERROR(...) ((void)0)
+#endif
+
+namespace ctwain{
+
+	/// <summary>
+	/// The severity of a log message.
+	/// </summary>
+	enum class LogLevel{
+		kTrace = CTWAIN_LOG_LEVEL_TRACE,
+		kDebug = CTWAIN_LOG_LEVEL_DEBUG,
+		kInfo = CTWAIN_LOG_LEVEL_INFO,
+		kWarning = CTWAIN_LOG_LEVEL_WARNING,
+		kError = CTWAIN_LOG_LEVEL_ERROR,
+		kOff = CTWAIN_LOG_LEVEL_OFF
+	};
+
+	/// <summary>
+	/// Receives formatted log messages. Only the logger thread calls it, one message at a time.
+	/// </summary>
+	class LogSink
+	{
+	public:
+		virtual ~LogSink(){}
+
+		/// <summary>
+		/// Writes one message.
+		/// </summary>
+		/// <param name="level">The level.</param>
+		/// <param name="message">The text, not null terminated and without a line break.</param>
+		/// <param name="length">The text length.</param>
+		virtual void Write(LogLevel level, const char* message, size_t length) = 0;
+
+		/// <summary>
+		/// Called after a batch of messages has been written.
+		/// </summary>
+		virtual void Flush(){}
+	};
+
+	/// <summary>
+	/// Writes to stderr, flushed once per batch instead of once per line. The default sink.
+	/// </summary>
+	class ConsoleLogSink : public LogSink
+	{
+	public:
+		void Write(LogLevel level, const char* message, size_t length) override;
+		void Flush() override;
+
+	private:
+		std::string buffer_;
+	};
+
+	/// <summary>
+	/// The library's log. Use the CTWAIN_LOG_* macros rather than calling <see cref="Write"/>.
+	/// Messages are formatted on the calling thread into a fixed ring without locks or allocations,
+	/// and a background thread hands them to the sink. When the ring is full messages are dropped.
+	/// </summary>
+	class Logger
+	{
+	public:
+		/// <summary>
+		/// The ring capacity in messages.
+		/// </summary>
+		static const unsigned kRingMessages = 1024;
+
+		/// <summary>
+		/// The longest message kept, longer ones are cut.
+		/// </summary>
+		static const unsigned kMaxMessageLength = 240;
+
+		/// <summary>
+		/// Formats and queues a message if <paramref name="level"/> is enabled at runtime.
+		/// </summary>
+		/// <param name="level">The level.</param>
+		/// <param name="format">The printf style format.</param>
+		static void Write(LogLevel level, const char* format, ...);
+
+		/// <summary>
+		/// Gets the lowest level written at runtime. Can't go below CTWAIN_LOG_LEVEL.
+		/// </summary>
+		static LogLevel level(){ return level_.load(std::memory_order_relaxed); }
+
+		/// <summary>
+		/// Sets the lowest level written at runtime.
+		/// </summary>
+		static void set_level(LogLevel level){ level_.store(level, std::memory_order_relaxed); }
+
+		/// <summary>
+		/// Replaces the sink. Messages already queued go to the new one.
+		/// </summary>
+		/// <param name="sink">The sink, or nullptr to discard messages.</param>
+		static void set_sink(std::shared_ptr<LogSink> sink);
+
+		/// <summary>
+		/// Waits until every message queued so far has been written.
+		/// </summary>
+		static void Flush();
+
+		/// <summary>
+		/// Gets the number of messages dropped because the ring was full.
+		/// </summary>
+		static unsigned long long dropped();
+
+	private:
+		static std::atomic<LogLevel> level_;
+	};
+}
+
+#endif //LOGGER_H_
@@ -0,0 +1,120 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <cstdint>
+#include "build_macros.h"
+#include "mapped_file.h"
+#include "logger.h"
+
+#ifndef TWH_CMP_MSC
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ctwain{
+
+	bool MappedFile::Open(const std::string& path){
+		Close();
+#ifdef TWH_CMP_MSC
+		// sequential scan only steers the cache manager, views are read ahead by the memory manager anyway.
+		// Sharing delete lets the file be moved or deleted while mapped, as on POSIX.
+		auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE){
+			CTWAIN_LOG_ERROR("Failed to open %s for mapping (error %lu).", path.c_str(), GetLastError());
+			return false;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || static_cast<unsigned long long>(size.QuadPart) > SIZE_MAX){
+			CTWAIN_LOG_ERROR("Can't map %s, it is too large.", path.c_str());
+			CloseHandle(file);
+			return false;
+		}
+		if (size.QuadPart == 0){
+			CloseHandle(file);
+			return true;
+		}
+		// the view keeps the file open after its handles are closed
+		auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		auto view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!view){
+			CTWAIN_LOG_ERROR("Failed to map %s (error %lu).", path.c_str(), GetLastError());
+			if (mapping){
+				CloseHandle(mapping);
+			}
+			return false;
+		}
+		mapping_ = mapping;
+		data_ = static_cast<const TW_UINT8*>(view);
+		size_ = static_cast<size_t>(size.QuadPart);
+#else
+		auto fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0){
+			CTWAIN_LOG_ERROR("Failed to open %s for mapping (error %d).", path.c_str(), errno);
+			return false;
+		}
+		struct stat status;
+		if (fstat(fd, &status) != 0 || static_cast<unsigned long long>(status.st_size) > SIZE_MAX){
+			CTWAIN_LOG_ERROR("Can't map %s (error %d).", path.c_str(), errno);
+			close(fd);
+			return false;
+		}
+		if (status.st_size == 0){
+			close(fd);
+			return true;
+		}
+		auto size = static_cast<size_t>(status.st_size);
+		// the mapping keeps the file open after the descriptor is closed
+		auto view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (view == MAP_FAILED){
+			CTWAIN_LOG_ERROR("Failed to map %s (error %d).", path.c_str(), errno);
+			return false;
+		}
+		madvise(view, size, MADV_SEQUENTIAL);
+		data_ = static_cast<const TW_UINT8*>(view);
+		size_ = size;
+#endif
+		return true;
+	}
+
+	void MappedFile::Close(){
+		if (!data_){
+			return;
+		}
+#ifdef TWH_CMP_MSC
+		UnmapViewOfFile(data_);
+		CloseHandle(mapping_);
+		mapping_ = nullptr;
+#else
+		munmap(const_cast<TW_UINT8*>(data_), size_);
+#endif
+		data_ = nullptr;
+		size_ = 0;
+	}
+}
@@ -0,0 +1,81 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <string>
+
+namespace ctwain{
+
+	/// <summary>
+	/// A read-only memory-mapped view of a whole file, unmapped when destroyed.
+	/// The view is meant for one pass from start to end, such as hashing, parsing or uploading
+	/// a file the source just wrote, and reads straight from the page cache without a buffer.
+	/// This class is not thread-safe but the data can be read from any thread while it's open.
+	/// </summary>
+	class MappedFile
+	{
+	public:
+		MappedFile(){}
+
+		/// <summary>
+		/// Unmaps the file if mapped.
+		/// </summary>
+		~MappedFile(){ Close(); }
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		/// <summary>
+		/// Maps a file. The pages are hinted for sequential access so they are read ahead
+		/// and can be dropped soon after.
+		/// </summary>
+		/// <param name="path">The file path.</param>
+		/// <returns>false if the file couldn't be opened or mapped. An empty file opens with no data.</returns>
+		bool Open(const std::string& path);
+
+		/// <summary>
+		/// Unmaps the file.
+		/// </summary>
+		void Close();
+
+		/// <summary>
+		/// Gets the start of the file, nullptr if not open or the file is empty.
+		/// </summary>
+		const TW_UINT8* data() const{ return data_; }
+
+		/// <summary>
+		/// Gets the file size.
+		/// </summary>
+		size_t size() const{ return size_; }
+
+	private:
+		const TW_UINT8* data_ = nullptr;
+		size_t size_ = 0;
+		// the mapping handle on Windows
+		void* mapping_ = nullptr;
+	};
+}
+
+#endif //MAPPED_FILE_H_
@@ -21,25 +21,33 @@
 // OR OTHER DEALINGS IN THE SOFTWARE.
 //
 #include "stdafx.h"
-#include <thread>
 #include <mutex>
-#include <iostream>
 #include <condition_variable>
+#include "build_macros.h"
 #include "message_loop.h"
 #include "twain_session.h"
+#include "dsm_trace.h"
+#include "logger.h"
 
 using namespace std;
 
 namespace ctwain{
 
+#ifdef TWH_CMP_MSC
 	////////////////////////////////////////////////////
-	// static window registration
+	// window backend
 	////////////////////////////////////////////////////
 
+	namespace{
+		// every session's loop thread registers and unregisters the class
+		mutex class_mutex;
+	}
+
 	ATOM MessageLoop::class_atom_ = 0;
 	HINSTANCE MessageLoop::instance_ = GetModuleHandle(NULL);
 	int MessageLoop::window_count_ = 0;
 	void MessageLoop::RegisterWindowClass(){
+		lock_guard<mutex> lock(class_mutex);
 		if (window_count_ == 0){
 			WNDCLASSEX wcex;
 
@@ -57,11 +65,12 @@ namespace ctwain{
 			wcex.lpszClassName = L"TWAIN_INTERNAL_WINDOW";
 			wcex.hIconSm = NULL;
 
-			RegisterClassEx(&wcex);
+			class_atom_ = RegisterClassEx(&wcex);
 		}
 		window_count_++;
 	}
 	void MessageLoop::UnregisterWindowClass(){
+		lock_guard<mutex> lock(class_mutex);
 		if (--window_count_ == 0){
 			UnregisterClass(MAKEINTATOM(class_atom_), instance_);
 		}
@@ -88,76 +97,139 @@ namespace ctwain{
 		return 0;
 	}
 
+	void MessageLoop::CreateParentWindow(){
+		wake_event_ = CreateEvent(NULL, FALSE, FALSE, NULL);
+		RegisterWindowClass();
+		parent_handle_ = CreateWindow(MAKEINTATOM(class_atom_), L"Twain Window", WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, 0, CW_USEDEFAULT, 0,
+			NULL, NULL, instance_, NULL);
+		if (parent_handle_){
+			ShowWindow(parent_handle_, 10);
+			UpdateWindow(parent_handle_);
+		}
+		else{
+			CTWAIN_LOG_ERROR("Failed to create the TWAIN window (error %lu).", GetLastError());
+		}
+	}
+
+	void MessageLoop::DestroyParentWindow(){
+		// the window has to be destroyed on the thread that created it
+		if (parent_handle_){
+			DestroyWindow(parent_handle_);
+			parent_handle_ = nullptr;
+		}
+		UnregisterWindowClass();
+		CloseHandle(wake_event_);
+		wake_event_ = nullptr;
+	}
+
+	void MessageLoop::PumpWindowMessages(){
+		MSG msg;
+		while (!stop_ && PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)){
+			if (msg.message == WM_QUIT){
+				stop_ = true;
+			}
+			else if (twain_ == nullptr || !twain_->IsTwainMessage(msg)){
+				TranslateMessage(&msg);
+				DispatchMessage(&msg);
+			}
+		}
+	}
+#endif
+
 	////////////////////////////////////////////////////
 	// message loop code
 	////////////////////////////////////////////////////
-	MessageLoop::MessageLoop(TwainSession* ptwain) : owns_{ true }, twain_{ ptwain }
+	MessageLoop::MessageLoop(TwainSession* ptwain) : twain_{ ptwain }
 	{
 		condition_variable loopWaiter;
 		mutex loopMtx;
-		bool threadStarted = false; // don't know enough about condition_variable to know why needs this to work
-
-		thread t{ [this, &loopWaiter, &loopMtx, &threadStarted](){
-			unique_lock<mutex> lk(loopMtx);
-			threadStarted = true;
-
-			RegisterWindowClass(); // yes ain't thread-safe but any one calling this simultaneously in multiple threads can only blame themselves.
-			parent_handle_ = CreateWindow(MAKEINTATOM(class_atom_), L"Twain Window", WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, 0, CW_USEDEFAULT, 0,
-				NULL, NULL, instance_, NULL);
-			/*parent_handle_ = CreateWindowEx(WS_EX_TOOLWINDOW,
-			class_name_, L"Twain Window", WS_OVERLAPPEDWINDOW,
-			CW_USEDEFAULT, 0, CW_USEDEFAULT, 0,
-			HWND_MESSAGE, NULL, instance_, NULL);*/
-
-			if (parent_handle_){
-				ShowWindow(parent_handle_, 10);
-				UpdateWindow(parent_handle_);
-
-				MSG msg;
-
-				// Main message loop:
-				if (PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE)){
-					loopWaiter.notify_all();
-					lk.unlock();
-					lk.release();
-					while (GetMessage(&msg, NULL, 0, 0))
-					{
-						cout << "got msg " << msg.message << endl;
-						if (twain_ == nullptr || !twain_->IsTwainMessage(msg)){
-							TranslateMessage(&msg);
-							DispatchMessage(&msg);
-						}
-					}
-					return;
-				}
+		bool threadStarted = false;
+
+		thread_ = thread{ [this, &loopWaiter, &loopMtx, &threadStarted](){
+			{
+				lock_guard<mutex> lk(loopMtx);
+#ifdef TWH_CMP_MSC
+				CreateParentWindow();
+#endif
+				threadStarted = true;
+				// the waiter is gone once it sees the flag so notify under the lock
+				loopWaiter.notify_all();
 			}
-
-			loopWaiter.notify_all();
-			lk.unlock();
-			lk.release();
+			Run();
 		} };
+
 		unique_lock<mutex> lk(loopMtx);
 		while (!threadStarted){
 			loopWaiter.wait(lk);
 		}
-		t.detach();
 	}
 
 	MessageLoop::~MessageLoop()
 	{
-		if (owns_ && parent_handle_ != nullptr){
-			DestroyWindow(parent_handle_);
-			UnregisterWindowClass();
-		}
-		parent_handle_ = nullptr;
+		Post([this]{ stop_ = true; });
+		thread_.join();
 		twain_ = nullptr;
 	}
 
-	void MessageLoop::Post(){
-//		auto test = 10;
+	void MessageLoop::Post(function<void()> work){
+		work_.Push(move(work));
+		{
+			lock_guard<mutex> lk(wake_mutex_);
+			woken_ = true;
+		}
+		wake_changed_.notify_one();
+#ifdef TWH_CMP_MSC
+		SetEvent(wake_event_);
+#endif
+	}
+
+	void MessageLoop::set_pump_window_messages(bool pump){
+#ifdef TWH_CMP_MSC
+		pump_window_messages_ = pump;
+#else
+		UNREFERENCED_PARAMETER(pump);
+#endif
+	}
+
+	void MessageLoop::Run(){
+		while (!stop_){
+			RunPending();
+#ifdef TWH_CMP_MSC
+			if (pump_window_messages_){
+				PumpWindowMessages();
+			}
+#endif
+			if (!stop_){
+				Wait();
+			}
+		}
+#ifdef TWH_CMP_MSC
+		DestroyParentWindow();
+#endif
+		// the session's DSM calls are made here, the ring goes to the next loop
+		DsmTrace::DetachThread();
+	}
 
+	void MessageLoop::Wait(){
+#ifdef TWH_CMP_MSC
+		if (pump_window_messages_){
+			// wakes for either queued work or window messages
+			MsgWaitForMultipleObjectsEx(1, &wake_event_, INFINITE, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+			return;
+		}
+#endif
+		unique_lock<mutex> lk(wake_mutex_);
+		while (!woken_){
+			wake_changed_.wait(lk);
+		}
+		woken_ = false;
 	}
-	void MessageLoop::Send(){
 
+	void MessageLoop::RunPending(){
+		function<void()> work;
+		while (!stop_ && work_.Pop(work)){
+			work();
+			work = nullptr;
+		}
 	}
-}
\ No newline at end of file
+}
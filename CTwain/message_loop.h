@@ -24,70 +24,115 @@
 #ifndef MESSAGE_LOOP_H_
 #define MESSAGE_LOOP_H_
 
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include "build_macros.h"
+#include "mpsc_queue.h"
+
 namespace ctwain{
 
 	class TwainSession;
 
 	/// <summary>
-	/// A base interface for a message loop for TWAIN to use.
+	/// The thread that all TWAIN calls of a session run on. It runs work queued with
+	/// <see cref="Post"/> or <see cref="Send"/> from other threads. On Windows it also owns
+	/// a window for the DSM and pumps its messages, unless told the source reports through
+	/// DAT_CALLBACK2 (<see cref="set_pump_window_messages"/>); otherwise, and on other systems,
+	/// it sleeps on a condition variable until work is queued.
 	/// </summary>
 	class MessageLoop {
 	public:
 		/// <summary>
 		/// Initializes a new instance of the <see cref="MessageLoop"/> class
-		/// with an internal message loop.
+		/// and starts its thread. Returns once the window has been created.
 		/// </summary>
-		MessageLoop(TwainSession*);
-
-		/// <summary>
-		/// Initializes a new instance of the <see cref="MessageLoop"/> class
-		/// using an existing window handle.
-		/// </summary>
-		/// <param name="handle">The handle.</param>
-		MessageLoop(HWND handle) :parent_handle_{ handle }{};
+		/// <param name="twain">The session to pass window messages to.</param>
+		explicit MessageLoop(TwainSession* twain);
 
 		// no copy ctor
 		MessageLoop(const MessageLoop&) = delete;
 		// no copy assign
 		MessageLoop& operator=(const MessageLoop&) = delete;
 
-		// move ctor
-		MessageLoop(MessageLoop&& other) :parent_handle_{ other.parent_handle_ }, owns_{ other.owns_ }{
-			other.parent_handle_ = nullptr;
-		}
-		// move assign
-		MessageLoop& operator=(MessageLoop&& other){
-			if (this != &other)
-			{
-				parent_handle_ = other.parent_handle_;
-				owns_ = other.owns_;
-				other.parent_handle_ = nullptr;
+		/// <summary>
+		/// Runs the pending work and stops the thread. Must not be called from the loop thread.
+		/// </summary>
+		~MessageLoop();
+
+		/// <summary>
+		/// Queues work to run on the loop thread and returns right away.
+		/// Safe to call from any thread, including from inside the DSM callback.
+		/// </summary>
+		/// <param name="work">The work.</param>
+		void Post(std::function<void()> work);
+
+		/// <summary>
+		/// Runs work on the loop thread and waits for its result.
+		/// Runs it directly when already on the loop thread.
+		/// </summary>
+		/// <param name="work">The work.</param>
+		template<typename F>
+		auto Send(F work) -> decltype(work()){
+			if (on_loop_thread()){
+				return work();
 			}
-			return *this;
+			std::packaged_task<decltype(work())()> task{ std::move(work) };
+			auto result = task.get_future();
+			Post([&task]{ task(); });
+			return result.get();
 		}
 
-		~MessageLoop();
-
-		void Send();
-		void Post();
+		/// <summary>
+		/// Gets a value indicating whether the caller is on the loop thread.
+		/// </summary>
+		bool on_loop_thread() const { return std::this_thread::get_id() == thread_.get_id(); }
 
 		/// <summary>
-		/// Gets the parent handle to the message loop.
+		/// Gets the parent handle to the message loop, nullptr where there is no window.
 		/// </summary>
 		HWND parent_handle() { return parent_handle_; }
 
+		/// <summary>
+		/// Sets whether the loop pumps window messages between work items, which the DSM
+		/// needs unless the source reports through DAT_CALLBACK2, and driver UI always needs.
+		/// Only has an effect on Windows. Only call this from the loop thread.
+		/// </summary>
+		/// <param name="pump">Whether to pump window messages.</param>
+		void set_pump_window_messages(bool pump);
+
 	protected:
 		HWND parent_handle_ = nullptr;
-		bool owns_ = false;
+		bool stop_ = false;
+		MpscQueue<std::function<void()>> work_;
+		std::mutex wake_mutex_;
+		std::condition_variable wake_changed_;
+		bool woken_ = false;
+		std::thread thread_;
 
 		TwainSession* twain_;
 
+		void Run();
+		void RunPending();
+		void Wait();
+
+#ifdef TWH_CMP_MSC
+		HANDLE wake_event_ = nullptr;
+		bool pump_window_messages_ = true;
+
+		void CreateParentWindow();
+		void DestroyParentWindow();
+		void PumpWindowMessages();
+
 		static void RegisterWindowClass();
 		static void UnregisterWindowClass();
 		static HINSTANCE instance_;
 		static ATOM class_atom_;
 		static int window_count_;
 		static LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam);
+#endif
 	};
 }
 
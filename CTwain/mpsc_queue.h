@@ -0,0 +1,149 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef MPSC_QUEUE_H_
+#define MPSC_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+namespace ctwain{
+
+	/// <summary>
+	/// An unbounded lock-free queue for many producers and a single consumer
+	/// (an intrusive linked list with a stub node). Push never blocks.
+	/// Pop may briefly see the queue as empty while a push is half way through,
+	/// so producers should wake the consumer after pushing.
+	/// Popped nodes are kept for later pushes, so the queue only allocates while it grows.
+	/// This class should not be used by typical consumers.
+	/// </summary>
+	template<typename T>
+	class MpscQueue
+	{
+	public:
+		MpscQueue() : head_{ &stub_ }, tail_{ &stub_ }{}
+
+		~MpscQueue(){
+			T value;
+			while (Pop(value)){}
+			if (tail_ != &stub_){
+				delete tail_;
+			}
+			auto node = free_.load(std::memory_order_acquire);
+			while (node){
+				auto next = node->next.load(std::memory_order_relaxed);
+				delete node;
+				node = next;
+			}
+		}
+
+		MpscQueue(const MpscQueue&) = delete;
+		MpscQueue& operator=(const MpscQueue&) = delete;
+
+		/// <summary>
+		/// Adds an item. Safe to call from any thread.
+		/// </summary>
+		void Push(T value){
+			auto node = TakeNode();
+			if (node){
+				node->value = std::move(value);
+			}
+			else{
+				node = new Node(std::move(value));
+			}
+			auto previous = head_.exchange(node, std::memory_order_acq_rel);
+			previous->next.store(node, std::memory_order_release);
+		}
+
+		/// <summary>
+		/// Removes the oldest item. Only call this from the consumer thread.
+		/// </summary>
+		/// <returns>false if there was nothing to remove.</returns>
+		bool Pop(T& value){
+			auto tail = tail_;
+			auto next = tail->next.load(std::memory_order_acquire);
+			if (!next){
+				return false;
+			}
+			// the popped node becomes the new stub
+			value = std::move(next->value);
+			tail_ = next;
+			if (tail != &stub_){
+				Recycle(tail);
+			}
+			return true;
+		}
+
+	private:
+		struct Node{
+			Node() : next{ nullptr }{}
+			explicit Node(T&& item) : next{ nullptr }, value(std::move(item)){}
+			std::atomic<Node*> next;
+			T value;
+		};
+
+		Node stub_;
+		std::atomic<Node*> head_;
+		Node* tail_;
+		// nodes done with, linked through next. Only the consumer adds to it and producers
+		// take all of it at once, so no node can come back while a producer looks at it
+		std::atomic<Node*> free_{ nullptr };
+
+		Node* TakeNode(){
+			auto node = free_.exchange(nullptr, std::memory_order_acquire);
+			if (!node){
+				return nullptr;
+			}
+			auto rest = node->next.load(std::memory_order_relaxed);
+			node->next.store(nullptr, std::memory_order_relaxed);
+			if (rest){
+				Node* empty = nullptr;
+				if (!free_.compare_exchange_strong(empty, rest, std::memory_order_release, std::memory_order_relaxed)){
+					// the consumer recycled meanwhile, hang its nodes after ours
+					auto last = rest;
+					while (auto next = last->next.load(std::memory_order_relaxed)){
+						last = next;
+					}
+					AddFree(rest, last);
+				}
+			}
+			return node;
+		}
+
+		void Recycle(Node* node){
+			// drop what the value holds now rather than on reuse
+			node->value = T();
+			AddFree(node, node);
+		}
+
+		// puts the chain from first to last onto the free nodes
+		void AddFree(Node* first, Node* last){
+			auto top = free_.load(std::memory_order_relaxed);
+			do{
+				last->next.store(top, std::memory_order_relaxed);
+			} while (!free_.compare_exchange_weak(top, first, std::memory_order_release, std::memory_order_relaxed));
+		}
+	};
+}
+
+#endif //MPSC_QUEUE_H_
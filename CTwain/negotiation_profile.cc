@@ -0,0 +1,174 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <algorithm>
+#include <cstring>
+#include "negotiation_profile.h"
+#include "capability_cache.h"
+
+using namespace std;
+
+namespace ctwain{
+
+	namespace{
+		// negotiation order from the spec's dependency notes. device and transfer setup first,
+		// then units and pixel layout, then anything sized in those units.
+		struct CapRank{
+			TW_UINT16 Cap;
+			int Rank;
+		};
+
+		const CapRank kRanks[] = {
+			{ CAP_CAMERASIDE, 0 },
+			{ CAP_FEEDERENABLED, 1 },
+			{ ICAP_LIGHTPATH, 1 },
+			{ CAP_DUPLEXENABLED, 2 },
+			{ CAP_AUTOFEED, 2 },
+			{ ICAP_XFERMECH, 3 },
+			{ ICAP_IMAGEFILEFORMAT, 4 },
+			{ ICAP_UNITS, 5 },
+			{ ICAP_PIXELTYPE, 6 },
+			{ ICAP_BITDEPTH, 7 },
+			{ ICAP_BITDEPTHREDUCTION, 8 },
+			{ ICAP_PIXELFLAVOR, 8 },
+			{ ICAP_THRESHOLD, 9 },
+			{ ICAP_HALFTONES, 9 },
+			{ ICAP_COMPRESSION, 10 },
+			{ ICAP_JPEGPIXELTYPE, 11 },
+			{ ICAP_XRESOLUTION, 12 },
+			{ ICAP_YRESOLUTION, 12 },
+			{ ICAP_AUTOMATICBORDERDETECTION, 13 },
+			{ ICAP_UNDEFINEDIMAGESIZE, 14 },
+			{ ICAP_SUPPORTEDSIZES, 15 },
+			{ ICAP_ORIENTATION, 16 },
+			{ ICAP_FRAMES, 17 },
+			{ CAP_XFERCOUNT, 100 },
+		};
+		const int kDefaultRank = 50;
+
+		void PackItem(TW_UINT16 itemType, TW_UINT32 value, TW_UINT8* item){
+			switch (CapabilityCache::ItemSize(itemType)){
+			case 1:
+				*item = static_cast<TW_UINT8>(value);
+				break;
+			case 2:
+			{
+				auto small = static_cast<TW_UINT16>(value);
+				memcpy(item, &small, sizeof(small));
+				break;
+			}
+			default:
+				memcpy(item, &value, sizeof(value));
+				break;
+			}
+		}
+	}
+
+	NegotiationProfile& NegotiationProfile::Add(TW_UINT16 cap, TW_UINT16 itemType, TW_UINT32 value){
+		return AddEntry(cap, TWON_ONEVALUE, itemType, vector<TW_UINT32>{ value }, 0);
+	}
+
+	NegotiationProfile& NegotiationProfile::Add(TW_UINT16 cap, TW_FIX32 value){
+		return AddRaw(cap, TWTY_FIX32, &value, sizeof(value));
+	}
+
+	NegotiationProfile& NegotiationProfile::Add(TW_UINT16 cap, const TW_FRAME& value){
+		return AddRaw(cap, TWTY_FRAME, &value, sizeof(value));
+	}
+
+	NegotiationProfile& NegotiationProfile::Add(TW_UINT16 cap, TW_UINT16 itemType, const string& value){
+		size_t size = CapabilityCache::ItemSize(itemType);
+		if (size == 0){
+			itemType = TWTY_STR255;
+			size = CapabilityCache::ItemSize(itemType);
+		}
+		vector<char> text(size, '\0');
+		memcpy(text.data(), value.c_str(), min(value.size(), size - 1));
+		return AddRaw(cap, itemType, text.data(), size);
+	}
+
+	NegotiationProfile& NegotiationProfile::AddEnumeration(TW_UINT16 cap, TW_UINT16 itemType, const vector<TW_UINT32>& values, TW_UINT32 currentIndex){
+		return AddEntry(cap, TWON_ENUMERATION, itemType, values, currentIndex);
+	}
+
+	NegotiationProfile& NegotiationProfile::AddArray(TW_UINT16 cap, TW_UINT16 itemType, const vector<TW_UINT32>& values){
+		return AddEntry(cap, TWON_ARRAY, itemType, values, 0);
+	}
+
+	NegotiationProfile& NegotiationProfile::AddEntry(TW_UINT16 cap, TW_UINT16 conType, TW_UINT16 itemType,
+		const vector<TW_UINT32>& values, TW_UINT32 currentIndex){
+
+		NegotiationEntry entry;
+		entry.Cap = cap;
+		entry.ConType = conType;
+		entry.ItemType = itemType;
+		entry.NumItems = static_cast<TW_UINT32>(values.size());
+		entry.CurrentIndex = currentIndex;
+
+		size_t size = CapabilityCache::ItemSize(itemType);
+		entry.Items.resize(size * values.size());
+		for (size_t i = 0; i < values.size(); i++){
+			PackItem(itemType, values[i], entry.Items.data() + i * size);
+		}
+		entries_.push_back(std::move(entry));
+		return *this;
+	}
+
+	NegotiationProfile& NegotiationProfile::AddRaw(TW_UINT16 cap, TW_UINT16 itemType, const void* item, size_t size){
+		NegotiationEntry entry;
+		entry.Cap = cap;
+		entry.ConType = TWON_ONEVALUE;
+		entry.ItemType = itemType;
+		entry.NumItems = 1;
+		entry.CurrentIndex = 0;
+		entry.Items.resize(size);
+		memcpy(entry.Items.data(), item, size);
+		entries_.push_back(std::move(entry));
+		return *this;
+	}
+
+	vector<NegotiationEntry> NegotiationProfile::Ordered() const{
+		vector<NegotiationEntry> ordered{ entries_ };
+		stable_sort(ordered.begin(), ordered.end(),
+			[](const NegotiationEntry& a, const NegotiationEntry& b){ return Rank(a.Cap) < Rank(b.Cap); });
+		return ordered;
+	}
+
+	vector<TW_UINT16> NegotiationProfile::Caps() const{
+		vector<TW_UINT16> caps;
+		for (auto& entry : entries_){
+			caps.push_back(entry.Cap);
+		}
+		return caps;
+	}
+
+	int NegotiationProfile::Rank(TW_UINT16 cap){
+		for (auto& rank : kRanks){
+			if (rank.Cap == cap){
+				return rank.Rank;
+			}
+		}
+		return kDefaultRank;
+	}
+}
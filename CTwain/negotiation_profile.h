@@ -0,0 +1,206 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef NEGOTIATION_PROFILE_H_
+#define NEGOTIATION_PROFILE_H_
+
+#include <string>
+#include <vector>
+#include "twain2.3.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// One capability value to negotiate.
+	/// </summary>
+	struct NegotiationEntry{
+		/// <summary>
+		/// Gets the CAP_* or ICAP_* value.
+		/// </summary>
+		TW_UINT16 Cap;
+
+		/// <summary>
+		/// Gets the TWON_* container to send, TWON_ONEVALUE, TWON_ENUMERATION or TWON_ARRAY.
+		/// </summary>
+		TW_UINT16 ConType;
+
+		/// <summary>
+		/// Gets the TWTY_* item type.
+		/// </summary>
+		TW_UINT16 ItemType;
+
+		/// <summary>
+		/// Gets the number of items.
+		/// </summary>
+		TW_UINT32 NumItems;
+
+		/// <summary>
+		/// Gets the current index for enumerations.
+		/// </summary>
+		TW_UINT32 CurrentIndex;
+
+		/// <summary>
+		/// Gets the items packed as the source expects them in the container.
+		/// </summary>
+		std::vector<TW_UINT8> Items;
+	};
+
+	/// <summary>
+	/// How a capability in a profile was handled.
+	/// </summary>
+	enum class NegotiationOutcome{
+		/// <summary>
+		/// The current value already matched so nothing was sent.
+		/// </summary>
+		kUnchanged,
+		/// <summary>
+		/// The value was set.
+		/// </summary>
+		kSet,
+		/// <summary>
+		/// The source accepted the value but changed it or other caps (TWRC_CHECKSTATUS).
+		/// </summary>
+		kSetWithChanges,
+		/// <summary>
+		/// The source does not support setting the cap so nothing was sent.
+		/// </summary>
+		kUnsupported,
+		/// <summary>
+		/// The source rejected the value.
+		/// </summary>
+		kFailed
+	};
+
+	/// <summary>
+	/// The result of applying one profile entry.
+	/// </summary>
+	struct NegotiationResult{
+		/// <summary>
+		/// Gets the CAP_* or ICAP_* value.
+		/// </summary>
+		TW_UINT16 Cap;
+
+		/// <summary>
+		/// Gets how the cap was handled.
+		/// </summary>
+		NegotiationOutcome Outcome;
+
+		/// <summary>
+		/// Gets the return code of the set call, TWRC_SUCCESS if nothing was sent.
+		/// </summary>
+		TW_UINT16 ReturnCode;
+
+		/// <summary>
+		/// Gets the source condition code when the set failed.
+		/// </summary>
+		TW_UINT16 ConditionCode;
+
+		/// <summary>
+		/// Gets the time spent on this cap in microseconds, including the comparison.
+		/// </summary>
+		long long Microseconds;
+	};
+
+	/// <summary>
+	/// An ordered set of capability values to apply to a source in one go
+	/// with <see cref="TwainSession::ApplyProfile"/>.
+	/// Entries are applied in dependency order (e.g. ICAP_PIXELTYPE before ICAP_BITDEPTH)
+	/// and only when the cached current value differs.
+	/// </summary>
+	class NegotiationProfile
+	{
+	public:
+		/// <summary>
+		/// Adds an integer or bool value (TWTY_INT8 to TWTY_BOOL).
+		/// </summary>
+		/// <param name="cap">The capability.</param>
+		/// <param name="itemType">The TWTY_* type the source uses for the cap.</param>
+		/// <param name="value">The value.</param>
+		NegotiationProfile& Add(TW_UINT16 cap, TW_UINT16 itemType, TW_UINT32 value);
+
+		/// <summary>
+		/// Adds a fixed point value.
+		/// </summary>
+		NegotiationProfile& Add(TW_UINT16 cap, TW_FIX32 value);
+
+		/// <summary>
+		/// Adds a frame value.
+		/// </summary>
+		NegotiationProfile& Add(TW_UINT16 cap, const TW_FRAME& value);
+
+		/// <summary>
+		/// Adds a string value.
+		/// </summary>
+		/// <param name="cap">The capability.</param>
+		/// <param name="itemType">The TWTY_STR* type the source uses for the cap.</param>
+		/// <param name="value">The value, truncated to fit the type.</param>
+		NegotiationProfile& Add(TW_UINT16 cap, TW_UINT16 itemType, const std::string& value);
+
+		/// <summary>
+		/// Adds an enumeration of integer values to constrain the cap to.
+		/// </summary>
+		/// <param name="cap">The capability.</param>
+		/// <param name="itemType">The TWTY_* integer type the source uses for the cap.</param>
+		/// <param name="values">The allowed values.</param>
+		/// <param name="currentIndex">The index of the value to make current.</param>
+		NegotiationProfile& AddEnumeration(TW_UINT16 cap, TW_UINT16 itemType, const std::vector<TW_UINT32>& values, TW_UINT32 currentIndex);
+
+		/// <summary>
+		/// Adds an array of integer values.
+		/// </summary>
+		/// <param name="cap">The capability.</param>
+		/// <param name="itemType">The TWTY_* integer type the source uses for the cap.</param>
+		/// <param name="values">The values.</param>
+		NegotiationProfile& AddArray(TW_UINT16 cap, TW_UINT16 itemType, const std::vector<TW_UINT32>& values);
+
+		/// <summary>
+		/// Gets the entries in the order they were added.
+		/// </summary>
+		const std::vector<NegotiationEntry>& entries() const{ return entries_; }
+
+		/// <summary>
+		/// Gets the entries in the order they should be applied.
+		/// Caps that others depend on come first, the rest keep the order they were added in.
+		/// </summary>
+		std::vector<NegotiationEntry> Ordered() const;
+
+		/// <summary>
+		/// Gets the capability list of this profile, e.g. for <see cref="TwainSession::CacheCapabilities"/>.
+		/// </summary>
+		std::vector<TW_UINT16> Caps() const;
+
+		/// <summary>
+		/// Gets the negotiation rank of a capability, lower ranks are applied first.
+		/// </summary>
+		static int Rank(TW_UINT16 cap);
+
+	private:
+		std::vector<NegotiationEntry> entries_;
+
+		NegotiationProfile& AddEntry(TW_UINT16 cap, TW_UINT16 conType, TW_UINT16 itemType,
+			const std::vector<TW_UINT32>& values, TW_UINT32 currentIndex);
+		NegotiationProfile& AddRaw(TW_UINT16 cap, TW_UINT16 itemType, const void* item, size_t size);
+	};
+}
+
+#endif //NEGOTIATION_PROFILE_H_
@@ -0,0 +1,226 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <algorithm>
+#include <cstring>
+#include "FreeImage.h"
+#include "page_encoder.h"
+#include "dib_view.h"
+#include "logger.h"
+#include "pixel_kernels.h"
+
+namespace ctwain{
+
+	namespace{
+
+		struct BitmapDeleter{
+			void operator()(FIBITMAP* bitmap) const{ FreeImage_Unload(bitmap); }
+		};
+		typedef std::unique_ptr<FIBITMAP, BitmapDeleter> Bitmap;
+
+		const double kMetersPerInch = 0.0254;
+
+		void SetGrayPalette(FIBITMAP* bitmap, unsigned colors){
+			auto palette = FreeImage_GetPalette(bitmap);
+			for (unsigned i = 0; i < colors; i++){
+				auto gray = static_cast<BYTE>(i * 255 / (colors - 1));
+				palette[i].rgbRed = palette[i].rgbGreen = palette[i].rgbBlue = gray;
+				palette[i].rgbReserved = 0;
+			}
+		}
+
+		unsigned DotsPerMeter(const TW_FIX32& resolution){
+			double dpi = resolution.Whole + resolution.Frac / 65536.0;
+			return dpi > 0 ? static_cast<unsigned>(dpi / kMetersPerInch + 0.5) : 0;
+		}
+
+		Bitmap FromDib(const TransferredPage& page){
+			DibView dib(page.native_data());
+			if (!dib.valid()){
+				return nullptr;
+			}
+			auto width = static_cast<int>(dib.width());
+			auto height = static_cast<int>(dib.height());
+			Bitmap bitmap(FreeImage_Allocate(width, height, dib.bit_depth(), dib.red_mask(), dib.green_mask(), dib.blue_mask()));
+			if (!bitmap){
+				return nullptr;
+			}
+			// FreeImage rows are bottom-up like most DIBs so this is usually a straight copy
+			size_t rowBytes = (static_cast<size_t>(width) * dib.bit_depth() + 7) / 8;
+			for (int y = 0; y < height; y++){
+				memcpy(FreeImage_GetScanLine(bitmap.get(), height - 1 - y), dib.row(y), rowBytes);
+			}
+			if (dib.bit_depth() <= 8){
+				auto colors = std::min<TW_UINT32>(dib.palette_size(), 1u << dib.bit_depth());
+				memcpy(FreeImage_GetPalette(bitmap.get()), dib.palette(), colors * 4);
+			}
+			if (dib.x_pels_per_meter() > 0 && dib.y_pels_per_meter() > 0){
+				FreeImage_SetDotsPerMeterX(bitmap.get(), dib.x_pels_per_meter());
+				FreeImage_SetDotsPerMeterY(bitmap.get(), dib.y_pels_per_meter());
+			}
+			return bitmap;
+		}
+
+		Bitmap FromMemory(const TransferredPage& page){
+			auto info = page.image_info();
+			if (!info || page.compression() != TWCP_NONE || info->Planar || info->PixelType == TWPT_PALETTE ||
+				info->ImageWidth <= 0 || info->ImageLength <= 0){
+				return nullptr;
+			}
+			int samples = info->SamplesPerPixel;
+			bool bitonal = samples == 1 && info->BitsPerPixel == 1;
+			bool deep = info->BitsPerPixel == samples * 16;
+			if ((samples != 1 && samples != 3) || (!bitonal && !deep && info->BitsPerPixel != samples * 8)){
+				return nullptr;
+			}
+			auto width = static_cast<int>(info->ImageWidth);
+			auto height = static_cast<int>(info->ImageLength);
+			size_t srcBytes = (static_cast<size_t>(width) * info->BitsPerPixel + 7) / 8;
+			if (page.bytes_per_row() < srcBytes || page.memory_size() < static_cast<size_t>(page.bytes_per_row()) * height){
+				return nullptr;
+			}
+
+			Bitmap bitmap(FreeImage_Allocate(width, height, bitonal ? 1 : samples * 8));
+			if (!bitmap){
+				return nullptr;
+			}
+			// memory transfers are top-down RGB, 16-bit samples are cut to 8 first
+			for (int y = 0; y < height; y++){
+				auto src = page.memory_data() + static_cast<size_t>(y) * page.bytes_per_row();
+				auto dst = FreeImage_GetScanLine(bitmap.get(), height - 1 - y);
+				if (deep){
+					PixelKernels::Reduce16To8(reinterpret_cast<const TW_UINT16*>(src), dst, static_cast<size_t>(width) * samples);
+					src = dst;
+				}
+#if FREEIMAGE_COLORORDER == FREEIMAGE_COLORORDER_BGR
+				if (samples == 3){
+					PixelKernels::SwapRedBlue(src, dst, width);
+					continue;
+				}
+#endif
+				if (src != dst){
+					memcpy(dst, src, bitonal ? (width + 7) / 8 : static_cast<size_t>(width) * samples);
+				}
+			}
+			if (samples == 1){
+				// bitonal is taken as TWPF_CHOCOLATE, 0 is black
+				SetGrayPalette(bitmap.get(), bitonal ? 2 : 256);
+			}
+			FreeImage_SetDotsPerMeterX(bitmap.get(), DotsPerMeter(info->XResolution));
+			FreeImage_SetDotsPerMeterY(bitmap.get(), DotsPerMeter(info->YResolution));
+			return bitmap;
+		}
+
+		Bitmap FromFile(const TransferredPage& page){
+			auto path = page.file_path().c_str();
+			auto format = FreeImage_GetFileType(path);
+			if (format == FIF_UNKNOWN){
+				format = FreeImage_GetFIFFromFilename(path);
+			}
+			if (format == FIF_UNKNOWN){
+				return nullptr;
+			}
+			return Bitmap(FreeImage_Load(format, path));
+		}
+	}
+
+	PageEncoder::PageEncoder(unsigned workers, size_t capacity, const EncodeOptions& options, PagePipeline::Completion completion) :
+		options_(options),
+		pipeline_(workers, capacity, [this](TransferredPage& page){
+			std::vector<TW_UINT8> encoded;
+			if (Encode(page, options_, encoded)){
+				page.set_encoded_data(std::move(encoded));
+			}
+			else{
+				CTWAIN_LOG_WARNING("Page %u could not be encoded.", static_cast<unsigned>(page.sequence()));
+			}
+			if (!options_.KeepTransferData){
+				page.FreeTransferData();
+			}
+		}, completion)
+	{
+	}
+
+	bool PageEncoder::Encode(const TransferredPage& page, const EncodeOptions& options, std::vector<TW_UINT8>& encoded){
+		Bitmap bitmap;
+		if (page.native_data()){
+			bitmap = FromDib(page);
+		}
+		else if (page.memory_data()){
+			bitmap = FromMemory(page);
+		}
+		else if (!page.file_path().empty()){
+			bitmap = FromFile(page);
+		}
+		if (!bitmap){
+			return false;
+		}
+
+		auto bpp = FreeImage_GetBPP(bitmap.get());
+		FREE_IMAGE_FORMAT format;
+		int flags;
+		switch (options.Format){
+		case EncodeFormat::kJpeg:
+			format = FIF_JPEG;
+			flags = std::max(1, std::min(options.JpegQuality, 100)) | (options.JpegProgressive ? JPEG_PROGRESSIVE : 0);
+			break;
+		case EncodeFormat::kPng:
+			format = FIF_PNG;
+			flags = options.PngLevel <= 0 ? PNG_Z_NO_COMPRESSION : std::min(options.PngLevel, 9);
+			break;
+		default:
+			format = FIF_TIFF;
+			if (options.Tiff == TiffCompression::kNone){
+				flags = TIFF_NONE;
+			}
+			else{
+				flags = options.Tiff == TiffCompression::kG4 && bpp == 1 ? TIFF_CCITTFAX4 : TIFF_LZW;
+			}
+			break;
+		}
+
+		// such as JPEG of a bitonal page
+		if (!FreeImage_FIFSupportsExportBPP(format, bpp)){
+			Bitmap converted(bpp <= 8 ? FreeImage_ConvertTo8Bits(bitmap.get()) : FreeImage_ConvertTo24Bits(bitmap.get()));
+			if (!converted){
+				return false;
+			}
+			bitmap = std::move(converted);
+		}
+
+		auto stream = FreeImage_OpenMemory();
+		if (!stream){
+			return false;
+		}
+		BYTE* data = nullptr;
+		DWORD size = 0;
+		bool saved = FreeImage_SaveToMemory(format, bitmap.get(), stream, flags) &&
+			FreeImage_AcquireMemory(stream, &data, &size);
+		if (saved){
+			encoded.assign(data, data + size);
+		}
+		FreeImage_CloseMemory(stream);
+		return saved;
+	}
+}
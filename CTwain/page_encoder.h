@@ -0,0 +1,160 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef PAGE_ENCODER_H_
+#define PAGE_ENCODER_H_
+
+#include <memory>
+#include <vector>
+#include "page_pipeline.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// The file formats <see cref="PageEncoder"/> can write.
+	/// </summary>
+	enum class EncodeFormat{
+		/// <summary>
+		/// TIFF, compressed as set by <see cref="EncodeOptions::Tiff"/>.
+		/// </summary>
+		kTiff,
+		/// <summary>
+		/// JPEG, bitonal pages are written as grayscale.
+		/// </summary>
+		kJpeg,
+		/// <summary>
+		/// PNG.
+		/// </summary>
+		kPng
+	};
+
+	/// <summary>
+	/// TIFF compression for <see cref="PageEncoder"/>.
+	/// </summary>
+	enum class TiffCompression{
+		/// <summary>
+		/// No compression.
+		/// </summary>
+		kNone,
+		/// <summary>
+		/// LZW.
+		/// </summary>
+		kLzw,
+		/// <summary>
+		/// CCITT group 4 for bitonal pages, LZW for the others.
+		/// </summary>
+		kG4
+	};
+
+	/// <summary>
+	/// How <see cref="PageEncoder"/> writes pages, with options for each format.
+	/// </summary>
+	struct EncodeOptions{
+		/// <summary>
+		/// Gets or sets the file format.
+		/// </summary>
+		EncodeFormat Format = EncodeFormat::kTiff;
+
+		/// <summary>
+		/// Gets or sets the TIFF compression.
+		/// </summary>
+		TiffCompression Tiff = TiffCompression::kG4;
+
+		/// <summary>
+		/// Gets or sets the JPEG quality, 1 to 100.
+		/// </summary>
+		int JpegQuality = 75;
+
+		/// <summary>
+		/// Gets or sets whether JPEG is written progressive.
+		/// </summary>
+		bool JpegProgressive = false;
+
+		/// <summary>
+		/// Gets or sets the PNG zlib level, 0 (none) to 9.
+		/// </summary>
+		int PngLevel = 6;
+
+		/// <summary>
+		/// Gets or sets whether the transferred data is kept after encoding.
+		/// By default it is freed so only the encoded data stays in memory.
+		/// </summary>
+		bool KeepTransferData = false;
+	};
+
+	/// <summary>
+	/// Encodes transferred pages with FreeImage on a pool of worker threads and hands them back
+	/// in page order with <see cref="TransferredPage::encoded_data"/> set, left empty if a page
+	/// couldn't be encoded. Native DIB pages, uncompressed memory transfer pages and file transfer
+	/// pages FreeImage can read are supported.
+	/// Pages can come from <see cref="TwainSession::OnPageCompleted"/>, or <see cref="Encode"/>
+	/// can be called from <see cref="TwainSession::OnProcessPage"/> to use the session's own pipeline.
+	/// Using this class requires linking FreeImage.
+	/// </summary>
+	class PageEncoder
+	{
+	public:
+		/// <summary>
+		/// Initializes a new instance of the <see cref="PageEncoder"/> class and starts its workers.
+		/// </summary>
+		/// <param name="workers">The number of worker threads.</param>
+		/// <param name="capacity">The most pages allowed in the encoder before <see cref="Push"/> blocks.</param>
+		/// <param name="options">How to encode.</param>
+		/// <param name="completion">Called on a worker thread for each encoded page, one at a time in push order.</param>
+		PageEncoder(unsigned workers, size_t capacity, const EncodeOptions& options, PagePipeline::Completion completion);
+
+		PageEncoder(const PageEncoder&) = delete;
+		PageEncoder& operator=(const PageEncoder&) = delete;
+
+		/// <summary>
+		/// Adds a page to encode. Blocks while the encoder is at capacity.
+		/// </summary>
+		/// <param name="page">The page.</param>
+		void Push(std::unique_ptr<TransferredPage> page){ pipeline_.Push(std::move(page)); }
+
+		/// <summary>
+		/// Waits until every pushed page has been completed.
+		/// </summary>
+		void Flush(){ pipeline_.Flush(); }
+
+		/// <summary>
+		/// Gets the number of pages pushed but not yet completed.
+		/// </summary>
+		size_t pending() const{ return pipeline_.pending(); }
+
+		/// <summary>
+		/// Encodes one page on the calling thread.
+		/// </summary>
+		/// <param name="page">The page.</param>
+		/// <param name="options">How to encode.</param>
+		/// <param name="encoded">The encoded file.</param>
+		/// <returns>false if the page data isn't supported or FreeImage failed.</returns>
+		static bool Encode(const TransferredPage& page, const EncodeOptions& options, std::vector<TW_UINT8>& encoded);
+
+	private:
+		EncodeOptions options_;
+		PagePipeline pipeline_;
+	};
+}
+
+#endif //PAGE_ENCODER_H_
@@ -0,0 +1,134 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include "page_pipeline.h"
+
+using namespace std;
+
+namespace ctwain{
+
+	PagePipeline::PagePipeline(unsigned workers, size_t capacity, Processor processor, Completion completion) :
+		processor_(processor), completion_(completion), capacity_{ capacity > 0 ? capacity : 1 }
+	{
+		// no more than capacity pages are ever queued or waiting to complete
+		queue_.resize(capacity_);
+		processed_.resize(capacity_);
+		if (workers < 1){
+			workers = 1;
+		}
+		for (unsigned i = 0; i < workers; i++){
+			workers_.emplace_back([this](){ Run(); });
+		}
+	}
+
+	PagePipeline::~PagePipeline()
+	{
+		Flush();
+		{
+			lock_guard<mutex> lk(mutex_);
+			stopping_ = true;
+		}
+		work_ready_.notify_all();
+		for (auto& worker : workers_){
+			worker.join();
+		}
+	}
+
+	void PagePipeline::Push(unique_ptr<TransferredPage> page){
+		unique_lock<mutex> lk(mutex_);
+		while (in_flight_ >= capacity_){
+			space_ready_.wait(lk);
+		}
+		in_flight_++;
+		auto& entry = queue_[(queue_start_ + queue_count_) % capacity_];
+		entry.Order = next_order_++;
+		entry.Page = std::move(page);
+		queue_count_++;
+		lk.unlock();
+		work_ready_.notify_one();
+	}
+
+	void PagePipeline::Flush(){
+		unique_lock<mutex> lk(mutex_);
+		while (in_flight_ > 0){
+			space_ready_.wait(lk);
+		}
+	}
+
+	size_t PagePipeline::pending() const{
+		lock_guard<mutex> lk(mutex_);
+		return in_flight_;
+	}
+
+	void PagePipeline::Run(){
+		unique_lock<mutex> lk(mutex_);
+		while (true){
+			while (queue_count_ == 0 && !stopping_){
+				work_ready_.wait(lk);
+			}
+			if (queue_count_ == 0){
+				return;
+			}
+
+			Entry entry = std::move(queue_[queue_start_]);
+			queue_start_ = (queue_start_ + 1) % capacity_;
+			queue_count_--;
+			lk.unlock();
+
+			if (processor_ && entry.Page){
+				processor_(*entry.Page);
+			}
+
+			lk.lock();
+			// the pages in flight have consecutive orders so they never share a slot
+			auto& processed = processed_[entry.Order % capacity_];
+			processed.Ready = true;
+			processed.Page = std::move(entry.Page);
+
+			// only one worker completes at a time, it keeps going while the next page in order is ready
+			if (completing_){
+				continue;
+			}
+			completing_ = true;
+			auto next = &processed_[next_completion_ % capacity_];
+			while (next->Ready){
+				auto page = std::move(next->Page);
+				next->Ready = false;
+				next_completion_++;
+				lk.unlock();
+
+				if (completion_){
+					completion_(std::move(page));
+				}
+				page.reset();
+
+				lk.lock();
+				in_flight_--;
+				space_ready_.notify_all();
+				next = &processed_[next_completion_ % capacity_];
+			}
+			completing_ = false;
+		}
+	}
+}
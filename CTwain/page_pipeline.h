@@ -0,0 +1,124 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef PAGE_PIPELINE_H_
+#define PAGE_PIPELINE_H_
+
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "transferred_page.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// A bounded queue of transferred pages processed by a pool of worker threads.
+	/// Pages are processed in parallel but completed one at a time in the order they were pushed.
+	/// Its queues are sized to the capacity up front, so moving pages through it doesn't allocate.
+	/// </summary>
+	class PagePipeline
+	{
+	public:
+		/// <summary>
+		/// Called on a worker thread for each page, possibly for several pages at once.
+		/// </summary>
+		typedef std::function<void(TransferredPage&)> Processor;
+
+		/// <summary>
+		/// Called on a worker thread for each processed page, one page at a time in push order.
+		/// </summary>
+		typedef std::function<void(std::unique_ptr<TransferredPage>)> Completion;
+
+		/// <summary>
+		/// Initializes a new instance of the <see cref="PagePipeline"/> class and starts its workers.
+		/// </summary>
+		/// <param name="workers">The number of worker threads.</param>
+		/// <param name="capacity">The most pages allowed in the pipeline before <see cref="Push"/> blocks.</param>
+		/// <param name="processor">The parallel processing step.</param>
+		/// <param name="completion">The in-order completion step.</param>
+		PagePipeline(unsigned workers, size_t capacity, Processor processor, Completion completion);
+
+		/// <summary>
+		/// Finishes every pushed page and stops the workers.
+		/// </summary>
+		~PagePipeline();
+
+		PagePipeline(const PagePipeline&) = delete;
+		PagePipeline& operator=(const PagePipeline&) = delete;
+
+		/// <summary>
+		/// Adds a page to the pipeline. Blocks while the pipeline is at capacity.
+		/// </summary>
+		/// <param name="page">The page.</param>
+		void Push(std::unique_ptr<TransferredPage> page);
+
+		/// <summary>
+		/// Waits until every pushed page has been completed.
+		/// </summary>
+		void Flush();
+
+		/// <summary>
+		/// Gets the number of pages pushed but not yet completed.
+		/// </summary>
+		size_t pending() const;
+
+	private:
+		struct Entry{
+			unsigned long long Order;
+			std::unique_ptr<TransferredPage> Page;
+		};
+
+		struct Processed{
+			bool Ready;
+			std::unique_ptr<TransferredPage> Page;
+		};
+
+		Processor processor_;
+		Completion completion_;
+		size_t capacity_;
+
+		std::vector<std::thread> workers_;
+		mutable std::mutex mutex_;
+		std::condition_variable work_ready_;
+		std::condition_variable space_ready_;
+
+		// pages waiting for a worker, a ring of capacity entries
+		std::vector<Entry> queue_;
+		size_t queue_start_ = 0;
+		size_t queue_count_ = 0;
+		// pages waiting for their turn to complete, at their order modulo the capacity
+		std::vector<Processed> processed_;
+		unsigned long long next_order_ = 0;
+		unsigned long long next_completion_ = 0;
+		size_t in_flight_ = 0;
+		bool completing_ = false;
+		bool stopping_ = false;
+
+		void Run();
+	};
+}
+
+#endif //PAGE_PIPELINE_H_
@@ -0,0 +1,227 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <atomic>
+#include <chrono>
+#include <new>
+#include "page_ring.h"
+
+namespace ctwain{
+
+	namespace{
+		const TW_UINT32 kMagic = 0x54575052; // TWPR
+		const size_t kArenaAlignment = 4096;
+
+		size_t AlignUp(size_t value, size_t alignment){
+			return (value + alignment - 1) / alignment * alignment;
+		}
+	}
+
+	// the counters only ever grow, positions are taken modulo the slot count and arena size.
+	// 64 bit atomics are lock-free on every target so they work across processes
+	struct PageRing::Header{
+		TW_UINT32 Magic;
+		TW_UINT32 DescriptorSize;
+		TW_UINT32 SlotCount;
+		TW_UINT32 Reserved;
+		unsigned long long ArenaSize;
+		std::atomic<unsigned long long> Published;
+		std::atomic<unsigned long long> Freed;
+		std::atomic<unsigned long long> ArenaFreed;
+		std::atomic<TW_UINT32> Closed;
+		std::atomic<unsigned long long> Heartbeat;
+	};
+
+	bool PageRing::Create(const std::string& name, size_t arena_size, TW_UINT32 slot_count){
+		return Connect(name, arena_size, slot_count, true);
+	}
+
+	bool PageRing::Open(const std::string& name, size_t arena_size, TW_UINT32 slot_count){
+		return Connect(name, arena_size, slot_count, false);
+	}
+
+	bool PageRing::Connect(const std::string& name, size_t arena_size, TW_UINT32 slot_count, bool create){
+		Close();
+		if (arena_size == 0 || slot_count == 0){
+			return false;
+		}
+		arena_size = AlignUp(arena_size, kAlignment);
+		auto slotsOffset = AlignUp(sizeof(Header), kAlignment);
+		auto arenaOffset = AlignUp(slotsOffset + sizeof(PageDescriptor) * slot_count, kArenaAlignment);
+
+		bool connected = create ?
+			memory_.Create(name, arenaOffset + arena_size) && published_.Create(name + "-published") && released_.Create(name + "-released") :
+			memory_.Open(name, arenaOffset + arena_size) && published_.Open(name + "-published") && released_.Open(name + "-released");
+		if (!connected){
+			Close();
+			return false;
+		}
+
+		if (create){
+			// the memory comes zeroed
+			header_ = new (memory_.data()) Header();
+			header_->DescriptorSize = sizeof(PageDescriptor);
+			header_->SlotCount = slot_count;
+			header_->ArenaSize = arena_size;
+			std::atomic_thread_fence(std::memory_order_release);
+			header_->Magic = kMagic;
+		}
+		else{
+			header_ = reinterpret_cast<Header*>(memory_.data());
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (header_->Magic != kMagic || header_->DescriptorSize != sizeof(PageDescriptor) ||
+				header_->SlotCount != slot_count || header_->ArenaSize != arena_size){
+				header_ = nullptr;
+				Close();
+				return false;
+			}
+		}
+		slots_ = reinterpret_cast<PageDescriptor*>(memory_.data() + slotsOffset);
+		arena_ = memory_.data() + arenaOffset;
+		arena_size_ = arena_size;
+		slot_count_ = slot_count;
+		released_slots_.assign(slot_count, false);
+		return true;
+	}
+
+	void PageRing::Close(){
+		if (header_){
+			header_->Closed.store(1, std::memory_order_release);
+			// both ends may be waiting
+			published_.Post();
+			released_.Post();
+		}
+		header_ = nullptr;
+		slots_ = nullptr;
+		arena_ = nullptr;
+		arena_size_ = 0;
+		slot_count_ = 0;
+		written_ = 0;
+		reserved_ = false;
+		next_ = 0;
+		freed_ = 0;
+		published_.Close();
+		released_.Close();
+		memory_.Close();
+	}
+
+	bool PageRing::closed() const{
+		return !header_ || header_->Closed.load(std::memory_order_acquire) != 0;
+	}
+
+	void PageRing::Beat(){
+		if (header_){
+			header_->Heartbeat.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	unsigned long long PageRing::heartbeat() const{
+		return header_ ? header_->Heartbeat.load(std::memory_order_relaxed) : 0;
+	}
+
+	TW_UINT8* PageRing::Reserve(size_t size, unsigned milliseconds){
+		if (!header_ || size > arena_size_){
+			return nullptr;
+		}
+		auto padded = AlignUp(size, kAlignment);
+		// data doesn't wrap, an entry that doesn't fit the end of the arena starts over at the front
+		auto position = written_ % arena_size_;
+		auto skip = arena_size_ - position < padded ? arena_size_ - position : 0;
+		auto end = written_ + skip + padded;
+
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+		for (;;){
+			if (closed()){
+				return nullptr;
+			}
+			auto published = header_->Published.load(std::memory_order_relaxed);
+			if (published - header_->Freed.load(std::memory_order_acquire) < slot_count_ &&
+				end - header_->ArenaFreed.load(std::memory_order_acquire) <= arena_size_){
+				break;
+			}
+			auto now = std::chrono::steady_clock::now();
+			if (now >= deadline){
+				return nullptr;
+			}
+			// extra posts only cause another look
+			released_.Wait(static_cast<unsigned>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()) + 1);
+		}
+
+		reserved_offset_ = skip ? 0 : position;
+		reserved_end_ = end;
+		reserved_ = true;
+		return arena_ + reserved_offset_;
+	}
+
+	bool PageRing::Publish(PageDescriptor& descriptor, size_t size){
+		if (!header_ || !reserved_ || reserved_offset_ + size > arena_size_){
+			return false;
+		}
+		auto index = header_->Published.load(std::memory_order_relaxed);
+		descriptor.Index = index;
+		descriptor.Offset = reserved_offset_;
+		descriptor.Size = size;
+		descriptor.End = reserved_end_;
+		slots_[index % slot_count_] = descriptor;
+		header_->Published.store(index + 1, std::memory_order_release);
+		written_ = reserved_end_;
+		reserved_ = false;
+		published_.Post();
+		return true;
+	}
+
+	bool PageRing::Next(PageDescriptor& descriptor, unsigned milliseconds){
+		if (!header_ || (closed() && header_->Published.load(std::memory_order_acquire) == next_)){
+			return false;
+		}
+		// one post per entry, or the wakeup from closing
+		if (!published_.Wait(milliseconds) || header_->Published.load(std::memory_order_acquire) == next_){
+			return false;
+		}
+		descriptor = slots_[next_ % slot_count_];
+		next_++;
+		return true;
+	}
+
+	void PageRing::Release(const PageDescriptor& descriptor){
+		std::lock_guard<std::mutex> lock(release_mutex_);
+		if (!header_){
+			return;
+		}
+		released_slots_[descriptor.Index % slot_count_] = true;
+		auto freed = freed_;
+		while (released_slots_[freed % slot_count_]){
+			released_slots_[freed % slot_count_] = false;
+			freed++;
+		}
+		if (freed == freed_){
+			return;
+		}
+		// the producer doesn't touch a slot until it's freed so its end is still there
+		header_->ArenaFreed.store(slots_[(freed - 1) % slot_count_].End, std::memory_order_release);
+		header_->Freed.store(freed, std::memory_order_release);
+		freed_ = freed;
+		released_.Post();
+	}
+}
@@ -0,0 +1,279 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef PAGE_RING_H_
+#define PAGE_RING_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include "shared_memory.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// What a <see cref="PageDescriptor"/> passed between a <see cref="DriverHost"/> and its worker means.
+	/// </summary>
+	enum class HostMessage : TW_UINT16{
+		/// <summary>
+		/// From the worker: it opened the source or couldn't, see <see cref="PageDescriptor::Result"/>.
+		/// </summary>
+		kWorkerStarted = 1,
+		/// <summary>
+		/// From the worker: a native transfer, the data is the DIB.
+		/// </summary>
+		kNativePage,
+		/// <summary>
+		/// From the worker: a memory transfer, the data is the assembled page.
+		/// </summary>
+		kMemoryPage,
+		/// <summary>
+		/// From the worker: a file transfer, the data is the null terminated path.
+		/// </summary>
+		kFilePage,
+		/// <summary>
+		/// From the worker: the acquisition is over, see <see cref="PageDescriptor::Result"/>.
+		/// </summary>
+		kBatchEnded,
+		/// <summary>
+		/// To the worker: acquire once with the ICAP_XFERMECH in <see cref="PageDescriptor::Argument"/>.
+		/// </summary>
+		kAcquire,
+		/// <summary>
+		/// To the worker: cancel the acquisition.
+		/// </summary>
+		kCancel,
+		/// <summary>
+		/// To the worker: close the source and exit.
+		/// </summary>
+		kQuit,
+	};
+
+	/// <summary>
+	/// The small fixed size entry a <see cref="PageRing"/> carries. Page data stays in the ring's
+	/// shared arena and is only referenced from here. Both ends must be the same build since
+	/// this is shared as is.
+	/// </summary>
+	struct PageDescriptor{
+		/// <summary>
+		/// The <see cref="HostMessage"/>.
+		/// </summary>
+		HostMessage Message;
+
+		/// <summary>
+		/// The TWRC_* result of starting the worker or the acquisition.
+		/// </summary>
+		TW_UINT16 Result;
+
+		/// <summary>
+		/// The message argument.
+		/// </summary>
+		TW_UINT32 Argument;
+
+		/// <summary>
+		/// The page number within the worker's session, starting from 0.
+		/// </summary>
+		TW_UINT32 Sequence;
+
+		/// <summary>
+		/// The row stride of memory page data for uncompressed data.
+		/// </summary>
+		TW_UINT32 BytesPerRow;
+
+		/// <summary>
+		/// The compression of memory page data (TWCP_* value).
+		/// </summary>
+		TW_UINT16 Compression;
+
+		/// <summary>
+		/// The image file format of file and memory file pages.
+		/// </summary>
+		TW_UINT16 ImageFileFormat;
+
+		/// <summary>
+		/// Whether <see cref="ImageInfo"/> is set.
+		/// </summary>
+		TW_BOOL HasImageInfo;
+
+		/// <summary>
+		/// The final image information.
+		/// </summary>
+		TW_IMAGEINFO ImageInfo;
+
+		/// <summary>
+		/// The position of this entry in the ring, set by <see cref="PageRing::Publish"/>.
+		/// </summary>
+		unsigned long long Index;
+
+		/// <summary>
+		/// The offset of the data in the arena, set by <see cref="PageRing::Publish"/>.
+		/// </summary>
+		unsigned long long Offset;
+
+		/// <summary>
+		/// The size of the data, set by <see cref="PageRing::Publish"/>.
+		/// </summary>
+		unsigned long long Size;
+
+		/// <summary>
+		/// Where the arena is free from once this entry is released, set by <see cref="PageRing::Publish"/>.
+		/// </summary>
+		unsigned long long End;
+	};
+
+	/// <summary>
+	/// A single producer, single consumer queue of <see cref="PageDescriptor"/>s in shared memory,
+	/// with an arena alongside for the data they reference. The producer writes data into the arena
+	/// in place and publishes a descriptor for it, the consumer reads the data where it is and
+	/// releases the descriptor once done, so the data crosses the process boundary without being copied again.
+	/// Descriptors may be released in any order and from any thread, space is reclaimed in order.
+	/// The producer waits for space once the arena or the descriptors run out.
+	/// </summary>
+	class PageRing
+	{
+	public:
+		/// <summary>
+		/// The alignment of the data in the arena.
+		/// </summary>
+		static const size_t kAlignment = 64;
+
+		PageRing(){}
+
+		/// <summary>
+		/// Closes the ring if open.
+		/// </summary>
+		~PageRing(){ Close(); }
+
+		PageRing(const PageRing&) = delete;
+		PageRing& operator=(const PageRing&) = delete;
+
+		/// <summary>
+		/// Creates a new ring.
+		/// </summary>
+		/// <param name="name">The name the other end opens it by.</param>
+		/// <param name="arena_size">The bytes of data that can be in flight, at least the largest entry's.</param>
+		/// <param name="slot_count">The descriptors that can be in flight.</param>
+		/// <returns>false if the shared memory or semaphores couldn't be created.</returns>
+		bool Create(const std::string& name, size_t arena_size, TW_UINT32 slot_count);
+
+		/// <summary>
+		/// Opens a ring created by another process, with the same arguments as it was created.
+		/// </summary>
+		/// <returns>false if there is no such ring or it was created differently.</returns>
+		bool Open(const std::string& name, size_t arena_size, TW_UINT32 slot_count);
+
+		/// <summary>
+		/// Marks the ring closed, which wakes up the other end, and unmaps it.
+		/// </summary>
+		void Close();
+
+		/// <summary>
+		/// Gets a value indicating whether either end closed the ring.
+		/// </summary>
+		bool closed() const;
+
+		/// <summary>
+		/// Counts up the heartbeat the other end watches to tell a busy peer from a hung one.
+		/// Thread-safe.
+		/// </summary>
+		void Beat();
+
+		/// <summary>
+		/// Gets the number of <see cref="Beat"/>s so far from either end.
+		/// </summary>
+		unsigned long long heartbeat() const;
+
+		/// <summary>
+		/// Gets the size of the arena.
+		/// </summary>
+		size_t arena_size() const{ return arena_size_; }
+
+		/// <summary>
+		/// Waits for room for an entry and its data. Producer only, and needed before every
+		/// <see cref="Publish"/>, with a size of 0 for entries without data.
+		/// </summary>
+		/// <param name="size">The bytes of data.</param>
+		/// <param name="milliseconds">The most time to wait for the consumer to release entries.</param>
+		/// <returns>Where to write the data, or nullptr if there was no room in time, the ring
+		/// closed, or <paramref name="size"/> is larger than the arena.</returns>
+		TW_UINT8* Reserve(size_t size, unsigned milliseconds);
+
+		/// <summary>
+		/// Hands an entry to the consumer along with the data written to the last reservation.
+		/// Producer only.
+		/// </summary>
+		/// <param name="descriptor">The entry, whose ring fields are filled in here.</param>
+		/// <param name="size">The bytes of data written, at most what was reserved.</param>
+		/// <returns>false if nothing was reserved.</returns>
+		bool Publish(PageDescriptor& descriptor, size_t size);
+
+		/// <summary>
+		/// Takes the next entry. Consumer only. Every entry taken must be <see cref="Release"/>d.
+		/// </summary>
+		/// <param name="descriptor">The entry.</param>
+		/// <param name="milliseconds">The most time to wait for one.</param>
+		/// <returns>false if none came in time or the ring is closed and empty.</returns>
+		bool Next(PageDescriptor& descriptor, unsigned milliseconds);
+
+		/// <summary>
+		/// Gets the data of an entry taken with <see cref="Next"/>, valid until it is released.
+		/// </summary>
+		const TW_UINT8* data(const PageDescriptor& descriptor) const{ return arena_ + descriptor.Offset; }
+
+		/// <summary>
+		/// Gives an entry taken with <see cref="Next"/> back to the producer. Thread-safe.
+		/// </summary>
+		/// <param name="descriptor">The entry.</param>
+		void Release(const PageDescriptor& descriptor);
+
+	private:
+		struct Header;
+
+		SharedMemory memory_;
+		// posted for every entry published
+		SharedSemaphore published_;
+		// posted whenever released entries free up space
+		SharedSemaphore released_;
+		Header* header_ = nullptr;
+		PageDescriptor* slots_ = nullptr;
+		TW_UINT8* arena_ = nullptr;
+		size_t arena_size_ = 0;
+		TW_UINT32 slot_count_ = 0;
+
+		// producer side
+		unsigned long long written_ = 0;
+		unsigned long long reserved_offset_ = 0;
+		unsigned long long reserved_end_ = 0;
+		bool reserved_ = false;
+
+		// consumer side
+		unsigned long long next_ = 0;
+		std::mutex release_mutex_;
+		std::vector<bool> released_slots_;
+		unsigned long long freed_ = 0;
+
+		bool Connect(const std::string& name, size_t arena_size, TW_UINT32 slot_count, bool create);
+	};
+}
+
+#endif //PAGE_RING_H_
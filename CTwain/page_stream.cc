@@ -0,0 +1,118 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include "page_stream.h"
+
+namespace ctwain{
+
+	std::future<std::unique_ptr<TransferredPage>> PageStream::Next(){
+		Promise promise;
+		auto future = promise.get_future();
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (!pages_.empty()){
+			bool wasFull = pages_.size() >= capacity_;
+			promise.set_value(std::move(pages_.front()));
+			pages_.pop_front();
+			lock.unlock();
+			if (wasFull){
+				Wake();
+			}
+		}
+		else if (ended_ || canceled_){
+			promise.set_value(nullptr);
+		}
+		else{
+			waiters_.push_back(std::move(promise));
+		}
+		return future;
+	}
+
+	void PageStream::Cancel(){
+		std::deque<std::unique_ptr<TransferredPage>> dropped;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (canceled_){
+				return;
+			}
+			canceled_ = true;
+			dropped.swap(pages_);
+			for (auto& waiter : waiters_){
+				waiter.set_value(nullptr);
+			}
+			waiters_.clear();
+		}
+		Wake();
+	}
+
+	bool PageStream::canceled() const{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return canceled_;
+	}
+
+	bool PageStream::ended() const{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return ended_;
+	}
+
+	bool PageStream::full() const{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return pages_.size() >= capacity_;
+	}
+
+	void PageStream::Push(std::unique_ptr<TransferredPage> page){
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (ended_ || canceled_){
+			return;
+		}
+		if (!waiters_.empty()){
+			waiters_.front().set_value(std::move(page));
+			waiters_.pop_front();
+		}
+		else{
+			pages_.push_back(std::move(page));
+		}
+	}
+
+	void PageStream::End(){
+		std::lock_guard<std::mutex> lock(mutex_);
+		ended_ = true;
+		for (auto& waiter : waiters_){
+			waiter.set_value(nullptr);
+		}
+		waiters_.clear();
+	}
+
+	void PageStream::set_wakeup(Wakeup wakeup){
+		std::lock_guard<std::mutex> lock(wakeup_mutex_);
+		wakeup_ = std::move(wakeup);
+	}
+
+	void PageStream::Wake(){
+		// held while calling so the session can't go away in between
+		std::lock_guard<std::mutex> lock(wakeup_mutex_);
+		if (wakeup_){
+			wakeup_();
+		}
+	}
+}
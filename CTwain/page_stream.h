@@ -0,0 +1,146 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef PAGE_STREAM_H_
+#define PAGE_STREAM_H_
+
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include "transferred_page.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// Settings for <see cref="TwainSession::AcquireAsync"/>.
+	/// </summary>
+	struct AcquireOptions{
+		/// <summary>
+		/// How the source is enabled.
+		/// </summary>
+		EnableSourceMode Mode = EnableSourceMode::kHideUI;
+
+		/// <summary>
+		/// Whether the driver UI is modal.
+		/// </summary>
+		bool Modal = false;
+
+		/// <summary>
+		/// The most pages waiting in the stream before the session holds off the next transfer.
+		/// </summary>
+		size_t MaxQueuedPages = 4;
+	};
+
+	/// <summary>
+	/// The pages of one acquisition started with <see cref="TwainSession::AcquireAsync"/>, in transfer order.
+	/// Pages are pulled with <see cref="Next"/>, whose future can be waited on, polled, or continued from
+	/// any thread, so the consumer never runs on the session's event thread. When
+	/// <see cref="AcquireOptions::MaxQueuedPages"/> pages are waiting the session pauses between transfers
+	/// without blocking its event thread and carries on as soon as one is taken.
+	/// The stream may outlive the session. This class is thread-safe.
+	/// </summary>
+	class PageStream
+	{
+	public:
+		/// <summary>
+		/// Called when the stream has room again or got canceled. Runs on the consumer's thread.
+		/// </summary>
+		typedef std::function<void()> Wakeup;
+
+		/// <summary>
+		/// Initializes a new instance of the <see cref="PageStream"/> class.
+		/// </summary>
+		/// <param name="capacity">The most pages queued before <see cref="full"/> is true.</param>
+		explicit PageStream(size_t capacity) : capacity_(capacity ? capacity : 1){}
+
+		PageStream(const PageStream&) = delete;
+		PageStream& operator=(const PageStream&) = delete;
+
+		/// <summary>
+		/// Gets the next page. The future holds nullptr once the acquisition has ended,
+		/// whether every page was transferred, it was canceled, or the source went away.
+		/// Several calls can be outstanding and are served in order.
+		/// </summary>
+		std::future<std::unique_ptr<TransferredPage>> Next();
+
+		/// <summary>
+		/// Stops the acquisition. The source is told to drop its remaining transfers
+		/// before the next one starts, and the pages queued but not taken are freed.
+		/// Call this before letting go of a stream that hasn't ended, or a full stream
+		/// leaves the session waiting with the source enabled.
+		/// </summary>
+		void Cancel();
+
+		/// <summary>
+		/// Gets a value indicating whether <see cref="Cancel"/> has been called.
+		/// </summary>
+		bool canceled() const;
+
+		/// <summary>
+		/// Gets a value indicating whether the acquisition has ended. Queued pages can still be taken.
+		/// </summary>
+		bool ended() const;
+
+		/// <summary>
+		/// Gets a value indicating whether as many pages as allowed are waiting to be taken.
+		/// </summary>
+		bool full() const;
+
+		/// <summary>
+		/// Adds a page, handing it straight to a waiting <see cref="Next"/> if there is one.
+		/// Pages added after the stream ended or got canceled are freed. Used by the session.
+		/// </summary>
+		/// <param name="page">The page.</param>
+		void Push(std::unique_ptr<TransferredPage> page);
+
+		/// <summary>
+		/// Ends the acquisition, so <see cref="Next"/> gives nullptr once the queue is empty. Used by the session.
+		/// </summary>
+		void End();
+
+		/// <summary>
+		/// Sets what to call when the stream has room again or got canceled, nullptr to stop.
+		/// Returns only once a call in progress is done. Used by the session.
+		/// </summary>
+		/// <param name="wakeup">The function.</param>
+		void set_wakeup(Wakeup wakeup);
+
+	private:
+		typedef std::promise<std::unique_ptr<TransferredPage>> Promise;
+
+		mutable std::mutex mutex_;
+		std::mutex wakeup_mutex_;
+		size_t capacity_;
+		std::deque<std::unique_ptr<TransferredPage>> pages_;
+		std::deque<Promise> waiters_;
+		Wakeup wakeup_;
+		bool canceled_ = false;
+		bool ended_ = false;
+
+		void Wake();
+	};
+}
+
+#endif //PAGE_STREAM_H_
@@ -0,0 +1,783 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include "pixel_kernels.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CTWAIN_PIXELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC allows any intrinsic in any function
+#define CTWAIN_TARGET(isa)
+#else
+#include <cpuid.h>
+#define CTWAIN_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace ctwain{
+
+	namespace{
+
+		////////////////////////////////////////////////////////////////////////
+		// scalar versions, also used for the tails of the vector versions
+
+		void SwapRedBlueScalar(const uint8_t* src, uint8_t* dst, size_t pixels){
+			for (size_t i = 0; i < pixels; i++, src += 3, dst += 3){
+				auto first = src[0];
+				auto third = src[2];
+				dst[0] = third;
+				dst[1] = src[1];
+				dst[2] = first;
+			}
+		}
+
+		void SwapRowsScalar(uint8_t* a, uint8_t* b, size_t bytes){
+			std::swap_ranges(a, a + bytes, b);
+		}
+
+		void Unpack1To8Scalar(const uint8_t* src, uint8_t* dst, size_t pixels, uint8_t zero, uint8_t one){
+			for (size_t i = 0; i < pixels; i++){
+				dst[i] = (src[i >> 3] & (0x80 >> (i & 7))) ? one : zero;
+			}
+		}
+
+		void Reduce16To8Scalar(const uint16_t* src, uint8_t* dst, size_t samples){
+			for (size_t i = 0; i < samples; i++){
+				dst[i] = static_cast<uint8_t>(src[i] >> 8);
+			}
+		}
+
+		void ExpandPaletteScalar(const uint8_t* src, uint8_t* dst, size_t pixels, const uint8_t* palette){
+			// copy whole entries and let the next pixel overwrite the fourth byte
+			size_t i = 0;
+			for (; i + 1 < pixels; i++, dst += 3){
+				memcpy(dst, palette + src[i] * 4, 4);
+			}
+			if (i < pixels){
+				memcpy(dst, palette + src[i] * 4, 3);
+			}
+		}
+
+		void DeinterleaveScalar(const uint8_t* src, uint8_t* const* planes, size_t pixels, int channels){
+			for (int c = 0; c < channels; c++){
+				auto plane = planes[c];
+				auto sample = src + c;
+				for (size_t i = 0; i < pixels; i++, sample += channels){
+					plane[i] = *sample;
+				}
+			}
+		}
+
+		void AccumulateSamplesScalar(const uint8_t* src, size_t samples, uint8_t threshold, SampleStats& stats){
+			unsigned long long sum = 0;
+			unsigned long long squares = 0;
+			unsigned long long dark = 0;
+			for (size_t i = 0; i < samples; i++){
+				unsigned value = src[i];
+				sum += value;
+				squares += value * value;
+				dark += value < threshold ? 1 : 0;
+			}
+			stats.Count += samples;
+			stats.Sum += sum;
+			stats.SumOfSquares += squares;
+			stats.Dark += dark;
+		}
+
+		void AddToSumsScalar(const uint8_t* src, uint16_t* sums, size_t samples){
+			for (size_t i = 0; i < samples; i++){
+				sums[i] = static_cast<uint16_t>(sums[i] + src[i]);
+			}
+		}
+
+		size_t CountBitsScalar(const uint8_t* src, size_t bytes){
+			// add up bit pairs, then nibbles, then bytes, 8 bytes at a time
+			size_t count = 0;
+			size_t i = 0;
+			for (; i + 8 <= bytes; i += 8){
+				uint64_t v;
+				memcpy(&v, src + i, sizeof(v));
+				v = v - ((v >> 1) & 0x5555555555555555ull);
+				v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+				v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+				count += static_cast<size_t>((v * 0x0101010101010101ull) >> 56);
+			}
+			for (; i < bytes; i++){
+				unsigned v = src[i];
+				v = v - ((v >> 1) & 0x55);
+				v = (v & 0x33) + ((v >> 2) & 0x33);
+				count += (v + (v >> 4)) & 0x0F;
+			}
+			return count;
+		}
+
+#ifdef CTWAIN_PIXELS_X86
+
+		////////////////////////////////////////////////////////////////////////
+		// SSE2 and SSSE3 versions
+
+		// squared samples are added up in 32-bit lanes that each take 4 squares per block,
+		// so they are moved to 64 bits before 16384 blocks could overflow them
+		const size_t kSquareBlocks = 8192;
+
+		CTWAIN_TARGET("sse2")
+		unsigned long long Sum64(__m128i v){
+			uint64_t parts[2];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(parts), v);
+			return parts[0] + parts[1];
+		}
+
+		CTWAIN_TARGET("sse2")
+		void AccumulateSamplesSse2(const uint8_t* src, size_t samples, uint8_t threshold, SampleStats& stats){
+			// unsigned compare by flipping the sign bits
+			const auto zero = _mm_setzero_si128();
+			const auto one = _mm_set1_epi8(1);
+			const auto bias = _mm_set1_epi8(-128);
+			const auto limit = _mm_set1_epi8(static_cast<char>(threshold ^ 0x80));
+			auto sum = zero;
+			auto squares = zero;
+			auto dark = zero;
+			size_t blocks = samples / 16;
+			size_t i = 0;
+			while (i < blocks * 16){
+				auto end = std::min(blocks, i / 16 + kSquareBlocks) * 16;
+				auto lanes = zero;
+				for (; i < end; i += 16){
+					auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+					sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+					auto below = _mm_cmplt_epi8(_mm_xor_si128(v, bias), limit);
+					dark = _mm_add_epi64(dark, _mm_sad_epu8(_mm_and_si128(below, one), zero));
+					auto lo = _mm_unpacklo_epi8(v, zero);
+					auto hi = _mm_unpackhi_epi8(v, zero);
+					lanes = _mm_add_epi32(lanes, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+				}
+				squares = _mm_add_epi64(squares, _mm_add_epi64(_mm_unpacklo_epi32(lanes, zero), _mm_unpackhi_epi32(lanes, zero)));
+			}
+			stats.Count += i;
+			stats.Sum += Sum64(sum);
+			stats.SumOfSquares += Sum64(squares);
+			stats.Dark += Sum64(dark);
+			AccumulateSamplesScalar(src + i, samples - i, threshold, stats);
+		}
+
+		CTWAIN_TARGET("sse2")
+		void AddToSumsSse2(const uint8_t* src, uint16_t* sums, size_t samples){
+			const auto zero = _mm_setzero_si128();
+			size_t i = 0;
+			for (; i + 16 <= samples; i += 16){
+				auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				auto lo = reinterpret_cast<__m128i*>(sums + i);
+				auto hi = reinterpret_cast<__m128i*>(sums + i + 8);
+				_mm_storeu_si128(lo, _mm_add_epi16(_mm_loadu_si128(lo), _mm_unpacklo_epi8(v, zero)));
+				_mm_storeu_si128(hi, _mm_add_epi16(_mm_loadu_si128(hi), _mm_unpackhi_epi8(v, zero)));
+			}
+			AddToSumsScalar(src + i, sums + i, samples - i);
+		}
+
+		CTWAIN_TARGET("sse2")
+		size_t CountBitsSse2(const uint8_t* src, size_t bytes){
+			// the scalar bit slicing per byte lane, the 16-bit shifts leak nothing past the masks
+			const auto zero = _mm_setzero_si128();
+			const auto m1 = _mm_set1_epi8(0x55);
+			const auto m2 = _mm_set1_epi8(0x33);
+			const auto m4 = _mm_set1_epi8(0x0F);
+			auto total = zero;
+			size_t i = 0;
+			for (; i + 16 <= bytes; i += 16){
+				auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				v = _mm_sub_epi8(v, _mm_and_si128(_mm_srli_epi16(v, 1), m1));
+				v = _mm_add_epi8(_mm_and_si128(v, m2), _mm_and_si128(_mm_srli_epi16(v, 2), m2));
+				v = _mm_and_si128(_mm_add_epi8(v, _mm_srli_epi16(v, 4)), m4);
+				total = _mm_add_epi64(total, _mm_sad_epu8(v, zero));
+			}
+			return static_cast<size_t>(Sum64(total)) + CountBitsScalar(src + i, bytes - i);
+		}
+
+		CTWAIN_TARGET("sse2")
+		void SwapRowsSse2(uint8_t* a, uint8_t* b, size_t bytes){
+			size_t i = 0;
+			for (; i + 16 <= bytes; i += 16){
+				auto va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+				auto vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), vb);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), va);
+			}
+			SwapRowsScalar(a + i, b + i, bytes - i);
+		}
+
+		CTWAIN_TARGET("sse2")
+		void Unpack1To8Sse2(const uint8_t* src, uint8_t* dst, size_t pixels, uint8_t zero, uint8_t one){
+			// spread each source byte over 8 lanes then test one bit per lane
+			const auto bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+			const auto base = _mm_set1_epi8(static_cast<char>(zero));
+			const auto flip = _mm_set1_epi8(static_cast<char>(zero ^ one));
+			size_t i = 0;
+			for (; i + 128 <= pixels; i += 128){
+				auto packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i / 8));
+				auto bytes2 = _mm_unpacklo_epi8(packed, packed);
+				auto bytes2hi = _mm_unpackhi_epi8(packed, packed);
+				__m128i bytes4[4] = {
+					_mm_unpacklo_epi16(bytes2, bytes2), _mm_unpackhi_epi16(bytes2, bytes2),
+					_mm_unpacklo_epi16(bytes2hi, bytes2hi), _mm_unpackhi_epi16(bytes2hi, bytes2hi)
+				};
+				auto out = reinterpret_cast<__m128i*>(dst + i);
+				for (int j = 0; j < 4; j++){
+					auto lo = _mm_unpacklo_epi32(bytes4[j], bytes4[j]);
+					auto hi = _mm_unpackhi_epi32(bytes4[j], bytes4[j]);
+					lo = _mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits);
+					hi = _mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits);
+					_mm_storeu_si128(out + j * 2, _mm_xor_si128(base, _mm_and_si128(lo, flip)));
+					_mm_storeu_si128(out + j * 2 + 1, _mm_xor_si128(base, _mm_and_si128(hi, flip)));
+				}
+			}
+			Unpack1To8Scalar(src + i / 8, dst + i, pixels - i, zero, one);
+		}
+
+		CTWAIN_TARGET("sse2")
+		void Reduce16To8Sse2(const uint16_t* src, uint8_t* dst, size_t samples){
+			size_t i = 0;
+			for (; i + 16 <= samples; i += 16){
+				auto lo = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), 8);
+				auto hi = _mm_srli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8)), 8);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+			}
+			Reduce16To8Scalar(src + i, dst + i, samples - i);
+		}
+
+		CTWAIN_TARGET("ssse3")
+		void SwapRedBlueSsse3(const uint8_t* src, uint8_t* dst, size_t pixels){
+			// 4 pixels per 16 byte load, the last 4 bytes are stored back unchanged
+			const auto swap = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+			size_t i = 0;
+			for (; i + 6 <= pixels; i += 4){
+				auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 3), _mm_shuffle_epi8(v, swap));
+			}
+			SwapRedBlueScalar(src + i * 3, dst + i * 3, pixels - i);
+		}
+
+		CTWAIN_TARGET("ssse3")
+		size_t CountBitsSsse3(const uint8_t* src, size_t bytes){
+			// look up both nibbles of every byte
+			const auto zero = _mm_setzero_si128();
+			const auto nibble = _mm_set1_epi8(0x0F);
+			const auto table = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+			auto total = zero;
+			size_t i = 0;
+			for (; i + 16 <= bytes; i += 16){
+				auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				auto lo = _mm_shuffle_epi8(table, _mm_and_si128(v, nibble));
+				auto hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+				total = _mm_add_epi64(total, _mm_sad_epu8(_mm_add_epi8(lo, hi), zero));
+			}
+			return static_cast<size_t>(Sum64(total)) + CountBitsScalar(src + i, bytes - i);
+		}
+
+		/// <summary>
+		/// Gets the shuffle that moves the samples of one channel within one 16 byte block
+		/// of 16 interleaved pixels to their places in the plane.
+		/// </summary>
+		CTWAIN_TARGET("ssse3")
+		__m128i DeinterleaveMask(int channels, int channel, int block){
+			char mask[16];
+			for (int p = 0; p < 16; p++){
+				int at = p * channels + channel - block * 16;
+				mask[p] = at >= 0 && at < 16 ? static_cast<char>(at) : static_cast<char>(-128);
+			}
+			return _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask));
+		}
+
+		CTWAIN_TARGET("ssse3")
+		void DeinterleaveSsse3(const uint8_t* src, uint8_t* const* planes, size_t pixels, int channels){
+			if (channels != 3 && channels != 4){
+				DeinterleaveScalar(src, planes, pixels, channels);
+				return;
+			}
+			// 16 pixels are 3 or 4 blocks, each plane takes a few bytes from every block
+			__m128i masks[4][4];
+			for (int c = 0; c < channels; c++){
+				for (int b = 0; b < channels; b++){
+					masks[c][b] = DeinterleaveMask(channels, c, b);
+				}
+			}
+			size_t i = 0;
+			for (; i + 16 <= pixels; i += 16){
+				__m128i blocks[4];
+				for (int b = 0; b < channels; b++){
+					blocks[b] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * channels + b * 16));
+				}
+				for (int c = 0; c < channels; c++){
+					auto plane = _mm_shuffle_epi8(blocks[0], masks[c][0]);
+					for (int b = 1; b < channels; b++){
+						plane = _mm_or_si128(plane, _mm_shuffle_epi8(blocks[b], masks[c][b]));
+					}
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(planes[c] + i), plane);
+				}
+			}
+			uint8_t* rest[4];
+			for (int c = 0; c < channels; c++){
+				rest[c] = planes[c] + i;
+			}
+			DeinterleaveScalar(src + i * channels, rest, pixels - i, channels);
+		}
+
+		////////////////////////////////////////////////////////////////////////
+		// AVX2 versions
+
+		/// <summary>
+		/// Loads two 16 byte blocks into the low and high lanes.
+		/// </summary>
+		CTWAIN_TARGET("avx2")
+		__m256i LoadLanes(const uint8_t* low, const uint8_t* high){
+			return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(low))),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(high)), 1);
+		}
+
+		/// <summary>
+		/// Stores the low and high lanes as two 16 byte blocks, low first.
+		/// </summary>
+		CTWAIN_TARGET("avx2")
+		void StoreLanes(uint8_t* low, uint8_t* high, __m256i v){
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(low), _mm256_castsi256_si128(v));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(high), _mm256_extracti128_si256(v, 1));
+		}
+
+		// every AVX2 version clears the upper halves before handing its tail to
+		// SSE code, which MSVC emits without VEX unless building with /arch:AVX
+
+		CTWAIN_TARGET("avx2")
+		void SwapRedBlueAvx2(const uint8_t* src, uint8_t* dst, size_t pixels){
+			// 4 pixels per lane like the SSSE3 version, both loads happen before the overlapping stores
+			const auto swap = _mm256_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15,
+				2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+			size_t i = 0;
+			for (; i + 18 <= pixels; i += 16){
+				auto s = src + i * 3;
+				auto d = dst + i * 3;
+				auto a = _mm256_shuffle_epi8(LoadLanes(s, s + 12), swap);
+				auto b = _mm256_shuffle_epi8(LoadLanes(s + 24, s + 36), swap);
+				StoreLanes(d, d + 12, a);
+				StoreLanes(d + 24, d + 36, b);
+			}
+			_mm256_zeroupper();
+			SwapRedBlueSsse3(src + i * 3, dst + i * 3, pixels - i);
+		}
+
+		CTWAIN_TARGET("avx2")
+		void SwapRowsAvx2(uint8_t* a, uint8_t* b, size_t bytes){
+			size_t i = 0;
+			for (; i + 32 <= bytes; i += 32){
+				auto va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+				auto vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i), vb);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(b + i), va);
+			}
+			_mm256_zeroupper();
+			SwapRowsSse2(a + i, b + i, bytes - i);
+		}
+
+		CTWAIN_TARGET("avx2")
+		void Unpack1To8Avx2(const uint8_t* src, uint8_t* dst, size_t pixels, uint8_t zero, uint8_t one){
+			// broadcast 4 source bytes and give each one 8 lanes to test a bit in
+			const auto spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+				2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+			const auto bits = _mm256_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1,
+				-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+			const auto base = _mm256_set1_epi8(static_cast<char>(zero));
+			const auto flip = _mm256_set1_epi8(static_cast<char>(zero ^ one));
+			size_t i = 0;
+			for (; i + 32 <= pixels; i += 32){
+				int32_t packed;
+				memcpy(&packed, src + i / 8, 4);
+				auto v = _mm256_shuffle_epi8(_mm256_set1_epi32(packed), spread);
+				v = _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(base, _mm256_and_si256(v, flip)));
+			}
+			_mm256_zeroupper();
+			Unpack1To8Scalar(src + i / 8, dst + i, pixels - i, zero, one);
+		}
+
+		CTWAIN_TARGET("avx2")
+		void Reduce16To8Avx2(const uint16_t* src, uint8_t* dst, size_t samples){
+			size_t i = 0;
+			for (; i + 32 <= samples; i += 32){
+				auto lo = _mm256_srli_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)), 8);
+				auto hi = _mm256_srli_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 16)), 8);
+				// the pack works per lane so put the quarters back in order
+				auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+			}
+			_mm256_zeroupper();
+			Reduce16To8Sse2(src + i, dst + i, samples - i);
+		}
+
+		CTWAIN_TARGET("avx2")
+		void ExpandPaletteAvx2(const uint8_t* src, uint8_t* dst, size_t pixels, const uint8_t* palette){
+			// gather 8 entries, drop every fourth byte per lane and store the lanes 12 bytes apart,
+			// the 4 spare bytes written past each lane are overwritten by what follows
+			const auto pack = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+				0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+			auto table = reinterpret_cast<const int*>(palette);
+			size_t i = 0;
+			for (; i + 10 <= pixels; i += 8){
+				auto indexes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i)));
+				auto entries = _mm256_shuffle_epi8(_mm256_i32gather_epi32(table, indexes, 4), pack);
+				StoreLanes(dst + i * 3, dst + i * 3 + 12, entries);
+			}
+			_mm256_zeroupper();
+			ExpandPaletteScalar(src + i, dst + i * 3, pixels - i, palette);
+		}
+
+		CTWAIN_TARGET("avx2")
+		void DeinterleaveAvx2(const uint8_t* src, uint8_t* const* planes, size_t pixels, int channels){
+			if (channels != 3 && channels != 4){
+				DeinterleaveScalar(src, planes, pixels, channels);
+				return;
+			}
+			// the SSSE3 version with pixels 0-15 in the low lane and 16-31 in the high lane
+			__m256i masks[4][4];
+			for (int c = 0; c < channels; c++){
+				for (int b = 0; b < channels; b++){
+					auto mask = DeinterleaveMask(channels, c, b);
+					masks[c][b] = _mm256_inserti128_si256(_mm256_castsi128_si256(mask), mask, 1);
+				}
+			}
+			size_t i = 0;
+			for (; i + 32 <= pixels; i += 32){
+				auto s = src + i * channels;
+				__m256i blocks[4];
+				for (int b = 0; b < channels; b++){
+					blocks[b] = LoadLanes(s + b * 16, s + (channels + b) * 16);
+				}
+				for (int c = 0; c < channels; c++){
+					auto plane = _mm256_shuffle_epi8(blocks[0], masks[c][0]);
+					for (int b = 1; b < channels; b++){
+						plane = _mm256_or_si256(plane, _mm256_shuffle_epi8(blocks[b], masks[c][b]));
+					}
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(planes[c] + i), plane);
+				}
+			}
+			uint8_t* rest[4];
+			for (int c = 0; c < channels; c++){
+				rest[c] = planes[c] + i;
+			}
+			_mm256_zeroupper();
+			DeinterleaveSsse3(src + i * channels, rest, pixels - i, channels);
+		}
+
+		CTWAIN_TARGET("avx2")
+		unsigned long long Sum64(__m256i v){
+			uint64_t parts[4];
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(parts), v);
+			return parts[0] + parts[1] + parts[2] + parts[3];
+		}
+
+		CTWAIN_TARGET("avx2")
+		void AccumulateSamplesAvx2(const uint8_t* src, size_t samples, uint8_t threshold, SampleStats& stats){
+			const auto zero = _mm256_setzero_si256();
+			const auto one = _mm256_set1_epi8(1);
+			const auto bias = _mm256_set1_epi8(-128);
+			const auto limit = _mm256_set1_epi8(static_cast<char>(threshold ^ 0x80));
+			auto sum = zero;
+			auto squares = zero;
+			auto dark = zero;
+			size_t blocks = samples / 32;
+			size_t i = 0;
+			while (i < blocks * 32){
+				auto end = std::min(blocks, i / 32 + kSquareBlocks) * 32;
+				auto lanes = zero;
+				for (; i < end; i += 32){
+					auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+					sum = _mm256_add_epi64(sum, _mm256_sad_epu8(v, zero));
+					auto below = _mm256_cmpgt_epi8(limit, _mm256_xor_si256(v, bias));
+					dark = _mm256_add_epi64(dark, _mm256_sad_epu8(_mm256_and_si256(below, one), zero));
+					auto lo = _mm256_unpacklo_epi8(v, zero);
+					auto hi = _mm256_unpackhi_epi8(v, zero);
+					lanes = _mm256_add_epi32(lanes, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+				}
+				squares = _mm256_add_epi64(squares,
+					_mm256_add_epi64(_mm256_unpacklo_epi32(lanes, zero), _mm256_unpackhi_epi32(lanes, zero)));
+			}
+			stats.Count += i;
+			stats.Sum += Sum64(sum);
+			stats.SumOfSquares += Sum64(squares);
+			stats.Dark += Sum64(dark);
+			_mm256_zeroupper();
+			AccumulateSamplesSse2(src + i, samples - i, threshold, stats);
+		}
+
+		CTWAIN_TARGET("avx2")
+		void AddToSumsAvx2(const uint8_t* src, uint16_t* sums, size_t samples){
+			size_t i = 0;
+			for (; i + 32 <= samples; i += 32){
+				auto lo = reinterpret_cast<__m256i*>(sums + i);
+				auto hi = reinterpret_cast<__m256i*>(sums + i + 16);
+				auto vlo = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+				auto vhi = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16)));
+				_mm256_storeu_si256(lo, _mm256_add_epi16(_mm256_loadu_si256(lo), vlo));
+				_mm256_storeu_si256(hi, _mm256_add_epi16(_mm256_loadu_si256(hi), vhi));
+			}
+			_mm256_zeroupper();
+			AddToSumsSse2(src + i, sums + i, samples - i);
+		}
+
+		CTWAIN_TARGET("avx2")
+		size_t CountBitsAvx2(const uint8_t* src, size_t bytes){
+			const auto zero = _mm256_setzero_si256();
+			const auto nibble = _mm256_set1_epi8(0x0F);
+			const auto table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+				0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+			auto total = zero;
+			size_t i = 0;
+			for (; i + 32 <= bytes; i += 32){
+				auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+				auto lo = _mm256_shuffle_epi8(table, _mm256_and_si256(v, nibble));
+				auto hi = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+				total = _mm256_add_epi64(total, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), zero));
+			}
+			auto count = static_cast<size_t>(Sum64(total));
+			_mm256_zeroupper();
+			return count + CountBitsSsse3(src + i, bytes - i);
+		}
+
+		////////////////////////////////////////////////////////////////////////
+		// CPU detection
+
+		void Cpuid(int leaf, int regs[4]){
+#ifdef _MSC_VER
+			__cpuidex(regs, leaf, 0);
+#else
+			unsigned a, b, c, d;
+			__cpuid_count(leaf, 0, a, b, c, d);
+			regs[0] = static_cast<int>(a);
+			regs[1] = static_cast<int>(b);
+			regs[2] = static_cast<int>(c);
+			regs[3] = static_cast<int>(d);
+#endif
+		}
+
+		unsigned long long Xgetbv(){
+#ifdef _MSC_VER
+			return _xgetbv(0);
+#else
+			unsigned lo, hi;
+			__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+			return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+		}
+
+#endif // CTWAIN_PIXELS_X86
+
+		SimdLevel DetectLevel(){
+#ifdef CTWAIN_PIXELS_X86
+			int regs[4];
+			Cpuid(0, regs);
+			int maxLeaf = regs[0];
+			if (maxLeaf < 1){
+				return SimdLevel::kScalar;
+			}
+			Cpuid(1, regs);
+			bool sse2 = (regs[3] & (1 << 26)) != 0;
+			bool ssse3 = (regs[2] & (1 << 9)) != 0;
+			// AVX registers also need saving by the OS
+			bool avx = (regs[2] & (1 << 27)) != 0 && (regs[2] & (1 << 28)) != 0 && (Xgetbv() & 6) == 6;
+			bool avx2 = false;
+			if (avx && maxLeaf >= 7){
+				Cpuid(7, regs);
+				avx2 = (regs[1] & (1 << 5)) != 0;
+			}
+			if (avx2 && ssse3){
+				return SimdLevel::kAvx2;
+			}
+			if (ssse3 && sse2){
+				return SimdLevel::kSsse3;
+			}
+			if (sse2){
+				return SimdLevel::kSse2;
+			}
+#endif
+			return SimdLevel::kScalar;
+		}
+
+		struct KernelTable{
+			void(*SwapRedBlue)(const uint8_t*, uint8_t*, size_t);
+			void(*SwapRows)(uint8_t*, uint8_t*, size_t);
+			void(*Unpack1To8)(const uint8_t*, uint8_t*, size_t, uint8_t, uint8_t);
+			void(*Reduce16To8)(const uint16_t*, uint8_t*, size_t);
+			void(*ExpandPalette)(const uint8_t*, uint8_t*, size_t, const uint8_t*);
+			void(*Deinterleave)(const uint8_t*, uint8_t* const*, size_t, int);
+			void(*AccumulateSamples)(const uint8_t*, size_t, uint8_t, SampleStats&);
+			void(*AddToSums)(const uint8_t*, uint16_t*, size_t);
+			size_t(*CountBits)(const uint8_t*, size_t);
+		};
+
+		// indexed by SimdLevel
+		const KernelTable kKernels[] = {
+			{ SwapRedBlueScalar, SwapRowsScalar, Unpack1To8Scalar, Reduce16To8Scalar, ExpandPaletteScalar, DeinterleaveScalar,
+				AccumulateSamplesScalar, AddToSumsScalar, CountBitsScalar },
+#ifdef CTWAIN_PIXELS_X86
+			{ SwapRedBlueScalar, SwapRowsSse2, Unpack1To8Sse2, Reduce16To8Sse2, ExpandPaletteScalar, DeinterleaveScalar,
+				AccumulateSamplesSse2, AddToSumsSse2, CountBitsSse2 },
+			{ SwapRedBlueSsse3, SwapRowsSse2, Unpack1To8Sse2, Reduce16To8Sse2, ExpandPaletteScalar, DeinterleaveSsse3,
+				AccumulateSamplesSse2, AddToSumsSse2, CountBitsSsse3 },
+			{ SwapRedBlueAvx2, SwapRowsAvx2, Unpack1To8Avx2, Reduce16To8Avx2, ExpandPaletteAvx2, DeinterleaveAvx2,
+				AccumulateSamplesAvx2, AddToSumsAvx2, CountBitsAvx2 },
+#endif
+		};
+
+		// -1 until first use
+		std::atomic<int> supported{ -1 };
+		std::atomic<int> selected{ -1 };
+
+		const KernelTable& Kernels(){
+			auto level = selected.load(std::memory_order_relaxed);
+			if (level < 0){
+				// racing threads all detect the same thing
+				level = static_cast<int>(PixelKernels::supported_level());
+				selected.store(level, std::memory_order_relaxed);
+			}
+			return kKernels[level];
+		}
+	}
+
+	SimdLevel PixelKernels::supported_level(){
+		auto level = supported.load(std::memory_order_relaxed);
+		if (level < 0){
+			level = static_cast<int>(DetectLevel());
+			supported.store(level, std::memory_order_relaxed);
+		}
+		return static_cast<SimdLevel>(level);
+	}
+
+	SimdLevel PixelKernels::level(){
+		Kernels();
+		return static_cast<SimdLevel>(selected.load(std::memory_order_relaxed));
+	}
+
+	void PixelKernels::set_level(SimdLevel level){
+		selected.store(static_cast<int>(std::min(level, supported_level())), std::memory_order_relaxed);
+	}
+
+	void PixelKernels::SwapRedBlue(const TW_UINT8* src, TW_UINT8* dst, size_t pixels){
+		Kernels().SwapRedBlue(src, dst, pixels);
+	}
+
+	void PixelKernels::FlipVertical(TW_UINT8* data, size_t stride, TW_UINT32 rows){
+		if (rows < 2){
+			return;
+		}
+		auto swapRows = Kernels().SwapRows;
+		for (TW_UINT32 top = 0, bottom = rows - 1; top < bottom; top++, bottom--){
+			swapRows(data + top * stride, data + bottom * stride, stride);
+		}
+	}
+
+	void PixelKernels::Unpack1To8(const TW_UINT8* src, TW_UINT8* dst, size_t pixels, TW_UINT8 zero, TW_UINT8 one){
+		Kernels().Unpack1To8(src, dst, pixels, zero, one);
+	}
+
+	void PixelKernels::Reduce16To8(const TW_UINT16* src, TW_UINT8* dst, size_t samples){
+		Kernels().Reduce16To8(src, dst, samples);
+	}
+
+	void PixelKernels::ExpandPalette(const TW_UINT8* src, TW_UINT8* dst, size_t pixels, const TW_UINT8* palette){
+		Kernels().ExpandPalette(src, dst, pixels, palette);
+	}
+
+	void PixelKernels::Deinterleave(const TW_UINT8* src, TW_UINT8* const* planes, size_t pixels, int channels){
+		Kernels().Deinterleave(src, planes, pixels, channels);
+	}
+
+	void PixelKernels::AccumulateSamples(const TW_UINT8* src, size_t samples, TW_UINT8 threshold, SampleStats& stats){
+		Kernels().AccumulateSamples(src, samples, threshold, stats);
+	}
+
+	void PixelKernels::AddToSums(const TW_UINT8* src, TW_UINT16* sums, size_t samples){
+		Kernels().AddToSums(src, sums, samples);
+	}
+
+	size_t PixelKernels::CountBits(const TW_UINT8* src, size_t bytes){
+		return Kernels().CountBits(src, bytes);
+	}
+
+	void PixelKernels::LoadPalette(const TW_PALETTE8& palette, TW_UINT8* table){
+		memset(table, 0, 256 * 4);
+		TW_UINT16 count = std::min<TW_UINT16>(palette.NumColors, 256);
+		for (TW_UINT16 i = 0; i < count; i++){
+			table[i * 4] = palette.Colors[i].Channel1;
+			table[i * 4 + 1] = palette.Colors[i].Channel2;
+			table[i * 4 + 2] = palette.Colors[i].Channel3;
+		}
+	}
+
+	int PixelKernels::Interleaved8Channels(const TW_IMAGEINFO& info){
+		if (info.Compression != TWCP_NONE || info.Planar || info.ImageWidth <= 0 ||
+			info.SamplesPerPixel < 1 || info.SamplesPerPixel > 4){
+			return 0;
+		}
+		if (info.SamplesPerPixel == 1 && info.BitsPerPixel == 1){
+			return 1;
+		}
+		if (info.PixelType == TWPT_PALETTE){
+			return info.SamplesPerPixel == 1 && info.BitsPerPixel == 8 ? 3 : 0;
+		}
+		if (info.BitsPerPixel == info.SamplesPerPixel * 8 || info.BitsPerPixel == info.SamplesPerPixel * 16){
+			return info.SamplesPerPixel;
+		}
+		return 0;
+	}
+
+	bool PixelKernels::ToInterleaved8(const TW_IMAGEINFO& info, const TW_UINT8* src, size_t src_stride,
+		TW_UINT8* dst, size_t dst_stride, const TW_UINT8* palette){
+
+		auto channels = Interleaved8Channels(info);
+		if (channels == 0 || (info.PixelType == TWPT_PALETTE && !palette)){
+			return false;
+		}
+		auto& kernels = Kernels();
+		size_t width = static_cast<size_t>(info.ImageWidth);
+		size_t samples = width * info.SamplesPerPixel;
+		for (TW_INT32 y = 0; y < info.ImageLength; y++, src += src_stride, dst += dst_stride){
+			if (info.BitsPerPixel == 1){
+				kernels.Unpack1To8(src, dst, width, 0, 0xFF);
+			}
+			else if (info.PixelType == TWPT_PALETTE){
+				kernels.ExpandPalette(src, dst, width, palette);
+			}
+			else if (info.BitsPerPixel == info.SamplesPerPixel * 16){
+				kernels.Reduce16To8(reinterpret_cast<const uint16_t*>(src), dst, samples);
+			}
+			else if (src != dst){
+				memcpy(dst, src, samples);
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,203 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef PIXEL_KERNELS_H_
+#define PIXEL_KERNELS_H_
+
+#include <cstddef>
+
+namespace ctwain{
+
+	/// <summary>
+	/// Instruction sets <see cref="PixelKernels"/> can use, from slowest to fastest.
+	/// </summary>
+	enum class SimdLevel{
+		kScalar,
+		kSse2,
+		kSsse3,
+		kAvx2
+	};
+
+	/// <summary>
+	/// Running totals over 8-bit samples, see <see cref="PixelKernels::AccumulateSamples"/>.
+	/// </summary>
+	struct SampleStats{
+		/// <summary>
+		/// The number of samples.
+		/// </summary>
+		unsigned long long Count = 0;
+
+		/// <summary>
+		/// The sum of the sample values.
+		/// </summary>
+		unsigned long long Sum = 0;
+
+		/// <summary>
+		/// The sum of the squared sample values.
+		/// </summary>
+		unsigned long long SumOfSquares = 0;
+
+		/// <summary>
+		/// The number of samples below the threshold.
+		/// </summary>
+		unsigned long long Dark = 0;
+	};
+
+	/// <summary>
+	/// Pixel format conversions for transferred pages. Every kernel has a scalar version and
+	/// SSE2/SSSE3/AVX2 versions where they help, and the fastest one the CPU supports is picked
+	/// at run time. Buffers need no particular alignment and the source and destination
+	/// may not overlap unless noted.
+	/// </summary>
+	class PixelKernels
+	{
+	public:
+		/// <summary>
+		/// Gets the instruction set the kernels are using.
+		/// </summary>
+		static SimdLevel level();
+
+		/// <summary>
+		/// Gets the best instruction set the CPU and OS support.
+		/// </summary>
+		static SimdLevel supported_level();
+
+		/// <summary>
+		/// Limits the kernels to an instruction set, such as <see cref="SimdLevel::kScalar"/>
+		/// to compare against. Levels above <see cref="supported_level"/> are lowered to it.
+		/// </summary>
+		static void set_level(SimdLevel level);
+
+		/// <summary>
+		/// Swaps the first and third bytes of 24-bit pixels, turning BGR into RGB and back.
+		/// May be done in place.
+		/// </summary>
+		/// <param name="src">The pixels.</param>
+		/// <param name="dst">Where the swapped pixels go, can be <paramref name="src"/>.</param>
+		/// <param name="pixels">The number of pixels.</param>
+		static void SwapRedBlue(const TW_UINT8* src, TW_UINT8* dst, size_t pixels);
+
+		/// <summary>
+		/// Turns an image upside down in place, such as a bottom-up DIB.
+		/// </summary>
+		/// <param name="data">The first row.</param>
+		/// <param name="stride">The bytes from one row to the next.</param>
+		/// <param name="rows">The number of rows.</param>
+		static void FlipVertical(TW_UINT8* data, size_t stride, TW_UINT32 rows);
+
+		/// <summary>
+		/// Unpacks 1-bit pixels, most significant bit first, to one byte each.
+		/// </summary>
+		/// <param name="src">The packed pixels.</param>
+		/// <param name="dst">The unpacked pixels.</param>
+		/// <param name="pixels">The number of pixels.</param>
+		/// <param name="zero">The value of a 0 bit.</param>
+		/// <param name="one">The value of a 1 bit.</param>
+		static void Unpack1To8(const TW_UINT8* src, TW_UINT8* dst, size_t pixels, TW_UINT8 zero = 0, TW_UINT8 one = 0xFF);
+
+		/// <summary>
+		/// Reduces 16-bit samples in native byte order to 8 bits by keeping the high byte.
+		/// </summary>
+		/// <param name="src">The 16-bit samples.</param>
+		/// <param name="dst">The 8-bit samples.</param>
+		/// <param name="samples">The number of samples.</param>
+		static void Reduce16To8(const TW_UINT16* src, TW_UINT8* dst, size_t samples);
+
+		/// <summary>
+		/// Expands 8-bit palette indexes to 24-bit pixels.
+		/// </summary>
+		/// <param name="src">The indexes.</param>
+		/// <param name="dst">The pixels.</param>
+		/// <param name="pixels">The number of pixels.</param>
+		/// <param name="palette">256 four-byte entries whose first three bytes are copied out,
+		/// such as the BGRX quads of <see cref="DibView::palette"/> or a table from <see cref="LoadPalette"/>.</param>
+		static void ExpandPalette(const TW_UINT8* src, TW_UINT8* dst, size_t pixels, const TW_UINT8* palette);
+
+		/// <summary>
+		/// Splits interleaved 8-bit samples into one plane per channel.
+		/// </summary>
+		/// <param name="src">The interleaved pixels.</param>
+		/// <param name="planes">The <paramref name="channels"/> planes, each getting one byte per pixel.</param>
+		/// <param name="pixels">The number of pixels.</param>
+		/// <param name="channels">The samples per pixel.</param>
+		static void Deinterleave(const TW_UINT8* src, TW_UINT8* const* planes, size_t pixels, int channels);
+
+		/// <summary>
+		/// Adds 8-bit samples to running totals, such as for the mean and variance of a page.
+		/// </summary>
+		/// <param name="src">The samples.</param>
+		/// <param name="samples">The number of samples.</param>
+		/// <param name="threshold">Samples below this are counted in <see cref="SampleStats::Dark"/>.</param>
+		/// <param name="stats">The totals to add to.</param>
+		static void AccumulateSamples(const TW_UINT8* src, size_t samples, TW_UINT8 threshold, SampleStats& stats);
+
+		/// <summary>
+		/// Adds 8-bit samples to 16-bit running sums, such as the columns of a box filter.
+		/// The sums hold up to 257 rows of any values.
+		/// </summary>
+		/// <param name="src">The samples.</param>
+		/// <param name="sums">The sums, one per sample.</param>
+		/// <param name="samples">The number of samples.</param>
+		static void AddToSums(const TW_UINT8* src, TW_UINT16* sums, size_t samples);
+
+		/// <summary>
+		/// Counts the bits set in a buffer, such as the white pixels of a bitonal row.
+		/// </summary>
+		/// <param name="src">The bytes.</param>
+		/// <param name="bytes">The number of bytes.</param>
+		/// <returns>The number of 1 bits.</returns>
+		static size_t CountBits(const TW_UINT8* src, size_t bytes);
+
+		/// <summary>
+		/// Converts a DAT_PALETTE8 palette to the table <see cref="ExpandPalette"/> takes.
+		/// Entries past NumColors are black.
+		/// </summary>
+		/// <param name="palette">The palette from the source.</param>
+		/// <param name="table">The 1024 byte table.</param>
+		static void LoadPalette(const TW_PALETTE8& palette, TW_UINT8* table);
+
+		/// <summary>
+		/// Gets the number of 8-bit samples per pixel <see cref="ToInterleaved8"/> produces for an image,
+		/// 3 for palette images.
+		/// </summary>
+		/// <returns>The channels, or 0 if the image can't be converted.</returns>
+		static int Interleaved8Channels(const TW_IMAGEINFO& info);
+
+		/// <summary>
+		/// Converts uncompressed chunky image data described by <paramref name="info"/> to 8 bits per sample,
+		/// such as memory transfer pages. Bitonal images are taken as TWPF_CHOCOLATE (0 is black)
+		/// and palette images are expanded. Sample order is kept.
+		/// </summary>
+		/// <param name="info">The image information from the source.</param>
+		/// <param name="src">The first source row.</param>
+		/// <param name="src_stride">The bytes from one source row to the next.</param>
+		/// <param name="dst">The first destination row, holding ImageWidth * <see cref="Interleaved8Channels"/> bytes.</param>
+		/// <param name="dst_stride">The bytes from one destination row to the next.</param>
+		/// <param name="palette">The table from <see cref="LoadPalette"/> for palette images.</param>
+		/// <returns>false if the format isn't supported.</returns>
+		static bool ToInterleaved8(const TW_IMAGEINFO& info, const TW_UINT8* src, size_t src_stride,
+			TW_UINT8* dst, size_t dst_stride, const TW_UINT8* palette = nullptr);
+	};
+}
+
+#endif //PIXEL_KERNELS_H_
@@ -0,0 +1,258 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <algorithm>
+#include "preview_builder.h"
+#include "dib_view.h"
+#include "twain_session.h"
+
+namespace ctwain{
+
+	namespace{
+		// 16-bit column sums hold this many rows of 255
+		const TW_UINT32 kMaxScale = 256;
+
+		TW_UINT8 Luma(const TW_UINT8* bgr){
+			return static_cast<TW_UINT8>((bgr[0] * 29u + bgr[1] * 150u + bgr[2] * 77u) >> 8);
+		}
+
+		TW_UINT32 DivideUp(TW_UINT32 value, TW_UINT32 divisor){
+			return static_cast<TW_UINT32>((static_cast<unsigned long long>(value) + divisor - 1) / divisor);
+		}
+	}
+
+	bool PreviewBuilder::Begin(const TW_IMAGEINFO& info){
+		building_ = false;
+		swap_red_blue_ = false;
+		if (info.Compression != TWCP_NONE || info.Planar || info.ImageWidth <= 0){
+			return false;
+		}
+		switch (info.PixelType){
+		case TWPT_BW:
+			zero_ = 0;
+			one_ = 0xFF;
+			return info.BitsPerPixel == 1 && Start(info.ImageWidth, info.ImageLength, Format::kBits, 1);
+		case TWPT_GRAY:
+			return (info.BitsPerPixel == 8 || info.BitsPerPixel == 16) &&
+				Start(info.ImageWidth, info.ImageLength, info.BitsPerPixel == 8 ? Format::kDirect : Format::kWide, 1);
+		case TWPT_RGB:
+			return (info.BitsPerPixel == 24 || info.BitsPerPixel == 48) &&
+				Start(info.ImageWidth, info.ImageLength, info.BitsPerPixel == 24 ? Format::kDirect : Format::kWide, 3);
+		default:
+			// palette pages would need DAT_PALETTE8 first
+			return false;
+		}
+	}
+
+	bool PreviewBuilder::Start(TW_UINT32 width, TW_INT32 height, Format format, int channels){
+		auto maxWidth = std::max<TW_UINT32>(options_.MaxWidth, 1);
+		auto maxHeight = std::max<TW_UINT32>(options_.MaxHeight, 1);
+		scale_ = DivideUp(width, maxWidth);
+		if (height > 0){
+			scale_ = std::max(scale_, DivideUp(static_cast<TW_UINT32>(height), maxHeight));
+		}
+		scale_ = std::min(std::max<TW_UINT32>(scale_, 1), kMaxScale);
+
+		format_ = format;
+		channels_ = channels;
+		page_width_ = width;
+		page_height_ = height > 0 ? static_cast<TW_UINT32>(height) : 0;
+		width_ = DivideUp(width, scale_);
+		height_ = page_height_ ? DivideUp(page_height_, scale_) : 0;
+		next_row_ = 0;
+		band_rows_ = 0;
+		rows_ready_ = 0;
+		polled_rows_ = 0;
+
+		size_t samples = static_cast<size_t>(width) * channels;
+		row_.resize(samples);
+		sums_.assign(samples, 0);
+		image_.assign(stride() * height_, 0);
+		building_ = true;
+		return true;
+	}
+
+	void PreviewBuilder::AddRows(const TW_UINT8* data, size_t stride, TW_UINT32 first_row, TW_UINT32 rows){
+		if (!building_){
+			return;
+		}
+		if (first_row != next_row_){
+			Cancel();
+			return;
+		}
+		for (TW_UINT32 i = 0; i < rows && building_; i++){
+			AddRow(data + i * stride);
+		}
+	}
+
+	void PreviewBuilder::AddRow(const TW_UINT8* row){
+		// sources may send more rows than they said up front
+		if (page_height_ && next_row_ >= page_height_){
+			return;
+		}
+		size_t samples = sums_.size();
+		const TW_UINT8* samples8 = row;
+		switch (format_){
+		case Format::kBits:
+			PixelKernels::Unpack1To8(row, row_.data(), page_width_, zero_, one_);
+			samples8 = row_.data();
+			break;
+		case Format::kWide:
+			PixelKernels::Reduce16To8(reinterpret_cast<const TW_UINT16*>(row), row_.data(), samples);
+			samples8 = row_.data();
+			break;
+		case Format::kPalette:
+			PixelKernels::ExpandPalette(row, row_.data(), page_width_, palette_.data());
+			samples8 = row_.data();
+			break;
+		default:
+			break;
+		}
+		PixelKernels::AddToSums(samples8, sums_.data(), samples);
+		next_row_++;
+		if (++band_rows_ == scale_){
+			EmitRow();
+		}
+	}
+
+	void PreviewBuilder::EmitRow(){
+		auto rowBytes = stride();
+		if (image_.size() < (rows_ready_ + 1) * rowBytes){
+			image_.resize((rows_ready_ + 1) * rowBytes);
+		}
+		auto out = image_.data() + rows_ready_ * rowBytes;
+		auto sum = sums_.data();
+		for (TW_UINT32 x = 0; x < width_; x++){
+			// the last box is cut short by the page edge
+			auto columns = std::min(scale_, page_width_ - x * scale_);
+			auto count = columns * band_rows_;
+			for (int c = 0; c < channels_; c++){
+				unsigned total = 0;
+				for (TW_UINT32 i = 0; i < columns; i++){
+					total += sum[i * channels_ + c];
+				}
+				*out++ = static_cast<TW_UINT8>((total + count / 2) / count);
+			}
+			sum += columns * channels_;
+		}
+		if (swap_red_blue_){
+			auto row = image_.data() + rows_ready_ * rowBytes;
+			PixelKernels::SwapRedBlue(row, row, width_);
+		}
+		std::fill(sums_.begin(), sums_.end(), static_cast<TW_UINT16>(0));
+		band_rows_ = 0;
+		rows_ready_++;
+	}
+
+	void PreviewBuilder::AddStrip(const TransferredStripEventArgs& strip){
+		if (!building_){
+			return;
+		}
+		if (strip.Compression != TWCP_NONE || strip.XOffset != 0 || strip.Columns < page_width_ ||
+			strip.BytesPerRow == TWON_DONTCARE32 || strip.Rows == TWON_DONTCARE32 ||
+			static_cast<unsigned long long>(strip.BytesPerRow) * strip.Rows > strip.BytesWritten){
+			Cancel();
+			return;
+		}
+		AddRows(strip.Data, strip.BytesPerRow, strip.YOffset, strip.Rows);
+	}
+
+	bool PreviewBuilder::Finish(){
+		if (!building_ && !page_width_){
+			return false;
+		}
+		if (building_ && band_rows_ > 0){
+			EmitRow();
+		}
+		building_ = false;
+		page_width_ = 0;
+		height_ = rows_ready_;
+		return rows_ready_ > 0;
+	}
+
+	bool PreviewBuilder::Build(const DibView& dib){
+		building_ = false;
+		swap_red_blue_ = false;
+		if (!dib.valid() || dib.compression() != 0 || dib.width() == 0 || dib.height() == 0){
+			return false;
+		}
+
+		auto palette = dib.palette();
+		bool started = false;
+		switch (dib.bit_depth()){
+		case 1:
+			zero_ = palette ? Luma(palette) : 0;
+			one_ = palette && dib.palette_size() > 1 ? Luma(palette + 4) : 0xFF;
+			started = Start(dib.width(), dib.height(), Format::kBits, 1);
+			break;
+		case 8:{
+			bool gray = true;
+			if (palette){
+				for (TW_UINT32 i = 0; i < dib.palette_size() && gray; i++){
+					auto entry = palette + i * 4;
+					gray = entry[0] == i && entry[1] == i && entry[2] == i;
+				}
+			}
+			if (gray){
+				started = Start(dib.width(), dib.height(), Format::kDirect, 1);
+			}
+			else{
+				// quads past the table are black
+				palette_.assign(256 * 4, 0);
+				std::copy(palette, palette + std::min<TW_UINT32>(dib.palette_size(), 256) * 4, palette_.begin());
+				started = Start(dib.width(), dib.height(), Format::kPalette, 3);
+			}
+			swap_red_blue_ = !gray;
+			break;
+		}
+		case 24:
+			started = Start(dib.width(), dib.height(), Format::kDirect, 3);
+			swap_red_blue_ = true;
+			break;
+		default:
+			break;
+		}
+		if (!started){
+			swap_red_blue_ = false;
+			return false;
+		}
+		for (TW_UINT32 y = 0; y < dib.height() && building_; y++){
+			AddRow(dib.row(y));
+		}
+		return Finish();
+	}
+
+	bool PreviewBuilder::PollUpdate(){
+		if (rows_ready_ == polled_rows_){
+			return false;
+		}
+		auto now = std::chrono::steady_clock::now();
+		if (polled_rows_ > 0 && now - polled_at_ < std::chrono::milliseconds(options_.MinIntervalMilliseconds)){
+			return false;
+		}
+		polled_rows_ = rows_ready_;
+		polled_at_ = now;
+		return true;
+	}
+}
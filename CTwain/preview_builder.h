@@ -0,0 +1,211 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef PREVIEW_BUILDER_H_
+#define PREVIEW_BUILDER_H_
+
+#include <chrono>
+#include <vector>
+#include "pixel_kernels.h"
+
+namespace ctwain{
+
+	class DibView;
+	struct TransferredStripEventArgs;
+
+	/// <summary>
+	/// Settings for <see cref="PreviewBuilder"/>.
+	/// </summary>
+	struct PreviewOptions{
+		/// <summary>
+		/// The widest the preview gets, in pixels. Pages more than 256 times as large
+		/// get a bigger preview.
+		/// </summary>
+		TW_UINT32 MaxWidth = 320;
+
+		/// <summary>
+		/// The tallest the preview gets when the page length is known, in pixels.
+		/// </summary>
+		TW_UINT32 MaxHeight = 320;
+
+		/// <summary>
+		/// The least time between two updates of the same page, in milliseconds.
+		/// The first and the final update of a page are always raised.
+		/// </summary>
+		TW_UINT32 MinIntervalMilliseconds = 100;
+	};
+
+	/// <summary>
+	/// Builds a downscaled copy of a page while it transfers, so it can be shown before
+	/// the page is complete. Every output pixel is the average of a square box of page pixels,
+	/// summed a row at a time with <see cref="PixelKernels::AddToSums"/>, and the output grows
+	/// one row whenever a box height of page rows has come in. The preview is 8-bit gray
+	/// for bitonal and gray pages, or RGB, top row first.
+	/// This class is not thread-safe.
+	/// </summary>
+	class PreviewBuilder
+	{
+	public:
+		/// <summary>
+		/// Initializes a new instance of the <see cref="PreviewBuilder"/> class.
+		/// </summary>
+		/// <param name="options">The settings.</param>
+		explicit PreviewBuilder(const PreviewOptions& options) : options_(options){}
+
+		/// <summary>
+		/// Gets the settings.
+		/// </summary>
+		const PreviewOptions& options() const{ return options_; }
+
+		/// <summary>
+		/// Starts a page that comes in strips. Uncompressed chunky 1-bit, 8 and 16-bit gray
+		/// and 24 and 48-bit RGB pages are supported. When the page length isn't known yet
+		/// the box size comes from the width alone.
+		/// </summary>
+		/// <param name="info">The image information from the source.</param>
+		/// <returns>false if the page can't be previewed.</returns>
+		bool Begin(const TW_IMAGEINFO& info);
+
+		/// <summary>
+		/// Adds rows of the page started with <see cref="Begin"/>. Rows must come in order,
+		/// others cancel the page.
+		/// </summary>
+		/// <param name="data">The first row.</param>
+		/// <param name="stride">The bytes from one row to the next.</param>
+		/// <param name="first_row">The page row <paramref name="data"/> starts at.</param>
+		/// <param name="rows">The number of rows.</param>
+		void AddRows(const TW_UINT8* data, size_t stride, TW_UINT32 first_row, TW_UINT32 rows);
+
+		/// <summary>
+		/// Adds a memory transfer strip of the page started with <see cref="Begin"/>.
+		/// Compressed strips and tiles narrower than the page cancel the page.
+		/// </summary>
+		/// <param name="strip">The strip.</param>
+		void AddStrip(const TransferredStripEventArgs& strip);
+
+		/// <summary>
+		/// Stops adding to the page started with <see cref="Begin"/>. What was built so far is kept.
+		/// </summary>
+		void Cancel(){ building_ = false; }
+
+		/// <summary>
+		/// Adds the rows of a last partial box and ends the page started with <see cref="Begin"/>.
+		/// The preview height becomes the rows built.
+		/// </summary>
+		/// <returns>false if no page was being built.</returns>
+		bool Finish();
+
+		/// <summary>
+		/// Builds the preview of a whole 1, 8 or 24-bit uncompressed DIB such as from a native transfer.
+		/// </summary>
+		/// <param name="dib">The DIB.</param>
+		/// <returns>false if the DIB can't be previewed.</returns>
+		bool Build(const DibView& dib);
+
+		/// <summary>
+		/// Gets a value indicating whether the preview has grown since the last time this returned true
+		/// and <see cref="PreviewOptions::MinIntervalMilliseconds"/> have passed since, then counts
+		/// this as an update.
+		/// </summary>
+		bool PollUpdate();
+
+		/// <summary>
+		/// Gets a value indicating whether a page is being built.
+		/// </summary>
+		bool building() const{ return building_; }
+
+		/// <summary>
+		/// Gets the preview pixels, <see cref="stride"/> bytes per row. Rows past
+		/// <see cref="rows_ready"/> are black. The buffer is reused for the next page
+		/// and may move while a page of unknown length grows.
+		/// </summary>
+		const TW_UINT8* data() const{ return image_.data(); }
+
+		/// <summary>
+		/// Gets the preview width in pixels.
+		/// </summary>
+		TW_UINT32 width() const{ return width_; }
+
+		/// <summary>
+		/// Gets the preview height in pixels, which is <see cref="rows_ready"/> while a page
+		/// of unknown length is being built.
+		/// </summary>
+		TW_UINT32 height() const{ return height_ ? height_ : rows_ready_; }
+
+		/// <summary>
+		/// Gets the number of preview rows built so far.
+		/// </summary>
+		TW_UINT32 rows_ready() const{ return rows_ready_; }
+
+		/// <summary>
+		/// Gets the samples per preview pixel, 1 for gray and 3 for RGB.
+		/// </summary>
+		int channels() const{ return channels_; }
+
+		/// <summary>
+		/// Gets the bytes from one preview row to the next.
+		/// </summary>
+		size_t stride() const{ return static_cast<size_t>(width_) * channels_; }
+
+		/// <summary>
+		/// Gets the size of the box of page pixels averaged into one preview pixel, along each side.
+		/// </summary>
+		TW_UINT32 scale() const{ return scale_; }
+
+	private:
+		enum class Format{
+			kDirect,
+			kBits,
+			kWide,
+			kPalette
+		};
+
+		PreviewOptions options_;
+		bool building_ = false;
+		Format format_ = Format::kDirect;
+		bool swap_red_blue_ = false;
+		TW_UINT8 zero_ = 0;
+		TW_UINT8 one_ = 0xFF;
+		int channels_ = 1;
+		TW_UINT32 page_width_ = 0;
+		TW_UINT32 page_height_ = 0;
+		TW_UINT32 scale_ = 1;
+		TW_UINT32 width_ = 0;
+		TW_UINT32 height_ = 0;
+		TW_UINT32 next_row_ = 0;
+		TW_UINT32 band_rows_ = 0;
+		TW_UINT32 rows_ready_ = 0;
+		TW_UINT32 polled_rows_ = 0;
+		std::chrono::steady_clock::time_point polled_at_;
+		std::vector<TW_UINT8> palette_;
+		std::vector<TW_UINT8> row_;
+		std::vector<TW_UINT16> sums_;
+		std::vector<TW_UINT8> image_;
+
+		bool Start(TW_UINT32 width, TW_INT32 height, Format format, int channels);
+		void AddRow(const TW_UINT8* row);
+		void EmitRow();
+	};
+}
+
+#endif //PREVIEW_BUILDER_H_
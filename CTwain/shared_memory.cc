@@ -0,0 +1,219 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <climits>
+#include "build_macros.h"
+#include "shared_memory.h"
+#include "logger.h"
+
+#ifndef TWH_CMP_MSC
+#include <cerrno>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace ctwain{
+
+	namespace{
+		std::string SystemName(const std::string& name){
+#ifdef TWH_CMP_MSC
+			// session local so services and desktop apps don't see each other's
+			return "Local\\" + name;
+#else
+			return "/" + name;
+#endif
+		}
+	}
+
+	bool SharedMemory::Create(const std::string& name, size_t size){
+		return Map(name, size, true);
+	}
+
+	bool SharedMemory::Open(const std::string& name, size_t size){
+		return Map(name, size, false);
+	}
+
+	bool SharedMemory::Map(const std::string& name, size_t size, bool create){
+		Close();
+		auto systemName = SystemName(name);
+#ifdef TWH_CMP_MSC
+		HANDLE mapping;
+		if (create){
+			auto size64 = static_cast<unsigned long long>(size);
+			mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+				static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64), systemName.c_str());
+			if (mapping && GetLastError() == ERROR_ALREADY_EXISTS){
+				CloseHandle(mapping);
+				mapping = nullptr;
+			}
+		}
+		else{
+			mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, systemName.c_str());
+		}
+		if (!mapping){
+			CTWAIN_LOG_ERROR("Failed to %s shared memory %s (error %lu).", create ? "create" : "open", name.c_str(), GetLastError());
+			return false;
+		}
+		auto view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (!view){
+			CTWAIN_LOG_ERROR("Failed to map shared memory %s (error %lu).", name.c_str(), GetLastError());
+			CloseHandle(mapping);
+			return false;
+		}
+		handle_ = mapping;
+#else
+		auto fd = create ? shm_open(systemName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600) : shm_open(systemName.c_str(), O_RDWR, 0);
+		if (fd < 0){
+			CTWAIN_LOG_ERROR("Failed to %s shared memory %s (error %d).", create ? "create" : "open", name.c_str(), errno);
+			return false;
+		}
+		struct stat status;
+		bool sized = create ? ftruncate(fd, static_cast<off_t>(size)) == 0 :
+			fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) >= size;
+		auto view = sized ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+		close(fd);
+		if (view == MAP_FAILED){
+			CTWAIN_LOG_ERROR("Failed to map shared memory %s (error %d).", name.c_str(), errno);
+			if (create){
+				shm_unlink(systemName.c_str());
+			}
+			return false;
+		}
+#endif
+		name_ = name;
+		data_ = static_cast<TW_UINT8*>(view);
+		size_ = size;
+		owner_ = create;
+		return true;
+	}
+
+	void SharedMemory::Close(){
+		if (!data_){
+			return;
+		}
+#ifdef TWH_CMP_MSC
+		UnmapViewOfFile(data_);
+		CloseHandle(handle_);
+		handle_ = nullptr;
+#else
+		munmap(data_, size_);
+		if (owner_){
+			shm_unlink(SystemName(name_).c_str());
+		}
+#endif
+		data_ = nullptr;
+		size_ = 0;
+		owner_ = false;
+		name_.clear();
+	}
+
+	bool SharedSemaphore::Create(const std::string& name){
+		return Connect(name, true);
+	}
+
+	bool SharedSemaphore::Open(const std::string& name){
+		return Connect(name, false);
+	}
+
+	bool SharedSemaphore::Connect(const std::string& name, bool create){
+		Close();
+		auto systemName = SystemName(name);
+#ifdef TWH_CMP_MSC
+		HANDLE semaphore;
+		if (create){
+			semaphore = CreateSemaphoreA(nullptr, 0, LONG_MAX, systemName.c_str());
+			if (semaphore && GetLastError() == ERROR_ALREADY_EXISTS){
+				CloseHandle(semaphore);
+				semaphore = nullptr;
+			}
+		}
+		else{
+			semaphore = OpenSemaphoreA(SEMAPHORE_ALL_ACCESS, FALSE, systemName.c_str());
+		}
+		if (!semaphore){
+			CTWAIN_LOG_ERROR("Failed to %s semaphore %s (error %lu).", create ? "create" : "open", name.c_str(), GetLastError());
+			return false;
+		}
+		handle_ = semaphore;
+#else
+		auto semaphore = create ? sem_open(systemName.c_str(), O_CREAT | O_EXCL, 0600, 0) : sem_open(systemName.c_str(), 0);
+		if (semaphore == SEM_FAILED){
+			CTWAIN_LOG_ERROR("Failed to %s semaphore %s (error %d).", create ? "create" : "open", name.c_str(), errno);
+			return false;
+		}
+		handle_ = semaphore;
+#endif
+		name_ = name;
+		owner_ = create;
+		return true;
+	}
+
+	void SharedSemaphore::Close(){
+		if (!handle_){
+			return;
+		}
+#ifdef TWH_CMP_MSC
+		CloseHandle(handle_);
+#else
+		sem_close(static_cast<sem_t*>(handle_));
+		if (owner_){
+			sem_unlink(SystemName(name_).c_str());
+		}
+#endif
+		handle_ = nullptr;
+		owner_ = false;
+		name_.clear();
+	}
+
+	void SharedSemaphore::Post(){
+#ifdef TWH_CMP_MSC
+		ReleaseSemaphore(handle_, 1, nullptr);
+#else
+		sem_post(static_cast<sem_t*>(handle_));
+#endif
+	}
+
+	bool SharedSemaphore::Wait(unsigned milliseconds){
+#ifdef TWH_CMP_MSC
+		return WaitForSingleObject(handle_, milliseconds) == WAIT_OBJECT_0;
+#else
+		timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += milliseconds / 1000;
+		deadline.tv_nsec += static_cast<long>(milliseconds % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		int result;
+		while ((result = sem_timedwait(static_cast<sem_t*>(handle_), &deadline)) != 0 && errno == EINTR){
+		}
+		return result == 0;
+#endif
+	}
+}
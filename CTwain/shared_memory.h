@@ -0,0 +1,151 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef SHARED_MEMORY_H_
+#define SHARED_MEMORY_H_
+
+#include <string>
+
+namespace ctwain{
+
+	/// <summary>
+	/// A named block of memory that several processes map, a page file backed mapping on Windows
+	/// and a POSIX shared memory object elsewhere. Names are plain words, the platform prefix
+	/// is added here. The creator removes the name when it closes, views opened by others stay
+	/// valid until they close too. This class is not thread-safe.
+	/// </summary>
+	class SharedMemory
+	{
+	public:
+		SharedMemory(){}
+
+		/// <summary>
+		/// Unmaps the memory if mapped.
+		/// </summary>
+		~SharedMemory(){ Close(); }
+
+		SharedMemory(const SharedMemory&) = delete;
+		SharedMemory& operator=(const SharedMemory&) = delete;
+
+		/// <summary>
+		/// Creates and maps a new zeroed block.
+		/// </summary>
+		/// <param name="name">The name the other processes open it by.</param>
+		/// <param name="size">The size in bytes.</param>
+		/// <returns>false if the name is taken or the block couldn't be created.</returns>
+		bool Create(const std::string& name, size_t size);
+
+		/// <summary>
+		/// Maps a block created by another process.
+		/// </summary>
+		/// <param name="name">The name it was created with.</param>
+		/// <param name="size">The size it was created with.</param>
+		/// <returns>false if there is no such block.</returns>
+		bool Open(const std::string& name, size_t size);
+
+		/// <summary>
+		/// Unmaps the block, and removes its name if this created it.
+		/// </summary>
+		void Close();
+
+		/// <summary>
+		/// Gets the start of the mapped block or nullptr if none is.
+		/// </summary>
+		TW_UINT8* data() const{ return data_; }
+
+		/// <summary>
+		/// Gets the size of the mapped block.
+		/// </summary>
+		size_t size() const{ return size_; }
+
+	private:
+		std::string name_;
+		TW_UINT8* data_ = nullptr;
+		size_t size_ = 0;
+		bool owner_ = false;
+		// the mapping handle on Windows
+		void* handle_ = nullptr;
+
+		bool Map(const std::string& name, size_t size, bool create);
+	};
+
+	/// <summary>
+	/// A named counting semaphore that several processes wait on and post to.
+	/// Names follow <see cref="SharedMemory"/> and share their namespace on Windows,
+	/// so give the two different names. This class is thread-safe once created or opened.
+	/// </summary>
+	class SharedSemaphore
+	{
+	public:
+		SharedSemaphore(){}
+
+		/// <summary>
+		/// Closes the semaphore if open.
+		/// </summary>
+		~SharedSemaphore(){ Close(); }
+
+		SharedSemaphore(const SharedSemaphore&) = delete;
+		SharedSemaphore& operator=(const SharedSemaphore&) = delete;
+
+		/// <summary>
+		/// Creates a new semaphore with a count of 0.
+		/// </summary>
+		/// <param name="name">The name the other processes open it by.</param>
+		/// <returns>false if the name is taken or the semaphore couldn't be created.</returns>
+		bool Create(const std::string& name);
+
+		/// <summary>
+		/// Opens a semaphore created by another process.
+		/// </summary>
+		/// <param name="name">The name it was created with.</param>
+		/// <returns>false if there is no such semaphore.</returns>
+		bool Open(const std::string& name);
+
+		/// <summary>
+		/// Closes the semaphore, and removes its name if this created it.
+		/// </summary>
+		void Close();
+
+		/// <summary>
+		/// Adds one to the count, releasing a waiter if there is one.
+		/// </summary>
+		void Post();
+
+		/// <summary>
+		/// Waits for the count to be above 0 and takes one off it.
+		/// </summary>
+		/// <param name="milliseconds">The most time to wait.</param>
+		/// <returns>false if the time ran out first.</returns>
+		bool Wait(unsigned milliseconds);
+
+	private:
+		std::string name_;
+		bool owner_ = false;
+		// the semaphore handle on Windows, sem_t* elsewhere
+		void* handle_ = nullptr;
+
+		bool Connect(const std::string& name, bool create);
+	};
+}
+
+#endif //SHARED_MEMORY_H_
@@ -27,9 +27,11 @@
 //#include <SDKDDKVer.h>
 
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 // Windows Header Files:
 #include <windows.h>
+#endif
 
 // C RunTime Header Files
 //#include <stdlib.h>
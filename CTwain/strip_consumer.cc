@@ -0,0 +1,123 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include "strip_consumer.h"
+
+using namespace std;
+
+namespace ctwain{
+
+	StripConsumer::StripConsumer(Handler handler) : handler_(handler)
+	{
+		worker_ = thread{ [this](){ Run(); } };
+	}
+
+	StripConsumer::~StripConsumer()
+	{
+		{
+			lock_guard<mutex> lk(mutex_);
+			stopping_ = true;
+		}
+		changed_.notify_all();
+		if (worker_.joinable()){
+			worker_.join();
+		}
+	}
+
+	void StripConsumer::Reset(unsigned count){
+		if (count > kMaxBuffers){
+			count = kMaxBuffers;
+		}
+		lock_guard<mutex> lk(mutex_);
+		free_mask_ = (1u << count) - 1;
+		busy_ = 0;
+		head_ = 0;
+		size_ = 0;
+	}
+
+	unsigned StripConsumer::Acquire(){
+		unique_lock<mutex> lk(mutex_);
+		while (free_mask_ == 0){
+			changed_.wait(lk);
+		}
+		unsigned index = 0;
+		while ((free_mask_ & (1u << index)) == 0){
+			index++;
+		}
+		free_mask_ &= ~(1u << index);
+		return index;
+	}
+
+	void StripConsumer::Release(unsigned index){
+		{
+			lock_guard<mutex> lk(mutex_);
+			free_mask_ |= 1u << index;
+		}
+		changed_.notify_all();
+	}
+
+	void StripConsumer::Submit(unsigned index, const TransferredStripEventArgs& strip){
+		{
+			lock_guard<mutex> lk(mutex_);
+			auto& item = queue_[(head_ + size_) % kMaxBuffers];
+			item.Index = index;
+			item.Strip = strip;
+			size_++;
+		}
+		changed_.notify_all();
+	}
+
+	void StripConsumer::Drain(){
+		unique_lock<mutex> lk(mutex_);
+		while (size_ > 0 || busy_ > 0){
+			changed_.wait(lk);
+		}
+	}
+
+	void StripConsumer::Run(){
+		unique_lock<mutex> lk(mutex_);
+		while (true){
+			while (size_ == 0 && !stopping_){
+				changed_.wait(lk);
+			}
+			if (size_ == 0){
+				// only leave once everything submitted has been handled
+				return;
+			}
+
+			Item item = queue_[head_];
+			head_ = (head_ + 1) % kMaxBuffers;
+			size_--;
+			busy_++;
+
+			lk.unlock();
+			handler_(item.Strip);
+			lk.lock();
+
+			busy_--;
+			free_mask_ |= 1u << item.Index;
+			changed_.notify_all();
+		}
+	}
+}
@@ -0,0 +1,117 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef STRIP_CONSUMER_H_
+#define STRIP_CONSUMER_H_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "twain_session.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// Worker thread that processes memory transfer strips while the source fills the next buffer.
+	/// Buffers are tracked by index, a buffer is free again once its strip has been handled.
+	/// This class should not be used by typical consumers.
+	/// </summary>
+	class StripConsumer
+	{
+	public:
+		/// <summary>
+		/// The maximum number of buffers that can rotate through the consumer.
+		/// </summary>
+		static const unsigned kMaxBuffers = 8;
+
+		typedef std::function<void(const TransferredStripEventArgs&)> Handler;
+
+		/// <summary>
+		/// Initializes a new instance of the <see cref="StripConsumer"/> class
+		/// and starts its worker thread.
+		/// </summary>
+		/// <param name="handler">The function to call for each strip on the worker thread.</param>
+		explicit StripConsumer(Handler handler);
+		~StripConsumer();
+
+		StripConsumer(const StripConsumer&) = delete;
+		StripConsumer& operator=(const StripConsumer&) = delete;
+
+		/// <summary>
+		/// Marks the first <paramref name="count"/> buffers as free. Only call this
+		/// when the consumer is idle, i.e. before a page or after <see cref="Drain"/>.
+		/// </summary>
+		/// <param name="count">The number of buffers used for the page.</param>
+		void Reset(unsigned count);
+
+		/// <summary>
+		/// Waits for a free buffer and marks it as in use.
+		/// </summary>
+		/// <returns>The buffer index.</returns>
+		unsigned Acquire();
+
+		/// <summary>
+		/// Returns an acquired buffer that ended up not holding a strip.
+		/// </summary>
+		/// <param name="index">The buffer index from <see cref="Acquire"/>.</param>
+		void Release(unsigned index);
+
+		/// <summary>
+		/// Queues a filled buffer for the worker thread. The buffer is released
+		/// once the handler returns.
+		/// </summary>
+		/// <param name="index">The buffer index from <see cref="Acquire"/>.</param>
+		/// <param name="strip">The strip description pointing into the buffer.</param>
+		void Submit(unsigned index, const TransferredStripEventArgs& strip);
+
+		/// <summary>
+		/// Waits until every queued strip has been handled.
+		/// </summary>
+		void Drain();
+
+	private:
+		struct Item{
+			unsigned Index;
+			TransferredStripEventArgs Strip;
+		};
+
+		Handler handler_;
+		std::thread worker_;
+		std::mutex mutex_;
+		std::condition_variable changed_;
+		bool stopping_ = false;
+
+		unsigned free_mask_ = 0;
+		unsigned busy_ = 0;
+
+		// ring of submitted strips, never more than the buffer count
+		Item queue_[kMaxBuffers];
+		unsigned head_ = 0;
+		unsigned size_ = 0;
+
+		void Run();
+	};
+}
+
+#endif //STRIP_CONSUMER_H_
@@ -0,0 +1,467 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <cstdio>
+#include "tiff_writer.h"
+
+namespace ctwain{
+
+	namespace{
+
+		const uint16_t kMagic = 42;
+		const size_t kHeaderSize = 8;
+		const size_t kEntrySize = 12;
+		const unsigned long long kMaxOffset = 0xFFFFFFFFull;
+
+		const uint16_t kTagImageWidth = 256;
+		const uint16_t kTagImageLength = 257;
+		const uint16_t kTagBitsPerSample = 258;
+		const uint16_t kTagCompression = 259;
+		const uint16_t kTagPhotometric = 262;
+		const uint16_t kTagStripOffsets = 273;
+		const uint16_t kTagSamplesPerPixel = 277;
+		const uint16_t kTagRowsPerStrip = 278;
+		const uint16_t kTagStripByteCounts = 279;
+		const uint16_t kTagXResolution = 282;
+		const uint16_t kTagYResolution = 283;
+		const uint16_t kTagT4Options = 292;
+		const uint16_t kTagResolutionUnit = 296;
+		const uint16_t kTagTileOffsets = 324;
+		const uint16_t kTagTileByteCounts = 325;
+
+		const uint16_t kTypeShort = 3;
+		const uint16_t kTypeLong = 4;
+		const uint16_t kTypeRational = 5;
+
+		const uint16_t kCompressionNone = 1;
+		const uint16_t kCompressionCcittRle = 2;
+		const uint16_t kCompressionCcittT4 = 3;
+		const uint16_t kCompressionCcittT6 = 4;
+		const uint16_t kCompressionPackBits = 32773;
+
+		const uint16_t kPhotometricWhiteIsZero = 0;
+		const uint16_t kPhotometricBlackIsZero = 1;
+		const uint16_t kPhotometricRgb = 2;
+		const uint16_t kResolutionUnitInch = 2;
+
+		uint16_t Get16(const uint8_t* data){
+			return static_cast<uint16_t>(data[0] | data[1] << 8);
+		}
+
+		uint32_t Get32(const uint8_t* data){
+			return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8 |
+				static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+		}
+
+		void Put16(std::vector<uint8_t>& out, uint16_t value){
+			out.push_back(static_cast<uint8_t>(value));
+			out.push_back(static_cast<uint8_t>(value >> 8));
+		}
+
+		void Put32(std::vector<uint8_t>& out, uint32_t value){
+			Put16(out, static_cast<uint16_t>(value));
+			Put16(out, static_cast<uint16_t>(value >> 16));
+		}
+
+		uint32_t TypeSize(uint16_t type){
+			switch (type){
+			case 1: // BYTE
+			case 2: // ASCII
+			case 6: // SBYTE
+			case 7: // UNDEFINED
+				return 1;
+			case 3: // SHORT
+			case 8: // SSHORT
+				return 2;
+			case 4: // LONG
+			case 9: // SLONG
+			case 11: // FLOAT
+				return 4;
+			case 5: // RATIONAL
+			case 10: // SRATIONAL
+			case 12: // DOUBLE
+				return 8;
+			default:
+				return 0;
+			}
+		}
+
+		bool PointsToDirectory(uint16_t tag){
+			// SubIFDs, EXIF, GPS and interoperability directories aren't followed
+			return tag == 330 || tag == 34665 || tag == 34853 || tag == 40965;
+		}
+
+		struct Field{
+			uint16_t Tag;
+			uint16_t Type;
+			uint32_t Count;
+			const uint8_t* Value;
+			size_t Size;
+			uint32_t Offset; // where Value went in the output when it doesn't fit the entry
+		};
+
+		uint32_t ArrayItem(const Field& field, uint32_t index){
+			return field.Type == kTypeShort ? Get16(field.Value + index * 2) : Get32(field.Value + index * 4);
+		}
+
+		void PutEntry(std::vector<uint8_t>& out, uint16_t tag, uint16_t type, uint32_t count, uint32_t value){
+			Put16(out, tag);
+			Put16(out, type);
+			Put32(out, count);
+			if (type == kTypeShort && count == 1){
+				Put16(out, static_cast<uint16_t>(value));
+				Put16(out, 0);
+			}
+			else{
+				Put32(out, value);
+			}
+		}
+
+		void PutResolution(std::vector<uint8_t>& out, const TW_FIX32& value){
+			// the fixed point value as is over 65536
+			Put32(out, static_cast<uint32_t>(static_cast<uint16_t>(value.Whole)) << 16 | value.Frac);
+			Put32(out, 0x10000);
+		}
+	}
+
+	TiffWriter::~TiffWriter(){
+		if (is_open()){
+			Close();
+		}
+	}
+
+	bool TiffWriter::Open(const std::string& path){
+		if (is_open()){
+			Close();
+		}
+		end_ = 0;
+		page_count_ = 0;
+		file_.clear();
+		file_.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+		if (!file_.is_open()){
+			return false;
+		}
+		path_ = path;
+		// the first directory offset is linked when the first page is done
+		std::vector<uint8_t> header;
+		header.push_back('I');
+		header.push_back('I');
+		Put16(header, kMagic);
+		Put32(header, 0);
+		next_link_ = 4;
+		return Write(header.data(), header.size()) && file_.flush().good();
+	}
+
+	bool TiffWriter::AppendTiff(const TW_UINT8* data, size_t size){
+		if (!is_open() || !data || size < kHeaderSize ||
+			data[0] != 'I' || data[1] != 'I' || Get16(data + 2) != kMagic){
+			return false;
+		}
+		unsigned long long ifd = Get32(data + 4);
+		if (ifd + 2 > size){
+			return false;
+		}
+		uint16_t entries = Get16(data + ifd);
+		if (ifd + 2 + entries * kEntrySize + 4 > size){
+			return false;
+		}
+
+		std::vector<Field> fields;
+		fields.reserve(entries);
+		Field* offsets = nullptr;
+		Field* counts = nullptr;
+		for (uint16_t i = 0; i < entries; i++){
+			auto entry = data + ifd + 2 + i * kEntrySize;
+			Field field{ Get16(entry), Get16(entry + 2), Get32(entry + 4), entry + 8, 0, 0 };
+			unsigned long long bytes = static_cast<unsigned long long>(field.Count) * TypeSize(field.Type);
+			if (bytes == 0 || PointsToDirectory(field.Tag)){
+				continue;
+			}
+			if (bytes > 4){
+				unsigned long long at = Get32(entry + 8);
+				if (at + bytes > size){
+					return false;
+				}
+				field.Value = data + at;
+			}
+			field.Size = static_cast<size_t>(bytes);
+			fields.push_back(field);
+		}
+		for (auto& field : fields){
+			if (field.Tag == kTagStripOffsets || field.Tag == kTagTileOffsets){
+				offsets = &field;
+			}
+			else if (field.Tag == kTagStripByteCounts || field.Tag == kTagTileByteCounts){
+				counts = &field;
+			}
+		}
+		if (!offsets || !counts || offsets->Count != counts->Count ||
+			(offsets->Type != kTypeShort && offsets->Type != kTypeLong) ||
+			(counts->Type != kTypeShort && counts->Type != kTypeLong)){
+			return false;
+		}
+
+		// image data first, then values too big for their entries, then the directory
+		std::vector<uint8_t> moved;
+		moved.reserve(offsets->Count * 4);
+		for (uint32_t i = 0; i < offsets->Count; i++){
+			unsigned long long at = ArrayItem(*offsets, i);
+			unsigned long long bytes = ArrayItem(*counts, i);
+			if (at + bytes > size || !Align()){
+				return false;
+			}
+			Put32(moved, static_cast<uint32_t>(end_));
+			if (!Write(data + at, static_cast<size_t>(bytes))){
+				return false;
+			}
+		}
+		offsets->Type = kTypeLong;
+		offsets->Value = moved.data();
+		offsets->Size = moved.size();
+
+		for (auto& field : fields){
+			if (field.Size > 4){
+				if (!Align()){
+					return false;
+				}
+				field.Offset = static_cast<uint32_t>(end_);
+				if (!Write(field.Value, field.Size)){
+					return false;
+				}
+			}
+		}
+
+		std::vector<uint8_t> directory;
+		directory.reserve(2 + fields.size() * kEntrySize + 4);
+		Put16(directory, static_cast<uint16_t>(fields.size()));
+		for (auto& field : fields){
+			Put16(directory, field.Tag);
+			Put16(directory, field.Type);
+			Put32(directory, field.Count);
+			if (field.Size > 4){
+				Put32(directory, field.Offset);
+			}
+			else{
+				// small values are left aligned in the entry
+				directory.insert(directory.end(), field.Value, field.Value + field.Size);
+				directory.insert(directory.end(), 4 - field.Size, 0);
+			}
+		}
+		Put32(directory, 0);
+		return AppendDirectory(directory);
+	}
+
+	bool TiffWriter::AppendImage(const TW_IMAGEINFO& info, const TW_UINT8* data, size_t size){
+		if (!is_open() || !data || size == 0 || info.ImageWidth <= 0 || info.ImageLength <= 0){
+			return false;
+		}
+
+		uint16_t samples = 1;
+		uint16_t photometric = kPhotometricBlackIsZero;
+		switch (info.PixelType){
+		case TWPT_BW:
+		case TWPT_GRAY:
+			break;
+		case TWPT_RGB:
+			samples = 3;
+			photometric = kPhotometricRgb;
+			break;
+		default:
+			return false;
+		}
+		uint16_t bits = info.BitsPerSample[0];
+		if (info.SamplesPerPixel != samples || bits == 0 || (samples > 1 && info.Planar)){
+			return false;
+		}
+
+		uint16_t compression = 0;
+		uint32_t t4Options = 0;
+		switch (info.Compression){
+		case TWCP_NONE:
+			compression = kCompressionNone;
+			break;
+		case TWCP_PACKBITS:
+			compression = kCompressionPackBits;
+			break;
+		case TWCP_GROUP31D:
+			compression = kCompressionCcittRle;
+			break;
+		case TWCP_GROUP31DEOL:
+			compression = kCompressionCcittT4;
+			break;
+		case TWCP_GROUP32D:
+			compression = kCompressionCcittT4;
+			t4Options = 1; // 2D coding
+			break;
+		case TWCP_GROUP4:
+			compression = kCompressionCcittT6;
+			break;
+		default:
+			return false;
+		}
+		uint32_t width = static_cast<uint32_t>(info.ImageWidth);
+		uint32_t length = static_cast<uint32_t>(info.ImageLength);
+		if (compression >= kCompressionCcittRle && compression <= kCompressionCcittT6){
+			// fax codes are white and black runs rather than sample values
+			if (bits != 1 || samples != 1){
+				return false;
+			}
+			photometric = kPhotometricWhiteIsZero;
+		}
+		else if (compression == kCompressionNone &&
+			size != (static_cast<unsigned long long>(width) * bits * samples + 7) / 8 * length){
+			// rows must be packed without the source's padding
+			return false;
+		}
+
+		// image data, then values too big for their entries, then the directory
+		if (!Align()){
+			return false;
+		}
+		auto dataOffset = static_cast<uint32_t>(end_);
+		if (!Write(data, size) || !Align()){
+			return false;
+		}
+
+		std::vector<uint8_t> values;
+		auto valuesOffset = static_cast<uint32_t>(end_);
+		uint32_t bitsValue = bits;
+		if (samples > 1){
+			bitsValue = valuesOffset + static_cast<uint32_t>(values.size());
+			for (uint16_t i = 0; i < samples; i++){
+				Put16(values, bits);
+			}
+		}
+		bool hasResolution = info.XResolution.Whole > 0 && info.YResolution.Whole > 0;
+		uint32_t xResolution = valuesOffset + static_cast<uint32_t>(values.size());
+		uint32_t yResolution = xResolution + 8;
+		if (hasResolution){
+			PutResolution(values, info.XResolution);
+			PutResolution(values, info.YResolution);
+		}
+		if (!values.empty() && !Write(values.data(), values.size())){
+			return false;
+		}
+
+		// entries go in tag order
+		std::vector<uint8_t> directory;
+		uint16_t entries = 0;
+		directory.reserve(2 + 13 * kEntrySize + 4);
+		Put16(directory, 0);
+		PutEntry(directory, kTagImageWidth, kTypeLong, 1, width);
+		PutEntry(directory, kTagImageLength, kTypeLong, 1, length);
+		PutEntry(directory, kTagBitsPerSample, kTypeShort, samples, bitsValue);
+		PutEntry(directory, kTagCompression, kTypeShort, 1, compression);
+		PutEntry(directory, kTagPhotometric, kTypeShort, 1, photometric);
+		PutEntry(directory, kTagStripOffsets, kTypeLong, 1, dataOffset);
+		PutEntry(directory, kTagSamplesPerPixel, kTypeShort, 1, samples);
+		PutEntry(directory, kTagRowsPerStrip, kTypeLong, 1, length);
+		PutEntry(directory, kTagStripByteCounts, kTypeLong, 1, static_cast<uint32_t>(size));
+		entries += 9;
+		if (hasResolution){
+			PutEntry(directory, kTagXResolution, kTypeRational, 1, xResolution);
+			PutEntry(directory, kTagYResolution, kTypeRational, 1, yResolution);
+			entries += 2;
+		}
+		if (compression == kCompressionCcittT4){
+			PutEntry(directory, kTagT4Options, kTypeLong, 1, t4Options);
+			entries++;
+		}
+		if (hasResolution){
+			PutEntry(directory, kTagResolutionUnit, kTypeShort, 1, kResolutionUnitInch);
+			entries++;
+		}
+		Put32(directory, 0);
+		directory[0] = static_cast<uint8_t>(entries);
+		directory[1] = static_cast<uint8_t>(entries >> 8);
+		return AppendDirectory(directory);
+	}
+
+	bool TiffWriter::AppendPage(const TransferredPage& page){
+		auto& encoded = page.encoded_data();
+		if (!encoded.empty()){
+			return AppendTiff(encoded.data(), encoded.size());
+		}
+		// compressed memory transfers go in as they came
+		auto info = page.image_info();
+		if (!info || !page.memory_data()){
+			return false;
+		}
+		TW_IMAGEINFO stored = *info;
+		stored.Compression = page.compression();
+		return AppendImage(stored, page.memory_data(), page.memory_size());
+	}
+
+	bool TiffWriter::Close(){
+		if (!is_open()){
+			return false;
+		}
+		bool good = file_.flush().good();
+		file_.close();
+		if (page_count_ == 0){
+			// the header points at no directory, which readers reject
+			std::remove(path_.c_str());
+			return false;
+		}
+		return good && !file_.fail();
+	}
+
+	bool TiffWriter::Write(const void* data, size_t size){
+		if (end_ + size > kMaxOffset){
+			return false;
+		}
+		file_.write(static_cast<const char*>(data), size);
+		end_ += size;
+		return file_.good();
+	}
+
+	bool TiffWriter::Align(){
+		// values and directories start on word boundaries
+		const char pad = 0;
+		return (end_ & 1) == 0 || Write(&pad, 1);
+	}
+
+	bool TiffWriter::AppendDirectory(const std::vector<uint8_t>& directory){
+		if (!Align()){
+			return false;
+		}
+		auto directoryOffset = end_;
+		if (!Write(directory.data(), directory.size()) || !Link(directoryOffset)){
+			return false;
+		}
+		next_link_ = directoryOffset + directory.size() - 4;
+		page_count_++;
+		return true;
+	}
+
+	bool TiffWriter::Link(unsigned long long ifd){
+		// point the header or the previous directory at the new one and hand it all to the OS
+		std::vector<uint8_t> link;
+		Put32(link, static_cast<uint32_t>(ifd));
+		file_.seekp(static_cast<std::streamoff>(next_link_));
+		file_.write(reinterpret_cast<const char*>(link.data()), link.size());
+		file_.seekp(0, std::ios::end);
+		return file_.flush().good();
+	}
+}
@@ -0,0 +1,129 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef TIFF_WRITER_H_
+#define TIFF_WRITER_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "transferred_page.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// Writes a multipage TIFF one page at a time. Each page's data and directory are flushed
+	/// to the OS as soon as it is appended and are then linked from the previous page, so memory use
+	/// stays at about one page however long the batch, and the file holds every page appended
+	/// so far even if the process ends without closing the writer. Nothing is synced to the disk
+	/// itself, so pages can still be lost if the machine goes down.
+	/// Pages are single page TIFFs in Intel byte order, such as from <see cref="PageEncoder"/>,
+	/// whose first directory and image data are copied in, or image data straight from memory
+	/// transfers, compressed or not, which gets a directory of its own. The output is classic TIFF so it is
+	/// limited to 4 GB. This class is not thread-safe; <see cref="TwainSession::OnPageCompleted"/>
+	/// is a good place to append pages in order.
+	/// </summary>
+	class TiffWriter
+	{
+	public:
+		TiffWriter(){}
+
+		/// <summary>
+		/// Finishes the file if still open.
+		/// </summary>
+		~TiffWriter();
+
+		TiffWriter(const TiffWriter&) = delete;
+		TiffWriter& operator=(const TiffWriter&) = delete;
+
+		/// <summary>
+		/// Creates the file, replacing any existing one.
+		/// </summary>
+		/// <param name="path">The file path.</param>
+		/// <returns>false if the file couldn't be created.</returns>
+		bool Open(const std::string& path);
+
+		/// <summary>
+		/// Appends the first page of a TIFF file held in memory.
+		/// </summary>
+		/// <param name="data">The TIFF file.</param>
+		/// <param name="size">The size of <paramref name="data"/>.</param>
+		/// <returns>false if the data isn't a TIFF this can read or writing failed.
+		/// The pages appended before are still intact.</returns>
+		bool AppendTiff(const TW_UINT8* data, size_t size);
+
+		/// <summary>
+		/// Appends image data as it came from the source as one strip, without decoding it.
+		/// This stores compressed memory transfers (<see cref="TwainSession::SetCompression"/>)
+		/// such as TWCP_GROUP4, the G3 variants and TWCP_PACKBITS as well as packed TWCP_NONE rows.
+		/// CCITT data is expected in MSB first bit order (ICAP_BITORDERCODES) and uncompressed
+		/// bitonal data in the default chocolate flavor (ICAP_PIXELFLAVOR). JPEG data is a JFIF
+		/// file already so it is not taken here.
+		/// </summary>
+		/// <param name="info">The final image information, whose compression is that of <paramref name="data"/>.</param>
+		/// <param name="data">The image data.</param>
+		/// <param name="size">The size of <paramref name="data"/>.</param>
+		/// <returns>false if the image type or compression can't be stored or writing failed.</returns>
+		bool AppendImage(const TW_IMAGEINFO& info, const TW_UINT8* data, size_t size);
+
+		/// <summary>
+		/// Appends a page with TIFF <see cref="TransferredPage::encoded_data"/>,
+		/// or failing that its compressed memory data with <see cref="AppendImage"/>.
+		/// </summary>
+		/// <param name="page">The page.</param>
+		/// <returns>false if the page has no data this can store or writing failed.</returns>
+		bool AppendPage(const TransferredPage& page);
+
+		/// <summary>
+		/// Flushes and closes the file. A TIFF needs at least one page, so a file
+		/// nothing was appended to is deleted instead.
+		/// </summary>
+		/// <returns>false if the file was not open, had no pages or couldn't be written.</returns>
+		bool Close();
+
+		/// <summary>
+		/// Gets a value indicating whether a file is open.
+		/// </summary>
+		bool is_open() const{ return file_.is_open(); }
+
+		/// <summary>
+		/// Gets the number of pages written to the current file.
+		/// </summary>
+		TW_UINT32 page_count() const{ return page_count_; }
+
+	private:
+		std::ofstream file_;
+		std::string path_;
+		unsigned long long end_ = 0;
+		unsigned long long next_link_ = 0;
+		TW_UINT32 page_count_ = 0;
+
+		bool Write(const void* data, size_t size);
+		bool Align();
+		bool Link(unsigned long long ifd);
+		bool AppendDirectory(const std::vector<uint8_t>& directory);
+	};
+}
+
+#endif //TIFF_WRITER_H_
@@ -0,0 +1,284 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "transferred_page.h"
+#include "entry_points.h"
+#include "buffer_pool.h"
+
+namespace ctwain{
+
+	namespace{
+		// more pages than this are rarely in flight at once
+		const size_t kKeptPages = 64;
+
+		// pages are made on the loop thread and freed wherever the app is done with them
+		struct PageRecycler{
+			std::mutex Mutex;
+			std::vector<void*> Pages;
+			std::vector<std::string> Paths;
+		};
+
+		// the most pages alive at once according to KeepMemoryFor
+		std::atomic<size_t> kept_page_count{ 0 };
+
+		std::once_flag recycler_once;
+		PageRecycler* recycler = nullptr;
+
+		// never destroyed since pages may be freed during static destruction
+		PageRecycler& Recycler(){
+			std::call_once(recycler_once, []{
+				recycler = new PageRecycler();
+				recycler->Pages.reserve(kKeptPages);
+				recycler->Paths.reserve(kKeptPages);
+			});
+			return *recycler;
+		}
+	}
+
+	void* TransferredPage::operator new(size_t size){
+		if (size == sizeof(TransferredPage)){
+			auto& kept = Recycler();
+			std::lock_guard<std::mutex> lock(kept.Mutex);
+			if (!kept.Pages.empty()){
+				auto memory = kept.Pages.back();
+				kept.Pages.pop_back();
+				return memory;
+			}
+		}
+		return ::operator new(size);
+	}
+
+	void TransferredPage::operator delete(void* memory){
+		if (!memory){
+			return;
+		}
+		{
+			auto& kept = Recycler();
+			std::lock_guard<std::mutex> lock(kept.Mutex);
+			if (kept.Pages.size() < kKeptPages){
+				kept.Pages.push_back(memory);
+				return;
+			}
+		}
+		::operator delete(memory);
+	}
+
+	void TransferredPage::KeepMemoryFor(size_t pages){
+		auto& kept = Recycler();
+		std::lock_guard<std::mutex> lock(kept.Mutex);
+		kept_page_count = pages;
+		while (kept.Pages.size() < pages && kept.Pages.size() < kKeptPages){
+			kept.Pages.push_back(::operator new(sizeof(TransferredPage)));
+		}
+	}
+
+	TransferredPage::TransferredPage(TW_UINT32 sequence) : sequence_{ sequence }, image_info_{}
+	{
+	}
+
+	TransferredPage::~TransferredPage()
+	{
+		Clear();
+		if (file_path_.capacity() > std::string().capacity()){
+			auto& kept = Recycler();
+			std::lock_guard<std::mutex> lock(kept.Mutex);
+			if (kept.Paths.size() < kKeptPages){
+				kept.Paths.push_back(std::move(file_path_));
+			}
+		}
+	}
+
+	TransferredPage::TransferredPage(TransferredPage&& other) : sequence_{ other.sequence_ }, image_info_{}
+	{
+		*this = std::move(other);
+	}
+
+	TransferredPage& TransferredPage::operator=(TransferredPage&& other){
+		if (this != &other)
+		{
+			Clear();
+			sequence_ = other.sequence_;
+			has_image_info_ = other.has_image_info_;
+			image_info_ = other.image_info_;
+			native_handle_ = other.native_handle_;
+			native_data_ = other.native_data_;
+			file_path_ = std::move(other.file_path_);
+			image_file_format_ = other.image_file_format_;
+			file_data_ = std::move(other.file_data_);
+			memory_ = other.memory_;
+			memory_capacity_ = other.memory_capacity_;
+			memory_size_ = other.memory_size_;
+			bytes_per_row_ = other.bytes_per_row_;
+			compression_ = other.compression_;
+			encoded_data_ = std::move(other.encoded_data_);
+			blank_page_ = other.blank_page_;
+
+			other.native_handle_ = nullptr;
+			other.native_data_ = nullptr;
+			other.memory_ = nullptr;
+			other.memory_capacity_ = 0;
+			other.memory_size_ = 0;
+		}
+		return *this;
+	}
+
+	void TransferredPage::set_image_info(const TW_IMAGEINFO& info){
+		image_info_ = info;
+		has_image_info_ = true;
+	}
+
+	void TransferredPage::AdoptNativeData(TW_HANDLE handle, TW_MEMREF locked){
+		ReleaseNativeData();
+		native_handle_ = handle;
+		native_data_ = locked;
+	}
+
+	TW_HANDLE TransferredPage::ReleaseNativeData(){
+		auto handle = native_handle_;
+		native_handle_ = nullptr;
+		native_data_ = nullptr;
+		return handle;
+	}
+
+	void TransferredPage::set_file(const std::string& path, TW_UINT16 format){
+		if (file_path_.capacity() < path.size()){
+			auto& kept = Recycler();
+			std::lock_guard<std::mutex> lock(kept.Mutex);
+			if (!kept.Paths.empty()){
+				file_path_.swap(kept.Paths.back());
+				kept.Paths.pop_back();
+			}
+		}
+		file_path_ = path;
+		image_file_format_ = format;
+	}
+
+	bool TransferredPage::AppendStrip(const TransferredStripEventArgs& strip){
+		compression_ = strip.Compression;
+
+		if (strip.Compression != TWCP_NONE || strip.BytesPerRow == 0 || strip.BytesPerRow == TWON_DONTCARE32){
+			// compressed strips have no row layout so just keep them in order
+			if (!Reserve(memory_size_ + strip.BytesWritten)){
+				return false;
+			}
+			memcpy(memory_ + memory_size_, strip.Data, strip.BytesWritten);
+			memory_size_ += strip.BytesWritten;
+			return true;
+		}
+
+		// a source that misreports its strip must not make the rows read past its data
+		if (static_cast<unsigned long long>(strip.BytesPerRow) * strip.Rows > strip.BytesWritten){
+			return false;
+		}
+
+		// place rows at their offsets, tiles narrower than the page use the full page width as stride
+		auto info = strip.ImageInfo;
+		size_t bitsPerPixel = info && info->BitsPerPixel > 0 ? info->BitsPerPixel : 0;
+		if (bytes_per_row_ == 0){
+			bytes_per_row_ = strip.BytesPerRow;
+			if ((strip.XOffset != 0 || (info && static_cast<TW_INT32>(strip.Columns) < info->ImageWidth)) && bitsPerPixel){
+				bytes_per_row_ = static_cast<TW_UINT32>((info->ImageWidth * bitsPerPixel + 7) / 8);
+			}
+		}
+		size_t rowBytes = bitsPerPixel ? (strip.Columns * bitsPerPixel + 7) / 8 : strip.BytesPerRow;
+		if (rowBytes > strip.BytesPerRow){
+			rowBytes = strip.BytesPerRow;
+		}
+		size_t columnOffset = bitsPerPixel ? strip.XOffset * bitsPerPixel / 8 : 0;
+		if (columnOffset + rowBytes > bytes_per_row_){
+			return false;
+		}
+
+		size_t end = (static_cast<size_t>(strip.YOffset) + strip.Rows) * bytes_per_row_;
+		if (info && info->ImageLength > 0 && memory_capacity_ == 0){
+			// first strip of a page with known length, get it all at once
+			size_t full = static_cast<size_t>(info->ImageLength) * bytes_per_row_;
+			if (kept_page_count > 0){
+				EntryPoints::buffer_pool().Keep(full > end ? full : end, kept_page_count);
+			}
+			if (!Reserve(full > end ? full : end)){
+				return false;
+			}
+		}
+		if (!Reserve(end)){
+			return false;
+		}
+
+		for (TW_UINT32 row = 0; row < strip.Rows; row++){
+			memcpy(memory_ + (static_cast<size_t>(strip.YOffset) + row) * bytes_per_row_ + columnOffset,
+				strip.Data + static_cast<size_t>(row) * strip.BytesPerRow, rowBytes);
+		}
+		if (end > memory_size_){
+			memory_size_ = end;
+		}
+		return true;
+	}
+
+	void TransferredPage::FreeTransferData(){
+		Clear();
+	}
+
+	bool TransferredPage::Reserve(size_t size){
+		if (size <= memory_capacity_){
+			return true;
+		}
+		size_t capacity = memory_capacity_ ? memory_capacity_ * 2 : size;
+		if (capacity < size){
+			capacity = size;
+		}
+		auto grown = static_cast<TW_UINT8*>(EntryPoints::AllocBuffer(static_cast<TW_UINT32>(capacity)));
+		if (!grown){
+			return false;
+		}
+		if (memory_){
+			memcpy(grown, memory_, memory_size_);
+			EntryPoints::FreeBuffer(memory_);
+		}
+		memory_ = grown;
+		memory_capacity_ = capacity;
+		return true;
+	}
+
+	void TransferredPage::Clear(){
+		if (native_handle_){
+			if (native_data_){
+				EntryPoints::Unlock(native_handle_);
+			}
+			EntryPoints::Free(native_handle_);
+			native_handle_ = nullptr;
+			native_data_ = nullptr;
+		}
+		if (memory_){
+			EntryPoints::FreeBuffer(memory_);
+			memory_ = nullptr;
+			memory_capacity_ = 0;
+			memory_size_ = 0;
+		}
+	}
+}
@@ -0,0 +1,227 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef TRANSFERRED_PAGE_H_
+#define TRANSFERRED_PAGE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "twain_session.h"
+
+namespace ctwain{
+
+	/// <summary>
+	/// A transferred page that owns its data, so it can outlive the transfer
+	/// and be handed to other threads. Native handles are unlocked and freed,
+	/// and memory transfer buffers are returned to the pool, when the page is destroyed.
+	/// The memory of freed pages and of their file paths is kept for the next pages.
+	/// </summary>
+	class TransferredPage
+	{
+	public:
+		/// <summary>
+		/// Initializes a new instance of the <see cref="TransferredPage"/> class.
+		/// </summary>
+		/// <param name="sequence">The page number within the session, starting from 0.</param>
+		explicit TransferredPage(TW_UINT32 sequence);
+		~TransferredPage();
+
+		/// <summary>
+		/// Takes the memory of a freed page if there is one.
+		/// </summary>
+		static void* operator new(size_t size);
+
+		/// <summary>
+		/// Keeps the memory for the next page, up to a limit.
+		/// </summary>
+		static void operator delete(void* memory);
+
+		/// <summary>
+		/// Sets aside memory for as many pages as may be alive at once, so even the first
+		/// pages through a pipeline don't allocate. Memory transfer buffers for that many pages
+		/// are put in the pool when the first page of a size comes in.
+		/// </summary>
+		/// <param name="pages">The number of pages.</param>
+		static void KeepMemoryFor(size_t pages);
+
+		TransferredPage(const TransferredPage&) = delete;
+		TransferredPage& operator=(const TransferredPage&) = delete;
+		TransferredPage(TransferredPage&& other);
+		TransferredPage& operator=(TransferredPage&& other);
+
+		/// <summary>
+		/// Gets the page number within the session, starting from 0.
+		/// </summary>
+		TW_UINT32 sequence() const{ return sequence_; }
+
+		/// <summary>
+		/// Gets the final image information or nullptr if not applicable.
+		/// </summary>
+		const TW_IMAGEINFO* image_info() const{ return has_image_info_ ? &image_info_ : nullptr; }
+
+		/// <summary>
+		/// Sets the final image information.
+		/// </summary>
+		void set_image_info(const TW_IMAGEINFO& info);
+
+		/// <summary>
+		/// Gets the locked native data if the transfer was native.
+		/// For image type this data is DIB (Windows) or TIFF (Linux).
+		/// </summary>
+		TW_MEMREF native_data() const{ return native_data_; }
+
+		/// <summary>
+		/// Gets the native handle if the transfer was native.
+		/// </summary>
+		TW_HANDLE native_handle() const{ return native_handle_; }
+
+		/// <summary>
+		/// Takes ownership of a native transfer handle. The handle is unlocked
+		/// and freed when the page is destroyed.
+		/// </summary>
+		/// <param name="handle">The handle from the source.</param>
+		/// <param name="locked">The locked pointer of <paramref name="handle"/>.</param>
+		void AdoptNativeData(TW_HANDLE handle, TW_MEMREF locked);
+
+		/// <summary>
+		/// Gives up ownership of the native handle, the caller is then responsible
+		/// for unlocking and freeing it.
+		/// </summary>
+		/// <returns>The native handle.</returns>
+		TW_HANDLE ReleaseNativeData();
+
+		/// <summary>
+		/// Gets the file path if transfer is for file.
+		/// </summary>
+		const std::string& file_path() const{ return file_path_; }
+
+		/// <summary>
+		/// Gets the image file format if transfer is for file or memory file.
+		/// </summary>
+		TW_UINT16 image_file_format() const{ return image_file_format_; }
+
+		/// <summary>
+		/// Sets the image file format of a memory file transfer.
+		/// </summary>
+		void set_image_file_format(TW_UINT16 format){ image_file_format_ = format; }
+
+		/// <summary>
+		/// Sets the file transfer result.
+		/// </summary>
+		void set_file(const std::string& path, TW_UINT16 format);
+
+		/// <summary>
+		/// Gets the file mapped read-only if file transfers are mapped, see <see cref="TwainSession::set_map_transferred_files"/>.
+		/// </summary>
+		const std::shared_ptr<MappedFile>& file_data() const{ return file_data_; }
+
+		/// <summary>
+		/// Sets the mapped file.
+		/// </summary>
+		void set_file_data(std::shared_ptr<MappedFile> data){ file_data_ = std::move(data); }
+
+		/// <summary>
+		/// Gets the assembled memory transfer data if transfer was buffered memory.
+		/// Uncompressed strips are placed at their row offsets, compressed strips
+		/// and memory file chunks are concatenated.
+		/// </summary>
+		const TW_UINT8* memory_data() const{ return memory_; }
+
+		/// <summary>
+		/// Gets the number of valid bytes in <see cref="memory_data"/>.
+		/// </summary>
+		size_t memory_size() const{ return memory_size_; }
+
+		/// <summary>
+		/// Gets the row stride of <see cref="memory_data"/> for uncompressed data.
+		/// </summary>
+		TW_UINT32 bytes_per_row() const{ return bytes_per_row_; }
+
+		/// <summary>
+		/// Gets the compression of <see cref="memory_data"/> (TWCP_* value).
+		/// </summary>
+		TW_UINT16 compression() const{ return compression_; }
+
+		/// <summary>
+		/// Copies a memory transfer strip into the page.
+		/// </summary>
+		/// <param name="strip">The strip.</param>
+		/// <returns>false if the strip does not fit the page or its data, or the page buffer could not be allocated.</returns>
+		bool AppendStrip(const TransferredStripEventArgs& strip);
+
+		/// <summary>
+		/// Gets the page encoded to a file format such as by <see cref="PageEncoder"/>,
+		/// empty if it wasn't encoded.
+		/// </summary>
+		const std::vector<TW_UINT8>& encoded_data() const{ return encoded_data_; }
+
+		/// <summary>
+		/// Sets the encoded page.
+		/// </summary>
+		void set_encoded_data(std::vector<TW_UINT8> data){ encoded_data_ = std::move(data); }
+
+		/// <summary>
+		/// Gets what blank page detection found, see <see cref="TwainSession::EnableBlankPageDetection"/>.
+		/// </summary>
+		const BlankPageResult& blank_page() const{ return blank_page_; }
+
+		/// <summary>
+		/// Sets the blank page detection result.
+		/// </summary>
+		void set_blank_page(const BlankPageResult& result){ blank_page_ = result; }
+
+		/// <summary>
+		/// Frees the native data and memory transfer data early, such as once the page
+		/// was encoded. The image information, file path and encoded data are kept.
+		/// </summary>
+		void FreeTransferData();
+
+	private:
+		TW_UINT32 sequence_;
+
+		bool has_image_info_ = false;
+		TW_IMAGEINFO image_info_;
+
+		TW_HANDLE native_handle_ = nullptr;
+		TW_MEMREF native_data_ = nullptr;
+
+		std::string file_path_;
+		TW_UINT16 image_file_format_ = 0;
+		std::shared_ptr<MappedFile> file_data_;
+
+		TW_UINT8* memory_ = nullptr;
+		size_t memory_capacity_ = 0;
+		size_t memory_size_ = 0;
+		TW_UINT32 bytes_per_row_ = 0;
+		TW_UINT16 compression_ = TWCP_NONE;
+
+		std::vector<TW_UINT8> encoded_data_;
+		BlankPageResult blank_page_;
+
+		bool Reserve(size_t size);
+		void Clear();
+	};
+}
+
+#endif //TRANSFERRED_PAGE_H_
@@ -22,283 +22,410 @@
 //
 
 #include "stdafx.h"
-#include <iostream>
 #include "build_macros.h"
 #include "twain_session.h"
 #include "entry_points.h"
 #include "message_loop.h"
+#include "strip_consumer.h"
+#include "page_pipeline.h"
+#include "capability_cache.h"
+#include "logger.h"
+#include "dib_view.h"
+#include "page_stream.h"
+#include "mapped_file.h"
+#include <cstring>
 
 namespace ctwain{
 
 
 
 	///////////////////////////////////////////////////////
-	// tests
+	// public twain session parts
 	///////////////////////////////////////////////////////
 
 
-	// temp hack to use static func for callback with current session instance
-	// this doesn't work yet.
-	struct CallbackHack{
 
-		static TwainSession* Instance;
-		static
-#ifdef TWH_CMP_MSC
-			TW_UINT16 FAR PASCAL
-#else
-			FAR PASCAL TW_UINT16
-#endif
-			DsmCallback(pTW_IDENTITY orig, pTW_IDENTITY, TW_UINT32, TW_UINT16, TW_UINT16 /*msg*/, TW_MEMREF){
-			if (Instance){
-				if (orig && orig->Id == Instance->source_id()){
-					//Instance->HandleDsmMessage(msg);
-					return TWRC_SUCCESS;
-				}
+	TwainSession::TwainSession() : cap_cache_{ std::make_unique<CapabilityCache>() }, memory_entry_(){
+		loop_ = std::make_unique<MessageLoop>(this);
+	}
+
+	TwainSession::~TwainSession(){
+		loop_->Send([this]{
+			EndStream();
+			pipeline_.reset();
+			// other sessions may still be using the DSM
+			if (state_ >= State::kDsmLoaded){
+				ForceStepDown(State::kDsmLoaded);
+				EntryPoints::UninitializeDSM();
+				state_ = State::kDsmUnloaded;
 			}
-			return TWRC_FAILURE;
+		});
+		loop_.reset();
+	}
+
+	TW_UINT32 TwainSession::source_id() const{
+		return ds_id_.Id;
+	}
+
+	void TwainSession::set_memory_buffer_count(unsigned count){
+		if (count < 1){
+			count = 1;
+		}
+		else if (count > StripConsumer::kMaxBuffers){
+			count = StripConsumer::kMaxBuffers;
 		}
+		// read by the transfer loop
+		loop_->Send([&]{ memory_buffer_count_ = count; });
+	}
 
-	};
+	void TwainSession::set_map_transferred_files(bool enabled){
+		// read by the transfer loop
+		loop_->Send([&]{ map_transferred_files_ = enabled; });
+	}
 
-	TwainSession* CallbackHack::Instance = nullptr;
+	void TwainSession::EnablePagePipeline(unsigned workers, size_t capacity){
+		loop_->Send([&]{
+			pipeline_.reset();
+			// the pages in the pipeline and the one waiting to get in
+			TransferredPage::KeepMemoryFor(capacity + 1);
+			pipeline_ = std::make_unique<PagePipeline>(workers, capacity,
+				[this](TransferredPage& page){ OnProcessPage(page); },
+				[this](std::unique_ptr<TransferredPage> page){ CompletePage(std::move(page)); });
+		});
+	}
 
+	void TwainSession::DisablePagePipeline(){
+		loop_->Send([&]{ pipeline_.reset(); });
+	}
 
+	void TwainSession::EnableBlankPageDetection(const BlankPageOptions& options){
+		loop_->Send([&]{ blank_detector_ = std::make_unique<BlankPageDetector>(options); });
+	}
 
+	void TwainSession::DisableBlankPageDetection(){
+		loop_->Send([&]{ blank_detector_.reset(); });
+	}
 
-	///////////////////////////////////////////////////////
-	// public twain session parts
-	///////////////////////////////////////////////////////
+	void TwainSession::EnablePreview(const PreviewOptions& options){
+		loop_->Send([&]{ preview_ = std::make_unique<PreviewBuilder>(options); });
+	}
 
+	void TwainSession::DisablePreview(){
+		loop_->Send([&]{ preview_.reset(); });
+	}
 
+	void TwainSession::EnableFileNaming(const FileNamingOptions& options){
+		loop_->Send([&]{
+			file_naming_ = std::make_unique<FileNamingOptions>(options);
+			file_number_ = options.FirstNumber;
+			if (options.StagingDirectory.empty()){
+				file_mover_.reset();
+			}
+			else if (!file_mover_){
+				file_mover_ = std::make_unique<FileMover>();
+			}
+		});
+	}
 
-	TwainSession::~TwainSession(){
-		EntryPoints::UninitializeDSM();
+	void TwainSession::DisableFileNaming(){
+		loop_->Send([&]{
+			file_naming_.reset();
+			file_mover_.reset();
+		});
+	}
 
-		if (loop_){
-			delete loop_;
-			loop_ = nullptr;
-		}
+	void TwainSession::FlushFileMoves(){
+		loop_->Send([&]{
+			if (file_mover_){
+				file_mover_->Flush();
+			}
+		});
 	}
 
-	TW_UINT32 TwainSession::source_id() const{
-		return ds_id_.Id;
+	void TwainSession::FlushPages(){
+		loop_->Send([&]{
+			if (pipeline_){
+				pipeline_->Flush();
+			}
+		});
 	}
 
 	bool TwainSession::Initialize(){
-		if (state_ < State::kDsmLoaded && EntryPoints::InitializeDSM()){
-			state_ = State::kDsmLoaded;
-			OnFillAppId(app_id_);
-		}
-		return state_ == State::kDsmLoaded;
+		return loop_->Send([&]{
+			if (state_ < State::kDsmLoaded && EntryPoints::InitializeDSM()){
+				state_ = State::kDsmLoaded;
+				OnFillAppId(app_id_);
+			}
+			return state_ == State::kDsmLoaded;
+		});
 	}
 
 
 	void TwainSession::ForceStepDown(State state){
-
-		if (state_ == State::kTransferring && state_ > state)
-		{
-			TW_PENDINGXFERS xfer;
-			CallDsm(true, DG_CONTROL, DAT_PENDINGXFERS, MSG_ENDXFER, &xfer);
-			state_ = State::kTransferReady;
-		}
-		if (state_ == State::kTransferReady && state_ > state)
-		{
-			TW_PENDINGXFERS xfer;
-			CallDsm(true, DG_CONTROL, DAT_PENDINGXFERS, MSG_RESET, &xfer);
-			state_ = State::kSourceEnabled;
-		}
-		if (state_ == State::kSourceEnabled && state_ > state)
-		{
-			DisableSource();
-			state_ = State::kSourceOpened;
-		}
-		if (state_ == State::kSourceOpened && state_ > state)
-		{
-			CloseSource();
-			state_ = State::kDsmOpened;
-		}
-		if (state_ == State::kDsmOpened && state_ > state)
-		{
-			CloseDsm();
-			state_ = State::kDsmLoaded;
-		}
+		loop_->Send([&]{
+			if (state_ == State::kTransferring && state_ > state)
+			{
+				TW_PENDINGXFERS xfer;
+				CallDsm(true, DG_CONTROL, DAT_PENDINGXFERS, MSG_ENDXFER, &xfer);
+				state_ = State::kTransferReady;
+			}
+			if (state_ == State::kTransferReady && state_ > state)
+			{
+				TW_PENDINGXFERS xfer;
+				CallDsm(true, DG_CONTROL, DAT_PENDINGXFERS, MSG_RESET, &xfer);
+				state_ = State::kSourceEnabled;
+			}
+			if (state_ == State::kSourceEnabled && state_ > state)
+			{
+				DisableSource();
+				state_ = State::kSourceOpened;
+			}
+			if (state_ == State::kSourceOpened && state_ > state)
+			{
+				CloseSource();
+				state_ = State::kDsmOpened;
+			}
+			if (state_ == State::kDsmOpened && state_ > state)
+			{
+				CloseDsm();
+				state_ = State::kDsmLoaded;
+			}
+		});
 	}
 
 
 	TW_UINT16 TwainSession::OpenDsm(HWND hWnd)
 	{
-		if (state_ == State::kDsmLoaded)
-		{
-			if (loop_){
-				delete loop_;
-				loop_ = nullptr;
-			}
-			if (hWnd){
-				loop_ = new MessageLoop{ hWnd };
-			}
-			else{
-				loop_ = new MessageLoop(this);
-			}
-
-			TW_UINT16 rc = CallDsm(false, DG_CONTROL, DAT_PARENT, MSG_OPENDSM, &hWnd);
-			if (rc == TWRC_SUCCESS)
+		return loop_->Send([&]() -> TW_UINT16 {
+			if (state_ == State::kDsmLoaded)
 			{
-				state_ = State::kDsmOpened;
-				EntryPoints::UpdateMemoryEntry(&app_id_);
+				// the loop's own window is used unless the app has one for the driver UI
+				parent_ = hWnd ? hWnd : loop_->parent_handle();
+
+				TW_UINT16 rc = CallDsm(false, DG_CONTROL, DAT_PARENT, MSG_OPENDSM, &parent_);
+				if (rc == TWRC_SUCCESS)
+				{
+					state_ = State::kDsmOpened;
+					memory_entry_ = EntryPoints::AddMemoryEntry(&app_id_);
+				}
+				return rc;
 			}
-			return rc;
-		}
-		return TWRC_FAILURE;
+			return TWRC_FAILURE;
+		});
 	}
 	TW_UINT16 TwainSession::CloseDsm()
 	{
-		if (state_ == State::kDsmOpened)
-		{
-			auto handle = loop_->parent_handle();
-			TW_UINT16 rc = CallDsm(false, DG_CONTROL, DAT_PARENT, MSG_CLOSEDSM, &handle);
-			if (rc == TWRC_SUCCESS)
+		return loop_->Send([&]() -> TW_UINT16 {
+			if (state_ == State::kDsmOpened)
 			{
-				state_ = State::kDsmLoaded;
-				EntryPoints::UpdateMemoryEntry(nullptr);
-				if (loop_){
-					delete loop_;
-					loop_ = nullptr;
+				TW_UINT16 rc = CallDsm(false, DG_CONTROL, DAT_PARENT, MSG_CLOSEDSM, &parent_);
+				if (rc == TWRC_SUCCESS)
+				{
+					state_ = State::kDsmLoaded;
+					EntryPoints::RemoveMemoryEntry(&app_id_);
+					memory_entry_ = TW_ENTRYPOINT();
+					parent_ = nullptr;
 				}
+				return rc;
 			}
-			return rc;
-		}
-		return TWRC_FAILURE;
+			return TWRC_FAILURE;
+		});
 	}
 
 	TW_STATUS TwainSession::GetDsmStatus()
 	{
-		TW_STATUS status{ 0 };
-		if (state_ >= State::kDsmLoaded)
-		{
-			CallDsm(false, DG_CONTROL, DAT_STATUS, MSG_GET, &status);
-		}
-		return status;
+		return loop_->Send([&]() -> TW_STATUS {
+			TW_STATUS status{ 0 };
+			if (state_ >= State::kDsmLoaded)
+			{
+				CallDsm(false, DG_CONTROL, DAT_STATUS, MSG_GET, &status);
+			}
+			return status;
+		});
 	}
 	TW_STATUS TwainSession::GetSourceStatus()
 	{
-		TW_STATUS status{ 0 };
-		if (state_ >= State::kSourceOpened)
-		{
-			CallDsm(true, DG_CONTROL, DAT_STATUS, MSG_GET, &status);
-		}
-		return status;
+		return loop_->Send([&]() -> TW_STATUS {
+			TW_STATUS status{ 0 };
+			if (state_ >= State::kSourceOpened)
+			{
+				CallDsm(true, DG_CONTROL, DAT_STATUS, MSG_GET, &status);
+			}
+			return status;
+		});
 	}
 
 	TW_IDENTITY TwainSession::ShowSourceSelector()
 	{
-		TW_IDENTITY src{ 0 };
-		if (state_ >= State::kDsmOpened)
-		{
-			CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_USERSELECT, &src);
-		}
-		return src;
+		return loop_->Send([&]() -> TW_IDENTITY {
+			TW_IDENTITY src{ 0 };
+			if (state_ >= State::kDsmOpened)
+			{
+				CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_USERSELECT, &src);
+			}
+			return src;
+		});
 	}
 	TW_IDENTITY TwainSession::GetDefaultSource()
 	{
-		TW_IDENTITY src{ 0 };
-		if (state_ >= State::kDsmOpened)
-		{
-			CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_GETDEFAULT, &src);
-		}
-		return src;
+		return loop_->Send([&]() -> TW_IDENTITY {
+			TW_IDENTITY src{ 0 };
+			if (state_ >= State::kDsmOpened)
+			{
+				CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_GETDEFAULT, &src);
+			}
+			return src;
+		});
 	}
 	std::vector<TW_IDENTITY> TwainSession::GetSources(){
-		std::vector<TW_IDENTITY> list;
-		if (state_ >= State::kDsmOpened){
-			TW_IDENTITY src{ 0 };
-			auto twRC = CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_GETFIRST, &src);
-			while (twRC == TWRC_SUCCESS){
-				list.push_back(src);
-
-				twRC = CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_GETNEXT, &src);
+		return loop_->Send([&]() -> std::vector<TW_IDENTITY> {
+			std::vector<TW_IDENTITY> list;
+			if (state_ >= State::kDsmOpened){
+				TW_IDENTITY src{ 0 };
+				auto twRC = CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_GETFIRST, &src);
+				while (twRC == TWRC_SUCCESS){
+					list.push_back(src);
+
+					twRC = CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_GETNEXT, &src);
+				}
 			}
-		}
-		return list;
+			return list;
+		});
 	}
 
 	TW_UINT16 TwainSession::OpenSource(TW_IDENTITY& source)
 	{
-		TW_UINT16 twRC = TWRC_FAILURE;
-		if (state_ >= State::kDsmOpened && state_ < State::kSourceEnabled)
-		{
-			if (state_ == State::kSourceOpened)
+		return loop_->Send([&]() -> TW_UINT16 {
+			TW_UINT16 twRC = TWRC_FAILURE;
+			if (state_ >= State::kDsmOpened && state_ < State::kSourceEnabled)
 			{
-				CloseSource();
-			}
+				if (state_ == State::kSourceOpened)
+				{
+					CloseSource();
+				}
 
-			twRC = CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_OPENDS, &source);
-			if (twRC == TWRC_SUCCESS)
-			{
-				state_ = State::kSourceOpened;
-				ds_id_ = source;
-				TryRegisterCallback();
+				twRC = CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_OPENDS, &source);
+				if (twRC == TWRC_SUCCESS)
+				{
+					state_ = State::kSourceOpened;
+					ds_id_ = source;
+					cap_cache_->Bind(ds_id_);
+					xfer_group_valid_ = false;
+					TryRegisterCallback();
+				}
 			}
-		}
-		return twRC;
+			return twRC;
+		});
 	}
 	TW_UINT16 TwainSession::CloseSource()
 	{
-		TW_UINT16 twRC = TWRC_FAILURE;
-		if (state_ == State::kSourceOpened)
-		{
-			twRC = CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_CLOSEDS, &ds_id_);
-			if (twRC == TWRC_SUCCESS)
+		return loop_->Send([&]() -> TW_UINT16 {
+			TW_UINT16 twRC = TWRC_FAILURE;
+			if (state_ == State::kSourceOpened)
 			{
-				state_ = State::kDsmOpened;
-				CallbackHack::Instance = nullptr;
+				twRC = CallDsm(false, DG_CONTROL, DAT_IDENTITY, MSG_CLOSEDS, &ds_id_);
+				if (twRC == TWRC_SUCCESS)
+				{
+					state_ = State::kDsmOpened;
+					cap_cache_->Clear();
+					xfer_group_valid_ = false;
+					callback_registered_ = false;
+					loop_->set_pump_window_messages(true);
+				}
 			}
-		}
-		return twRC;
+			return twRC;
+		});
 	}
 
 	TW_UINT16 TwainSession::EnableSource(EnableSourceMode mode, bool modal){
+		return loop_->Send([&]() -> TW_UINT16 {
+			TW_UINT16 twRC = TWRC_FAILURE;
+			if (state_ == State::kSourceOpened)
+			{
+				ui_.hParent = parent_;
+				ui_.ModalUI = modal ? TRUE : FALSE;
+				ui_.ShowUI = mode == EnableSourceMode::kHideUI ? FALSE : TRUE;
+				if (ui_.ShowUI){
+					// the user can change anything in the driver UI
+					cap_cache_->Clear();
+					xfer_group_valid_ = false;
+				}
+				// driver UI runs on the loop's window messages even with a callback
+				loop_->set_pump_window_messages(!callback_registered_ || ui_.ShowUI);
+				// set to this state first to start receiving msg from loop
+				state_ = State::kSourceEnabled;
+				twRC = mode == EnableSourceMode::kShowUIOnly ?
+					CallDsm(true, DG_CONTROL, DAT_USERINTERFACE, MSG_ENABLEDSUIONLY, &ui_) :
+					CallDsm(true, DG_CONTROL, DAT_USERINTERFACE, MSG_ENABLEDS, &ui_);
+
+				if (twRC != TWRC_SUCCESS && twRC != TWRC_CHECKSTATUS)
+				{
+					state_ = State::kSourceOpened;
+					loop_->set_pump_window_messages(!callback_registered_);
+				}
+			}
+			return twRC;
+		});
+	}
 
-		TW_UINT16 twRC = TWRC_FAILURE;
-		if (state_ == State::kSourceOpened)
-		{
-			ui_.hParent = loop_->parent_handle();
-			ui_.ModalUI = modal ? TRUE : FALSE;
-			ui_.ShowUI = mode == EnableSourceMode::kHideUI ? FALSE : TRUE;
-			// set to this state first to start receiving msg from loop
-			state_ = State::kSourceEnabled;
-			twRC = mode == EnableSourceMode::kShowUIOnly ?
-				CallDsm(true, DG_CONTROL, DAT_USERINTERFACE, MSG_ENABLEDSUIONLY, &ui_) :
-				CallDsm(true, DG_CONTROL, DAT_USERINTERFACE, MSG_ENABLEDS, &ui_);
-
-			if (twRC != TWRC_SUCCESS && twRC != TWRC_CHECKSTATUS)
+	std::shared_ptr<PageStream> TwainSession::AcquireAsync(const AcquireOptions& options){
+		return loop_->Send([&]() -> std::shared_ptr<PageStream> {
+			if (state_ != State::kSourceOpened){
+				return nullptr;
+			}
+			auto stream = std::make_shared<PageStream>(options.MaxQueuedPages);
+			stream->set_wakeup([this]{ loop_->Post([this]{ ResumeTransfers(); }); });
 			{
-				state_ = State::kSourceOpened;
+				std::lock_guard<std::mutex> lock(stream_mutex_);
+				stream_ = stream;
 			}
-		}
-		return twRC;
+			auto twRC = EnableSource(options.Mode, options.Modal);
+			if (twRC != TWRC_SUCCESS && twRC != TWRC_CHECKSTATUS){
+				EndStream();
+				return nullptr;
+			}
+			return stream;
+		});
 	}
 
 	bool TwainSession::IsTwainMessage(const MSG& msg)
 	{
-		if (state_ >= State::kSourceEnabled)
-		{
-			TW_EVENT evt{ const_cast<MSG*>(&msg) };
-			TW_UINT16 twRC = CallDsm(true, DG_CONTROL, DAT_EVENT, MSG_PROCESSEVENT, &evt);
-			if (twRC == TWRC_DSEVENT)
+		// most messages arrive when no source is enabled so don't wait on the loop for those
+		if (state_ < State::kSourceEnabled){
+			return false;
+		}
+
+		return loop_->Send([&]() -> bool {
+			// with a callback the source doesn't need to see every window message
+			if (state_ >= State::kSourceEnabled && !callback_registered_)
 			{
-				std::cout << "Received TWAIN message " << evt.TWMessage << " from loop" << std::endl;
-				HandleDsmMessage(evt.TWMessage);
-				return true;
+				TW_EVENT evt{ const_cast<MSG*>(&msg) };
+				TW_UINT16 twRC = CallDsm(true, DG_CONTROL, DAT_EVENT, MSG_PROCESSEVENT, &evt);
+				if (twRC == TWRC_DSEVENT)
+				{
+					CTWAIN_LOG_TRACE("Received TWAIN message %u from loop", evt.TWMessage);
+					HandleDsmMessage(evt.TWMessage);
+					return true;
+				}
 			}
-		}
-		return false;
+			return false;
+		});
 	}
 
 	TW_UINT16 TwainSession::CallDsm(bool includeSource, TW_UINT32 DG, TW_UINT16 DAT, TW_UINT16 MSG, TW_MEMREF pData)
 	{
-		return includeSource ?
-			EntryPoints::DSM_Entry(&app_id_, &ds_id_, DG, DAT, MSG, pData) :
-			EntryPoints::DSM_Entry(&app_id_, nullptr, DG, DAT, MSG, pData);
+		return loop_->Send([&]() -> TW_UINT16 {
+			return includeSource ?
+				EntryPoints::DSM_Entry(&app_id_, &ds_id_, DG, DAT, MSG, pData) :
+				EntryPoints::DSM_Entry(&app_id_, nullptr, DG, DAT, MSG, pData);
+		});
+	}
+
+
+	TW_HANDLE TwainSession::DetachNativeData(){
+		auto handle = delivering_handle_;
+		delivering_handle_ = nullptr;
+		return handle;
 	}
 
 
@@ -307,6 +434,11 @@ namespace ctwain{
 	///////////////////////////////////////////////////////
 
 
+	void TwainSession::OnPageCompleted(std::unique_ptr<TransferredPage> page)
+	{
+		UNREFERENCED_PARAMETER(page);
+	}
+
 	void TwainSession::OnFillAppId(TW_IDENTITY& appId)
 	{
 		appId.Id = 0;
@@ -317,10 +449,10 @@ namespace ctwain{
 		appId.Version.MinorNum = 0;
 		appId.Version.Language = TWLG_ENGLISH_USA;
 		appId.Version.Country = TWCY_USA;
-		strncpy_s(appId.Version.Info, sizeof(appId.Version.Info), "1.0.0", _TRUNCATE);
-		strncpy_s(appId.Manufacturer, sizeof(appId.Manufacturer), "App's Manufacturer", _TRUNCATE);
-		strncpy_s(appId.ProductFamily, sizeof(appId.ProductFamily), "App's Product Family", _TRUNCATE);
-		strncpy_s(appId.ProductName, sizeof(appId.ProductName), "Specific App Product Name", _TRUNCATE);
+		CTWAIN_COPY_TEXT(appId.Version.Info, sizeof(appId.Version.Info), "1.0.0");
+		CTWAIN_COPY_TEXT(appId.Manufacturer, sizeof(appId.Manufacturer), "App's Manufacturer");
+		CTWAIN_COPY_TEXT(appId.ProductFamily, sizeof(appId.ProductFamily), "App's Product Family");
+		CTWAIN_COPY_TEXT(appId.ProductName, sizeof(appId.ProductName), "Specific App Product Name");
 	}
 
 
@@ -337,67 +469,107 @@ namespace ctwain{
 		if (twRC == TWRC_SUCCESS)
 		{
 			state_ = State::kSourceOpened;
+			loop_->set_pump_window_messages(!callback_registered_);
 			OnSourceDisabled();
 		}
-
+		EndStream();
 	}
 	void TwainSession::TryRegisterCallback(){
+		callback_registered_ = false;
 
-		return;//doesn't work yet
-
-		//auto funcPtr = CallbackHack::DsmCallback;
-		//TW_UINT16 twRC = TWRC_FAILURE;
-		//if (app_id_.ProtocolMajor > 2 || (app_id_.ProtocolMajor >= 2 && app_id_.ProtocolMinor >= 3)){
-		//	// callback2
-		//	TW_CALLBACK2 callback{ funcPtr, 0, 0 };
-		//	twRC = CallDsm(true, DG_CONTROL, DAT_CALLBACK2, MSG_REGISTER_CALLBACK, &callback);
-		//}
-		//else{
-		//	// old callback
-		//	TW_CALLBACK callback{ funcPtr, 0, 0 };
-		//	twRC = CallDsm(true, DG_CONTROL, DAT_CALLBACK, MSG_REGISTER_CALLBACK, &callback);
-		//}
-		//if (twRC == TWRC_SUCCESS){
-		//	CallbackHack::Instance = this;
-		//}
-		//else{
-		//	CallbackHack::Instance = nullptr;
-		//}
+		// callbacks need both the DSM and the source to be 2.x
+		if ((app_id_.SupportedGroups & DF_DSM2) != DF_DSM2 || (ds_id_.SupportedGroups & DF_DS2) != DF_DS2){
+			return;
+		}
+
+		TW_CALLBACK2 callback{ 0 };
+		callback.CallBackProc = reinterpret_cast<TW_MEMREF>(&TwainSession::DsmCallback);
+		callback.RefCon = reinterpret_cast<TW_UINTPTR>(this);
+		callback_registered_ = CallDsm(true, DG_CONTROL, DAT_CALLBACK2, MSG_REGISTER_CALLBACK, &callback) == TWRC_SUCCESS;
+		// callbacks are posted to the loop so it no longer has to pump for the source
+		loop_->set_pump_window_messages(!callback_registered_);
+	}
+
+	TW_UINT16 TW_CALLINGSTYLE TwainSession::DsmCallback(pTW_IDENTITY origin, pTW_IDENTITY destination,
+		TW_UINT32 dg, TW_UINT16 dat, TW_UINT16 msg, TW_MEMREF data){
+		UNREFERENCED_PARAMETER(destination);
+		UNREFERENCED_PARAMETER(dg);
+		UNREFERENCED_PARAMETER(dat);
+
+		// the DSM hands back the RefCon we registered as the data
+		auto session = static_cast<TwainSession*>(data);
+		if (session && session->loop_ && origin && origin->Id == session->ds_id_.Id){
+			// this can be on any thread and the source can't be called from inside
+			// its own callback, so handle it on the loop thread after this returns
+			session->loop_->Post([session, msg]{
+				if (session->state_ >= State::kSourceEnabled){
+					session->HandleDsmMessage(msg);
+				}
+			});
+			return TWRC_SUCCESS;
+		}
+		return TWRC_FAILURE;
 	}
+
 	void TwainSession::HandleTransferReady()
 	{
-		TW_PENDINGXFERS pending;
-		TW_UINT16 rc = CallDsm(true, DG_CONTROL, DAT_PENDINGXFERS, MSG_GET, &pending);;
+		CallDsm(true, DG_CONTROL, DAT_PENDINGXFERS, MSG_GET, &pending_xfers_);
 
+		// settings may have been changed in the driver UI since the last batch
+		if (ui_.ShowUI){
+			cap_cache_->Clear();
+			xfer_group_valid_ = false;
+		}
+		transfers_paused_ = false;
+		TransferPending();
+	}
+
+	void TwainSession::TransferPending()
+	{
+		auto& pending = pending_xfers_;
+		TW_UINT16 rc{ 0 };
 		do
 		{
+			// the stream consumer is behind so hold off until it takes a page,
+			// staying in state 6 and keeping the loop thread free meanwhile
+			if (stream_ && stream_->full() && !stream_->canceled()){
+				transfers_paused_ = true;
+				return;
+			}
+
 			TransferReadyEventArgs preXferArgs{ 0 };
 			preXferArgs.PendingTransferCount = static_cast<TW_INT16>(pending.Count); // good idea? check with spec
 			preXferArgs.EndOfJob = pending.EOJ == 0;
 
 			auto xferImage = true;
 			auto xferAudio = false;
-			TW_UINT32 xferGroup{ DG_IMAGE };
-			if (CallDsm(true, DG_CONTROL, DAT_XFERGROUP, MSG_GET, &xferGroup) == TWRC_SUCCESS){
-				xferAudio = (xferGroup & DG_AUDIO) == DG_AUDIO;
-				xferImage = xferGroup == 0 || (xferGroup & DG_IMAGE) == DG_IMAGE;
+			if (!xfer_group_valid_ || !capability_caching_){
+				// sources that don't know DAT_XFERGROUP only do images
+				if (CallDsm(true, DG_CONTROL, DAT_XFERGROUP, MSG_GET, &xfer_group_) != TWRC_SUCCESS){
+					xfer_group_ = DG_IMAGE;
+				}
+				xfer_group_valid_ = true;
 			}
+			xferAudio = (xfer_group_ & DG_AUDIO) == DG_AUDIO;
+			xferImage = xfer_group_ == 0 || (xfer_group_ & DG_IMAGE) == DG_IMAGE;
 
 			if (xferImage){
-				auto info = std::make_unique<TW_IMAGEINFO>();
-				if (CallDsm(true, DG_IMAGE, DAT_IMAGEINFO, MSG_GET, info.get()) == TWRC_SUCCESS){
-					preXferArgs.PendingImageInfo = std::move(info);
+				TW_IMAGEINFO info;
+				if (CallDsm(true, DG_IMAGE, DAT_IMAGEINFO, MSG_GET, &info) == TWRC_SUCCESS){
+					preXferArgs.PendingImageInfo = info;
 				}
 			}
 			if (xferAudio){
-				auto info = std::make_unique<TW_AUDIOINFO>();
-				if (CallDsm(true, DG_IMAGE, DAT_AUDIOINFO, MSG_GET, info.get()) == TWRC_SUCCESS){
-					preXferArgs.AudioInfo = std::move(info);
+				TW_AUDIOINFO info;
+				if (CallDsm(true, DG_IMAGE, DAT_AUDIOINFO, MSG_GET, &info) == TWRC_SUCCESS){
+					preXferArgs.AudioInfo = info;
 				}
 			}
 
 			OnTransferReady(preXferArgs);
-
+			if (stream_ && stream_->canceled()){
+				preXferArgs.CancelAll = true;
+			}
 
 			if (preXferArgs.CancelAll)
 			{
@@ -456,6 +628,46 @@ namespace ctwain{
 		}
 	}
 
+	void TwainSession::ResumeTransfers(){
+		if (transfers_paused_ && state_ == State::kTransferReady){
+			transfers_paused_ = false;
+			TransferPending();
+		}
+		else if (stream_ && stream_->canceled() && state_ == State::kSourceEnabled){
+			// nothing was pending, such as while the driver UI is up
+			DisableSource();
+		}
+	}
+
+	void TwainSession::CompletePage(std::unique_ptr<TransferredPage> page){
+		std::shared_ptr<PageStream> stream;
+		{
+			std::lock_guard<std::mutex> lock(stream_mutex_);
+			stream = stream_;
+		}
+		if (stream){
+			stream->Push(std::move(page));
+		}
+		else{
+			OnPageCompleted(std::move(page));
+		}
+	}
+
+	void TwainSession::EndStream(){
+		transfers_paused_ = false;
+		if (!stream_){
+			return;
+		}
+		// pages still in the pipeline belong to this acquisition
+		if (pipeline_){
+			pipeline_->Flush();
+		}
+		stream_->set_wakeup(nullptr);
+		stream_->End();
+		std::lock_guard<std::mutex> lock(stream_mutex_);
+		stream_.reset();
+	}
+
 	void TwainSession::TransferNative(bool image){
 		TW_MEMREF pData = nullptr;
 
@@ -470,20 +682,22 @@ namespace ctwain{
 			TransferredDataEventArgs tde{ 0 };
 
 			if (image){
-				auto info = std::make_unique<TW_IMAGEINFO>();
-				if (CallDsm(true, DG_IMAGE, DAT_IMAGEINFO, MSG_GET, info.get()) == TWRC_SUCCESS){
-					tde.ImageInfo = std::move(info);
+				TW_IMAGEINFO info;
+				if (CallDsm(true, DG_IMAGE, DAT_IMAGEINFO, MSG_GET, &info) == TWRC_SUCCESS){
+					tde.ImageInfo = info;
 				}
 			}
 
-			tde.NativeData = EntryPoints::Lock(pData);
-			OnTransferredData(tde);
+			tde.NativeData = EntryPoints::Lock(memory_entry_, pData);
+			auto handedOff = DeliverData(tde, pData);
 			state_ = State::kTransferReady;
-			if (tde.NativeData){
-				EntryPoints::Unlock(pData);
-			}
-			if (pData){
-				EntryPoints::Free(pData);
+			if (!handedOff){
+				if (tde.NativeData){
+					EntryPoints::Unlock(memory_entry_, pData);
+				}
+				if (pData){
+					EntryPoints::Free(memory_entry_, pData);
+				}
 			}
 		}
 		else{
@@ -495,6 +709,26 @@ namespace ctwain{
 		TW_SETUPFILEXFER fileInfo;
 
 		auto rc = CallDsm(true, DG_CONTROL, DAT_SETUPFILEXFER, MSG_GET, &fileInfo);
+		std::string targetPath;
+		if (rc == TWRC_SUCCESS && image && file_naming_){
+			// the source writes the staged file, which is moved to the target once done
+			auto name = FormatFileName(file_naming_->NamePattern, file_number_, fileInfo.Format);
+			targetPath = JoinPath(file_naming_->TargetDirectory, name);
+			auto writePath = file_mover_ ? JoinPath(file_naming_->StagingDirectory, name) : targetPath;
+			TW_SETUPFILEXFER setup = fileInfo;
+			bool fits = writePath.size() < sizeof(setup.FileName);
+			if (fits){
+				memcpy(setup.FileName, writePath.c_str(), writePath.size() + 1);
+			}
+			if (fits && CallDsm(true, DG_CONTROL, DAT_SETUPFILEXFER, MSG_SET, &setup) == TWRC_SUCCESS){
+				fileInfo = setup;
+				file_number_++;
+			}
+			else{
+				CTWAIN_LOG_ERROR("Source didn't take file %s, using its own.", writePath.c_str());
+				targetPath.clear();
+			}
+		}
 		if (rc == TWRC_SUCCESS){
 			rc = image ?
 				CallDsm(true, DG_IMAGE, DAT_IMAGEFILEXFER, MSG_GET, nullptr) :
@@ -505,14 +739,29 @@ namespace ctwain{
 				TransferredDataEventArgs tde{ 0 };
 
 				if (image){
-					auto info = std::make_unique<TW_IMAGEINFO>();
-					if (CallDsm(true, DG_IMAGE, DAT_IMAGEINFO, MSG_GET, info.get()) == TWRC_SUCCESS){
-						tde.ImageInfo = std::move(info);
+					TW_IMAGEINFO info;
+					if (CallDsm(true, DG_IMAGE, DAT_IMAGEINFO, MSG_GET, &info) == TWRC_SUCCESS){
+						tde.ImageInfo = info;
 					}
 				}
 
-				tde.FileDataPath = std::string{ fileInfo.FileName };
-				OnTransferredData(tde);
+				// the path goes into a session owned string so it keeps its capacity from page to page
+				tde.FileDataPath.swap(file_path_);
+				tde.FileDataPath.assign(fileInfo.FileName);
+				tde.ImageFileFormat = fileInfo.Format;
+				// mapped before the move so the view doesn't depend on when it happens
+				if (map_transferred_files_){
+					auto mapped = std::make_shared<MappedFile>();
+					if (mapped->Open(tde.FileDataPath)){
+						tde.FileData = std::move(mapped);
+					}
+				}
+				if (!targetPath.empty() && file_mover_){
+					file_mover_->Move(tde.FileDataPath, targetPath);
+					tde.FileDataPath = targetPath;
+				}
+				DeliverData(tde, nullptr);
+				file_path_.swap(tde.FileDataPath);
 
 				state_ = State::kTransferReady;
 			}
@@ -520,7 +769,140 @@ namespace ctwain{
 
 	}
 	void TwainSession::TransferMemory(){
-		// TODO: implement
+		TW_SETUPMEMXFER memInfo;
+
+		if (CallDsm(true, DG_CONTROL, DAT_SETUPMEMXFER, MSG_GET, &memInfo) == TWRC_SUCCESS){
+
+			// some sources leave preferred as don't care so fall back to the bounds they gave
+			TW_UINT32 bufferSize = memInfo.Preferred;
+			if (bufferSize == 0 || bufferSize == TWON_DONTCARE32){
+				bufferSize = memInfo.MaxBufSize != TWON_DONTCARE32 ? memInfo.MaxBufSize : memInfo.MinBufSize;
+			}
+			if (bufferSize == 0 || bufferSize == TWON_DONTCARE32){
+				return;
+			}
+
+			TW_IMAGEINFO pendingInfo;
+			auto hasInfo = CallDsm(true, DG_IMAGE, DAT_IMAGEINFO, MSG_GET, &pendingInfo) == TWRC_SUCCESS;
+
+			// with more than one buffer the strips are handed to the consumer thread
+			// so the source can fill the next buffer while the previous one is processed
+			unsigned bufferCount = memory_buffer_count_;
+			if (bufferCount > 1 && !strip_consumer_){
+				strip_consumer_ = std::make_unique<StripConsumer>(
+					[this](const TransferredStripEventArgs& strip){ DeliverStrip(strip); });
+			}
+			StripConsumer* consumer = bufferCount > 1 ? strip_consumer_.get() : nullptr;
+
+			// pooled so consecutive pages reuse the same buffers
+			TW_MEMREF buffers[StripConsumer::kMaxBuffers]{};
+			unsigned allocated = 0;
+			for (; allocated < bufferCount; allocated++){
+				buffers[allocated] = EntryPoints::AllocBuffer(bufferSize);
+				if (buffers[allocated] == nullptr){
+					break;
+				}
+			}
+
+			if (allocated > 0){
+				if (consumer){
+					consumer->Reset(allocated);
+				}
+				// compressed strips can't be used on their own so those pages are always assembled
+				if (pipeline_ || stream_ || (hasInfo && pendingInfo.Compression != TWCP_NONE)){
+					if (spare_page_ && !pipeline_ && !stream_){
+						pending_page_ = std::move(spare_page_);
+						*pending_page_ = TransferredPage(page_sequence_);
+					}
+					else{
+						pending_page_ = std::make_unique<TransferredPage>(page_sequence_);
+					}
+				}
+				// pages whose format isn't known up front aren't looked at
+				if (blank_detector_ && !(hasInfo && blank_detector_->Begin(pendingInfo))){
+					blank_detector_->Cancel();
+				}
+				if (preview_ && !(hasInfo && preview_->Begin(pendingInfo))){
+					preview_->Cancel();
+				}
+
+				TW_IMAGEMEMXFER xferInfo;
+				TW_UINT16 rc{ 0 };
+				do{
+					unsigned index = consumer ? consumer->Acquire() : 0;
+
+					xferInfo.Compression = TWON_DONTCARE16;
+					xferInfo.BytesPerRow = TWON_DONTCARE32;
+					xferInfo.Columns = TWON_DONTCARE32;
+					xferInfo.Rows = TWON_DONTCARE32;
+					xferInfo.XOffset = TWON_DONTCARE32;
+					xferInfo.YOffset = TWON_DONTCARE32;
+					xferInfo.BytesWritten = TWON_DONTCARE32;
+					xferInfo.Memory.Flags = TWMF_APPOWNS | TWMF_POINTER;
+					xferInfo.Memory.Length = bufferSize;
+					xferInfo.Memory.TheMem = buffers[index];
+
+					rc = CallDsm(true, DG_IMAGE, DAT_IMAGEMEMXFER, MSG_GET, &xferInfo);
+
+					if (rc == TWRC_SUCCESS || rc == TWRC_XFERDONE){
+						state_ = State::kTransferring;
+
+						TransferredStripEventArgs strip{ 0 };
+						strip.ImageInfo = hasInfo ? &pendingInfo : nullptr;
+						strip.Compression = xferInfo.Compression;
+						strip.BytesPerRow = xferInfo.BytesPerRow;
+						strip.Columns = xferInfo.Columns;
+						strip.Rows = xferInfo.Rows;
+						strip.XOffset = xferInfo.XOffset;
+						strip.YOffset = xferInfo.YOffset;
+						// compressed strips vary in length so never trust it past the buffer
+						strip.BytesWritten = xferInfo.BytesWritten <= bufferSize ? xferInfo.BytesWritten : bufferSize;
+						strip.LastStrip = rc == TWRC_XFERDONE;
+						strip.Data = static_cast<const TW_UINT8*>(buffers[index]);
+
+						if (consumer){
+							consumer->Submit(index, strip);
+						}
+						else{
+							DeliverStrip(strip);
+						}
+					}
+					else if (consumer){
+						consumer->Release(index);
+					}
+				} while (rc == TWRC_SUCCESS);
+
+				if (consumer){
+					consumer->Drain();
+				}
+
+				if (rc == TWRC_XFERDONE){
+					TransferredDataEventArgs tde{ 0 };
+
+					TW_IMAGEINFO info;
+					if (CallDsm(true, DG_IMAGE, DAT_IMAGEINFO, MSG_GET, &info) == TWRC_SUCCESS){
+						tde.ImageInfo = info;
+					}
+					DeliverData(tde, nullptr);
+				}
+				else if (preview_){
+					// aborted pages get no final update
+					preview_->Finish();
+				}
+				// a page only lent to OnTransferredData is kept for the next one
+				if (pending_page_ && !pipeline_ && !stream_){
+					pending_page_->FreeTransferData();
+					spare_page_ = std::move(pending_page_);
+				}
+				pending_page_.reset();
+
+				state_ = State::kTransferReady;
+			}
+
+			for (unsigned i = 0; i < allocated; i++){
+				EntryPoints::FreeBuffer(buffers[i]);
+			}
+		}
 	}
 
 	void TwainSession::TransferMemoryFile(){
@@ -530,33 +912,168 @@ namespace ctwain{
 		if (CallDsm(true, DG_CONTROL, DAT_SETUPFILEXFER, MSG_GET, &fileInfo) == TWRC_SUCCESS &&
 			CallDsm(true, DG_CONTROL, DAT_SETUPMEMXFER, MSG_GET, &memInfo) == TWRC_SUCCESS){
 
+			TW_UINT32 bufferSize = memInfo.Preferred;
+			if (bufferSize == 0 || bufferSize == TWON_DONTCARE32){
+				bufferSize = memInfo.MaxBufSize != TWON_DONTCARE32 ? memInfo.MaxBufSize : memInfo.MinBufSize;
+			}
+			if (bufferSize == 0 || bufferSize == TWON_DONTCARE32){
+				return;
+			}
+
 			TW_IMAGEMEMXFER xferInfo;
 			xferInfo.Memory.Flags = TWMF_APPOWNS | TWMF_POINTER;
-			xferInfo.Memory.Length = memInfo.Preferred;
-			xferInfo.Memory.TheMem = EntryPoints::Alloc(memInfo.Preferred);
+			xferInfo.Memory.Length = bufferSize;
+			xferInfo.Memory.TheMem = EntryPoints::AllocBuffer(bufferSize);
 
 			if (xferInfo.Memory.TheMem != nullptr){
+				// the chunks are pieces of a file so they are always assembled into a page
+				if (spare_page_ && !pipeline_ && !stream_){
+					pending_page_ = std::move(spare_page_);
+					*pending_page_ = TransferredPage(page_sequence_);
+				}
+				else{
+					pending_page_ = std::make_unique<TransferredPage>(page_sequence_);
+				}
+				pending_page_->set_image_file_format(fileInfo.Format);
+				// the file format isn't something the pixel readers understand
+				if (blank_detector_){
+					blank_detector_->Cancel();
+				}
+				if (preview_){
+					preview_->Cancel();
+				}
+
+				bool complete = true;
 				TW_UINT16 rc{ 0 };
 				do{
 					rc = CallDsm(true, DG_IMAGE, DAT_IMAGEMEMFILEXFER, MSG_GET, &xferInfo);
 
 					if (rc == TWRC_SUCCESS || rc == TWRC_XFERDONE){
 						state_ = State::kTransferring;
-						EntryPoints::Lock(xferInfo.Memory.TheMem);
-
-						// TODO: do something
 
+						// chunks have no row layout so they are concatenated in order
+						TransferredStripEventArgs chunk{ 0 };
+						chunk.Compression = xferInfo.Compression;
+						chunk.BytesPerRow = TWON_DONTCARE32;
+						chunk.BytesWritten = xferInfo.BytesWritten <= bufferSize ? xferInfo.BytesWritten : bufferSize;
+						chunk.LastStrip = rc == TWRC_XFERDONE;
+						chunk.Data = static_cast<const TW_UINT8*>(xferInfo.Memory.TheMem);
+						complete = pending_page_->AppendStrip(chunk) && complete;
+					}
+				} while (rc == TWRC_SUCCESS);
 
+				// a file missing a chunk is no use to anyone
+				if (rc == TWRC_XFERDONE && complete){
+					TransferredDataEventArgs tde{ 0 };
 
-						EntryPoints::Unlock(xferInfo.Memory.TheMem);
+					TW_IMAGEINFO info;
+					if (CallDsm(true, DG_IMAGE, DAT_IMAGEINFO, MSG_GET, &info) == TWRC_SUCCESS){
+						tde.ImageInfo = info;
 					}
-				} while (rc == TWRC_SUCCESS);
+					tde.ImageFileFormat = fileInfo.Format;
+					DeliverData(tde, nullptr);
+				}
+				else if (!complete){
+					CTWAIN_LOG_ERROR("Couldn't hold a memory file page, dropped it.");
+				}
+				if (pending_page_ && !pipeline_ && !stream_){
+					pending_page_->FreeTransferData();
+					spare_page_ = std::move(pending_page_);
+				}
+				pending_page_.reset();
 
 				state_ = State::kTransferReady;
-				EntryPoints::Free(xferInfo.Memory.TheMem);
+				EntryPoints::FreeBuffer(xferInfo.Memory.TheMem);
+			}
+		}
+
+	}
+
+	void TwainSession::DeliverStrip(const TransferredStripEventArgs& strip){
+		if (pending_page_){
+			pending_page_->AppendStrip(strip);
+		}
+		if (blank_detector_){
+			blank_detector_->AddStrip(strip);
+		}
+		if (preview_ && preview_->building()){
+			preview_->AddStrip(strip);
+			if (preview_->PollUpdate()){
+				RaisePreview(false);
+			}
+		}
+		OnTransferredStrip(strip);
+	}
+
+	void TwainSession::RaisePreview(bool final){
+		PreviewEventArgs args{ 0 };
+		args.Data = preview_->data();
+		args.Width = preview_->width();
+		args.Height = preview_->height();
+		args.RowsReady = preview_->rows_ready();
+		args.Stride = preview_->stride();
+		args.Channels = preview_->channels();
+		args.Scale = preview_->scale();
+		args.Final = final;
+		OnPreviewUpdated(args);
+	}
+
+	bool TwainSession::DeliverData(TransferredDataEventArgs& tde, TW_HANDLE nativeHandle){
+#ifdef TWH_CMP_MSC
+		// the DIB is read no further than the driver allocated, whatever its header says
+		size_t nativeSize = nativeHandle ? GlobalSize(nativeHandle) : 0;
+#else
+		size_t nativeSize = 0;
+#endif
+		if (preview_ && (nativeHandle ? preview_->Build(DibView(tde.NativeData, nativeSize)) : preview_->Finish())){
+			RaisePreview(true);
+		}
+		if (blank_detector_){
+			// memory transfers were looked at strip by strip
+			tde.BlankPage = nativeHandle ? blank_detector_->Analyze(DibView(tde.NativeData, nativeSize)) : blank_detector_->Finish();
+			if (tde.BlankPage.Blank && blank_detector_->options().DropBlankPages){
+				CTWAIN_LOG_DEBUG("Dropped a blank page with %.3f%% ink.", tde.BlankPage.InkPercent);
+				pending_page_.reset();
+				return false;
+			}
+		}
+
+		if (!pipeline_ && !stream_){
+			if (pending_page_){
+				if (tde.ImageInfo){
+					pending_page_->set_image_info(*tde.ImageInfo);
+				}
+				tde.CompressedPage = pending_page_.get();
 			}
+			delivering_handle_ = nativeHandle;
+			OnTransferredData(tde);
+			// the handler kept it with DetachNativeData
+			auto detached = nativeHandle && !delivering_handle_;
+			delivering_handle_ = nullptr;
+			return detached;
 		}
 
+		// memory transfers have been assembling their page already
+		auto page = pending_page_ ? std::move(pending_page_) : std::make_unique<TransferredPage>(page_sequence_);
+		page_sequence_++;
+		if (tde.ImageInfo){
+			page->set_image_info(*tde.ImageInfo);
+		}
+		page->set_blank_page(tde.BlankPage);
+		if (nativeHandle){
+			page->AdoptNativeData(nativeHandle, tde.NativeData);
+		}
+		if (!tde.FileDataPath.empty()){
+			page->set_file(tde.FileDataPath, tde.ImageFileFormat);
+			page->set_file_data(std::move(tde.FileData));
+		}
+		if (pipeline_){
+			pipeline_->Push(std::move(page));
+		}
+		else{
+			stream_->Push(std::move(page));
+		}
+		return true;
 	}
 
 	void TwainSession::HandleDsmMessage(TW_UINT16 msg){
@@ -583,7 +1100,7 @@ namespace ctwain{
 		case MSG_NULL:
 			break;
 		default:
-			std::cerr << "Error - Unknown DSM message " << msg << "." << std::endl;
+			CTWAIN_LOG_WARNING("Unknown DSM message %u.", msg);
 			break;
 		}
 	}
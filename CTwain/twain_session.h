@@ -24,10 +24,16 @@
 #define TWAIN_SESSION_H_
 
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
-#include "twain2.3.h"
+#include "build_macros.h"
+#include "blank_page_detector.h"
+#include "file_mover.h"
+#include "inline_optional.h"
+#include "preview_builder.h"
 
 namespace ctwain{
 
@@ -80,14 +86,17 @@ namespace ctwain{
 		/// Gets the tentative image information for the current transfer if applicable.
 		/// This may differ from the final image depending on the transfer mode used (mostly when doing mem xfer).
 		/// </summary>
-		std::unique_ptr<TW_IMAGEINFO> PendingImageInfo;
+		InlineOptional<TW_IMAGEINFO> PendingImageInfo;
 
 		/// <summary>
 		/// Gets the audio information for the current transfer if applicable.
 		/// </summary>
-		std::unique_ptr<TW_AUDIOINFO> AudioInfo;
+		InlineOptional<TW_AUDIOINFO> AudioInfo;
 	};
 
+	class TransferredPage;
+	class MappedFile;
+
 	/// <summary>
 	/// Contains event data after whatever data from the source has been transferred.
 	/// </summary>
@@ -95,8 +104,9 @@ namespace ctwain{
 		/// <summary>
 		/// Gets pointer to the complete data if the transfer was native.
 		/// The data will be freed once the event handler ends
-		/// so consumers must complete whatever processing before then.
-		/// For image type this data is DIB (Windows) or TIFF (Linux).
+		/// so consumers must complete whatever processing before then,
+		/// or keep it with <see cref="TwainSession::DetachNativeData"/>.
+		/// For image type this data is DIB (Windows) or TIFF (Linux), see <see cref="DibView"/>.
 		/// This pointer is already locked for the duration of this event.
 		/// </summary>
 		TW_HANDLE NativeData;
@@ -107,19 +117,154 @@ namespace ctwain{
 		/// <value>
 		/// The final image information.
 		/// </value>
-		std::unique_ptr<TW_IMAGEINFO> ImageInfo;
+		InlineOptional<TW_IMAGEINFO> ImageInfo;
 		
 		/// <summary>
-		/// Gets the file path if transfer is for file.
+		/// Gets the file path if transfer is for file. With <see cref="TwainSession::EnableFileNaming"/>
+		/// and a staging directory this is where the file is being moved to, which may not have
+		/// happened yet, see <see cref="TwainSession::FlushFileMoves"/>.
 		/// </summary>
 		std::string FileDataPath;
 		
 		/// <summary>
-		/// Gets the iamge file format if applicable.
+		/// Gets the iamge file format if the transfer was file or memory file.
 		/// </summary>
 		TW_UINT16 ImageFileFormat;
+
+		/// <summary>
+		/// Gets the file at <see cref="FileDataPath"/> mapped read-only if
+		/// <see cref="TwainSession::set_map_transferred_files"/> is on, nullptr otherwise or if it
+		/// couldn't be mapped. Keep a copy to read it after the event handler ends.
+		/// </summary>
+		std::shared_ptr<MappedFile> FileData;
+
+		/// <summary>
+		/// Gets the assembled page if this was a compressed memory transfer
+		/// (see <see cref="TwainSession::SetCompression"/>). The strips are concatenated as sent
+		/// so the data can be stored without decoding, e.g. G4 with <see cref="TiffWriter::AppendImage"/>
+		/// or JPEG as a JFIF file. For a memory file transfer the page holds the whole file, in
+		/// <see cref="ImageFileFormat"/>. The page is cleared and reused for the next one once the event handler ends.
+		/// </summary>
+		const TransferredPage* CompressedPage;
+
+		/// <summary>
+		/// Gets what blank page detection found if it is on, see <see cref="TwainSession::EnableBlankPageDetection"/>.
+		/// </summary>
+		BlankPageResult BlankPage;
 	};
 
+	/// <summary>
+	/// Contains event data for one strip (buffer) of a buffered memory transfer.
+	/// </summary>
+	struct TransferredStripEventArgs{
+		/// <summary>
+		/// Gets the tentative image information for the page being transferred if available.
+		/// </summary>
+		const TW_IMAGEINFO* ImageInfo;
+
+		/// <summary>
+		/// Gets the compression used in this strip (TWCP_* value).
+		/// </summary>
+		TW_UINT16 Compression;
+
+		/// <summary>
+		/// Gets the number of bytes in a row of this strip. Only meaningful for uncompressed data.
+		/// </summary>
+		TW_UINT32 BytesPerRow;
+
+		/// <summary>
+		/// Gets the number of columns in this strip.
+		/// </summary>
+		TW_UINT32 Columns;
+
+		/// <summary>
+		/// Gets the number of rows in this strip.
+		/// </summary>
+		TW_UINT32 Rows;
+
+		/// <summary>
+		/// Gets the column offset of the strip's first pixel in the page.
+		/// </summary>
+		TW_UINT32 XOffset;
+
+		/// <summary>
+		/// Gets the row offset of the strip's first row in the page.
+		/// </summary>
+		TW_UINT32 YOffset;
+
+		/// <summary>
+		/// Gets the number of valid bytes in <see cref="Data"/>.
+		/// </summary>
+		TW_UINT32 BytesWritten;
+
+		/// <summary>
+		/// Gets pointer to the strip data. The buffer is reused for the next strip
+		/// so consumers must copy whatever they need to keep before the event handler ends.
+		/// </summary>
+		const TW_UINT8* Data;
+
+		/// <summary>
+		/// Gets a value indicating whether this is the last strip of the page.
+		/// </summary>
+		bool LastStrip;
+	};
+
+	/// <summary>
+	/// Contains event data when the preview of the page being transferred has grown,
+	/// see <see cref="TwainSession::EnablePreview"/>.
+	/// </summary>
+	struct PreviewEventArgs{
+		/// <summary>
+		/// Gets the preview pixels, 8-bit gray or RGB, top row first. Rows past <see cref="RowsReady"/>
+		/// are black. The buffer is reused so consumers must copy whatever they need to keep
+		/// before the event handler ends.
+		/// </summary>
+		const TW_UINT8* Data;
+
+		/// <summary>
+		/// Gets the preview width in pixels.
+		/// </summary>
+		TW_UINT32 Width;
+
+		/// <summary>
+		/// Gets the preview height in pixels, which is <see cref="RowsReady"/> while
+		/// the length of the page isn't known.
+		/// </summary>
+		TW_UINT32 Height;
+
+		/// <summary>
+		/// Gets the number of preview rows built so far.
+		/// </summary>
+		TW_UINT32 RowsReady;
+
+		/// <summary>
+		/// Gets the bytes from one row to the next.
+		/// </summary>
+		size_t Stride;
+
+		/// <summary>
+		/// Gets the samples per pixel, 1 for gray and 3 for RGB.
+		/// </summary>
+		int Channels;
+
+		/// <summary>
+		/// Gets the page pixels along each side of one preview pixel.
+		/// </summary>
+		TW_UINT32 Scale;
+
+		/// <summary>
+		/// Gets a value indicating whether the page has been transferred and this is its last update.
+		/// </summary>
+		bool Final;
+	};
+
+	class MessageLoop;
+	class PageStream;
+	struct AcquireOptions;
+	class NegotiationProfile;
+	class CapContainer;
+	struct NegotiationResult;
+
 	/// <summary>
 	/// The logical state of a TwainSession.
 	/// </summary>
@@ -165,13 +310,19 @@ namespace ctwain{
 	};
 
 	/// <summary>
-	/// Basic class for interfacing with TWAIN. You should only have one of this per application process.
+	/// Basic class for interfacing with TWAIN. Each session has its own app identity and loop thread
+	/// and shares the loaded DSM with the others, so several sessions can drive different sources
+	/// at the same time. Every TWAIN call runs on the session's own loop thread, so the public methods can be
+	/// called from any thread. The "event" methods are called on that thread as well
+	/// (except where noted) and may call back into the session directly. The ones noted to run
+	/// on a worker thread must not call the session's methods: the loop thread can be waiting
+	/// for that worker, so the call would never return. Hand such work to another thread instead.
 	/// </summary>
 	class TwainSession
 	{
 	public:
-		TwainSession(){}
-		~TwainSession();
+		TwainSession();
+		virtual ~TwainSession();
 		// all disabled for now until everything is working
 		TwainSession(const TwainSession&) = delete;            // Copy constructor
 		TwainSession(TwainSession&&) = delete;                 // Move constructor
@@ -191,9 +342,123 @@ namespace ctwain{
 
 		/// <summary>
 		/// Gets the current logical state as defined by the TWAIN spec.
+		/// Safe to call from any thread while the loop thread changes it.
 		/// </summary>
 		/// <returns></returns>
-		State state() const{ return state_; }
+		State state() const{ return state_.load(); }
+
+		/// <summary>
+		/// Gets the number of buffers rotated during buffered memory transfers.
+		/// </summary>
+		/// <returns></returns>
+		unsigned memory_buffer_count() const{ return memory_buffer_count_; }
+
+		/// <summary>
+		/// Sets the number of buffers rotated during buffered memory transfers.
+		/// With 2 or more buffers the source fills the next buffer while
+		/// <see cref="OnTransferredStrip"/> runs on a worker thread for the previous one.
+		/// </summary>
+		/// <param name="count">The buffer count, 1 to transfer and handle strips in turn.</param>
+		void set_memory_buffer_count(unsigned count);
+
+		/// <summary>
+		/// Switches to pipeline mode. Each transferred page is moved into a <see cref="TransferredPage"/>
+		/// and queued, so the transfer loop goes back to the source right away.
+		/// <see cref="OnProcessPage"/> then runs on the worker threads and <see cref="OnPageCompleted"/>
+		/// runs one page at a time in page order. Neither may call back into the session.
+		/// <see cref="OnTransferredData"/> is not called in this mode.
+		/// Only call this when no transfer is in progress.
+		/// </summary>
+		/// <param name="workers">The number of worker threads.</param>
+		/// <param name="capacity">The most pages allowed in the pipeline before the transfer loop waits.</param>
+		void EnablePagePipeline(unsigned workers, size_t capacity);
+
+		/// <summary>
+		/// Completes every queued page and goes back to calling <see cref="OnTransferredData"/> directly.
+		/// Derived classes should call this before they are destroyed if the pipeline was used.
+		/// </summary>
+		void DisablePagePipeline();
+
+		/// <summary>
+		/// Waits until every queued page has been completed.
+		/// </summary>
+		void FlushPages();
+
+		/// <summary>
+		/// Gets a value indicating whether the session is in pipeline mode.
+		/// </summary>
+		/// <returns></returns>
+		bool page_pipeline_enabled() const{ return pipeline_ != nullptr; }
+
+		/// <summary>
+		/// Gets a value indicating whether file transfers are mapped into memory once done.
+		/// </summary>
+		bool map_transferred_files() const{ return map_transferred_files_; }
+
+		/// <summary>
+		/// Turns mapping of file transfers on or off. When on, the file is mapped read-only right after
+		/// the source wrote it and handed over in <see cref="TransferredDataEventArgs::FileData"/>
+		/// and <see cref="TransferredPage::file_data"/>, so it can be read from the page cache
+		/// without opening it again and copying it into a buffer.
+		/// The view shows the file as it is on disk, so it only holds the page until the source
+		/// writes that file again. Sources reuse the same file for every page unless told otherwise,
+		/// so pages kept past the next transfer, such as from the page pipeline or
+		/// <see cref="AcquireAsync"/>, need a file of their own per page, see <see cref="EnableFileNaming"/>.
+		/// The view stays valid when the file is moved.
+		/// </summary>
+		/// <param name="enabled">Whether to map.</param>
+		void set_map_transferred_files(bool enabled);
+
+		/// <summary>
+		/// Turns on blank page detection for native and uncompressed memory transfers.
+		/// Memory transfer strips are looked at as they arrive and native DIBs right after
+		/// their transfer, so the result is in <see cref="TransferredDataEventArgs::BlankPage"/>
+		/// and <see cref="TransferredPage::blank_page"/>, and blank pages can be dropped
+		/// before anything else happens to them.
+		/// Only call this when no transfer is in progress.
+		/// </summary>
+		/// <param name="options">The detection settings.</param>
+		void EnableBlankPageDetection(const BlankPageOptions& options);
+
+		/// <summary>
+		/// Turns off blank page detection.
+		/// </summary>
+		void DisableBlankPageDetection();
+
+		/// <summary>
+		/// Turns on progressive previews for native and uncompressed memory transfers.
+		/// Memory transfer strips are scaled down as they arrive and <see cref="OnPreviewUpdated"/>
+		/// is raised as the preview grows, at most once per <see cref="PreviewOptions::MinIntervalMilliseconds"/>,
+		/// and once more when the page is done. Native DIBs only get the final update.
+		/// Only call this when no transfer is in progress.
+		/// </summary>
+		/// <param name="options">The preview settings.</param>
+		void EnablePreview(const PreviewOptions& options);
+
+		/// <summary>
+		/// Turns off progressive previews.
+		/// </summary>
+		void DisablePreview();
+
+		/// <summary>
+		/// Gives every image file transfer a file of its own. Before each transfer the source is told
+		/// (DAT_SETUPFILEXFER) to write the next numbered file, in the staging directory if there is one,
+		/// keeping the format it has. Staged files are moved to the target directory in the background
+		/// so the transfer loop never waits for that disk. If the source refuses the name the page goes
+		/// to its current file as before. Only call this when no transfer is in progress.
+		/// </summary>
+		/// <param name="options">The naming settings.</param>
+		void EnableFileNaming(const FileNamingOptions& options);
+
+		/// <summary>
+		/// Finishes the queued moves and leaves file transfer targets to the source again.
+		/// </summary>
+		void DisableFileNaming();
+
+		/// <summary>
+		/// Waits until every staged file has been moved to the target directory.
+		/// </summary>
+		void FlushFileMoves();
 
 		/// <summary>
 		/// Initializes the data source manager. This must be the first method used
@@ -259,10 +524,21 @@ namespace ctwain{
 		/// <param name="mode">indicate the enable mode.</param>
 		TW_UINT16 EnableSource(EnableSourceMode mode, bool modal);
 
+		/// <summary>
+		/// Enables the source and hands its pages out through a <see cref="PageStream"/>
+		/// instead of <see cref="OnTransferredData"/> or <see cref="OnPageCompleted"/>, after
+		/// <see cref="OnProcessPage"/> in pipeline mode. The stream ends when the source is disabled.
+		/// </summary>
+		/// <param name="options">The acquisition settings.</param>
+		/// <returns>The page stream, or nullptr if the source couldn't be enabled.</returns>
+		std::shared_ptr<PageStream> AcquireAsync(const AcquireOptions& options);
+
 
 		/// <summary>
 		/// Checks and handles the message if it's a TWAIN message
-		/// from inside a Windows message loop.
+		/// from inside a Windows message loop. Only needed when a window handle was given to
+		/// <see cref="OpenDsm"/>. When the source accepted a DAT_CALLBACK2 registration its
+		/// notifications go straight to the loop thread and this always returns false.
 		/// </summary>
 		/// <param name="message">The message from Windows message loop.</param>
 		bool IsTwainMessage(const MSG& message);
@@ -283,10 +559,28 @@ namespace ctwain{
 			TW_UINT16    message,
 			TW_MEMREF    data);
 
+		/// <summary>
+		/// Takes ownership of the native data being delivered so it can be used after the handler
+		/// returns without copying it. Only call this from <see cref="OnTransferredData"/>.
+		/// The handle stays locked; unlock and free it with <see cref="EntryPoints::Unlock"/> and
+		/// <see cref="EntryPoints::Free"/>, or give it to <see cref="TransferredPage::AdoptNativeData"/>.
+		/// </summary>
+		/// <returns>The handle, or nullptr if the transfer wasn't native or it was already taken.</returns>
+		TW_HANDLE DetachNativeData();
+
 
 		////////////////////////////////////////////////////////////////////////
 		// capability methods
 		////////////////////////////////////////////////////////////////////////
+		/// <summary>
+		/// Gets the MSG_GET container of a capability for reading in place. The container
+		/// owns what it holds, the source's handle or a copy of the cached entry when
+		/// caching is on, so it stays valid however the session changes afterwards.
+		/// </summary>
+		/// <param name="capType">The capability.</param>
+		/// <param name="container">Receives the container.</param>
+		TW_UINT16 CapGet(const TW_UINT16 capType, CapContainer& container);
+
 		TW_UINT16 CapGet(const TW_UINT16 capType, std::vector<TW_UINT32>& values);
 		TW_UINT16 CapGet(const TW_UINT16 capType, std::vector<TW_FIX32>& values);
 		TW_UINT16 CapGet(const TW_UINT16 capType, std::vector<TW_FRAME>& values);
@@ -302,6 +596,61 @@ namespace ctwain{
 		TW_UINT16 CapSet(const TW_UINT16 capType, const SetType setType, TW_FRAME& value);
 		TW_UINT16 CapSet(const TW_UINT16 capType, const SetType setType, std::string& value);
 
+		/// <summary>
+		/// Gets the MSG_QUERYSUPPORT bits (TWQC_* values) of a capability.
+		/// The result is cached per source identity.
+		/// </summary>
+		/// <param name="capType">The capability.</param>
+		/// <param name="support">The support bits, -1 if the source can't tell.</param>
+		TW_UINT16 CapQuerySupport(const TW_UINT16 capType, TW_INT32& support);
+
+		/// <summary>
+		/// Sets ICAP_COMPRESSION for buffered memory transfers. Compressed pages are not decoded,
+		/// they are handed over as <see cref="TransferredDataEventArgs::CompressedPage"/>
+		/// or as the pipeline page's memory data. Most sources only offer TWCP_GROUP4
+		/// with TWPT_BW and TWCP_JPEG with TWPT_GRAY or TWPT_RGB, so set ICAP_PIXELTYPE first.
+		/// </summary>
+		/// <param name="compression">The compression (TWCP_* value).</param>
+		/// <returns>TWRC_SUCCESS only if the source will use that compression.</returns>
+		TW_UINT16 SetCompression(TW_UINT16 compression);
+
+		/// <summary>
+		/// Fills the capability cache in one go for every cap in CAP_SUPPORTEDCAPS.
+		/// Only call this at state 4 or higher.
+		/// </summary>
+		TW_UINT16 CacheCapabilities();
+
+		/// <summary>
+		/// Fills the capability cache in one go for the specified caps.
+		/// Only call this at state 4 or higher.
+		/// </summary>
+		/// <param name="capTypes">The capabilities to cache.</param>
+		TW_UINT16 CacheCapabilities(const std::vector<TW_UINT16>& capTypes);
+
+		/// <summary>
+		/// Gets a value indicating whether capability values are cached between calls.
+		/// Cached values are dropped when a cap is set (along with caps that depend on it),
+		/// when the source is closed, and when the source is enabled or a new batch starts with driver UI shown.
+		/// Status caps like CAP_FEEDERLOADED are never cached.
+		/// </summary>
+		/// <returns></returns>
+		bool capability_caching() const{ return capability_caching_; }
+
+		/// <summary>
+		/// Turns capability caching on or off.
+		/// </summary>
+		/// <param name="enabled">Whether to cache.</param>
+		void set_capability_caching(bool enabled);
+
+		/// <summary>
+		/// Applies a set of capability values in dependency order, skipping caps whose
+		/// cached current value already matches. The source isn't asked for current values,
+		/// so with caching off every entry is set. Only call this at state 4.
+		/// </summary>
+		/// <param name="profile">The values to apply.</param>
+		/// <returns>The outcome and timing of every entry in the order they were applied.</returns>
+		std::vector<NegotiationResult> ApplyProfile(const NegotiationProfile& profile);
+
 		/*TW_UINT16 CapSet(const TW_UINT16 capType, TW_ONEVALUE& value);
 		TW_UINT16 CapSet(const TW_UINT16 capType, TW_ARRAY& value);
 		TW_UINT16 CapSet(const TW_UINT16 capType, TW_ENUMERATION& value);
@@ -336,28 +685,114 @@ namespace ctwain{
 		/// <param name="transferEvent">The transfer event.</param>
 		virtual void OnTransferredData(const TransferredDataEventArgs& transferEvent){ UNREFERENCED_PARAMETER(transferEvent); }
 
+		/// <summary>
+		/// Called for every strip received during a buffered memory transfer, as it arrives.
+		/// <see cref="OnTransferredData"/> is still called with the final image information
+		/// once the whole page has been transferred.
+		/// When <see cref="memory_buffer_count"/> is 2 or more this is called on a worker thread,
+		/// one strip at a time and in transfer order, and must not call back into the session
+		/// since the loop thread waits for the strips at the end of the page.
+		/// </summary>
+		/// <param name="stripEvent">The strip event.</param>
+		virtual void OnTransferredStrip(const TransferredStripEventArgs& stripEvent){ UNREFERENCED_PARAMETER(stripEvent); }
+
+		/// <summary>
+		/// Called when the preview of the page being transferred has grown, and once more
+		/// with <see cref="PreviewEventArgs::Final"/> set right before <see cref="OnTransferredData"/>
+		/// or the page pipeline gets the page, even if it is then dropped as blank. Updates during a transfer come on the same thread
+		/// as <see cref="OnTransferredStrip"/>, so keep the handler short and, with 2 or more
+		/// memory buffers, don't call back into the session from it.
+		/// </summary>
+		/// <param name="previewEvent">The preview event.</param>
+		virtual void OnPreviewUpdated(const PreviewEventArgs& previewEvent){ UNREFERENCED_PARAMETER(previewEvent); }
+
+		/// <summary>
+		/// Called in pipeline mode on a worker thread for each transferred page.
+		/// Several pages may be processed at the same time. Must not call back into the session:
+		/// the loop thread waits for the workers when the pipeline is full and on
+		/// <see cref="FlushPages"/>, <see cref="DisablePagePipeline"/> and the end of a stream.
+		/// </summary>
+		/// <param name="page">The page.</param>
+		virtual void OnProcessPage(TransferredPage& page){ UNREFERENCED_PARAMETER(page); }
+
+		/// <summary>
+		/// Called in pipeline mode on a worker thread after <see cref="OnProcessPage"/>,
+		/// one page at a time and in the order the pages were transferred.
+		/// The page is freed on return unless the handler keeps it. Like <see cref="OnProcessPage"/>
+		/// it must not call back into the session.
+		/// </summary>
+		/// <param name="page">The page.</param>
+		virtual void OnPageCompleted(std::unique_ptr<TransferredPage> page);
+
 		/// <summary>
 		/// Called when the source has been disabled.
 		/// </summary>
 		virtual void OnSourceDisabled(){}
 
 	private:
-		State state_ = State::kDsmUnloaded;
-		class MessageLoop* loop_ = nullptr;
+		std::atomic<State> state_{ State::kDsmUnloaded };
+		std::unique_ptr<MessageLoop> loop_;
+		HWND parent_ = nullptr;
+		std::unique_ptr<class StripConsumer> strip_consumer_;
+		unsigned memory_buffer_count_ = 1;
+		bool map_transferred_files_ = false;
+		std::unique_ptr<class PagePipeline> pipeline_;
+		std::unique_ptr<TransferredPage> pending_page_;
+		// the last page lent to OnTransferredData, reused for the next one
+		std::unique_ptr<TransferredPage> spare_page_;
+		std::unique_ptr<BlankPageDetector> blank_detector_;
+		std::unique_ptr<PreviewBuilder> preview_;
+		std::unique_ptr<FileNamingOptions> file_naming_;
+		std::unique_ptr<FileMover> file_mover_;
+		TW_UINT32 file_number_ = 0;
+		// lends its capacity to TransferredDataEventArgs::FileDataPath for every file transfer
+		std::string file_path_;
+		TW_UINT32 page_sequence_ = 0;
+		std::unique_ptr<class CapabilityCache> cap_cache_;
+		bool capability_caching_ = true;
+		TW_UINT32 xfer_group_ = DG_IMAGE;
+		bool xfer_group_valid_ = false;
+		bool callback_registered_ = false;
+		TW_HANDLE delivering_handle_ = nullptr;
+		// written on the loop thread, read by pipeline workers under the mutex
+		std::shared_ptr<PageStream> stream_;
+		std::mutex stream_mutex_;
+		bool transfers_paused_ = false;
+		TW_PENDINGXFERS pending_xfers_;
 
 		TW_USERINTERFACE ui_;
 		TW_IDENTITY app_id_;
 		TW_IDENTITY ds_id_;
+		// the DSM's memory functions, copied at open so transfers don't share any state for them
+		TW_ENTRYPOINT memory_entry_;
 
 
 		void DisableSource();
 		void TryRegisterCallback();
+		static TW_UINT16 TW_CALLINGSTYLE DsmCallback(pTW_IDENTITY origin, pTW_IDENTITY destination,
+			TW_UINT32 dg, TW_UINT16 dat, TW_UINT16 msg, TW_MEMREF data);
 		void HandleTransferReady();
+		void TransferPending();
+		void ResumeTransfers();
+		void CompletePage(std::unique_ptr<TransferredPage> page);
+		void EndStream();
 		void TransferNative(bool image);
 		void TransferFile(bool image);
 		void TransferMemory();
 		void TransferMemoryFile();
+		void DeliverStrip(const TransferredStripEventArgs& strip);
+		bool DeliverData(TransferredDataEventArgs& transferEvent, TW_HANDLE nativeHandle);
+		void RaisePreview(bool final);
 		void HandleDsmMessage(TW_UINT16);
+		TW_UINT16 QueryCap(TW_UINT16 capType, TW_UINT16 msg, CapContainer& container);
+		template<typename T>
+		TW_UINT16 CapGetValues(const TW_UINT16 capType, std::vector<T>& values);
+		template<typename T>
+		TW_UINT16 CapGetSingle(const TW_UINT16 capType, const GetSingleType getType, T& value);
+		TW_UINT16 CapItemType(const TW_UINT16 capType, const TW_UINT16 fallback);
+		TW_UINT16 CapSetContainer(TW_UINT16 capType, TW_UINT16 msg, TW_UINT16 conType, TW_UINT16 itemType,
+			const TW_UINT8* items, TW_UINT32 numItems, TW_UINT32 currentIndex);
+		static TW_UINT16 SetMessage(const SetType setType);
 	};
 }
 
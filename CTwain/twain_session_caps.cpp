@@ -22,77 +22,550 @@
 //
 
 #include "stdafx.h"
-#include <iostream>
 #include "build_macros.h"
 #include "twain_session.h"
 #include "entry_points.h"
 #include "message_loop.h"
+#include <chrono>
+#include <cstring>
+#include "cap_container.h"
+#include "capability_cache.h"
+#include "negotiation_profile.h"
 
 namespace ctwain{
 
-	TW_UINT16 TwainSession::CapGet(const TW_UINT16 capType, const GetSingleType getType, TW_UINT32& value){
-		value = 0;
+	namespace{
+		// reads an integer item of any TWTY_* integer type widened to TW_UINT32
+		TW_UINT32 ReadUInt(TW_UINT16 itemType, const void* item){
+			switch (itemType){
+			case TWTY_INT8:
+				return static_cast<TW_UINT32>(*static_cast<const TW_INT8*>(item));
+			case TWTY_UINT8:
+				return *static_cast<const TW_UINT8*>(item);
+			case TWTY_INT16:
+				return static_cast<TW_UINT32>(*static_cast<const TW_INT16*>(item));
+			case TWTY_UINT16:
+			case TWTY_BOOL:
+				return *static_cast<const TW_UINT16*>(item);
+			case TWTY_INT32:
+			case TWTY_UINT32:
+				return *static_cast<const TW_UINT32*>(item);
+			default:
+				return 0;
+			}
+		}
+
+		bool IsIntegerType(TW_UINT16 itemType){
+			return itemType <= TWTY_BOOL;
+		}
+
+		// gets the current item of a GETCURRENT container, ranges have theirs as TW_UINT32
+		const void* CurrentItem(const CapView& view, TW_UINT16& itemType){
+			itemType = view.item_type();
+			auto range = view.range();
+			if (range){
+				itemType = range->ItemType == TWTY_FIX32 ? TWTY_FIX32 : TWTY_UINT32;
+				return &range->CurrentValue;
+			}
+			return view.item(view.current_index());
+		}
+
+		bool CurrentMatches(const CapView& view, const NegotiationEntry& entry){
+			if (entry.ConType != TWON_ONEVALUE || entry.Items.empty()){
+				return false;
+			}
+			TW_UINT16 itemType;
+			auto current = CurrentItem(view, itemType);
+			if (!current){
+				return false;
+			}
+			if (IsIntegerType(itemType) && IsIntegerType(entry.ItemType)){
+				return ReadUInt(itemType, current) == ReadUInt(entry.ItemType, entry.Items.data());
+			}
+			if (itemType != entry.ItemType){
+				return false;
+			}
+			if (itemType >= TWTY_STR32 && itemType <= TWTY_STR255){
+				return strncmp(static_cast<const char*>(current), reinterpret_cast<const char*>(entry.Items.data()), entry.Items.size()) == 0;
+			}
+			return memcmp(current, entry.Items.data(), entry.Items.size()) == 0;
+		}
+
+		template<typename T>
+		void ReadSingle(const CapView& view, const GetSingleType getType, T& value){
+			auto range = view.range();
+			if (range){
+				CapView::ReadRange(*range, getType == GetSingleType::Current ? range->CurrentValue : range->DefaultValue, value);
+			}
+			else if (view.con_type() != TWON_ARRAY){ // array is not logical
+				view.Read(getType == GetSingleType::Current ? view.current_index() : view.default_index(), value);
+			}
+		}
+
+		double Fix32ToDouble(const TW_FIX32& fix){
+			return fix.Whole + fix.Frac / 65536.0;
+		}
+
+		TW_FIX32 DoubleToFix32(double value){
+			auto bits = static_cast<TW_INT32>(value * 65536.0 + (value < 0 ? -0.5 : 0.5));
+			TW_FIX32 fix;
+			fix.Whole = static_cast<TW_INT16>(bits >> 16);
+			fix.Frac = static_cast<TW_UINT16>(bits & 0xffff);
+			return fix;
+		}
+
+		// ranges are expanded up to this many values
+		const TW_UINT32 kMaxRangeItems = 65536;
+
+		template<typename T>
+		void ReadAll(const CapView& view, std::vector<T>& values){
+			auto count = view.count();
+			values.reserve(count);
+			for (TW_UINT32 i = 0; i < count; i++){
+				T value;
+				if (view.Read(i, value)){
+					values.push_back(value);
+				}
+			}
+		}
+
+		void ExpandRange(const TW_RANGE& range, std::vector<TW_UINT32>& values){
+			if (range.ItemType == TWTY_FIX32 || range.StepSize == 0){
+				return;
+			}
+			for (unsigned long long value = range.MinValue; value <= range.MaxValue && values.size() < kMaxRangeItems; value += range.StepSize){
+				values.push_back(static_cast<TW_UINT32>(value));
+			}
+		}
+
+		void ExpandRange(const TW_RANGE& range, std::vector<TW_FIX32>& values){
+			TW_FIX32 min, max, step;
+			CapView::ReadRange(range, range.MinValue, min);
+			CapView::ReadRange(range, range.MaxValue, max);
+			CapView::ReadRange(range, range.StepSize, step);
+			auto from = Fix32ToDouble(min);
+			auto to = Fix32ToDouble(max);
+			auto by = Fix32ToDouble(step);
+			if (by <= 0){
+				return;
+			}
+			for (TW_UINT32 i = 0; from + i * by <= to && values.size() < kMaxRangeItems; i++){
+				values.push_back(DoubleToFix32(from + i * by));
+			}
+		}
+
+		template<typename T>
+		void ExpandRange(const TW_RANGE&, std::vector<T>&){}
+	}
+
+	void TwainSession::set_capability_caching(bool enabled){
+		loop_->Send([&]{
+			capability_caching_ = enabled;
+			if (!enabled){
+				cap_cache_->Clear();
+			}
+		});
+	}
+
+	TW_UINT16 TwainSession::CapQuerySupport(const TW_UINT16 capType, TW_INT32& support){
+		return loop_->Send([&]() -> TW_UINT16 {
+			if (capability_caching_ && cap_cache_->FindSupport(capType, support)){
+				return TWRC_SUCCESS;
+			}
+
+			TW_CAPABILITY cap;
+			cap.Cap = capType;
+			cap.ConType = TWON_ONEVALUE;
+			cap.hContainer = nullptr;
+
+			support = CapabilityCache::kSupportUnknown;
+			auto rc = CallDsm(true, DG_CONTROL, DAT_CAPABILITY, MSG_QUERYSUPPORT, &cap);
+			if (rc == TWRC_SUCCESS && cap.hContainer){
+				auto one = static_cast<pTW_ONEVALUE>(EntryPoints::Lock(memory_entry_, cap.hContainer));
+				if (one && cap.ConType == TWON_ONEVALUE){
+					support = static_cast<TW_INT32>(one->Item);
+				}
+				EntryPoints::Unlock(memory_entry_, cap.hContainer);
+			}
+			if (cap.hContainer){
+				EntryPoints::Free(memory_entry_, cap.hContainer);
+			}
+			// sources that can't answer are remembered as unknown so they aren't asked again
+			cap_cache_->StoreSupport(capType, support);
+			return rc;
+		});
+	}
+
+	TW_UINT16 TwainSession::SetCompression(TW_UINT16 compression){
+		TW_UINT32 value = compression;
+		auto rc = CapSet(ICAP_COMPRESSION, SetType::Current, value);
+		if (rc == TWRC_CHECKSTATUS){
+			// the source may have coerced it to something else
+			TW_UINT32 current = TWCP_NONE;
+			if (CapGet(ICAP_COMPRESSION, GetSingleType::Current, current) == TWRC_SUCCESS && current == compression){
+				rc = TWRC_SUCCESS;
+			}
+			else{
+				rc = TWRC_FAILURE;
+			}
+		}
+		return rc;
+	}
+
+	TW_UINT16 TwainSession::CacheCapabilities(){
+		return loop_->Send([&]() -> TW_UINT16 {
+			std::vector<TW_UINT32> caps;
+			auto rc = CapGet(CAP_SUPPORTEDCAPS, caps);
+			if (rc == TWRC_SUCCESS){
+				return CacheCapabilities(std::vector<TW_UINT16>(caps.begin(), caps.end()));
+			}
+			return rc;
+		});
+	}
+
+	TW_UINT16 TwainSession::CacheCapabilities(const std::vector<TW_UINT16>& capTypes){
+		return loop_->Send([&]() -> TW_UINT16 {
+			if (state_ < State::kSourceOpened){
+				return TWRC_FAILURE;
+			}
+			for (auto capType : capTypes){
+				TW_INT32 support;
+				CapQuerySupport(capType, support);
+
+				CapContainer container;
+				QueryCap(capType, MSG_GETCURRENT, container);
+			}
+			return TWRC_SUCCESS;
+		});
+	}
+
+	TW_UINT16 TwainSession::QueryCap(TW_UINT16 capType, TW_UINT16 msg, CapContainer& container){
+		container.Reset();
+
+		bool cacheable = capability_caching_ && !CapabilityCache::IsVolatile(capType);
+		if (cacheable){
+			auto hit = cap_cache_->Find(capType, msg);
+			if (hit){
+				container.Reference(hit->ConType, hit->Container.data());
+				return TWRC_SUCCESS;
+			}
+
+			TW_INT32 support;
+			if (!cap_cache_->FindSupport(capType, support)){
+				CapQuerySupport(capType, support);
+			}
+			if (!cap_cache_->Allows(capType, msg)){
+				return TWRC_FAILURE;
+			}
+		}
 
 		TW_CAPABILITY cap;
 		cap.Cap = capType;
 		cap.ConType = TWON_DONTCARE16;
 		cap.hContainer = nullptr;
 
-		TW_UINT16 msg = (getType == GetSingleType::Current) ? MSG_GETCURRENT : MSG_GETDEFAULT;
-
 		auto rc = CallDsm(true, DG_CONTROL, DAT_CAPABILITY, msg, &cap);
 		if (rc == TWRC_SUCCESS){
-			EntryPoints::Lock(cap.hContainer);
+			container.Adopt(cap);
+			if (container.view().valid()){
+				cap_cache_->StoreItemType(capType, container.view().item_type());
+			}
+			if (cacheable && container.view().valid()){
+				// read from the cached copy so the handle can go right away
+				auto entry = cap_cache_->Store(capType, msg, cap.ConType, container.view().data());
+				container.Reference(entry->ConType, entry->Container.data());
+			}
+		}
+		else if (cap.hContainer){
+			EntryPoints::Free(memory_entry_, cap.hContainer);
+		}
+		return rc;
+	}
 
-			switch (cap.ConType)
-			{
-			case TWON_ONEVALUE:
+	template<typename T>
+	TW_UINT16 TwainSession::CapGetValues(const TW_UINT16 capType, std::vector<T>& values){
+		values.clear();
+		CapContainer container;
+		auto rc = QueryCap(capType, MSG_GET, container);
+		auto& view = container.view();
+		if (view.range()){
+			ExpandRange(*view.range(), values);
+		}
+		else{
+			ReadAll(view, values);
+		}
+		return rc;
+	}
+
+	template<typename T>
+	TW_UINT16 TwainSession::CapGetSingle(const TW_UINT16 capType, const GetSingleType getType, T& value){
+		CapContainer container;
+		auto rc = QueryCap(capType, getType == GetSingleType::Current ? MSG_GETCURRENT : MSG_GETDEFAULT, container);
+		ReadSingle(container.view(), getType, value);
+		return rc;
+	}
+
+	TW_UINT16 TwainSession::CapGet(const TW_UINT16 capType, CapContainer& container){
+		return loop_->Send([&]() -> TW_UINT16 {
+			auto rc = QueryCap(capType, MSG_GET, container);
+			// the cache belongs to the loop thread so the caller gets a copy of its entry
+			container.Own();
+			return rc;
+		});
+	}
+
+	TW_UINT16 TwainSession::CapGet(const TW_UINT16 capType, std::vector<TW_UINT32>& values){
+		return loop_->Send([&]{ return CapGetValues(capType, values); });
+	}
+
+	TW_UINT16 TwainSession::CapGet(const TW_UINT16 capType, std::vector<TW_FIX32>& values){
+		return loop_->Send([&]{ return CapGetValues(capType, values); });
+	}
+
+	TW_UINT16 TwainSession::CapGet(const TW_UINT16 capType, std::vector<TW_FRAME>& values){
+		return loop_->Send([&]{ return CapGetValues(capType, values); });
+	}
+
+	TW_UINT16 TwainSession::CapGet(const TW_UINT16 capType, std::vector<std::string>& values){
+		return loop_->Send([&]{ return CapGetValues(capType, values); });
+	}
+
+	TW_UINT16 TwainSession::CapGet(const TW_UINT16 capType, const GetSingleType getType, TW_UINT32& value){
+		return loop_->Send([&]() -> TW_UINT16 {
+			value = 0;
+			return CapGetSingle(capType, getType, value);
+		});
+	}
+
+	TW_UINT16 TwainSession::CapGet(const TW_UINT16 capType, const GetSingleType getType, TW_FIX32& value){
+		return loop_->Send([&]() -> TW_UINT16 {
+			value.Whole = 0;
+			value.Frac = 0;
+			return CapGetSingle(capType, getType, value);
+		});
+	}
+
+	TW_UINT16 TwainSession::CapGet(const TW_UINT16 capType, const GetSingleType getType, TW_FRAME& value){
+		return loop_->Send([&]() -> TW_UINT16 {
+			memset(&value, 0, sizeof(value));
+			return CapGetSingle(capType, getType, value);
+		});
+	}
+
+	TW_UINT16 TwainSession::CapGet(const TW_UINT16 capType, const GetSingleType getType, std::string& value){
+		return loop_->Send([&]() -> TW_UINT16 {
+			value.clear();
+			return CapGetSingle(capType, getType, value);
+		});
+	}
+
+	TW_UINT16 TwainSession::CapSet(const TW_UINT16 capType, const SetType setType, TW_UINT32& value){
+		return loop_->Send([&]() -> TW_UINT16 {
+			// use the item type the source reports, most integer caps are TWTY_UINT16
+			auto itemType = CapItemType(capType, TWTY_UINT16);
+			if (!IsIntegerType(itemType)){
+				itemType = TWTY_UINT16;
+			}
+			TW_UINT8 item[sizeof(TW_UINT32)];
+			switch (CapabilityCache::ItemSize(itemType)){
+			case 1:
+				item[0] = static_cast<TW_UINT8>(value);
+				break;
+			case 2:
 			{
-				auto test = static_cast<pTW_ONEVALUE>(cap.hContainer);
-				if (test->ItemType < TWTY_FIX32){
-					value = test->Item;
-				}
+				auto small = static_cast<TW_UINT16>(value);
+				memcpy(item, &small, sizeof(small));
 				break;
 			}
-			case TWON_RANGE:
-			{
-				auto test = static_cast<pTW_RANGE>(cap.hContainer);
-				if (test->ItemType < TWTY_FIX32){
-					switch (getType){
-					case GetSingleType::Current:
-						value = test->CurrentValue;
-						break;
-					case GetSingleType::Default:
-						value = test->DefaultValue;
-						break;
+			default:
+				memcpy(item, &value, sizeof(value));
+				break;
+			}
+			return CapSetContainer(capType, SetMessage(setType), TWON_ONEVALUE, itemType, item, 1, 0);
+		});
+	}
+
+	TW_UINT16 TwainSession::CapSet(const TW_UINT16 capType, const SetType setType, TW_FIX32& value){
+		return loop_->Send([&]() -> TW_UINT16 {
+			return CapSetContainer(capType, SetMessage(setType), TWON_ONEVALUE, TWTY_FIX32,
+				reinterpret_cast<const TW_UINT8*>(&value), 1, 0);
+		});
+	}
+
+	TW_UINT16 TwainSession::CapSet(const TW_UINT16 capType, const SetType setType, TW_FRAME& value){
+		return loop_->Send([&]() -> TW_UINT16 {
+			return CapSetContainer(capType, SetMessage(setType), TWON_ONEVALUE, TWTY_FRAME,
+				reinterpret_cast<const TW_UINT8*>(&value), 1, 0);
+		});
+	}
+
+	TW_UINT16 TwainSession::CapSet(const TW_UINT16 capType, const SetType setType, std::string& value){
+		return loop_->Send([&]() -> TW_UINT16 {
+			auto itemType = CapItemType(capType, TWTY_STR255);
+			if (itemType < TWTY_STR32 || itemType > TWTY_STR255){
+				itemType = TWTY_STR255;
+			}
+			TW_STR255 text{};
+			CTWAIN_COPY_TEXT(text, CapabilityCache::ItemSize(itemType), value.c_str());
+			return CapSetContainer(capType, SetMessage(setType), TWON_ONEVALUE, itemType,
+				reinterpret_cast<const TW_UINT8*>(text), 1, 0);
+		});
+	}
+
+	std::vector<NegotiationResult> TwainSession::ApplyProfile(const NegotiationProfile& profile){
+		return loop_->Send([&]() -> std::vector<NegotiationResult> {
+			std::vector<NegotiationResult> results;
+			auto ordered = profile.Ordered();
+			results.reserve(ordered.size());
+
+			for (auto& entry : ordered){
+				auto start = std::chrono::high_resolution_clock::now();
+
+				NegotiationResult result{ entry.Cap, NegotiationOutcome::kFailed, TWRC_FAILURE, TWCC_SUCCESS, 0 };
+				if (state_ != State::kSourceOpened){
+					result.ConditionCode = TWCC_SEQERROR;
+				}
+				else if (capability_caching_ && !cap_cache_->Allows(entry.Cap, MSG_SET)){
+					result.Outcome = NegotiationOutcome::kUnsupported;
+					result.ConditionCode = TWCC_CAPBADOPERATION;
+				}
+				else{
+					// only a cached value is compared, asking the source would cost as much as the set
+					auto cached = capability_caching_ && !CapabilityCache::IsVolatile(entry.Cap) ?
+						cap_cache_->Find(entry.Cap, MSG_GETCURRENT) : nullptr;
+					CapContainer current;
+					if (cached){
+						current.Reference(cached->ConType, cached->Container.data());
+					}
+					if (current.view().valid() && CurrentMatches(current.view(), entry)){
+						result.Outcome = NegotiationOutcome::kUnchanged;
+						result.ReturnCode = TWRC_SUCCESS;
+					}
+					else{
+						result.ReturnCode = CapSetContainer(entry.Cap, MSG_SET, entry.ConType, entry.ItemType,
+							entry.Items.data(), entry.NumItems, entry.CurrentIndex);
+						switch (result.ReturnCode){
+						case TWRC_SUCCESS:
+							result.Outcome = NegotiationOutcome::kSet;
+							break;
+						case TWRC_CHECKSTATUS:
+							result.Outcome = NegotiationOutcome::kSetWithChanges;
+							break;
+						default:
+							result.ConditionCode = GetSourceStatus().ConditionCode;
+							break;
+						}
 					}
 				}
+
+				result.Microseconds = std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::high_resolution_clock::now() - start).count();
+				results.push_back(result);
+			}
+			return results;
+		});
+	}
+
+	TW_UINT16 TwainSession::SetMessage(const SetType setType){
+		switch (setType){
+		case SetType::Default:
+			return MSG_RESET;
+		case SetType::Constraint:
+			return MSG_SETCONSTRAINT;
+		default:
+			return MSG_SET;
+		}
+	}
+
+	TW_UINT16 TwainSession::CapItemType(const TW_UINT16 capType, const TW_UINT16 fallback){
+		TW_UINT16 itemType;
+		if (cap_cache_->FindItemType(capType, itemType)){
+			return itemType;
+		}
+		// only the first read or set of a cap asks the source
+		CapContainer current;
+		QueryCap(capType, MSG_GETCURRENT, current);
+		return current.view().valid() ? current.view().item_type() : fallback;
+	}
+
+	TW_UINT16 TwainSession::CapSetContainer(TW_UINT16 capType, TW_UINT16 msg, TW_UINT16 conType, TW_UINT16 itemType,
+		const TW_UINT8* items, TW_UINT32 numItems, TW_UINT32 currentIndex){
+
+		if (capability_caching_ && !cap_cache_->Allows(capType, msg)){
+			return TWRC_FAILURE;
+		}
+
+		TW_CAPABILITY cap;
+		cap.Cap = capType;
+		cap.ConType = TWON_DONTCARE16;
+		cap.hContainer = nullptr;
+
+		if (msg != MSG_RESET){
+			size_t itemSize = CapabilityCache::ItemSize(itemType);
+			size_t itemBytes = itemSize * numItems;
+			size_t size = 0;
+			switch (conType){
+			case TWON_ONEVALUE:
+				size = offsetof(TW_ONEVALUE, Item) + (itemBytes > sizeof(TW_UINT32) ? itemBytes : sizeof(TW_UINT32));
+				break;
+			case TWON_ENUMERATION:
+				size = offsetof(TW_ENUMERATION, ItemList) + itemBytes;
+				break;
+			case TWON_ARRAY:
+				size = offsetof(TW_ARRAY, ItemList) + itemBytes;
+				break;
+			default:
+				return TWRC_FAILURE;
+			}
+
+			cap.ConType = conType;
+			cap.hContainer = EntryPoints::Alloc(memory_entry_, static_cast<TW_UINT32>(size));
+			if (!cap.hContainer){
+				return TWRC_FAILURE;
+			}
+			auto container = static_cast<TW_UINT8*>(EntryPoints::Lock(memory_entry_, cap.hContainer));
+			memset(container, 0, size);
+			switch (conType){
+			case TWON_ONEVALUE:
+			{
+				auto one = reinterpret_cast<pTW_ONEVALUE>(container);
+				one->ItemType = itemType;
+				memcpy(&one->Item, items, itemBytes);
 				break;
 			}
 			case TWON_ENUMERATION:
 			{
-				auto test = static_cast<pTW_ENUMERATION>(cap.hContainer);
-				if (test->ItemType < TWTY_FIX32){
-					switch (getType){
-					case GetSingleType::Current:
-						value = test->ItemList[test->CurrentIndex];
-						break;
-					case GetSingleType::Default:
-						value = test->ItemList[test->DefaultIndex];
-						break;
-					}
-				}
+				auto enumeration = reinterpret_cast<pTW_ENUMERATION>(container);
+				enumeration->ItemType = itemType;
+				enumeration->NumItems = numItems;
+				enumeration->CurrentIndex = currentIndex;
+				enumeration->DefaultIndex = currentIndex;
+				memcpy(enumeration->ItemList, items, itemBytes);
 				break;
 			}
-			case TWON_ARRAY: // not logical
+			case TWON_ARRAY:
+			{
+				auto array = reinterpret_cast<pTW_ARRAY>(container);
+				array->ItemType = itemType;
+				array->NumItems = numItems;
+				memcpy(array->ItemList, items, itemBytes);
 				break;
 			}
+			}
+			EntryPoints::Unlock(memory_entry_, cap.hContainer);
+		}
 
-			EntryPoints::Unlock(cap.hContainer);
+		auto rc = CallDsm(true, DG_CONTROL, DAT_CAPABILITY, msg, &cap);
+		if (rc == TWRC_SUCCESS || rc == TWRC_CHECKSTATUS){
+			// the source may have changed this and related caps
+			cap_cache_->Invalidate(capType);
+			if (msg != MSG_RESET){
+				cap_cache_->StoreItemType(capType, itemType);
+			}
 		}
 
 		if (cap.hContainer){
-			EntryPoints::Free(cap.hContainer);
+			EntryPoints::Free(memory_entry_, cap.hContainer);
 		}
 		return rc;
 	}
@@ -0,0 +1,350 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#include "stdafx.h"
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "fake_source.h"
+
+// A stand-in for the TWAIN DSM with fake sources so the library can be
+// exercised and benchmarked without a scanner. See FakeConfig for the FAKEDSM_*
+// environment variables that shape the generated pages and how many sources there are.
+// Any number of apps can open the DSM, each source can be open by one app at a time,
+// and calls to different sources run in parallel.
+
+using namespace ctwain::fake;
+
+namespace{
+	const TW_UINT32 kFirstSourceId = 101;
+
+	// a source and what the DSM tracks for the app that has it open
+	struct SourceSlot{
+		explicit SourceSlot(unsigned index) : source(index){
+			source.identity().Id = kFirstSourceId + index;
+		}
+
+		std::recursive_mutex mutex;
+		FakeSource source;
+		TW_UINT32 owner = 0;
+		bool enabled = false;
+		TW_USERINTERFACE ui{ 0 };
+		TWAINCALLBACKPROC callback = nullptr;
+		TW_UINTPTR callback_ref = 0;
+		TW_IDENTITY callback_app{ 0 };
+		std::thread notifier;
+	};
+
+	struct AppState{
+		size_t next_source = 0;
+	};
+
+	// guards the tables, each source has its own lock for its calls
+	std::mutex dsm_mutex;
+	std::vector<std::unique_ptr<SourceSlot>> sources;
+	std::map<TW_UINT32, AppState> apps;
+	TW_UINT32 next_app_id = 1;
+	// set from any thread so it needs no lock
+	std::atomic<TW_UINT16> dsm_condition{ TWCC_SUCCESS };
+
+#ifdef TWH_CMP_MSC
+	// posted to the app window and translated back in DAT_EVENT like real sources do
+	UINT EventMessage(){
+		static UINT message = RegisterWindowMessageW(L"CTWAIN_FAKEDSM_EVENT");
+		return message;
+	}
+#endif
+
+	TW_UINT16 DsmFail(TW_UINT16 code){
+		dsm_condition = code;
+		return TWRC_FAILURE;
+	}
+
+	void JoinNotifier(SourceSlot& slot){
+		if (slot.notifier.joinable() && slot.notifier.get_id() != std::this_thread::get_id()){
+			slot.notifier.join();
+		}
+	}
+
+	// tells the app a source event happened, with a callback if one was registered.
+	// other platforms have no window messages so apps must register one there.
+	void Notify(SourceSlot& slot, TW_UINT16 msg){
+		if (slot.callback){
+			JoinNotifier(slot);
+			auto* target = &slot;
+			slot.notifier = std::thread([target, msg](){
+				target->callback(&target->source.identity(), &target->callback_app, DG_CONTROL, DAT_NULL, msg,
+					reinterpret_cast<TW_MEMREF>(target->callback_ref));
+			});
+			return;
+		}
+#ifdef TWH_CMP_MSC
+		PostMessage(static_cast<HWND>(slot.ui.hParent), EventMessage(), msg, 0);
+#endif
+	}
+
+	SourceSlot* FindSource(const TW_IDENTITY& identity){
+		for (auto& slot : sources){
+			auto& candidate = slot->source.identity();
+			if (identity.Id ? candidate.Id == identity.Id : strcmp(candidate.ProductName, identity.ProductName) == 0){
+				return slot.get();
+			}
+		}
+		return nullptr;
+	}
+
+	// DSM level calls, made with the DSM lock held
+	TW_UINT16 DsmEntry(pTW_IDENTITY origin, TW_UINT16 dat, TW_UINT16 msg, TW_MEMREF data){
+		switch (dat){
+		case DAT_ENTRYPOINT:
+			if (msg == MSG_GET){
+				auto entry = static_cast<pTW_ENTRYPOINT>(data);
+				entry->DSM_Entry = DSM_Entry;
+				entry->DSM_MemAllocate = MemAllocate;
+				entry->DSM_MemFree = MemFree;
+				entry->DSM_MemLock = MemLock;
+				entry->DSM_MemUnlock = MemUnlock;
+				return TWRC_SUCCESS;
+			}
+			break;
+		case DAT_STATUS:
+		{
+			auto status = static_cast<pTW_STATUS>(data);
+			status->ConditionCode = dsm_condition;
+			status->Data = 0;
+			return TWRC_SUCCESS;
+		}
+		case DAT_IDENTITY:
+		{
+			auto identity = static_cast<pTW_IDENTITY>(data);
+			auto& app = apps[origin->Id];
+			switch (msg){
+			case MSG_GETFIRST:
+			case MSG_GETDEFAULT:
+			case MSG_USERSELECT:
+				app.next_source = 1;
+				*identity = sources.front()->source.identity();
+				return TWRC_SUCCESS;
+			case MSG_GETNEXT:
+				if (app.next_source >= sources.size()){
+					return TWRC_ENDOFLIST;
+				}
+				*identity = sources[app.next_source++]->source.identity();
+				return TWRC_SUCCESS;
+			case MSG_OPENDS:
+			{
+				auto slot = FindSource(*identity);
+				if (!slot){
+					return DsmFail(TWCC_NODS);
+				}
+				std::lock_guard<std::recursive_mutex> lock(slot->mutex);
+				if (slot->owner){
+					return DsmFail(TWCC_MAXCONNECTIONS);
+				}
+				slot->owner = origin->Id;
+				*identity = slot->source.identity();
+				return TWRC_SUCCESS;
+			}
+			case MSG_CLOSEDS:
+			{
+				auto slot = FindSource(*identity);
+				if (!slot){
+					return DsmFail(TWCC_NODS);
+				}
+				std::lock_guard<std::recursive_mutex> lock(slot->mutex);
+				if (slot->owner != origin->Id){
+					return DsmFail(TWCC_SEQERROR);
+				}
+				JoinNotifier(*slot);
+				slot->owner = 0;
+				slot->enabled = false;
+				slot->callback = nullptr;
+				return TWRC_SUCCESS;
+			}
+			}
+			break;
+		}
+		}
+		return DsmFail(TWCC_BADPROTOCOL);
+	}
+
+	// source level calls, made with the source's lock held
+	TW_UINT16 ControlEntry(SourceSlot& slot, pTW_IDENTITY origin, TW_UINT16 dat, TW_UINT16 msg, TW_MEMREF data){
+		auto& source = slot.source;
+		switch (dat){
+		case DAT_STATUS:
+		{
+			auto status = static_cast<pTW_STATUS>(data);
+			status->ConditionCode = source.condition_code();
+			status->Data = 0;
+			return TWRC_SUCCESS;
+		}
+		case DAT_CALLBACK2:
+			if (msg == MSG_REGISTER_CALLBACK){
+				auto registration = static_cast<pTW_CALLBACK2>(data);
+				slot.callback = reinterpret_cast<TWAINCALLBACKPROC>(registration->CallBackProc);
+				slot.callback_ref = registration->RefCon;
+				slot.callback_app = *origin;
+				return TWRC_SUCCESS;
+			}
+			break;
+		case DAT_USERINTERFACE:
+			switch (msg){
+			case MSG_ENABLEDS:
+			case MSG_ENABLEDSUIONLY:
+				slot.ui = *static_cast<pTW_USERINTERFACE>(data);
+				source.Enable();
+				slot.enabled = true;
+				Notify(slot, MSG_XFERREADY);
+				return TWRC_SUCCESS;
+			case MSG_DISABLEDS:
+				source.Disable();
+				slot.enabled = false;
+				return TWRC_SUCCESS;
+			}
+			break;
+		case DAT_EVENT:
+			if (msg == MSG_PROCESSEVENT){
+				auto evt = static_cast<pTW_EVENT>(data);
+				evt->TWMessage = MSG_NULL;
+#ifdef TWH_CMP_MSC
+				auto message = static_cast<MSG*>(evt->pEvent);
+				if (slot.enabled && message && message->message == EventMessage()){
+					evt->TWMessage = static_cast<TW_UINT16>(message->wParam);
+					return TWRC_DSEVENT;
+				}
+#endif
+				return TWRC_NOTDSEVENT;
+			}
+			break;
+		case DAT_XFERGROUP:
+			if (msg == MSG_GET){
+				*static_cast<pTW_UINT32>(data) = DG_IMAGE;
+				return TWRC_SUCCESS;
+			}
+			break;
+		case DAT_CAPABILITY:
+			return source.Capability(msg, *static_cast<pTW_CAPABILITY>(data));
+		case DAT_PENDINGXFERS:
+			return source.PendingTransfers(msg, *static_cast<pTW_PENDINGXFERS>(data));
+		case DAT_SETUPMEMXFER:
+			if (msg == MSG_GET){
+				return source.SetupMemory(*static_cast<pTW_SETUPMEMXFER>(data));
+			}
+			break;
+		case DAT_SETUPFILEXFER:
+			return source.SetupFile(msg, *static_cast<pTW_SETUPFILEXFER>(data));
+		}
+		source.set_condition_code(TWCC_BADPROTOCOL);
+		return TWRC_FAILURE;
+	}
+
+	TW_UINT16 ImageEntry(FakeSource& source, TW_UINT16 dat, TW_UINT16 msg, TW_MEMREF data){
+		if (msg != MSG_GET){
+			source.set_condition_code(TWCC_BADPROTOCOL);
+			return TWRC_FAILURE;
+		}
+		switch (dat){
+		case DAT_IMAGEINFO:
+			return source.ImageInfo(*static_cast<pTW_IMAGEINFO>(data));
+		case DAT_IMAGENATIVEXFER:
+			return source.NativeTransfer(*static_cast<TW_HANDLE*>(data));
+		case DAT_IMAGEFILEXFER:
+			return source.FileTransfer();
+		case DAT_IMAGEMEMXFER:
+			return source.MemoryTransfer(*static_cast<pTW_IMAGEMEMXFER>(data));
+		case DAT_IMAGEMEMFILEXFER:
+			return source.MemoryFileTransfer(*static_cast<pTW_IMAGEMEMXFER>(data));
+		}
+		source.set_condition_code(TWCC_BADPROTOCOL);
+		return TWRC_FAILURE;
+	}
+}
+
+TW_UINT16 TW_CALLINGSTYLE DSM_Entry(pTW_IDENTITY pOrigin, pTW_IDENTITY pDest,
+	TW_UINT32 DG, TW_UINT16 DAT, TW_UINT16 MSG, TW_MEMREF pData){
+
+	SourceSlot* slot = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(dsm_mutex);
+		if (!pOrigin){
+			return DsmFail(TWCC_SEQERROR);
+		}
+		if (DG == DG_CONTROL && DAT == DAT_PARENT && !pDest){
+			if (MSG == MSG_OPENDSM){
+				if (sources.empty()){
+					auto count = FakeConfig::FromEnvironment().Sources;
+					for (unsigned i = 0; i < count; i++){
+						sources.push_back(std::unique_ptr<SourceSlot>(new SourceSlot(i)));
+					}
+				}
+				pOrigin->Id = next_app_id++;
+				pOrigin->SupportedGroups |= DF_DSM2;
+				apps[pOrigin->Id] = AppState();
+				return TWRC_SUCCESS;
+			}
+			if (MSG == MSG_CLOSEDSM){
+				apps.erase(pOrigin->Id);
+				return TWRC_SUCCESS;
+			}
+			return DsmFail(TWCC_BADPROTOCOL);
+		}
+		if (apps.find(pOrigin->Id) == apps.end()){
+			return DsmFail(TWCC_SEQERROR);
+		}
+		if (!pDest){
+			return DsmEntry(pOrigin, DAT, MSG, pData);
+		}
+		for (auto& candidate : sources){
+			if (candidate->source.identity().Id == pDest->Id){
+				slot = candidate.get();
+				break;
+			}
+		}
+	}
+
+	// slots stay put once created so the lock is only needed to find them
+	if (!slot){
+		return DsmFail(TWCC_BADDEST);
+	}
+	std::lock_guard<std::recursive_mutex> lock(slot->mutex);
+	if (slot->owner != pOrigin->Id){
+		return DsmFail(TWCC_BADDEST);
+	}
+	if (DAT != DAT_STATUS){
+		slot->source.set_condition_code(TWCC_SUCCESS);
+	}
+
+	switch (DG){
+	case DG_CONTROL:
+		return ControlEntry(*slot, pOrigin, DAT, MSG, pData);
+	case DG_IMAGE:
+		return ImageEntry(slot->source, DAT, MSG, pData);
+	default:
+		slot->source.set_condition_code(TWCC_BADPROTOCOL);
+		return TWRC_FAILURE;
+	}
+}
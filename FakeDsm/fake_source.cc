@@ -0,0 +1,656 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include "stdafx.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include "fake_source.h"
+
+namespace ctwain{
+	namespace fake{
+
+		namespace{
+			template<size_t N>
+			void CopyText(char(&target)[N], const char* text){
+				auto length = std::min(strlen(text), N - 1);
+				memcpy(target, text, length);
+				target[length] = 0;
+			}
+
+			TW_UINT32 ReadEnvironment(const char* name, TW_UINT32 fallback){
+				char value[32]{};
+#ifdef TWH_CMP_MSC
+				if (GetEnvironmentVariableA(name, value, sizeof(value)) == 0){
+					return fallback;
+				}
+#else
+				auto found = getenv(name);
+				if (!found){
+					return fallback;
+				}
+				CopyText(value, found);
+#endif
+				char* end = nullptr;
+				auto number = strtoul(value, &end, 10);
+				return end != value ? static_cast<TW_UINT32>(number) : fallback;
+			}
+
+			// C stdio rather than a stream, whose buffer would show up in the host's allocation counts
+			bool WritePage(const char* path, const std::vector<TW_UINT8>& data){
+#ifdef TWH_CMP_MSC
+				FILE* file = nullptr;
+				fopen_s(&file, path, "wb");
+#else
+				auto file = fopen(path, "wb");
+#endif
+				if (!file){
+					return false;
+				}
+				auto written = fwrite(data.data(), 1, data.size(), file);
+				return fclose(file) == 0 && written == data.size();
+			}
+
+			const TW_UINT16 kCaps[] = {
+				CAP_SUPPORTEDCAPS,
+				CAP_XFERCOUNT,
+				CAP_UICONTROLLABLE,
+				ICAP_XFERMECH,
+				ICAP_PIXELTYPE,
+				ICAP_BITDEPTH,
+				ICAP_COMPRESSION,
+				ICAP_UNITS,
+				ICAP_XRESOLUTION,
+				ICAP_YRESOLUTION,
+				ICAP_BARCODETIMEOUT,
+				ICAP_IMAGEDATASET,
+			};
+
+			const TW_UINT16 kXferMechs[] = { TWSX_NATIVE, TWSX_FILE, TWSX_MEMORY, TWSX_MEMFILE };
+
+			const TW_UINT16 kCompressions[] = { TWCP_NONE, TWCP_PACKBITS };
+
+			// 32 bit items for the host's container readers, with values that don't fit in 16 bits
+			const TW_UINT32 kBarcodeTimeouts[] = { 100, 1000, 65536, 100000, 3600000 };
+			const TW_UINT32 kImageDataSet[] = { 1, 2, 70000, 0x7fffffff, 0x80000001 };
+
+			const TW_INT32 kGetSupport = TWQC_GET | TWQC_GETCURRENT | TWQC_GETDEFAULT;
+			const TW_INT32 kSetSupport = kGetSupport | TWQC_SET | TWQC_RESET;
+
+			void Put16(std::vector<TW_UINT8>& out, size_t offset, TW_UINT32 value){
+				out[offset] = static_cast<TW_UINT8>(value);
+				out[offset + 1] = static_cast<TW_UINT8>(value >> 8);
+			}
+
+			void Put32(std::vector<TW_UINT8>& out, size_t offset, TW_UINT32 value){
+				Put16(out, offset, value);
+				Put16(out, offset + 2, value >> 16);
+			}
+
+			TW_HANDLE AllocOneValue(TW_UINT16 itemType, TW_UINT32 item){
+				auto handle = MemAllocate(sizeof(TW_ONEVALUE));
+				auto one = static_cast<pTW_ONEVALUE>(MemLock(handle));
+				one->ItemType = itemType;
+				one->Item = item;
+				MemUnlock(handle);
+				return handle;
+			}
+
+			size_t PackBits(const TW_UINT8* row, size_t size, TW_UINT8* out){
+				// runs of 3 or more become repeats, everything else goes in literal blocks
+				size_t written = 0;
+				size_t i = 0;
+				while (i < size){
+					size_t run = 1;
+					while (i + run < size && run < 128 && row[i + run] == row[i]){
+						run++;
+					}
+					if (run >= 3){
+						out[written++] = static_cast<TW_UINT8>(257 - run);
+						out[written++] = row[i];
+						i += run;
+						continue;
+					}
+					size_t start = i;
+					while (i < size && i - start < 128 &&
+						!(i + 2 < size && row[i] == row[i + 1] && row[i] == row[i + 2])){
+						i++;
+					}
+					out[written++] = static_cast<TW_UINT8>(i - start - 1);
+					memcpy(out + written, row + start, i - start);
+					written += i - start;
+				}
+				return written;
+			}
+
+			TW_UINT32 Fix32Bits(TW_INT16 whole){
+				TW_FIX32 fix{ whole, 0 };
+				// TW_UINT32 is wider than the fix on 64 bit Linux
+				TW_UINT32 bits = 0;
+				memcpy(&bits, &fix, sizeof(fix));
+				return bits;
+			}
+		}
+
+		FakeConfig FakeConfig::FromEnvironment(){
+			FakeConfig config;
+			config.Pages = ReadEnvironment("FAKEDSM_PAGES", config.Pages);
+			config.Width = std::max<TW_UINT32>(1, ReadEnvironment("FAKEDSM_WIDTH", config.Width));
+			config.Height = std::max<TW_UINT32>(1, ReadEnvironment("FAKEDSM_HEIGHT", config.Height));
+			auto depth = ReadEnvironment("FAKEDSM_BITDEPTH", config.BitDepth);
+			config.BitDepth = static_cast<TW_UINT16>(depth == 1 || depth == 24 ? depth : 8);
+			config.LatencyMicroseconds = ReadEnvironment("FAKEDSM_LATENCY_US", config.LatencyMicroseconds);
+			config.StripRows = std::max<TW_UINT32>(1, ReadEnvironment("FAKEDSM_STRIP_ROWS", config.StripRows));
+			config.BlankEvery = ReadEnvironment("FAKEDSM_BLANK_EVERY", config.BlankEvery);
+			config.Sources = std::min<TW_UINT32>(16, std::max<TW_UINT32>(1, ReadEnvironment("FAKEDSM_SOURCES", config.Sources)));
+			return config;
+		}
+
+		FakeSource::FakeSource(unsigned index) : identity_{ 0 }, file_setup_{ 0 }{
+			identity_.ProtocolMajor = TWON_PROTOCOLMAJOR;
+			identity_.ProtocolMinor = TWON_PROTOCOLMINOR;
+			identity_.SupportedGroups = DF_DS2 | DG_IMAGE | DG_CONTROL;
+			identity_.Version.MajorNum = 1;
+			identity_.Version.MinorNum = 0;
+			identity_.Version.Language = TWLG_ENGLISH_USA;
+			identity_.Version.Country = TWCY_USA;
+			CopyText(identity_.Version.Info, "1.0.0");
+			CopyText(identity_.Manufacturer, "CTwain");
+			CopyText(identity_.ProductFamily, "Benchmark");
+			auto number = std::to_string(index + 1);
+			CopyText(identity_.ProductName, index ? ("CTwain Fake Source " + number).c_str() : "CTwain Fake Source");
+
+			CopyText(file_setup_.FileName, index ? ("fake_page_" + number + ".bmp").c_str() : "fake_page.bmp");
+			file_setup_.Format = TWFF_BMP;
+		}
+
+		void FakeSource::Enable(){
+			auto config = FakeConfig::FromEnvironment();
+			bool changed = config.Width != config_.Width || config.Height != config_.Height ||
+				config.BitDepth != config_.BitDepth || page_.empty();
+			config_ = config;
+			if (changed){
+				Generate();
+			}
+			pending_ = config_.Pages;
+			if (xfer_count_ > 0 && static_cast<TW_UINT32>(xfer_count_) < pending_){
+				pending_ = xfer_count_;
+			}
+			next_row_ = 0;
+			file_offset_ = 0;
+			page_index_ = 0;
+		}
+
+		void FakeSource::Disable(){
+			pending_ = 0;
+		}
+
+		void FakeSource::Generate(){
+			// a pattern instead of zeros so nothing downstream can shortcut blank data
+			auto stride = bytes_per_row();
+			page_.resize(static_cast<size_t>(stride) * config_.Height);
+			blank_page_.resize(page_.size());
+			for (TW_UINT32 y = 0; y < config_.Height; y++){
+				auto row = page_.data() + static_cast<size_t>(y) * stride;
+				auto blank = blank_page_.data() + static_cast<size_t>(y) * stride;
+				for (TW_UINT32 x = 0; x < stride; x++){
+					row[x] = config_.BitDepth == 1 ? ((y & 16) ? 0xf0 : 0x0f) : static_cast<TW_UINT8>(x + y);
+					// white paper with a little scanner noise, bitonal white is 1
+					blank[x] = config_.BitDepth == 1 ? 0xff : static_cast<TW_UINT8>(240 + (x * 7 + y * 3) % 8);
+				}
+			}
+			bitmap_.clear();
+			blank_bitmap_.clear();
+		}
+
+		bool FakeSource::blank() const{
+			return config_.BlankEvery > 0 && (page_index_ + 1) % config_.BlankEvery == 0;
+		}
+
+		const std::vector<TW_UINT8>& FakeSource::Bitmap(){
+			auto& bitmap = blank() ? blank_bitmap_ : bitmap_;
+			if (!bitmap.empty()){
+				return bitmap;
+			}
+			const size_t fileHeader = 14;
+			const size_t infoHeader = 40;
+			size_t colors = config_.BitDepth == 24 ? 0 : (1u << config_.BitDepth);
+			size_t stride = (bytes_per_row() + 3) & ~3u;
+			size_t offset = fileHeader + infoHeader + colors * 4;
+			bitmap.assign(offset + stride * config_.Height, 0);
+
+			bitmap[0] = 'B';
+			bitmap[1] = 'M';
+			Put32(bitmap, 2, static_cast<TW_UINT32>(bitmap.size()));
+			Put32(bitmap, 10, static_cast<TW_UINT32>(offset));
+			Put32(bitmap, 14, static_cast<TW_UINT32>(infoHeader));
+			Put32(bitmap, 18, config_.Width);
+			Put32(bitmap, 22, config_.Height);
+			Put16(bitmap, 26, 1);
+			Put16(bitmap, 28, config_.BitDepth);
+			Put32(bitmap, 34, static_cast<TW_UINT32>(stride * config_.Height));
+			Put32(bitmap, 38, 11811); // 300 dpi in pixels per meter
+			Put32(bitmap, 42, 11811);
+			Put32(bitmap, 46, static_cast<TW_UINT32>(colors));
+			for (size_t i = 0; i < colors; i++){
+				auto gray = static_cast<TW_UINT8>(i * 255 / (colors - 1));
+				bitmap[fileHeader + infoHeader + i * 4] = gray;
+				bitmap[fileHeader + infoHeader + i * 4 + 1] = gray;
+				bitmap[fileHeader + infoHeader + i * 4 + 2] = gray;
+			}
+			// bottom-up rows
+			for (TW_UINT32 y = 0; y < config_.Height; y++){
+				memcpy(&bitmap[offset + stride * (config_.Height - 1 - y)],
+					Page().data() + static_cast<size_t>(y) * bytes_per_row(), bytes_per_row());
+			}
+			return bitmap;
+		}
+
+		void FakeSource::Wait() const{
+			if (config_.LatencyMicroseconds == 0){
+				return;
+			}
+			// sleeping alone is too coarse for sub-millisecond latencies so spin the rest
+			auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(config_.LatencyMicroseconds);
+			if (config_.LatencyMicroseconds > 2000){
+				std::this_thread::sleep_for(std::chrono::microseconds(config_.LatencyMicroseconds - 2000));
+			}
+			while (std::chrono::steady_clock::now() < until){
+				std::this_thread::yield();
+			}
+		}
+
+		TW_UINT16 FakeSource::SupportedMessages(TW_UINT16 capType) const{
+			switch (capType){
+			case CAP_XFERCOUNT:
+			case ICAP_XFERMECH:
+			case ICAP_COMPRESSION:
+				return kSetSupport;
+			default:
+				for (auto cap : kCaps){
+					if (cap == capType){
+						return kGetSupport;
+					}
+				}
+				return 0;
+			}
+		}
+
+		TW_UINT16 FakeSource::Capability(TW_UINT16 msg, TW_CAPABILITY& cap){
+			auto support = SupportedMessages(cap.Cap);
+			if (!support){
+				return Fail(TWCC_CAPUNSUPPORTED);
+			}
+
+			switch (msg){
+			case MSG_QUERYSUPPORT:
+				cap.ConType = TWON_ONEVALUE;
+				cap.hContainer = AllocOneValue(TWTY_INT32, support);
+				return TWRC_SUCCESS;
+			case MSG_GET:
+			case MSG_GETCURRENT:
+			case MSG_GETDEFAULT:
+				return WriteCap(msg, cap);
+			case MSG_RESET:
+				if (!(support & TWQC_RESET)){
+					return Fail(TWCC_CAPBADOPERATION);
+				}
+				if (cap.Cap == ICAP_XFERMECH){
+					xfer_mech_ = TWSX_NATIVE;
+				}
+				else if (cap.Cap == CAP_XFERCOUNT){
+					xfer_count_ = -1;
+				}
+				else if (cap.Cap == ICAP_COMPRESSION){
+					compression_ = TWCP_NONE;
+				}
+				return WriteCap(MSG_GETCURRENT, cap);
+			case MSG_SET:
+			{
+				if (!(support & TWQC_SET)){
+					return Fail(TWCC_CAPBADOPERATION);
+				}
+				if (!cap.hContainer || cap.ConType != TWON_ONEVALUE){
+					return Fail(TWCC_BADVALUE);
+				}
+				auto one = static_cast<pTW_ONEVALUE>(MemLock(cap.hContainer));
+				TW_UINT16 narrow;
+				memcpy(&narrow, &one->Item, sizeof(narrow));
+				TW_UINT32 value = one->ItemType == TWTY_UINT32 || one->ItemType == TWTY_INT32 ?
+					one->Item : narrow;
+				MemUnlock(cap.hContainer);
+
+				if (cap.Cap == ICAP_XFERMECH){
+					if (std::find(std::begin(kXferMechs), std::end(kXferMechs), value) == std::end(kXferMechs)){
+						return Fail(TWCC_BADVALUE);
+					}
+					xfer_mech_ = static_cast<TW_UINT16>(value);
+				}
+				else if (cap.Cap == ICAP_COMPRESSION){
+					if (std::find(std::begin(kCompressions), std::end(kCompressions), value) == std::end(kCompressions)){
+						return Fail(TWCC_BADVALUE);
+					}
+					compression_ = static_cast<TW_UINT16>(value);
+				}
+				else{
+					auto count = static_cast<TW_INT16>(value);
+					if (count == 0 || count < -1){
+						return Fail(TWCC_BADVALUE);
+					}
+					xfer_count_ = count;
+				}
+				return TWRC_SUCCESS;
+			}
+			default:
+				return Fail(TWCC_CAPBADOPERATION);
+			}
+		}
+
+		TW_UINT16 FakeSource::WriteCap(TW_UINT16 msg, TW_CAPABILITY& cap){
+			bool current = msg != MSG_GETDEFAULT;
+			cap.ConType = TWON_ONEVALUE;
+			switch (cap.Cap){
+			case CAP_SUPPORTEDCAPS:
+			{
+				auto count = sizeof(kCaps) / sizeof(kCaps[0]);
+				cap.ConType = TWON_ARRAY;
+				cap.hContainer = MemAllocate(static_cast<TW_UINT32>(sizeof(TW_ARRAY) + sizeof(kCaps)));
+				auto array = static_cast<pTW_ARRAY>(MemLock(cap.hContainer));
+				array->ItemType = TWTY_UINT16;
+				array->NumItems = static_cast<TW_UINT32>(count);
+				memcpy(array->ItemList, kCaps, sizeof(kCaps));
+				MemUnlock(cap.hContainer);
+				break;
+			}
+			case ICAP_XFERMECH:
+				if (msg == MSG_GET){
+					auto count = sizeof(kXferMechs) / sizeof(kXferMechs[0]);
+					cap.ConType = TWON_ENUMERATION;
+					cap.hContainer = MemAllocate(static_cast<TW_UINT32>(sizeof(TW_ENUMERATION) + sizeof(kXferMechs)));
+					auto enumeration = static_cast<pTW_ENUMERATION>(MemLock(cap.hContainer));
+					enumeration->ItemType = TWTY_UINT16;
+					enumeration->NumItems = static_cast<TW_UINT32>(count);
+					enumeration->CurrentIndex = static_cast<TW_UINT32>(
+						std::find(std::begin(kXferMechs), std::end(kXferMechs), xfer_mech_) - std::begin(kXferMechs));
+					enumeration->DefaultIndex = 0;
+					memcpy(enumeration->ItemList, kXferMechs, sizeof(kXferMechs));
+					MemUnlock(cap.hContainer);
+				}
+				else{
+					cap.hContainer = AllocOneValue(TWTY_UINT16, current ? xfer_mech_ : TWSX_NATIVE);
+				}
+				break;
+			case CAP_XFERCOUNT:
+				cap.hContainer = AllocOneValue(TWTY_INT16, static_cast<TW_UINT16>(current ? xfer_count_ : -1));
+				break;
+			case CAP_UICONTROLLABLE:
+				cap.hContainer = AllocOneValue(TWTY_BOOL, TRUE);
+				break;
+			case ICAP_PIXELTYPE:
+				cap.hContainer = AllocOneValue(TWTY_UINT16,
+					config_.BitDepth == 1 ? TWPT_BW : config_.BitDepth == 24 ? TWPT_RGB : TWPT_GRAY);
+				break;
+			case ICAP_BITDEPTH:
+				cap.hContainer = AllocOneValue(TWTY_UINT16, config_.BitDepth == 24 ? 8 : config_.BitDepth);
+				break;
+			case ICAP_COMPRESSION:
+				cap.hContainer = AllocOneValue(TWTY_UINT16, current ? compression_ : TWCP_NONE);
+				break;
+			case ICAP_UNITS:
+				cap.hContainer = AllocOneValue(TWTY_UINT16, TWUN_INCHES);
+				break;
+			case ICAP_XRESOLUTION:
+			case ICAP_YRESOLUTION:
+				cap.hContainer = AllocOneValue(TWTY_FIX32, Fix32Bits(300));
+				break;
+			case ICAP_BARCODETIMEOUT:
+				if (msg == MSG_GET){
+					cap.ConType = TWON_ENUMERATION;
+					cap.hContainer = MemAllocate(static_cast<TW_UINT32>(sizeof(TW_ENUMERATION) + sizeof(kBarcodeTimeouts)));
+					auto enumeration = static_cast<pTW_ENUMERATION>(MemLock(cap.hContainer));
+					enumeration->ItemType = TWTY_UINT32;
+					enumeration->NumItems = static_cast<TW_UINT32>(sizeof(kBarcodeTimeouts) / sizeof(kBarcodeTimeouts[0]));
+					enumeration->CurrentIndex = 1;
+					enumeration->DefaultIndex = 1;
+					memcpy(enumeration->ItemList, kBarcodeTimeouts, sizeof(kBarcodeTimeouts));
+					MemUnlock(cap.hContainer);
+				}
+				else{
+					cap.hContainer = AllocOneValue(TWTY_UINT32, kBarcodeTimeouts[1]);
+				}
+				break;
+			case ICAP_IMAGEDATASET:
+			{
+				cap.ConType = TWON_ARRAY;
+				cap.hContainer = MemAllocate(static_cast<TW_UINT32>(sizeof(TW_ARRAY) + sizeof(kImageDataSet)));
+				auto array = static_cast<pTW_ARRAY>(MemLock(cap.hContainer));
+				array->ItemType = TWTY_UINT32;
+				array->NumItems = static_cast<TW_UINT32>(sizeof(kImageDataSet) / sizeof(kImageDataSet[0]));
+				memcpy(array->ItemList, kImageDataSet, sizeof(kImageDataSet));
+				MemUnlock(cap.hContainer);
+				break;
+			}
+			default:
+				return Fail(TWCC_CAPUNSUPPORTED);
+			}
+			return TWRC_SUCCESS;
+		}
+
+		TW_UINT16 FakeSource::PendingTransfers(TW_UINT16 msg, TW_PENDINGXFERS& pending){
+			switch (msg){
+			case MSG_GET:
+				break;
+			case MSG_ENDXFER:
+				if (pending_ > 0){
+					pending_--;
+				}
+				next_row_ = 0;
+				file_offset_ = 0;
+				page_index_++;
+				break;
+			case MSG_RESET:
+				pending_ = 0;
+				break;
+			default:
+				return Fail(TWCC_BADPROTOCOL);
+			}
+			pending.Count = static_cast<TW_UINT16>(pending_);
+			pending.EOJ = 0;
+			return TWRC_SUCCESS;
+		}
+
+		TW_UINT16 FakeSource::ImageInfo(TW_IMAGEINFO& info){
+			memset(&info, 0, sizeof(info));
+			info.XResolution.Whole = 300;
+			info.YResolution.Whole = 300;
+			info.ImageWidth = config_.Width;
+			info.ImageLength = config_.Height;
+			info.SamplesPerPixel = config_.BitDepth == 24 ? 3 : 1;
+			for (int i = 0; i < info.SamplesPerPixel; i++){
+				info.BitsPerSample[i] = config_.BitDepth == 1 ? 1 : 8;
+			}
+			info.BitsPerPixel = config_.BitDepth;
+			info.Planar = FALSE;
+			info.PixelType = config_.BitDepth == 1 ? TWPT_BW : config_.BitDepth == 24 ? TWPT_RGB : TWPT_GRAY;
+			info.Compression = xfer_mech_ == TWSX_MEMORY ? compression_ : TWCP_NONE;
+			return TWRC_SUCCESS;
+		}
+
+		TW_UINT16 FakeSource::SetupMemory(TW_SETUPMEMXFER& setup){
+			setup.MinBufSize = buffer_row();
+			setup.MaxBufSize = buffer_row() * config_.Height;
+			setup.Preferred = buffer_row() * std::min(config_.StripRows, config_.Height);
+			return TWRC_SUCCESS;
+		}
+
+		TW_UINT16 FakeSource::SetupFile(TW_UINT16 msg, TW_SETUPFILEXFER& setup){
+			switch (msg){
+			case MSG_GET:
+			case MSG_GETDEFAULT:
+				setup = file_setup_;
+				return TWRC_SUCCESS;
+			case MSG_SET:
+				if (setup.Format != TWFF_BMP){
+					return Fail(TWCC_BADVALUE);
+				}
+				file_setup_ = setup;
+				return TWRC_SUCCESS;
+			default:
+				return Fail(TWCC_BADPROTOCOL);
+			}
+		}
+
+		TW_UINT16 FakeSource::NativeTransfer(TW_HANDLE& handle){
+			if (pending_ == 0){
+				return Fail(TWCC_SEQERROR);
+			}
+			Wait();
+			// DIBs are bitmap files without the file header
+			auto& bitmap = Bitmap();
+			const size_t fileHeader = 14;
+			handle = MemAllocate(static_cast<TW_UINT32>(bitmap.size() - fileHeader));
+			if (!handle){
+				return Fail(TWCC_LOWMEMORY);
+			}
+			memcpy(MemLock(handle), bitmap.data() + fileHeader, bitmap.size() - fileHeader);
+			MemUnlock(handle);
+			return TWRC_XFERDONE;
+		}
+
+		TW_UINT16 FakeSource::FileTransfer(){
+			if (pending_ == 0){
+				return Fail(TWCC_SEQERROR);
+			}
+			Wait();
+			if (!WritePage(file_setup_.FileName, Bitmap())){
+				return Fail(TWCC_FILEWRITEERROR);
+			}
+			return TWRC_XFERDONE;
+		}
+
+		TW_UINT16 FakeSource::MemoryTransfer(TW_IMAGEMEMXFER& xfer){
+			if (pending_ == 0 || next_row_ >= config_.Height){
+				return Fail(TWCC_SEQERROR);
+			}
+			auto stride = bytes_per_row();
+			auto rows = std::min(config_.StripRows, config_.Height - next_row_);
+			rows = std::min(rows, xfer.Memory.Length / buffer_row());
+			if (rows == 0){
+				return Fail(TWCC_BADVALUE);
+			}
+			Wait();
+
+			bool handle = (xfer.Memory.Flags & TWMF_HANDLE) == TWMF_HANDLE;
+			auto target = static_cast<TW_UINT8*>(handle ? MemLock(xfer.Memory.TheMem) : xfer.Memory.TheMem);
+			auto source = Page().data() + static_cast<size_t>(next_row_) * stride;
+			size_t written = static_cast<size_t>(rows) * stride;
+			if (compression_ == TWCP_PACKBITS){
+				// rows are packed one by one as TIFF expects
+				written = 0;
+				for (TW_UINT32 row = 0; row < rows; row++){
+					written += PackBits(source + static_cast<size_t>(row) * stride, stride, target + written);
+				}
+			}
+			else{
+				memcpy(target, source, written);
+			}
+			if (handle){
+				MemUnlock(xfer.Memory.TheMem);
+			}
+
+			xfer.Compression = compression_;
+			xfer.BytesPerRow = stride;
+			xfer.Columns = config_.Width;
+			xfer.Rows = rows;
+			xfer.XOffset = 0;
+			xfer.YOffset = next_row_;
+			xfer.BytesWritten = static_cast<TW_UINT32>(written);
+			next_row_ += rows;
+			return next_row_ == config_.Height ? TWRC_XFERDONE : TWRC_SUCCESS;
+		}
+
+		TW_UINT16 FakeSource::MemoryFileTransfer(TW_IMAGEMEMXFER& xfer){
+			auto& bitmap = Bitmap();
+			if (pending_ == 0 || file_offset_ >= bitmap.size()){
+				return Fail(TWCC_SEQERROR);
+			}
+			auto length = std::min<size_t>(xfer.Memory.Length, bitmap.size() - file_offset_);
+			if (length == 0){
+				return Fail(TWCC_BADVALUE);
+			}
+			Wait();
+
+			bool handle = (xfer.Memory.Flags & TWMF_HANDLE) == TWMF_HANDLE;
+			auto target = handle ? MemLock(xfer.Memory.TheMem) : xfer.Memory.TheMem;
+			memcpy(target, bitmap.data() + file_offset_, length);
+			if (handle){
+				MemUnlock(xfer.Memory.TheMem);
+			}
+
+			xfer.Compression = TWCP_NONE;
+			xfer.BytesPerRow = TWON_DONTCARE32;
+			xfer.Columns = TWON_DONTCARE32;
+			xfer.Rows = TWON_DONTCARE32;
+			xfer.XOffset = TWON_DONTCARE32;
+			xfer.YOffset = TWON_DONTCARE32;
+			xfer.BytesWritten = static_cast<TW_UINT32>(length);
+			file_offset_ += length;
+			return file_offset_ == bitmap.size() ? TWRC_XFERDONE : TWRC_SUCCESS;
+		}
+
+		TW_HANDLE TW_CALLINGSTYLE MemAllocate(TW_UINT32 size){
+#ifdef TWH_CMP_MSC
+			return GlobalAlloc(GHND, size);
+#else
+			return calloc(1, size);
+#endif
+		}
+
+		void TW_CALLINGSTYLE MemFree(TW_HANDLE handle){
+#ifdef TWH_CMP_MSC
+			GlobalFree(handle);
+#else
+			free(handle);
+#endif
+		}
+
+		TW_MEMREF TW_CALLINGSTYLE MemLock(TW_HANDLE handle){
+#ifdef TWH_CMP_MSC
+			return GlobalLock(handle);
+#else
+			return handle;
+#endif
+		}
+
+		void TW_CALLINGSTYLE MemUnlock(TW_HANDLE handle){
+#ifdef TWH_CMP_MSC
+			GlobalUnlock(handle);
+#else
+			(void)handle;
+#endif
+		}
+	}
+}
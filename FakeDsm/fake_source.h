@@ -0,0 +1,208 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef FAKE_SOURCE_H_
+#define FAKE_SOURCE_H_
+
+#include <string>
+#include <vector>
+
+namespace ctwain{
+	namespace fake{
+
+		/// <summary>
+		/// What the fake source generates. Read from FAKEDSM_* environment variables
+		/// each time the source is enabled so a benchmark can change it between batches.
+		/// </summary>
+		struct FakeConfig{
+			/// <summary>
+			/// Pages per batch (FAKEDSM_PAGES).
+			/// </summary>
+			TW_UINT32 Pages = 10;
+
+			/// <summary>
+			/// Page width in pixels (FAKEDSM_WIDTH).
+			/// </summary>
+			TW_UINT32 Width = 2550;
+
+			/// <summary>
+			/// Page height in pixels (FAKEDSM_HEIGHT).
+			/// </summary>
+			TW_UINT32 Height = 3300;
+
+			/// <summary>
+			/// Bits per pixel, 1, 8 or 24 (FAKEDSM_BITDEPTH).
+			/// </summary>
+			TW_UINT16 BitDepth = 8;
+
+			/// <summary>
+			/// Simulated device time for every transfer call in microseconds (FAKEDSM_LATENCY_US).
+			/// </summary>
+			TW_UINT32 LatencyMicroseconds = 0;
+
+			/// <summary>
+			/// Rows per memory transfer strip (FAKEDSM_STRIP_ROWS).
+			/// </summary>
+			TW_UINT32 StripRows = 64;
+
+			/// <summary>
+			/// Makes every Nth page blank, 0 for none (FAKEDSM_BLANK_EVERY).
+			/// </summary>
+			TW_UINT32 BlankEvery = 0;
+
+			/// <summary>
+			/// Number of sources the DSM lists, 1 to 16 (FAKEDSM_SOURCES). Read when the DSM is first opened.
+			/// </summary>
+			TW_UINT32 Sources = 1;
+
+			/// <summary>
+			/// Reads the configuration from the environment, keeping defaults for anything not set.
+			/// </summary>
+			static FakeConfig FromEnvironment();
+		};
+
+		/// <summary>
+		/// A data source that makes up pages instead of scanning them.
+		/// Supports native, file, memory and memory file transfers of uncompressed images.
+		/// </summary>
+		class FakeSource
+		{
+		public:
+			/// <summary>
+			/// Initializes a new instance of the <see cref="FakeSource"/> class.
+			/// </summary>
+			/// <param name="index">The position in the DSM's source list. Sources after the
+			/// first get the number in their product name and file transfer name.</param>
+			explicit FakeSource(unsigned index = 0);
+
+			/// <summary>
+			/// Gets the source identity.
+			/// </summary>
+			TW_IDENTITY& identity(){ return identity_; }
+
+			/// <summary>
+			/// Gets the condition code of the last failed call.
+			/// </summary>
+			TW_UINT16 condition_code() const{ return condition_code_; }
+
+			/// <summary>
+			/// Sets the condition code reported by DAT_STATUS.
+			/// </summary>
+			void set_condition_code(TW_UINT16 code){ condition_code_ = code; }
+
+			/// <summary>
+			/// Starts a new batch with the current configuration.
+			/// </summary>
+			void Enable();
+
+			/// <summary>
+			/// Drops any pages left in the batch.
+			/// </summary>
+			void Disable();
+
+			/// <summary>
+			/// Handles DG_CONTROL / DAT_CAPABILITY.
+			/// </summary>
+			TW_UINT16 Capability(TW_UINT16 msg, TW_CAPABILITY& cap);
+
+			/// <summary>
+			/// Handles DG_CONTROL / DAT_PENDINGXFERS.
+			/// </summary>
+			TW_UINT16 PendingTransfers(TW_UINT16 msg, TW_PENDINGXFERS& pending);
+
+			/// <summary>
+			/// Handles DG_IMAGE / DAT_IMAGEINFO.
+			/// </summary>
+			TW_UINT16 ImageInfo(TW_IMAGEINFO& info);
+
+			/// <summary>
+			/// Handles DG_CONTROL / DAT_SETUPMEMXFER.
+			/// </summary>
+			TW_UINT16 SetupMemory(TW_SETUPMEMXFER& setup);
+
+			/// <summary>
+			/// Handles DG_CONTROL / DAT_SETUPFILEXFER.
+			/// </summary>
+			TW_UINT16 SetupFile(TW_UINT16 msg, TW_SETUPFILEXFER& setup);
+
+			/// <summary>
+			/// Handles DG_IMAGE / DAT_IMAGENATIVEXFER with a DIB (Windows) or BMP (others).
+			/// </summary>
+			TW_UINT16 NativeTransfer(TW_HANDLE& handle);
+
+			/// <summary>
+			/// Handles DG_IMAGE / DAT_IMAGEFILEXFER by writing a BMP file.
+			/// </summary>
+			TW_UINT16 FileTransfer();
+
+			/// <summary>
+			/// Handles DG_IMAGE / DAT_IMAGEMEMXFER one strip at a time.
+			/// </summary>
+			TW_UINT16 MemoryTransfer(TW_IMAGEMEMXFER& xfer);
+
+			/// <summary>
+			/// Handles DG_IMAGE / DAT_IMAGEMEMFILEXFER by streaming a BMP file.
+			/// </summary>
+			TW_UINT16 MemoryFileTransfer(TW_IMAGEMEMXFER& xfer);
+
+		private:
+			TW_IDENTITY identity_;
+			FakeConfig config_;
+			TW_UINT16 condition_code_ = TWCC_SUCCESS;
+			TW_UINT16 xfer_mech_ = TWSX_NATIVE;
+			TW_INT16 xfer_count_ = -1;
+			TW_UINT16 compression_ = TWCP_NONE;
+			TW_UINT32 pending_ = 0;
+			TW_UINT32 next_row_ = 0;
+			TW_UINT32 page_index_ = 0;
+			size_t file_offset_ = 0;
+			TW_SETUPFILEXFER file_setup_;
+			std::vector<TW_UINT8> page_;
+			std::vector<TW_UINT8> bitmap_;
+			std::vector<TW_UINT8> blank_page_;
+			std::vector<TW_UINT8> blank_bitmap_;
+
+			TW_UINT32 bytes_per_row() const{ return (config_.Width * config_.BitDepth + 7) / 8; }
+			// PackBits adds a header byte per 128 bytes at worst
+			TW_UINT32 buffer_row() const{ return bytes_per_row() + (compression_ == TWCP_PACKBITS ? (bytes_per_row() + 127) / 128 : 0); }
+			bool blank() const;
+			const std::vector<TW_UINT8>& Page() const{ return blank() ? blank_page_ : page_; }
+			void Generate();
+			const std::vector<TW_UINT8>& Bitmap();
+			void Wait() const;
+			TW_UINT16 Fail(TW_UINT16 code){ condition_code_ = code; return TWRC_FAILURE; }
+			TW_UINT16 SupportedMessages(TW_UINT16 capType) const;
+			TW_UINT16 WriteCap(TW_UINT16 msg, TW_CAPABILITY& cap);
+		};
+
+		/// <summary>
+		/// Memory functions handed out through DAT_ENTRYPOINT.
+		/// </summary>
+		TW_HANDLE TW_CALLINGSTYLE MemAllocate(TW_UINT32 size);
+		void TW_CALLINGSTYLE MemFree(TW_HANDLE handle);
+		TW_MEMREF TW_CALLINGSTYLE MemLock(TW_HANDLE handle);
+		void TW_CALLINGSTYLE MemUnlock(TW_HANDLE handle);
+	}
+}
+
+#endif //FAKE_SOURCE_H_
@@ -0,0 +1,803 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+// TwainBench: drives TwainSession through full batches against the fake DSM
+// and reports throughput, per-page latency percentiles and peak memory.
+//
+// usage: TwainBench [native|file|memory|memfile|all] [--pages N] [--width N] [--height N]
+//                   [--bits 1|8|24] [--latency-us N] [--handler-us N] [--strip-rows N]
+//                   [--buffers N] [--pipeline N] [--batches N] [--dsm path] [--trace path|-]
+//                   [--compression none|packbits] [--blank-every N] [--preview N]
+//                   [--async N] [--sessions N] [--hosted N] [--map-files 0|1]
+//                   [--file-target dir] [--file-staging dir] [--check-allocs]
+//
+// --latency-us makes the fake source take that long for every call, so for every strip.
+// --handler-us makes OnTransferredStrip take that long, which with --latency-us shows what
+// rotating --buffers saves per page, e.g.
+//   memory --pages 20 --height 4096 --latency-us 2000 --handler-us 1500 --buffers 2
+// has p50_ms near 64 strips * 2 ms where --buffers 1 takes 64 * 3.5 ms.
+// --trace writes the per-call DSM latency histograms as CSV once every run is done.
+// --compression negotiates ICAP_COMPRESSION for memory transfers and checks that
+// every page comes back assembled in that compression.
+// --blank-every makes every Nth page blank and has blank page detection drop them,
+// the run then expects that many fewer native and memory pages.
+// --preview builds previews at most N pixels on a side and checks that every native
+// and uncompressed memory page gets its final one.
+// --async takes the pages from AcquireAsync on the main thread, with at most N queued.
+// --sessions runs N sessions side by side, each on its own fake source and thread,
+// and adds a line with their combined throughput for every mechanism.
+// --hosted runs every source in a worker process (this program again) through DriverHost
+// with an N MB page ring, and reads the pages in place. The session tuning options are
+// left at their defaults there.
+// --map-files maps every file transfer read-only and reads it through the view, when
+// the pages are handled as they arrive (no --pipeline or --async) or go to files of their own.
+// --file-target gives every file transfer a numbered file in that directory, written to
+// --file-staging first if given, and checks that each one got there. The files are deleted.
+// --check-allocs counts the heap allocations on the transfer thread from the second page
+// of every batch on and fails the run if there are any. It applies to native, file and
+// memory transfers delivered through OnTransferredData without the options that keep pages
+// (--pipeline, --async, --map-files, --file-target) and without --blank-every,
+// e.g. file --pages 1000 --check-allocs.
+//
+// Exits with 1 when a batch doesn't deliver every page so it can gate a release.
+
+#include "stdafx.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "build_macros.h"
+#include "twain_session.h"
+#include "entry_points.h"
+#include "buffer_pool.h"
+#include "dib_view.h"
+#include "driver_host.h"
+#include "dsm_trace.h"
+#include "mapped_file.h"
+#include "page_stream.h"
+#include "transferred_page.h"
+
+using namespace ctwain;
+
+namespace{
+	// set on the threads whose allocations are counted, see --check-allocs
+	CTWAIN_THREAD_LOCAL bool counting_allocations = false;
+	std::atomic<unsigned long long> counted_allocations{ 0 };
+}
+
+void* operator new(size_t size){
+	if (counting_allocations){
+		counted_allocations++;
+	}
+	if (auto memory = malloc(size ? size : 1)){
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size){
+	return operator new(size);
+}
+
+void operator delete(void* memory) throw(){
+	free(memory);
+}
+
+void operator delete[](void* memory) throw(){
+	free(memory);
+}
+
+// C++14 compilers call the sized versions, forwarded so every delete pairs with the malloc above
+void operator delete(void* memory, size_t size) throw(){
+	UNREFERENCED_PARAMETER(size);
+	operator delete(memory);
+}
+
+void operator delete[](void* memory, size_t size) throw(){
+	UNREFERENCED_PARAMETER(size);
+	operator delete[](memory);
+}
+
+namespace{
+	typedef std::chrono::steady_clock Clock;
+
+	struct Options{
+		std::vector<TW_UINT16> Mechanisms;
+		std::string Pages = "50";
+		std::string Width = "2550";
+		std::string Height = "3300";
+		std::string Bits = "8";
+		std::string LatencyMicroseconds = "0";
+		unsigned HandlerMicroseconds = 0;
+		std::string StripRows = "64";
+		unsigned Buffers = 1;
+		unsigned PipelineWorkers = 0;
+		unsigned Batches = 1;
+#ifdef TWH_CMP_MSC
+		std::string DsmPath = "FakeDsm.dll";
+#else
+		std::string DsmPath = "./libfakedsm.so";
+#endif
+		std::string TracePath;
+		TW_UINT16 Compression = TWCP_NONE;
+		unsigned BlankEvery = 0;
+		unsigned PreviewSize = 0;
+		unsigned AsyncQueue = 0;
+		unsigned Sessions = 1;
+		unsigned HostedRingMegabytes = 0;
+		bool MapFiles = false;
+		std::string FileTarget;
+		std::string FileStaging;
+		bool CheckAllocations = false;
+	};
+
+	const char* MechanismName(TW_UINT16 mech){
+		switch (mech){
+		case TWSX_NATIVE:
+			return "native";
+		case TWSX_FILE:
+			return "file";
+		case TWSX_MEMORY:
+			return "memory";
+		case TWSX_MEMFILE:
+			return "memfile";
+		default:
+			return "unknown";
+		}
+	}
+
+	void SetEnvironment(const char* name, const std::string& value){
+#ifdef TWH_CMP_MSC
+		SetEnvironmentVariableA(name, value.c_str());
+#else
+		setenv(name, value.c_str(), 1);
+#endif
+	}
+
+	std::string GetEnvironment(const char* name){
+#ifdef TWH_CMP_MSC
+		char value[MAX_PATH]{};
+		GetEnvironmentVariableA(name, value, sizeof(value));
+		return value;
+#else
+		auto value = getenv(name);
+		return value ? value : "";
+#endif
+	}
+
+	void SetDsmPath(const std::string& dsmPath){
+		std::basic_string<DsmPathChar> path(dsmPath.begin(), dsmPath.end());
+		EntryPoints::set_dsm_path(path.c_str());
+	}
+
+	size_t PeakMemory(){
+#ifdef TWH_CMP_MSC
+		PROCESS_MEMORY_COUNTERS counters{ 0 };
+		counters.cb = sizeof(counters);
+		GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+		return counters.PeakWorkingSetSize;
+#else
+		rusage usage{};
+		getrusage(RUSAGE_SELF, &usage);
+		return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+	}
+
+	bool ParseOptions(int argc, char* argv[], Options& options){
+		for (int i = 1; i < argc; i++){
+			std::string arg = argv[i];
+			if (arg == "--check-allocs"){
+				options.CheckAllocations = true;
+			}
+			else if (arg == "native"){
+				options.Mechanisms.push_back(TWSX_NATIVE);
+			}
+			else if (arg == "file"){
+				options.Mechanisms.push_back(TWSX_FILE);
+			}
+			else if (arg == "memory"){
+				options.Mechanisms.push_back(TWSX_MEMORY);
+			}
+			else if (arg == "memfile"){
+				options.Mechanisms.push_back(TWSX_MEMFILE);
+			}
+			else if (arg == "all"){
+				options.Mechanisms = { TWSX_NATIVE, TWSX_FILE, TWSX_MEMORY, TWSX_MEMFILE };
+			}
+			else if (i + 1 < argc && arg.compare(0, 2, "--") == 0){
+				std::string value = argv[++i];
+				if (arg == "--pages") options.Pages = value;
+				else if (arg == "--width") options.Width = value;
+				else if (arg == "--height") options.Height = value;
+				else if (arg == "--bits") options.Bits = value;
+				else if (arg == "--latency-us") options.LatencyMicroseconds = value;
+				else if (arg == "--handler-us") options.HandlerMicroseconds = static_cast<unsigned>(atoi(value.c_str()));
+				else if (arg == "--strip-rows") options.StripRows = value;
+				else if (arg == "--buffers") options.Buffers = static_cast<unsigned>(atoi(value.c_str()));
+				else if (arg == "--pipeline") options.PipelineWorkers = static_cast<unsigned>(atoi(value.c_str()));
+				else if (arg == "--batches") options.Batches = std::max(1, atoi(value.c_str()));
+				else if (arg == "--dsm") options.DsmPath = value;
+				else if (arg == "--trace") options.TracePath = value;
+				else if (arg == "--compression" && value == "none") options.Compression = TWCP_NONE;
+				else if (arg == "--compression" && value == "packbits") options.Compression = TWCP_PACKBITS;
+				else if (arg == "--blank-every") options.BlankEvery = static_cast<unsigned>(atoi(value.c_str()));
+				else if (arg == "--preview") options.PreviewSize = static_cast<unsigned>(atoi(value.c_str()));
+				else if (arg == "--async") options.AsyncQueue = static_cast<unsigned>(atoi(value.c_str()));
+				else if (arg == "--hosted") options.HostedRingMegabytes = static_cast<unsigned>(atoi(value.c_str()));
+				else if (arg == "--file-target") options.FileTarget = value;
+				else if (arg == "--file-staging") options.FileStaging = value;
+				else if (arg == "--map-files") options.MapFiles = atoi(value.c_str()) != 0;
+				else if (arg == "--sessions") options.Sessions = static_cast<unsigned>(std::min(16, std::max(1, atoi(value.c_str()))));
+				else return false;
+			}
+			else{
+				return false;
+			}
+		}
+		if (options.Mechanisms.empty()){
+			options.Mechanisms.push_back(TWSX_NATIVE);
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Times every page from its transfer ready event to the next one
+	/// (or the end of the batch), which covers the whole transfer round-trip.
+	/// </summary>
+	class BenchSession : public TwainSession
+	{
+	public:
+		void StartBatch(){
+			std::lock_guard<std::mutex> lock(mutex_);
+			done_ = false;
+			page_started_ = false;
+			batch_pages_ = 0;
+		}
+
+		bool WaitForBatch(){
+			std::unique_lock<std::mutex> lock(mutex_);
+			return done_changed_.wait_for(lock, std::chrono::minutes(10), [this]{ return done_; });
+		}
+
+		std::vector<double>& latencies(){ return latencies_; }
+		unsigned long long delivered() const{ return delivered_; }
+		unsigned long long bad_dibs() const{ return bad_dibs_; }
+		unsigned long long bad_compressed() const{ return bad_compressed_; }
+		unsigned long long final_previews() const{ return final_previews_; }
+		unsigned long long bad_files() const{ return bad_files_; }
+		unsigned long long bad_memory_files() const{ return bad_memory_files_; }
+		void set_expected_compression(TW_UINT16 compression){ expected_compression_ = compression; }
+		void set_expect_mapped_files(bool expect){ expect_mapped_files_ = expect; }
+		void set_expect_memory_files(bool expect){ expect_memory_files_ = expect; }
+		void set_count_allocations(bool count){ count_allocations_ = count; }
+		void set_collect_files(bool collect){ collect_files_ = collect; }
+		void set_strip_handler_microseconds(unsigned microseconds){ strip_handler_microseconds_ = microseconds; }
+
+		void Consume(const TransferredPage& page){
+			if (expected_compression_ != TWCP_NONE && !IsCompressed(&page)){
+				bad_compressed_++;
+			}
+			CheckFile(page.file_data());
+			CheckMemoryFile(&page);
+			AddFile(page.file_path());
+			delivered_++;
+		}
+
+		/// <summary>
+		/// Takes the paths of the files transferred since the last call, if collected.
+		/// </summary>
+		std::vector<std::string> TakeFiles(){
+			std::lock_guard<std::mutex> lock(mutex_);
+			return std::move(files_);
+		}
+
+	protected:
+		void OnTransferReady(TransferReadyEventArgs& readyEvent) override{
+			UNREFERENCED_PARAMETER(readyEvent);
+			EndPage();
+			// the first page of a batch warms up the buffers, the rest should reuse them
+			if (count_allocations_ && ++batch_pages_ == 2){
+				counting_allocations = true;
+			}
+			page_start_ = Clock::now();
+			page_started_ = true;
+		}
+
+		void OnTransferredData(const TransferredDataEventArgs& transferEvent) override{
+			if (transferEvent.NativeData && !DibView(transferEvent.NativeData).valid()){
+				bad_dibs_++;
+			}
+			if (expected_compression_ != TWCP_NONE && !IsCompressed(transferEvent.CompressedPage)){
+				bad_compressed_++;
+			}
+			CheckFile(transferEvent.FileData);
+			CheckMemoryFile(transferEvent.CompressedPage);
+			AddFile(transferEvent.FileDataPath);
+			delivered_++;
+		}
+
+		void OnTransferredStrip(const TransferredStripEventArgs& stripEvent) override{
+			UNREFERENCED_PARAMETER(stripEvent);
+			if (strip_handler_microseconds_ == 0){
+				return;
+			}
+			// spin like the fake source does, sleeping is too coarse for a strip
+			auto until = Clock::now() + std::chrono::microseconds(strip_handler_microseconds_);
+			while (Clock::now() < until){
+				std::this_thread::yield();
+			}
+		}
+
+		void OnPreviewUpdated(const PreviewEventArgs& previewEvent) override{
+			if (previewEvent.Final){
+				final_previews_++;
+			}
+		}
+
+		void OnPageCompleted(std::unique_ptr<TransferredPage> page) override{
+			if (expected_compression_ != TWCP_NONE && !IsCompressed(page.get())){
+				bad_compressed_++;
+			}
+			CheckFile(page->file_data());
+			CheckMemoryFile(page.get());
+			AddFile(page->file_path());
+			delivered_++;
+		}
+
+		void OnSourceDisabled() override{
+			counting_allocations = false;
+			EndPage();
+			std::lock_guard<std::mutex> lock(mutex_);
+			done_ = true;
+			done_changed_.notify_all();
+		}
+
+	private:
+		std::mutex mutex_;
+		std::condition_variable done_changed_;
+		bool done_ = false;
+		bool page_started_ = false;
+		Clock::time_point page_start_;
+		std::vector<double> latencies_;
+		std::vector<std::string> files_;
+		std::atomic<unsigned long long> delivered_{ 0 };
+		std::atomic<unsigned long long> bad_dibs_{ 0 };
+		std::atomic<unsigned long long> bad_compressed_{ 0 };
+		std::atomic<unsigned long long> final_previews_{ 0 };
+		std::atomic<unsigned long long> bad_files_{ 0 };
+		std::atomic<unsigned long long> bad_memory_files_{ 0 };
+		std::atomic<unsigned long long> file_checksum_{ 0 };
+		TW_UINT16 expected_compression_ = TWCP_NONE;
+		bool expect_mapped_files_ = false;
+		bool expect_memory_files_ = false;
+		bool count_allocations_ = false;
+		bool collect_files_ = false;
+		unsigned strip_handler_microseconds_ = 0;
+		unsigned batch_pages_ = 0;
+
+		bool IsCompressed(const TransferredPage* page) const{
+			return page && page->compression() == expected_compression_ && page->memory_size() > 0 && page->image_info() &&
+				page->image_info()->Compression == expected_compression_;
+		}
+
+		/// <summary>
+		/// Reads a mapped file transfer through its view so the bench pays for the page faults.
+		/// </summary>
+		void CheckFile(const std::shared_ptr<MappedFile>& file){
+			if (!expect_mapped_files_){
+				return;
+			}
+			if (!file || file->size() == 0){
+				bad_files_++;
+				return;
+			}
+			unsigned long long sum = 0;
+			for (size_t i = 0; i < file->size(); i++){
+				sum += file->data()[i];
+			}
+			file_checksum_ += sum;
+		}
+
+		/// <summary>
+		/// Checks a memory file page came together as the BMP the fake source streams.
+		/// </summary>
+		void CheckMemoryFile(const TransferredPage* page){
+			if (!expect_memory_files_){
+				return;
+			}
+			if (!page || page->image_file_format() != TWFF_BMP || page->memory_size() < 2 ||
+				page->memory_data()[0] != 'B' || page->memory_data()[1] != 'M'){
+				bad_memory_files_++;
+			}
+		}
+
+		void AddFile(const std::string& path){
+			if (collect_files_ && !path.empty()){
+				std::lock_guard<std::mutex> lock(mutex_);
+				files_.push_back(path);
+			}
+		}
+
+		void EndPage(){
+			if (page_started_){
+				latencies_.push_back(std::chrono::duration<double, std::milli>(Clock::now() - page_start_).count());
+				page_started_ = false;
+			}
+		}
+	};
+
+	double Percentile(const std::vector<double>& sorted, double percent){
+		if (sorted.empty()){
+			return 0;
+		}
+		// nearest rank
+		auto rank = static_cast<size_t>(percent / 100.0 * sorted.size() + 0.5);
+		return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+	}
+
+	void Report(const Options& options, TW_UINT16 mech, unsigned long long delivered, double seconds, std::vector<double>& latencies){
+		auto& sorted = latencies;
+		std::sort(sorted.begin(), sorted.end());
+		double pageBytes = atof(options.Width.c_str()) * atof(options.Height.c_str()) * atof(options.Bits.c_str()) / 8;
+		auto stats = EntryPoints::buffer_pool().stats();
+
+		printf("mech=%s pages=%llu seconds=%.3f pages_per_sec=%.1f mb_per_sec=%.1f "
+			"p50_ms=%.3f p90_ms=%.3f p99_ms=%.3f max_ms=%.3f peak_mb=%.1f pool_high_mb=%.1f\n",
+			MechanismName(mech), delivered, seconds, delivered / seconds,
+			delivered * pageBytes / (1024 * 1024) / seconds,
+			Percentile(sorted, 50), Percentile(sorted, 90), Percentile(sorted, 99), sorted.empty() ? 0 : sorted.back(),
+			PeakMemory() / (1024.0 * 1024), stats.HighWaterBytes / (1024.0 * 1024));
+	}
+
+	std::string SourceName(unsigned index){
+		return index == 0 ? "CTwain Fake Source" : "CTwain Fake Source " + std::to_string(index + 1);
+	}
+
+	bool Run(BenchSession& session, const Options& options, TW_UINT16 mech, const std::string& sourceName,
+		unsigned long long& delivered){
+		if (session.OpenDsm() != TWRC_SUCCESS){
+			printf("failed to open the DSM\n");
+			return false;
+		}
+		auto sources = session.GetSources();
+		auto hit = std::find_if(sources.begin(), sources.end(),
+			[&sourceName](const TW_IDENTITY& test){ return sourceName == test.ProductName; });
+		if (hit == sources.end() || session.OpenSource(*hit) != TWRC_SUCCESS){
+			printf("failed to open the fake source\n");
+			session.CloseDsm();
+			return false;
+		}
+
+		TW_UINT32 value = mech;
+		session.CapSet(ICAP_XFERMECH, SetType::Current, value);
+		// only memory transfers come compressed
+		auto compression = mech == TWSX_MEMORY ? options.Compression : static_cast<TW_UINT16>(TWCP_NONE);
+		if (mech == TWSX_MEMORY && session.SetCompression(compression) != TWRC_SUCCESS){
+			printf("failed to set the compression\n");
+			session.CloseSource();
+			session.CloseDsm();
+			return false;
+		}
+		session.set_expected_compression(compression);
+		bool nameFiles = !options.FileTarget.empty() && mech == TWSX_FILE;
+		if (nameFiles){
+			FileNamingOptions naming;
+			naming.NamePattern = "bench_" + std::to_string(session.source_id()) + "_#####";
+			naming.TargetDirectory = options.FileTarget;
+			naming.StagingDirectory = options.FileStaging;
+			session.EnableFileNaming(naming);
+		}
+		else{
+			session.DisableFileNaming();
+		}
+		session.set_collect_files(nameFiles);
+		// the fake source writes every page to the same file unless named, so a view only holds
+		// its page until the next transfer and deferred pages can't be read through it
+		bool mapFiles = options.MapFiles && mech == TWSX_FILE &&
+			(nameFiles || (options.PipelineWorkers == 0 && options.AsyncQueue == 0));
+		session.set_map_transferred_files(mapFiles);
+		session.set_expect_mapped_files(mapFiles);
+		session.set_expect_memory_files(mech == TWSX_MEMFILE);
+		if (options.BlankEvery > 0){
+			BlankPageOptions blankOptions;
+			blankOptions.DropBlankPages = true;
+			session.EnableBlankPageDetection(blankOptions);
+		}
+		else{
+			session.DisableBlankPageDetection();
+		}
+		if (options.PreviewSize > 0){
+			PreviewOptions previewOptions;
+			previewOptions.MaxWidth = options.PreviewSize;
+			previewOptions.MaxHeight = options.PreviewSize;
+			session.EnablePreview(previewOptions);
+		}
+		else{
+			session.DisablePreview();
+		}
+		session.set_memory_buffer_count(options.Buffers);
+		session.set_strip_handler_microseconds(options.HandlerMicroseconds);
+		if (options.PipelineWorkers > 0){
+			session.EnablePagePipeline(options.PipelineWorkers, options.PipelineWorkers * 2);
+		}
+		else{
+			session.DisablePagePipeline();
+		}
+
+		session.latencies().clear();
+		// growing the latencies on the transfer thread would count as an allocation
+		session.latencies().reserve(static_cast<size_t>(std::max(0, atoi(options.Pages.c_str()))) * options.Batches + 1);
+		// the fake source builds its blank page the first time it sends one, which would count
+		bool countAllocations = options.CheckAllocations && options.BlankEvery == 0 &&
+			options.PipelineWorkers == 0 && options.AsyncQueue == 0 && !mapFiles && !nameFiles;
+		session.set_count_allocations(countAllocations);
+		auto allocationsBefore = counted_allocations.load();
+		auto before = session.delivered();
+		auto previewsBefore = session.final_previews();
+		auto start = Clock::now();
+		bool ok = true;
+		for (unsigned batch = 0; batch < options.Batches && ok; batch++){
+			session.StartBatch();
+			if (options.AsyncQueue > 0){
+				AcquireOptions acquire;
+				acquire.MaxQueuedPages = options.AsyncQueue;
+				auto stream = session.AcquireAsync(acquire);
+				ok = stream != nullptr;
+				while (ok){
+					auto page = stream->Next().get();
+					if (!page){
+						break;
+					}
+					session.Consume(*page);
+				}
+				ok = ok && session.WaitForBatch();
+			}
+			else{
+				ok = session.EnableSource(EnableSourceMode::kHideUI, false) == TWRC_SUCCESS && session.WaitForBatch();
+			}
+		}
+		session.FlushPages();
+		session.FlushFileMoves();
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		session.CloseSource();
+		session.CloseDsm();
+
+		auto pages = static_cast<unsigned long long>(atoi(options.Pages.c_str()));
+		// only uncompressed native and memory pages get looked at
+		bool analyzed = mech == TWSX_NATIVE || (mech == TWSX_MEMORY && options.Compression == TWCP_NONE);
+		auto expectedPreviews = options.PreviewSize > 0 && analyzed ? pages * options.Batches : 0;
+		if (options.BlankEvery > 0 && analyzed){
+			pages -= pages / options.BlankEvery;
+		}
+		auto expected = pages * options.Batches;
+		delivered = session.delivered() - before;
+
+		Report(options, mech, delivered, seconds, session.latencies());
+
+		if (!ok || delivered != expected){
+			printf("expected %llu pages\n", expected);
+			return false;
+		}
+		if (session.bad_dibs()){
+			printf("%llu native pages were not valid DIBs\n", session.bad_dibs());
+			return false;
+		}
+		if (session.bad_compressed()){
+			printf("%llu memory pages did not arrive compressed\n", session.bad_compressed());
+			return false;
+		}
+		auto allocations = counted_allocations.load() - allocationsBefore;
+		if (countAllocations && allocations){
+			printf("%llu heap allocations after the first page of a batch\n", allocations);
+			return false;
+		}
+		auto files = session.TakeFiles();
+		if (nameFiles){
+			unsigned long long missing = 0;
+			for (auto& file : files){
+				if (!std::ifstream(file, std::ios::binary).is_open() || std::remove(file.c_str()) != 0){
+					missing++;
+				}
+			}
+			if (missing){
+				printf("%llu files did not reach %s\n", missing, options.FileTarget.c_str());
+				return false;
+			}
+		}
+		if (session.bad_files()){
+			printf("%llu file pages were not mapped\n", session.bad_files());
+			return false;
+		}
+		if (session.bad_memory_files()){
+			printf("%llu memory file pages were not BMP files\n", session.bad_memory_files());
+			return false;
+		}
+		if (session.final_previews() - previewsBefore != expectedPreviews){
+			printf("expected %llu previews, got %llu\n", expectedPreviews, session.final_previews() - previewsBefore);
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Like <see cref="Run"/> but with the source in a <see cref="DriverHost"/> worker.
+	/// </summary>
+	bool RunHosted(const Options& options, TW_UINT16 mech, const std::string& sourceName, unsigned long long& delivered){
+		DriverHost host;
+		HostOptions hostOptions;
+		hostOptions.RingBytes = static_cast<size_t>(options.HostedRingMegabytes) * 1024 * 1024;
+		if (host.Start(sourceName, hostOptions) != TWRC_SUCCESS){
+			printf("failed to start the driver host\n");
+			return false;
+		}
+
+		std::vector<double> latencies;
+		unsigned long long badDibs = 0;
+		delivered = 0;
+		auto start = Clock::now();
+		bool ok = true;
+		for (unsigned batch = 0; batch < options.Batches && ok; batch++){
+			ok = host.Acquire(mech) == TWRC_SUCCESS;
+			auto pageStart = Clock::now();
+			while (ok){
+				auto page = host.Next();
+				if (!page){
+					ok = host.batch_result() == TWRC_SUCCESS;
+					break;
+				}
+				auto now = Clock::now();
+				latencies.push_back(std::chrono::duration<double, std::milli>(now - pageStart).count());
+				pageStart = now;
+				if (mech == TWSX_NATIVE && !DibView(page->native_data(), page->native_size()).valid()){
+					badDibs++;
+				}
+				delivered++;
+			}
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		host.Stop();
+
+		Report(options, mech, delivered, seconds, latencies);
+
+		auto expected = static_cast<unsigned long long>(atoi(options.Pages.c_str())) * options.Batches;
+		if (!ok || delivered != expected){
+			printf("expected %llu pages%s\n", expected, host.worker_failed() ? ", the worker failed" : "");
+			return false;
+		}
+		if (badDibs){
+			printf("%llu native pages were not valid DIBs\n", badDibs);
+			return false;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Runs the source at <paramref name="index"/>, in a worker if hosted, otherwise with its session.
+	/// </summary>
+	bool RunSource(std::vector<std::unique_ptr<BenchSession>>& sessions, const Options& options, TW_UINT16 mech,
+		unsigned index, unsigned long long& delivered){
+		if (options.HostedRingMegabytes > 0){
+			return RunHosted(options, mech, SourceName(index), delivered);
+		}
+		return Run(*sessions[index], options, mech, SourceName(index), delivered);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (DriverHost::IsWorker(argc, argv)){
+		// the host passes its DSM along
+		SetDsmPath(GetEnvironment("TWAINBENCH_DSM"));
+		return DriverHost::RunWorker(argc, argv);
+	}
+
+	Options options;
+	if (!ParseOptions(argc, argv, options)){
+		printf("usage: TwainBench [native|file|memory|memfile|all] [--pages N] [--width N] [--height N] [--bits 1|8|24]\n"
+			"                  [--latency-us N] [--handler-us N] [--strip-rows N] [--buffers N] [--pipeline N] [--batches N]\n"
+			"                  [--dsm path]\n"
+			"                  [--trace path|-] [--compression none|packbits] [--blank-every N]\n"
+			"                  [--preview N] [--async N] [--sessions N] [--hosted N] [--map-files 0|1]\n"
+			"                  [--file-target dir] [--file-staging dir] [--check-allocs]\n");
+		return 2;
+	}
+
+	SetEnvironment("FAKEDSM_PAGES", options.Pages);
+	SetEnvironment("FAKEDSM_WIDTH", options.Width);
+	SetEnvironment("FAKEDSM_HEIGHT", options.Height);
+	SetEnvironment("FAKEDSM_BITDEPTH", options.Bits);
+	SetEnvironment("FAKEDSM_LATENCY_US", options.LatencyMicroseconds);
+	SetEnvironment("FAKEDSM_STRIP_ROWS", options.StripRows);
+	SetEnvironment("FAKEDSM_BLANK_EVERY", std::to_string(options.BlankEvery));
+	SetEnvironment("FAKEDSM_SOURCES", std::to_string(options.Sessions));
+	SetEnvironment("TWAINBENCH_DSM", options.DsmPath);
+	SetDsmPath(options.DsmPath);
+
+	// hosted sources don't need a session here
+	std::vector<std::unique_ptr<BenchSession>> sessions;
+	for (unsigned i = 0; i < options.Sessions && options.HostedRingMegabytes == 0; i++){
+		sessions.emplace_back(new BenchSession());
+		if (!sessions.back()->Initialize()){
+			printf("failed to load %s\n", options.DsmPath.c_str());
+			return 1;
+		}
+	}
+
+	DsmTrace::set_enabled(!options.TracePath.empty());
+
+	int result = 0;
+	for (auto mech : options.Mechanisms){
+		if (options.Sessions == 1){
+			unsigned long long delivered = 0;
+			if (!RunSource(sessions, options, mech, 0, delivered)){
+				result = 1;
+			}
+			continue;
+		}
+
+		std::vector<unsigned long long> delivered(options.Sessions);
+		std::vector<char> ok(options.Sessions);
+		std::vector<std::thread> threads;
+		auto start = Clock::now();
+		for (unsigned i = 0; i < options.Sessions; i++){
+			threads.emplace_back([&, i]{
+				ok[i] = RunSource(sessions, options, mech, i, delivered[i]);
+			});
+		}
+		for (auto& thread : threads){
+			thread.join();
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		unsigned long long total = 0;
+		for (unsigned i = 0; i < options.Sessions; i++){
+			total += delivered[i];
+			if (!ok[i]){
+				result = 1;
+			}
+		}
+		printf("mech=%s sessions=%u pages=%llu seconds=%.3f pages_per_sec=%.1f\n",
+			MechanismName(mech), options.Sessions, total, seconds, total / seconds);
+	}
+
+	if (options.TracePath == "-"){
+		DsmTrace::ExportStats(std::cout);
+	}
+	else if (!options.TracePath.empty()){
+		std::ofstream trace(options.TracePath);
+		DsmTrace::ExportStats(trace);
+	}
+	return result;
+}
@@ -0,0 +1,550 @@
+// The MIT License (MIT)
+// Copyright (c) 2015 Yin-Chun Wang
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy 
+// of this software and associated documentation files (the "Software"), to deal 
+// in the Software without restriction, including without limitation the rights to 
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies 
+// of the Software, and to permit persons to whom the Software is furnished 
+// to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included 
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES 
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND 
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE 
+// OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+// TwainTests: runs 1000 page batches through TwainSession against the fake DSM and fails
+// when a page goes missing or the per-page path allocates from the heap on any thread
+// (the transfer loop, the strip consumer, the pipeline workers and posting threads),
+// or has to get a new transfer buffer from the system. The SIMD pixel kernels are checked
+// against their scalar versions at every level the CPU has.
+//
+// usage: TwainTests [--dsm path]
+//
+// Exits with 1 when a test fails.
+
+#include "stdafx.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "build_macros.h"
+#include "twain_session.h"
+#include "entry_points.h"
+#include "buffer_pool.h"
+#include "cap_container.h"
+#include "message_loop.h"
+#include "pixel_kernels.h"
+#include "transferred_page.h"
+
+using namespace ctwain;
+
+namespace{
+	// allocations on every thread count while set
+	std::atomic<bool> counting_allocations{ false };
+	std::atomic<unsigned long long> counted_allocations{ 0 };
+}
+
+void* operator new(size_t size){
+	if (counting_allocations.load(std::memory_order_relaxed)){
+		counted_allocations++;
+	}
+	if (auto memory = malloc(size ? size : 1)){
+		return memory;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size){
+	return operator new(size);
+}
+
+void operator delete(void* memory) throw(){
+	free(memory);
+}
+
+void operator delete[](void* memory) throw(){
+	free(memory);
+}
+
+// C++14 compilers call the sized versions, forwarded so every delete pairs with the malloc above
+void operator delete(void* memory, size_t size) throw(){
+	UNREFERENCED_PARAMETER(size);
+	operator delete(memory);
+}
+
+void operator delete[](void* memory, size_t size) throw(){
+	UNREFERENCED_PARAMETER(size);
+	operator delete[](memory);
+}
+
+namespace{
+	const unsigned kPages = 1000;
+	// pages before counting starts, enough to fill the pipeline and the pools behind it
+	const unsigned kWarmupPages = 16;
+	// the workers stall this long on each warm-up page so the pipeline fills up
+	// and every page buffer the batch can have alive at once comes out of the pool
+	const unsigned kWarmupStallMilliseconds = 10;
+
+	struct TestCase{
+		const char* Name;
+		TW_UINT16 Mechanism;
+		unsigned Buffers;
+		unsigned PipelineWorkers;
+	};
+
+	const TestCase kTestCases[] = {
+		{ "native", TWSX_NATIVE, 1, 0 },
+		{ "file", TWSX_FILE, 1, 0 },
+		{ "memory", TWSX_MEMORY, 1, 0 },
+		{ "memory_strip_consumer", TWSX_MEMORY, 3, 0 },
+		{ "native_pipeline", TWSX_NATIVE, 1, 2 },
+		{ "file_pipeline", TWSX_FILE, 1, 2 },
+		{ "memory_pipeline", TWSX_MEMORY, 2, 2 },
+	};
+
+	void SetEnvironment(const char* name, const char* value){
+#ifdef TWH_CMP_MSC
+		SetEnvironmentVariableA(name, value);
+#else
+		setenv(name, value, 1);
+#endif
+	}
+
+	class TestSession : public TwainSession
+	{
+	public:
+		void StartBatch(){
+			std::lock_guard<std::mutex> lock(mutex_);
+			done_ = false;
+			batch_pages_ = 0;
+			warming_up_ = true;
+		}
+
+		bool WaitForBatch(){
+			std::unique_lock<std::mutex> lock(mutex_);
+			return done_changed_.wait_for(lock, std::chrono::minutes(5), [this]{ return done_; });
+		}
+
+		unsigned long long delivered() const{ return delivered_; }
+		unsigned long long pool_misses() const{ return pool_misses_; }
+
+	protected:
+		void OnTransferReady(TransferReadyEventArgs& readyEvent) override{
+			UNREFERENCED_PARAMETER(readyEvent);
+			if (++batch_pages_ == kWarmupPages){
+				warming_up_ = false;
+				pool_misses_ = EntryPoints::buffer_pool().stats().Misses;
+				counting_allocations = true;
+			}
+		}
+
+		void OnTransferredData(const TransferredDataEventArgs& transferEvent) override{
+			UNREFERENCED_PARAMETER(transferEvent);
+			delivered_++;
+		}
+
+		void OnProcessPage(TransferredPage& page) override{
+			UNREFERENCED_PARAMETER(page);
+			if (warming_up_){
+				std::this_thread::sleep_for(std::chrono::milliseconds(kWarmupStallMilliseconds));
+			}
+		}
+
+		void OnPageCompleted(std::unique_ptr<TransferredPage> page) override{
+			UNREFERENCED_PARAMETER(page);
+			delivered_++;
+		}
+
+		void OnSourceDisabled() override{
+			counting_allocations = false;
+			pool_misses_ = EntryPoints::buffer_pool().stats().Misses - pool_misses_;
+			std::lock_guard<std::mutex> lock(mutex_);
+			done_ = true;
+			done_changed_.notify_all();
+		}
+
+	private:
+		std::mutex mutex_;
+		std::condition_variable done_changed_;
+		bool done_ = false;
+		unsigned batch_pages_ = 0;
+		unsigned long long pool_misses_ = 0;
+		std::atomic<bool> warming_up_{ false };
+		std::atomic<unsigned long long> delivered_{ 0 };
+	};
+
+	bool RunBatch(const TestCase& test){
+		TestSession session;
+		if (!session.Initialize() || session.OpenDsm() != TWRC_SUCCESS){
+			printf("FAIL %s: the DSM didn't open\n", test.Name);
+			return false;
+		}
+		auto sources = session.GetSources();
+		if (sources.empty() || session.OpenSource(sources.front()) != TWRC_SUCCESS){
+			printf("FAIL %s: the fake source didn't open\n", test.Name);
+			session.CloseDsm();
+			return false;
+		}
+		TW_UINT32 value = test.Mechanism;
+		session.CapSet(ICAP_XFERMECH, SetType::Current, value);
+		session.set_memory_buffer_count(test.Buffers);
+		if (test.PipelineWorkers > 0){
+			session.EnablePagePipeline(test.PipelineWorkers, test.PipelineWorkers * 2);
+		}
+
+		auto allocationsBefore = counted_allocations.load();
+		session.StartBatch();
+		bool ok = session.EnableSource(EnableSourceMode::kHideUI, false) == TWRC_SUCCESS && session.WaitForBatch();
+		counting_allocations = false;
+		session.FlushPages();
+		auto allocations = counted_allocations.load() - allocationsBefore;
+		session.DisablePagePipeline();
+		session.CloseSource();
+		session.CloseDsm();
+
+		if (!ok || session.delivered() != kPages){
+			printf("FAIL %s: %llu of %u pages delivered\n", test.Name, session.delivered(), kPages);
+			return false;
+		}
+		if (allocations){
+			printf("FAIL %s: %llu heap allocations after the first %u pages\n", test.Name, allocations, kWarmupPages);
+			return false;
+		}
+		if (session.pool_misses()){
+			printf("FAIL %s: %llu transfer buffers allocated after the first %u pages\n", test.Name, session.pool_misses(), kWarmupPages);
+			return false;
+		}
+		printf("ok %s\n", test.Name);
+		return true;
+	}
+
+	// the items the fake source serves for its 32 bit caps
+	const TW_UINT32 kBarcodeTimeouts[] = { 100, 1000, 65536, 100000, 3600000 };
+	const TW_UINT32 kImageDataSet[] = { 1, 2, 70000, 0x7fffffff, 0x80000001 };
+
+	template<size_t N>
+	bool CheckItems(const char* name, const CapContainer& container, TW_UINT16 conType, const TW_UINT32(&expected)[N]){
+		auto& view = container.view();
+		if (view.con_type() != conType || view.item_type() != TWTY_UINT32 || view.count() != N){
+			printf("FAIL cap_items: %s came back as container %u, item type %u with %u items\n",
+				name, view.con_type(), view.item_type(), view.count());
+			return false;
+		}
+		auto span = view.Items<TW_UINT32>();
+		for (TW_UINT32 i = 0; i < N; i++){
+			TW_UINT32 value = 0;
+			if (!view.Read(i, value) || value != expected[i] || span.size() != N || span[i] != expected[i]){
+				printf("FAIL cap_items: %s item %u is %lu, expected %lu\n", name, i,
+					static_cast<unsigned long>(value), static_cast<unsigned long>(expected[i]));
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// enumerations and arrays of 32 bit items read back at the stride the source wrote them
+	bool RunCapItems(){
+		TestSession session;
+		if (!session.Initialize() || session.OpenDsm() != TWRC_SUCCESS){
+			printf("FAIL cap_items: the DSM didn't open\n");
+			return false;
+		}
+		auto sources = session.GetSources();
+		if (sources.empty() || session.OpenSource(sources.front()) != TWRC_SUCCESS){
+			printf("FAIL cap_items: the fake source didn't open\n");
+			session.CloseDsm();
+			return false;
+		}
+
+		CapContainer timeouts;
+		CapContainer dataSet;
+		CapContainer dataSetAgain;
+		std::vector<TW_UINT32> values;
+		bool ok = true;
+		if (session.CapGet(ICAP_BARCODETIMEOUT, timeouts) != TWRC_SUCCESS ||
+			session.CapGet(ICAP_IMAGEDATASET, dataSet) != TWRC_SUCCESS ||
+			session.CapGet(ICAP_IMAGEDATASET, dataSetAgain) != TWRC_SUCCESS ||
+			session.CapGet(ICAP_IMAGEDATASET, values) != TWRC_SUCCESS){
+			printf("FAIL cap_items: the source didn't return its 32 bit caps\n");
+			ok = false;
+		}
+		else if (!CheckItems("ICAP_BARCODETIMEOUT", timeouts, TWON_ENUMERATION, kBarcodeTimeouts) ||
+			!CheckItems("ICAP_IMAGEDATASET", dataSet, TWON_ARRAY, kImageDataSet)){
+			ok = false;
+		}
+		else if (values.size() != std::extent<decltype(kImageDataSet)>::value ||
+			!std::equal(values.begin(), values.end(), std::begin(kImageDataSet))){
+			printf("FAIL cap_items: ICAP_IMAGEDATASET read into a vector came back wrong\n");
+			ok = false;
+		}
+		else if (dataSet.view().data() == dataSetAgain.view().data()){
+			// both would point at the one cache entry the loop thread owns
+			printf("FAIL cap_items: CapGet handed out the cached container instead of a copy\n");
+			ok = false;
+		}
+		timeouts.Reset();
+		dataSet.Reset();
+		dataSetAgain.Reset();
+		session.CloseSource();
+		session.CloseDsm();
+		if (ok){
+			printf("ok cap_items\n");
+		}
+		return ok;
+	}
+
+	// lengths around the 16 and 32 byte blocks of the SIMD kernels, and their tails
+	const size_t kKernelLengths[] = { 0, 1, 15, 16, 17, 31, 32, 33, 127, 128, 129 };
+
+	// the same bytes every run so a failure can be repeated
+	std::vector<TW_UINT8> TestBytes(size_t count, unsigned seed){
+		std::vector<TW_UINT8> bytes(count);
+		unsigned state = seed * 2654435761u + 1;
+		for (auto& byte : bytes){
+			state = state * 1103515245u + 12345u;
+			byte = static_cast<TW_UINT8>(state >> 16);
+		}
+		return bytes;
+	}
+
+	// runs a kernel at every level above scalar and compares what it produced with the scalar one
+	template<typename Kernel>
+	bool CompareLevels(const char* name, size_t length, Kernel kernel){
+		PixelKernels::set_level(SimdLevel::kScalar);
+		auto expected = kernel();
+		auto supported = static_cast<int>(PixelKernels::supported_level());
+		for (int level = static_cast<int>(SimdLevel::kSse2); level <= supported; level++){
+			PixelKernels::set_level(static_cast<SimdLevel>(level));
+			if (kernel() != expected){
+				printf("FAIL pixel_kernels: %s of %lu differs from scalar at level %d\n",
+					name, static_cast<unsigned long>(length), level);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool CompareInterleaved8(const char* name, size_t width, TW_INT16 pixelType, TW_INT16 samples, TW_INT16 bitsPerSample){
+		TW_IMAGEINFO info{};
+		info.ImageWidth = static_cast<TW_INT32>(width);
+		info.ImageLength = 3;
+		info.SamplesPerPixel = samples;
+		for (TW_INT16 i = 0; i < samples; i++){
+			info.BitsPerSample[i] = bitsPerSample;
+		}
+		info.BitsPerPixel = samples * bitsPerSample;
+		info.Planar = FALSE;
+		info.PixelType = pixelType;
+		info.Compression = TWCP_NONE;
+
+		TW_PALETTE8 palette{};
+		palette.NumColors = 200;
+		palette.PaletteType = TWPA_RGB;
+		auto colors = TestBytes(sizeof(palette.Colors), 7);
+		memcpy(palette.Colors, colors.data(), colors.size());
+		TW_UINT8 table[1024];
+		PixelKernels::LoadPalette(palette, table);
+
+		// padded rows starting off alignment, the way sources send them
+		size_t srcStride = (width * info.BitsPerPixel + 7) / 8 + 5;
+		auto src = TestBytes(srcStride * info.ImageLength + 1, static_cast<unsigned>(width));
+		auto channels = PixelKernels::Interleaved8Channels(info);
+		size_t dstStride = width * channels + 3;
+		return CompareLevels(name, width, [&]{
+			std::vector<TW_UINT8> dst(dstStride * info.ImageLength + 1);
+			auto converted = PixelKernels::ToInterleaved8(info, src.data() + 1, srcStride, dst.data() + 1, dstStride,
+				pixelType == TWPT_PALETTE ? table : nullptr);
+			// the byte before the rows is free, so it records whether the format was taken
+			dst[0] = converted ? 1 : 0;
+			return dst;
+		});
+	}
+
+	bool CompareKernels(size_t length){
+		// the extra byte starts every buffer off alignment
+		auto bytes = TestBytes(length * 4 + 1, static_cast<unsigned>(length));
+		const TW_UINT8* src = bytes.data() + 1;
+		auto palette = TestBytes(1024, 3);
+
+		bool ok = CompareLevels("SwapRedBlue", length, [&]{
+			std::vector<TW_UINT8> dst(length * 3 + 1);
+			PixelKernels::SwapRedBlue(src, dst.data() + 1, length);
+			return dst;
+		});
+		ok = ok && CompareLevels("SwapRedBlue in place", length, [&]{
+			std::vector<TW_UINT8> data(src - 1, src + length * 3);
+			PixelKernels::SwapRedBlue(data.data() + 1, data.data() + 1, length);
+			return data;
+		});
+		for (TW_UINT32 rows = 0; ok && rows <= 5; rows++){
+			ok = CompareLevels("FlipVertical", length, [&]{
+				// rows a little wider than the pixels, like a padded DIB
+				size_t stride = length + 3;
+				auto data = TestBytes(stride * rows + 1, rows);
+				PixelKernels::FlipVertical(data.data() + 1, stride, rows);
+				return data;
+			});
+		}
+		ok = ok && CompareLevels("Unpack1To8", length, [&]{
+			std::vector<TW_UINT8> dst(length + 1);
+			PixelKernels::Unpack1To8(src, dst.data() + 1, length, 0x10, 0xE0);
+			return dst;
+		});
+		ok = ok && CompareLevels("Reduce16To8", length, [&]{
+			std::vector<TW_UINT16> samples(length + 1);
+			memcpy(samples.data(), bytes.data(), length * sizeof(TW_UINT16));
+			std::vector<TW_UINT8> dst(length + 1);
+			PixelKernels::Reduce16To8(samples.data() + 1, dst.data() + 1, length);
+			return dst;
+		});
+		ok = ok && CompareLevels("ExpandPalette", length, [&]{
+			std::vector<TW_UINT8> dst(length * 3 + 1);
+			PixelKernels::ExpandPalette(src, dst.data() + 1, length, palette.data());
+			return dst;
+		});
+		for (int channels = 1; ok && channels <= 4; channels++){
+			ok = CompareLevels("Deinterleave", length, [&]{
+				std::vector<TW_UINT8> dst(length * channels + channels);
+				TW_UINT8* planes[4];
+				for (int i = 0; i < channels; i++){
+					planes[i] = dst.data() + i * (length + 1) + 1;
+				}
+				PixelKernels::Deinterleave(src, planes, length, channels);
+				return dst;
+			});
+		}
+		ok = ok && CompareLevels("AccumulateSamples", length, [&]{
+			SampleStats stats;
+			PixelKernels::AccumulateSamples(src, length, 0x80, stats);
+			return std::vector<unsigned long long>{ stats.Count, stats.Sum, stats.SumOfSquares, stats.Dark };
+		});
+		ok = ok && CompareLevels("AddToSums", length, [&]{
+			// sums part way through a box, past where a byte would overflow
+			std::vector<TW_UINT16> sums(length + 1);
+			for (size_t i = 0; i < sums.size(); i++){
+				sums[i] = static_cast<TW_UINT16>(bytes[i] * 200);
+			}
+			PixelKernels::AddToSums(src, sums.data() + 1, length);
+			return sums;
+		});
+		ok = ok && CompareLevels("CountBits", length, [&]{
+			return PixelKernels::CountBits(src, length);
+		});
+
+		ok = ok && CompareInterleaved8("ToInterleaved8 bitonal", length, TWPT_BW, 1, 1);
+		ok = ok && CompareInterleaved8("ToInterleaved8 gray", length, TWPT_GRAY, 1, 8);
+		ok = ok && CompareInterleaved8("ToInterleaved8 palette", length, TWPT_PALETTE, 1, 8);
+		ok = ok && CompareInterleaved8("ToInterleaved8 rgb", length, TWPT_RGB, 3, 8);
+		ok = ok && CompareInterleaved8("ToInterleaved8 rgb 16", length, TWPT_RGB, 3, 16);
+		ok = ok && CompareInterleaved8("ToInterleaved8 cmyk 16", length, TWPT_CMYK, 4, 16);
+		return ok;
+	}
+
+	// every SIMD kernel gives what the scalar one does, including the unaligned ends
+	bool RunPixelKernels(){
+		auto before = PixelKernels::level();
+		bool ok = true;
+		for (auto length : kKernelLengths){
+			if (!CompareKernels(length)){
+				ok = false;
+				break;
+			}
+		}
+		PixelKernels::set_level(before);
+		if (ok){
+			printf("ok pixel_kernels\n");
+		}
+		return ok;
+	}
+
+	// work posted to a loop from other threads reuses the queue's nodes
+	bool RunPosts(){
+		MessageLoop loop(nullptr);
+		std::atomic<unsigned> ran{ 0 };
+		auto post = [&loop, &ran](unsigned count){
+			std::thread poster([&loop, &ran, count]{
+				for (unsigned i = 0; i < count; i++){
+					loop.Post([&ran]{ ran++; });
+				}
+			});
+			poster.join();
+			while (ran < count){
+				std::this_thread::yield();
+			}
+			ran = 0;
+		};
+		post(kWarmupPages);
+
+		auto allocationsBefore = counted_allocations.load();
+		counting_allocations = true;
+		for (unsigned i = 0; i < kPages; i++){
+			loop.Post([&ran]{ ran++; });
+			while (ran == 0){
+				std::this_thread::yield();
+			}
+			ran = 0;
+		}
+		counting_allocations = false;
+		auto allocations = counted_allocations.load() - allocationsBefore;
+		if (allocations){
+			printf("FAIL posts: %llu heap allocations for %u posts\n", allocations, kPages);
+			return false;
+		}
+		printf("ok posts\n");
+		return true;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+#ifdef TWH_CMP_MSC
+	std::string dsmPath = "FakeDsm.dll";
+#else
+	std::string dsmPath = "./libfakedsm.so";
+#endif
+	for (int i = 1; i + 1 < argc; i += 2){
+		if (strcmp(argv[i], "--dsm") == 0){
+			dsmPath = argv[i + 1];
+		}
+	}
+	std::basic_string<DsmPathChar> path(dsmPath.begin(), dsmPath.end());
+	EntryPoints::set_dsm_path(path.c_str());
+	// small pages keep the batches quick, the per-page path is the same
+	SetEnvironment("FAKEDSM_PAGES", std::to_string(kPages).c_str());
+	SetEnvironment("FAKEDSM_WIDTH", "850");
+	SetEnvironment("FAKEDSM_HEIGHT", "1100");
+	SetEnvironment("FAKEDSM_BITDEPTH", "8");
+
+	int result = RunPosts() ? 0 : 1;
+	if (!RunCapItems()){
+		result = 1;
+	}
+	if (!RunPixelKernels()){
+		result = 1;
+	}
+	for (auto& test : kTestCases){
+		if (!RunBatch(test)){
+			result = 1;
+		}
+	}
+	return result;
+}